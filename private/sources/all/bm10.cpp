@@ -0,0 +1,159 @@
+#include "rpnx/experimental/priority_dispatcher.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+
+// priority_dispatcher submit benchmark.
+// Reports millions of submits per second and heap allocations per submit for:
+//  inline: a lambda capturing a reference and a pointer, stored in the job record.
+//  pooled: a lambda capturing 64 bytes by value, stored in a pool_allocator block.
+//  new: the same small lambda copied with new and freed with delete through the C style submit, which is what
+//       every templated submit used to cost.
+//  result: the small lambda through submit_with_result, dropping the job_future.
+//  promise: the small lambda moved into a pooled job together with a std::promise that it fulfils, which is how
+//           callers received results before submit_with_result.
+// Submits are timed with no service threads so only the submit path is measured, then the queued jobs run on
+// one service thread and the end to end rate is reported as well.
+// Usage: rpnx-core-benchmark10 [submits]
+
+namespace
+{
+    std::size_t g_allocations = 0;
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    g_allocations++;
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace
+{
+    using rpnx::experimental::priority_dispatcher;
+
+    template < typename F >
+    void submit_with_new(priority_dispatcher& dispatcher, F const& f, std::int64_t priority)
+    {
+        dispatcher.submit(
+            [](void* data) {
+                (*static_cast< F* >(data))();
+            },
+            [](void* data, priority_dispatcher::completion_state) noexcept {
+                delete static_cast< F* >(data);
+            },
+            new F(f), priority);
+    }
+
+    template < typename Submit >
+    void run(char const* name, priority_dispatcher::scheduling_mode mode, std::size_t submits, std::uint64_t const& counter, Submit submit)
+    {
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        options.m_thread_count = 1;
+        priority_dispatcher dispatcher(options);
+        dispatcher.set_service_thread_count(0);
+
+        // Warm up the queue's storage and the pool, so both runs measure the steady state.
+        for (std::size_t i = 0; i < submits; i++)
+        {
+            submit(dispatcher, std::int64_t(i % 4));
+        }
+        dispatcher.cancel_all();
+
+        std::uint64_t before = counter;
+        std::size_t allocations = g_allocations;
+        auto t0 = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < submits; i++)
+        {
+            submit(dispatcher, std::int64_t(i % 4));
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        allocations = g_allocations - allocations;
+        dispatcher.set_service_thread_count(1);
+        dispatcher.finish_all();
+        auto t2 = std::chrono::steady_clock::now();
+
+        auto rate = [&](std::chrono::steady_clock::duration d) {
+            return double(submits) / double(std::chrono::duration_cast< std::chrono::nanoseconds >(d).count()) * 1000.0;
+        };
+        std::cout << std::setw(10) << name << std::fixed << std::setprecision(2) << std::setw(12) << rate(t1 - t0) << std::setw(12) << rate(t2 - t0) << std::setw(14)
+                  << double(allocations) / double(submits) << std::endl;
+        if (counter - before != submits)
+        {
+            std::cout << "conformance failure" << std::endl;
+            std::exit(1);
+        }
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t submits = argc > 1 ? std::stoull(argv[1]) : 1000000;
+    std::uint64_t counter = 0;
+    std::uint64_t const* step = nullptr;
+    std::uint64_t one = 1;
+    step = &one;
+
+    auto small = [&counter, step] {
+        counter += *step;
+    };
+    std::array< std::uint64_t, 7 > padding{1, 0, 0, 0, 0, 0, 0};
+    auto large = [&counter, padding] {
+        counter += padding[0];
+    };
+
+    std::pair< char const*, priority_dispatcher::scheduling_mode > modes[] = {{"shared_queue", priority_dispatcher::scheduling_mode::shared_queue},
+                                                                              {"work_stealing", priority_dispatcher::scheduling_mode::work_stealing},
+                                                                              {"banded", priority_dispatcher::scheduling_mode::banded}};
+    std::cout << submits << " submits, millions per second" << std::endl;
+    for (auto const& [mode_name, mode] : modes)
+    {
+        std::cout << mode_name << std::endl;
+        std::cout << std::setw(10) << "functor" << std::setw(12) << "submit" << std::setw(12) << "end to end" << std::setw(14) << "allocs/submit" << std::endl;
+        run("inline", mode, submits, counter, [&](priority_dispatcher& d, std::int64_t p) {
+            d.submit(small, p);
+        });
+        run("pooled", mode, submits, counter, [&](priority_dispatcher& d, std::int64_t p) {
+            d.submit(large, p);
+        });
+        run("new", mode, submits, counter, [&](priority_dispatcher& d, std::int64_t p) {
+            submit_with_new(d, small, p);
+        });
+        run("result", mode, submits, counter, [&](priority_dispatcher& d, std::int64_t p) {
+            d.submit_with_result(small, p);
+        });
+        run("promise", mode, submits, counter, [&](priority_dispatcher& d, std::int64_t p) {
+            std::promise< void > promise;
+            promise.get_future();
+            d.submit(
+                [small, promise = std::move(promise)]() mutable {
+                    small();
+                    promise.set_value();
+                },
+                p);
+        });
+    }
+    return 0;
+}
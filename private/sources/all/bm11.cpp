@@ -0,0 +1,163 @@
+#include "rpnx/experimental/priority_dispatcher.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+
+// priority_dispatcher timer benchmark.
+// Schedules timers at random deadlines up to an hour away and reports, per timer, the nanoseconds to schedule
+// and to cancel them and the heap bytes they hold while pending, pool slabs included. Slabs are never freed, so
+// only the first mode carves new ones and reports memory; the others reuse them. A second run schedules
+// timers spread over one second, starting half a second out so scheduling is done before the first is due, and
+// reports how late they fire.
+// Usage: rpnx-core-benchmark11 [timers]
+
+// Live heap bytes, tracked through a size header in front of every allocation.
+namespace
+{
+    std::atomic< std::size_t > g_live_bytes{0};
+    constexpr std::size_t header_size = alignof(std::max_align_t);
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    auto* p = static_cast< unsigned char* >(std::malloc(size + header_size));
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast< std::size_t* >(p) = size;
+    g_live_bytes += size;
+    return p + header_size;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    unsigned char* p = static_cast< unsigned char* >(ptr) - header_size;
+    g_live_bytes -= *reinterpret_cast< std::size_t* >(p);
+    std::free(p);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+namespace
+{
+    using rpnx::experimental::priority_dispatcher;
+    using clock = std::chrono::steady_clock;
+
+    double nanoseconds_per(clock::duration d, std::size_t n)
+    {
+        return double(std::chrono::duration_cast< std::chrono::nanoseconds >(d).count()) / double(n);
+    }
+
+    void pending(char const* name, priority_dispatcher::scheduling_mode mode, std::size_t timers)
+    {
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        options.m_thread_count = 1;
+        priority_dispatcher dispatcher(options);
+        std::uint64_t counter = 0;
+        std::mt19937_64 rng(7);
+
+        // The first round reports the memory, including the pool slabs it carves; the second reuses them and
+        // reports the times.
+        double bytes = 0;
+        double schedule_ns = 0;
+        double cancel_ns = 0;
+        for (int round = 0; round < 2; round++)
+        {
+            std::size_t before = g_live_bytes;
+            auto now = clock::now();
+            auto t0 = clock::now();
+            for (std::size_t i = 0; i < timers; i++)
+            {
+                dispatcher.submit_at(
+                    [&counter] {
+                        counter++;
+                    },
+                    now + std::chrono::milliseconds(1000 + rng() % 3600000), std::int64_t(i % 4));
+            }
+            auto t1 = clock::now();
+            if (round == 0)
+            {
+                bytes = double(g_live_bytes - before) / double(timers);
+            }
+            dispatcher.cancel_all();
+            auto t2 = clock::now();
+            schedule_ns = nanoseconds_per(t1 - t0, timers);
+            cancel_ns = nanoseconds_per(t2 - t1, timers);
+        }
+
+        std::cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(1) << std::setw(12) << schedule_ns << std::setw(12) << cancel_ns << std::setw(12) << bytes
+                  << std::endl;
+    }
+
+    void firing(char const* name, priority_dispatcher::scheduling_mode mode, std::size_t timers)
+    {
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        priority_dispatcher dispatcher(options);
+        std::atomic< std::size_t > fired{0};
+        std::atomic< std::int64_t > total_late_us{0};
+        std::atomic< std::int64_t > max_late_us{0};
+        std::mt19937_64 rng(11);
+
+        auto now = clock::now();
+        for (std::size_t i = 0; i < timers; i++)
+        {
+            auto when = now + std::chrono::microseconds(500000 + rng() % 1000000);
+            dispatcher.submit_at(
+                [&, when] {
+                    std::int64_t late = std::chrono::duration_cast< std::chrono::microseconds >(clock::now() - when).count();
+                    total_late_us += late;
+                    std::int64_t seen = max_late_us.load();
+                    while (late > seen && !max_late_us.compare_exchange_weak(seen, late))
+                    {
+                    }
+                    fired++;
+                },
+                when, 0);
+        }
+        while (fired.load() != timers)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+
+        std::cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(1) << std::setw(12) << double(total_late_us.load()) / double(timers) << std::setw(12)
+                  << double(max_late_us.load()) << std::endl;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t timers = argc > 1 ? std::stoull(argv[1]) : 2000000;
+
+    std::cout << timers << " pending timers up to an hour away" << std::endl;
+    std::cout << std::left << std::setw(16) << "mode" << std::right << std::setw(12) << "schedule" << std::setw(12) << "cancel" << std::setw(12) << "bytes" << "  (ns, bytes per timer)" << std::endl;
+    pending("shared", priority_dispatcher::scheduling_mode::shared_queue, timers);
+    pending("steal", priority_dispatcher::scheduling_mode::work_stealing, timers);
+    pending("banded", priority_dispatcher::scheduling_mode::banded, timers);
+
+    std::size_t fire_count = std::max< std::size_t >(timers / 20, 1);
+    std::cout << std::endl << fire_count << " timers over one second" << std::endl;
+    std::cout << std::left << std::setw(16) << "mode" << std::right << std::setw(12) << "mean late" << std::setw(12) << "max late" << "  (us)" << std::endl;
+    firing("shared", priority_dispatcher::scheduling_mode::shared_queue, fire_count);
+    firing("steal", priority_dispatcher::scheduling_mode::work_stealing, fire_count);
+    firing("banded", priority_dispatcher::scheduling_mode::banded, fire_count);
+    return 0;
+}
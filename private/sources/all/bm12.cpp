@@ -0,0 +1,97 @@
+#include "rpnx/experimental/priority_dispatcher.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// priority_dispatcher pipeline benchmark.
+// Runs a number of independent pipelines of several stages each, where stage s of pipeline p spins for a time
+// that varies with p and s, so some pipelines are much slower than others at each stage. Reports the wall time
+// of running them:
+//  phased: every stage submitted at once and finish_all called between stages, the way pipelines were chained
+//          before task groups.
+//  graph: each stage a task_group job after the previous stage of the same pipeline, with no barriers.
+// Usage: rpnx-core-benchmark12 [pipelines] [stages]
+
+namespace
+{
+    using rpnx::experimental::priority_dispatcher;
+    using rpnx::experimental::task_group;
+    using clock = std::chrono::steady_clock;
+
+    std::atomic< std::uint64_t > g_sink{0};
+
+    void spin(std::size_t a_pipeline, std::size_t a_stage)
+    {
+        // Every seventh step is 20 times as long as the others.
+        std::size_t iterations = (a_pipeline + a_stage) % 7 == 0 ? 200000 : 10000;
+        std::uint64_t x = a_pipeline * 31 + a_stage;
+        for (std::size_t i = 0; i < iterations; i++)
+        {
+            x = x * 6364136223846793005ull + 1442695040888963407ull;
+        }
+        g_sink += x;
+    }
+
+    double phased(priority_dispatcher& dispatcher, std::size_t pipelines, std::size_t stages)
+    {
+        auto t0 = clock::now();
+        for (std::size_t s = 0; s < stages; s++)
+        {
+            for (std::size_t p = 0; p < pipelines; p++)
+            {
+                dispatcher.submit(
+                    [p, s] {
+                        spin(p, s);
+                    },
+                    0);
+            }
+            dispatcher.finish_all();
+        }
+        return std::chrono::duration< double, std::milli >(clock::now() - t0).count();
+    }
+
+    double graph(priority_dispatcher& dispatcher, std::size_t pipelines, std::size_t stages)
+    {
+        auto t0 = clock::now();
+        task_group group(dispatcher);
+        std::vector< task_group::task > last(pipelines);
+        for (std::size_t s = 0; s < stages; s++)
+        {
+            for (std::size_t p = 0; p < pipelines; p++)
+            {
+                last[p] = group.add(
+                    [p, s] {
+                        spin(p, s);
+                    },
+                    0, {last[p]});
+            }
+        }
+        group.wait();
+        return std::chrono::duration< double, std::milli >(clock::now() - t0).count();
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t pipelines = argc > 1 ? std::stoull(argv[1]) : 64;
+    std::size_t stages = argc > 2 ? std::stoull(argv[2]) : 16;
+
+    std::cout << pipelines << " pipelines of " << stages << " stages" << std::endl;
+    std::cout << std::left << std::setw(16) << "mode" << std::right << std::setw(12) << "phased" << std::setw(12) << "graph" << "  (ms)" << std::endl;
+    for (auto mode : {priority_dispatcher::scheduling_mode::shared_queue, priority_dispatcher::scheduling_mode::work_stealing, priority_dispatcher::scheduling_mode::banded})
+    {
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        priority_dispatcher dispatcher(options);
+        char const* name = mode == priority_dispatcher::scheduling_mode::shared_queue ? "shared" : mode == priority_dispatcher::scheduling_mode::work_stealing ? "steal" : "banded";
+        double phased_ms = phased(dispatcher, pipelines, stages);
+        double graph_ms = graph(dispatcher, pipelines, stages);
+        std::cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(1) << std::setw(12) << phased_ms << std::setw(12) << graph_ms << std::endl;
+    }
+    return g_sink == 0 ? 1 : 0;
+}
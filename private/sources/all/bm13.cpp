@@ -0,0 +1,74 @@
+#include "rpnx/experimental/priority_dispatcher.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+// priority_dispatcher statistics overhead benchmark.
+// Runs the same number of trivial jobs on one service thread with options::m_collect_stats off and on, and
+// reports the nanoseconds per job of each and their difference, which is what recording the wait and run times
+// costs. The jobs are queued first with no service threads so that only the service thread is measured.
+// Usage: rpnx-core-benchmark13 [jobs]
+
+namespace
+{
+    using rpnx::experimental::priority_dispatcher;
+    using clock = std::chrono::steady_clock;
+
+    std::atomic< std::uint64_t > g_sink{0};
+
+    double run(priority_dispatcher::scheduling_mode mode, bool collect, std::size_t jobs)
+    {
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        options.m_thread_count = 1;
+        options.m_collect_stats = collect;
+        priority_dispatcher dispatcher(options);
+        std::uint64_t counter = 0;
+
+        // The best of three rounds.
+        double best = 0;
+        for (int round = 0; round < 3; round++)
+        {
+            dispatcher.set_service_thread_count(0);
+            for (std::size_t i = 0; i < jobs; i++)
+            {
+                dispatcher.submit(
+                    [&counter] {
+                        counter++;
+                    },
+                    std::int64_t(i % 8));
+            }
+            auto t0 = clock::now();
+            dispatcher.set_service_thread_count(1);
+            dispatcher.finish_all();
+            double ns = double(std::chrono::duration_cast< std::chrono::nanoseconds >(clock::now() - t0).count()) / double(jobs);
+            best = round == 0 ? ns : std::min(best, ns);
+        }
+        if (collect && dispatcher.stats().m_run.count() != 3 * jobs)
+        {
+            std::cout << "statistics missed jobs" << std::endl;
+        }
+        g_sink += counter;
+        return best;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t jobs = argc > 1 ? std::stoull(argv[1]) : 1000000;
+
+    std::cout << jobs << " trivial jobs on one service thread" << std::endl;
+    std::cout << std::left << std::setw(16) << "mode" << std::right << std::setw(12) << "off" << std::setw(12) << "on" << std::setw(12) << "overhead" << "  (ns per job)" << std::endl;
+    for (auto mode : {priority_dispatcher::scheduling_mode::shared_queue, priority_dispatcher::scheduling_mode::work_stealing, priority_dispatcher::scheduling_mode::banded})
+    {
+        char const* name = mode == priority_dispatcher::scheduling_mode::shared_queue ? "shared" : mode == priority_dispatcher::scheduling_mode::work_stealing ? "steal" : "banded";
+        double off = run(mode, false, jobs);
+        double on = run(mode, true, jobs);
+        std::cout << std::left << std::setw(16) << name << std::right << std::fixed << std::setprecision(1) << std::setw(12) << off << std::setw(12) << on << std::setw(12) << on - off << std::endl;
+    }
+    return g_sink == 0 ? 1 : 0;
+}
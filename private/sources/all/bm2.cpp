@@ -0,0 +1,150 @@
+#include "rpnx/experimental/monoque.hpp"
+
+#include "bm2_legacy_monoque.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Monoque benchmark and conformance suite.
+// Runs monoque (ABI v2), monoque ABI v1, the retired legacy rpnx::monoque (kept in bm2_legacy_monoque.hpp),
+// std::vector and std::deque through push_back,
+// random access, iteration and clear at 1e3 .. 1e8 elements, and checks that every
+// container observes the same values.
+// Usage: rpnx-core-benchmark2 [max_elements]
+
+namespace
+{
+    struct measurement
+    {
+        double m_push_back_ns = 0;
+        double m_random_access_ns = 0;
+        double m_iteration_ns = 0;
+        double m_clear_ns = 0;
+        std::uint64_t m_checksum = 0;
+    };
+
+    double nanoseconds_per(std::chrono::steady_clock::duration d, std::size_t n)
+    {
+        return double(std::chrono::duration_cast< std::chrono::nanoseconds >(d).count()) / double(n);
+    }
+
+    template < typename Container >
+    measurement run(std::size_t n)
+    {
+        using clock = std::chrono::steady_clock;
+        measurement result;
+        Container c;
+
+        auto t0 = clock::now();
+        for (std::size_t i = 0; i < n; i++)
+        {
+            c.emplace_back(std::uint64_t(i) * 2654435761u);
+        }
+        auto t1 = clock::now();
+        result.m_push_back_ns = nanoseconds_per(t1 - t0, n);
+
+        if (c.size() != n)
+        {
+            throw std::runtime_error("size mismatch after push_back");
+        }
+
+        std::size_t const accesses = std::min< std::size_t >(n, 10000000);
+        std::uint64_t x = 88172645463325252ull;
+        std::uint64_t sum = 0;
+        t0 = clock::now();
+        for (std::size_t i = 0; i < accesses; i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            sum += c[x % n];
+        }
+        t1 = clock::now();
+        result.m_random_access_ns = nanoseconds_per(t1 - t0, accesses);
+        result.m_checksum = sum;
+
+        std::uint64_t iteration_sum = 0;
+        t0 = clock::now();
+        for (auto const& v : c)
+        {
+            iteration_sum += v;
+        }
+        t1 = clock::now();
+        result.m_iteration_ns = nanoseconds_per(t1 - t0, n);
+        result.m_checksum = result.m_checksum * 31 + iteration_sum;
+
+        t0 = clock::now();
+        c.clear();
+        t1 = clock::now();
+        result.m_clear_ns = nanoseconds_per(t1 - t0, n);
+
+        if (!c.empty())
+        {
+            throw std::runtime_error("container not empty after clear");
+        }
+
+        return result;
+    }
+
+    void print(std::string const& name, std::size_t n, measurement const& m)
+    {
+        std::cout << std::left << std::setw(14) << name << std::right << std::setw(11) << n << std::fixed << std::setprecision(2) << std::setw(12) << m.m_push_back_ns
+                  << std::setw(12) << m.m_random_access_ns << std::setw(12) << m.m_iteration_ns << std::setw(12) << m.m_clear_ns << std::endl;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t max_elements = 100000000;
+    if (argc > 1)
+    {
+        max_elements = std::stoull(argv[1]);
+    }
+
+    std::cout << std::left << std::setw(14) << "container" << std::right << std::setw(11) << "elements" << std::setw(12) << "push ns" << std::setw(12) << "random ns"
+              << std::setw(12) << "iterate ns" << std::setw(12) << "clear ns" << std::endl;
+
+    int failures = 0;
+    for (std::size_t n = 1000; n <= max_elements; n *= 10)
+    {
+        try
+        {
+            auto reference = run< std::vector< std::uint64_t > >(n);
+            print("std::vector", n, reference);
+
+            auto deque = run< std::deque< std::uint64_t > >(n);
+            print("std::deque", n, deque);
+
+            auto v1 = run< rpnx::experimental::monoque_abi_v1::monoque< std::uint64_t > >(n);
+            print("monoque v1", n, v1);
+
+            auto legacy = run< rpnx::bm2_legacy::monoque< std::uint64_t > >(n);
+            print("legacy", n, legacy);
+
+            auto v2 = run< rpnx::experimental::monoque< std::uint64_t > >(n);
+            print("monoque v2", n, v2);
+
+            for (auto const* m : {&deque, &v1, &legacy, &v2})
+            {
+                if (m->m_checksum != reference.m_checksum)
+                {
+                    std::cout << "conformance failure at " << n << " elements" << std::endl;
+                    failures++;
+                }
+            }
+        }
+        catch (std::exception const& err)
+        {
+            std::cout << "conformance failure at " << n << " elements: " << err.what() << std::endl;
+            failures++;
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
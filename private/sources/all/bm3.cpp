@@ -0,0 +1,153 @@
+#include "rpnx/experimental/pool_allocator.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Pool allocator benchmark.
+// Compares rpnx::experimental::pool_allocator against std::allocator in allocation heavy workloads on 1..N threads:
+//  - list:     each thread churns its own std::list (allocate and free on the same thread)
+//  - map:      each thread inserts into and erases from its own std::map
+//  - exchange: threads swap blocks through a shared slot table, so most frees happen on another thread
+// Usage: rpnx-core-benchmark3 [max_threads]
+
+namespace
+{
+    constexpr std::size_t operations_per_thread = 2000000;
+
+    struct message
+    {
+        std::uint64_t m_words[6];
+    };
+
+    template < template < typename > class Alloc >
+    void list_workload(std::size_t)
+    {
+        std::list< message, Alloc< message > > values;
+        for (std::size_t i = 0; i < operations_per_thread; i++)
+        {
+            values.push_back(message{{i}});
+            if (values.size() > 256)
+            {
+                values.pop_front();
+            }
+        }
+    }
+
+    template < template < typename > class Alloc >
+    void map_workload(std::size_t thread_index)
+    {
+        std::map< std::uint64_t, std::uint64_t, std::less< std::uint64_t >, Alloc< std::pair< std::uint64_t const, std::uint64_t > > > values;
+        std::uint64_t x = 0x9E3779B97F4A7C15ull * (thread_index + 1);
+        for (std::size_t i = 0; i < operations_per_thread / 2; i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            values[x % 4096] = i;
+            values.erase((x >> 32) % 4096);
+        }
+    }
+
+    std::vector< std::atomic< message* > > g_slots(4096);
+
+    template < template < typename > class Alloc >
+    void exchange_workload(std::size_t thread_index)
+    {
+        Alloc< message > alloc;
+        std::uint64_t x = 0x9E3779B97F4A7C15ull * (thread_index + 1);
+        for (std::size_t i = 0; i < operations_per_thread; i++)
+        {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            message* p = alloc.allocate(1);
+            p->m_words[0] = i;
+            message* old = g_slots[x % g_slots.size()].exchange(p, std::memory_order_acq_rel);
+            if (old != nullptr)
+            {
+                alloc.deallocate(old, 1);
+            }
+        }
+    }
+
+    template < template < typename > class Alloc >
+    void drain_slots()
+    {
+        Alloc< message > alloc;
+        for (auto& slot : g_slots)
+        {
+            if (message* p = slot.exchange(nullptr))
+            {
+                alloc.deallocate(p, 1);
+            }
+        }
+    }
+
+    template < template < typename > class Alloc, typename Workload >
+    double run(Workload workload, std::size_t thread_count)
+    {
+        std::atomic< bool > go{false};
+        std::vector< std::thread > threads;
+        for (std::size_t t = 0; t < thread_count; t++)
+        {
+            threads.emplace_back([&, t] {
+                while (!go.load())
+                {
+                    std::this_thread::yield();
+                }
+                workload(t);
+            });
+        }
+
+        auto t0 = std::chrono::steady_clock::now();
+        go = true;
+        for (auto& th : threads)
+        {
+            th.join();
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        drain_slots< Alloc >();
+
+        double seconds = std::chrono::duration< double >(t1 - t0).count();
+        return double(operations_per_thread * thread_count) / seconds / 1e6;
+    }
+
+    template < typename Workload1, typename Workload2 >
+    void compare(std::string const& name, std::size_t thread_count, Workload1 standard, Workload2 pool)
+    {
+        double standard_mops = run< std::allocator >(standard, thread_count);
+        double pool_mops = run< rpnx::experimental::pool_allocator >(pool, thread_count);
+        std::cout << std::left << std::setw(10) << name << std::right << std::setw(8) << thread_count << std::fixed << std::setprecision(2) << std::setw(16)
+                  << standard_mops << std::setw(16) << pool_mops << std::setw(10) << pool_mops / standard_mops << "x" << std::endl;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+    if (argc > 1)
+    {
+        max_threads = std::stoull(argv[1]);
+    }
+
+    std::cout << std::left << std::setw(10) << "workload" << std::right << std::setw(8) << "threads" << std::setw(16) << "std Mops/s" << std::setw(16) << "pool Mops/s"
+              << std::setw(11) << "speedup" << std::endl;
+
+    for (std::size_t threads = 1; threads <= max_threads; threads *= 2)
+    {
+        compare("list", threads, list_workload< std::allocator >, list_workload< rpnx::experimental::pool_allocator >);
+        compare("map", threads, map_workload< std::allocator >, map_workload< rpnx::experimental::pool_allocator >);
+        compare("exchange", threads, exchange_workload< std::allocator >, exchange_workload< rpnx::experimental::pool_allocator >);
+    }
+
+    return 0;
+}
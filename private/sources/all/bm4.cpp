@@ -0,0 +1,222 @@
+#include "rpnx/experimental/avl_tree.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+// Ordered map benchmark.
+// Runs rpnx::experimental::avl_tree and std::map through random insert, successful and failing
+// lookup, in order iteration and erase at 1e3 .. 1e6 elements, then compares range scans (a lower_bound
+// followed by 64 increments) and rebuilding an index from a sorted snapshot by individual inserts against
+// bulk loading.
+// Usage: rpnx-core-benchmark4 [max_elements]
+
+namespace
+{
+    struct measurement
+    {
+        double m_insert_ns = 0;
+        double m_find_ns = 0;
+        double m_miss_ns = 0;
+        double m_iterate_ns = 0;
+        double m_erase_ns = 0;
+        std::uint64_t m_checksum = 0;
+    };
+
+    double nanoseconds_per(std::chrono::steady_clock::duration d, std::size_t n)
+    {
+        return double(std::chrono::duration_cast< std::chrono::nanoseconds >(d).count()) / double(n);
+    }
+
+    template < typename Map >
+    measurement run(std::vector< std::uint64_t > const& keys)
+    {
+        using clock = std::chrono::steady_clock;
+        measurement result;
+        Map map;
+        std::size_t n = keys.size();
+
+        auto t0 = clock::now();
+        for (std::size_t i = 0; i < n; i++)
+        {
+            map.emplace(keys[i], i);
+        }
+        auto t1 = clock::now();
+        result.m_insert_ns = nanoseconds_per(t1 - t0, n);
+
+        std::uint64_t sum = 0;
+        t0 = clock::now();
+        for (std::size_t i = 0; i < n; i++)
+        {
+            sum += map.find(keys[(i * 7919) % n])->second;
+        }
+        t1 = clock::now();
+        result.m_find_ns = nanoseconds_per(t1 - t0, n);
+
+        t0 = clock::now();
+        for (std::size_t i = 0; i < n; i++)
+        {
+            sum += map.find(keys[i] + 1) == map.end();
+        }
+        t1 = clock::now();
+        result.m_miss_ns = nanoseconds_per(t1 - t0, n);
+
+        t0 = clock::now();
+        for (auto const& x : map)
+        {
+            sum = sum * 31 + x.first;
+        }
+        t1 = clock::now();
+        result.m_iterate_ns = nanoseconds_per(t1 - t0, n);
+
+        t0 = clock::now();
+        for (std::size_t i = 0; i < n; i++)
+        {
+            map.erase(keys[i]);
+        }
+        t1 = clock::now();
+        result.m_erase_ns = nanoseconds_per(t1 - t0, n);
+        result.m_checksum = sum + map.size();
+        return result;
+    }
+
+    template < typename F >
+    double time_ns_per(std::size_t n, F f)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        f();
+        auto t1 = std::chrono::steady_clock::now();
+        return nanoseconds_per(t1 - t0, n);
+    }
+
+    template < typename Map >
+    double scan(std::vector< std::uint64_t > const& keys, std::uint64_t& sum)
+    {
+        constexpr std::size_t scan_length = 64;
+        Map map;
+        for (std::size_t i = 0; i < keys.size(); i++)
+        {
+            map.emplace(keys[i], i);
+        }
+
+        std::size_t const scans = 100000;
+        std::size_t steps = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < scans; i++)
+        {
+            auto it = map.lower_bound(keys[(i * 7919) % keys.size()]);
+            for (std::size_t j = 0; j < scan_length && it != map.end(); j++, ++it)
+            {
+                sum += it->second;
+                steps++;
+            }
+        }
+        auto t1 = std::chrono::steady_clock::now();
+        return nanoseconds_per(t1 - t0, steps);
+    }
+
+    void rebuild(std::size_t n)
+    {
+        std::vector< std::pair< std::uint64_t, std::uint64_t > > snapshot(n);
+        for (std::size_t i = 0; i < n; i++)
+        {
+            snapshot[i] = {i * 2, i};
+        }
+
+        std::uint64_t sum = 0;
+        double map_ns = time_ns_per(n, [&] {
+            std::map< std::uint64_t, std::uint64_t > map(snapshot.begin(), snapshot.end());
+            sum += map.size();
+        });
+        double insert_ns = time_ns_per(n, [&] {
+            rpnx::experimental::avl_tree< std::uint64_t, std::uint64_t > tree;
+            for (auto const& x : snapshot)
+            {
+                tree.insert(x);
+            }
+            sum += tree.size();
+        });
+        double bulk_ns = time_ns_per(n, [&] {
+            rpnx::experimental::avl_tree< std::uint64_t, std::uint64_t > tree(rpnx::experimental::sorted_unique, snapshot.begin(), snapshot.end());
+            sum += tree.size();
+        });
+
+        std::cout << std::left << std::setw(10) << "rebuild" << std::right << std::setw(10) << n << std::fixed << std::setprecision(2) << "  std::map " << map_ns
+                  << " ns, avl_tree insert " << insert_ns << " ns, avl_tree sorted_unique " << bulk_ns << " ns (per element, " << sum / 3 << ")" << std::endl;
+    }
+
+    void print(std::string const& name, std::size_t n, measurement const& m)
+    {
+        std::cout << std::left << std::setw(10) << name << std::right << std::setw(10) << n << std::fixed << std::setprecision(2) << std::setw(11) << m.m_insert_ns
+                  << std::setw(11) << m.m_find_ns << std::setw(11) << m.m_miss_ns << std::setw(11) << m.m_iterate_ns << std::setw(11) << m.m_erase_ns << std::endl;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t max_elements = 1000000;
+    if (argc > 1)
+    {
+        max_elements = std::stoull(argv[1]);
+    }
+
+    std::cout << std::left << std::setw(10) << "map" << std::right << std::setw(10) << "elements" << std::setw(11) << "insert ns" << std::setw(11) << "find ns"
+              << std::setw(11) << "miss ns" << std::setw(11) << "iterate ns" << std::setw(11) << "erase ns" << std::endl;
+
+    int failures = 0;
+    for (std::size_t n = 1000; n <= max_elements; n *= 10)
+    {
+        // Even keys, so that key + 1 always misses
+        std::vector< std::uint64_t > keys(n);
+        std::uint64_t x = 88172645463325252ull;
+        for (auto& k : keys)
+        {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            k = x & ~std::uint64_t(1);
+        }
+
+        auto reference = run< std::map< std::uint64_t, std::uint64_t > >(keys);
+        print("std::map", n, reference);
+        auto avl = run< rpnx::experimental::avl_tree< std::uint64_t, std::uint64_t > >(keys);
+        print("avl_tree", n, avl);
+
+        if (avl.m_checksum != reference.m_checksum)
+        {
+            std::cout << "conformance failure at " << n << " elements" << std::endl;
+            failures++;
+        }
+    }
+
+    for (std::size_t n = 1000; n <= max_elements; n *= 10)
+    {
+        std::vector< std::uint64_t > keys(n);
+        for (std::size_t i = 0; i < n; i++)
+        {
+            keys[i] = (i * 2654435761u) % (n * 4);
+        }
+        std::uint64_t map_sum = 0;
+        std::uint64_t avl_sum = 0;
+        double map_ns = scan< std::map< std::uint64_t, std::uint64_t > >(keys, map_sum);
+        double avl_ns = scan< rpnx::experimental::avl_tree< std::uint64_t, std::uint64_t > >(keys, avl_sum);
+        std::cout << std::left << std::setw(10) << "scan" << std::right << std::setw(10) << n << std::fixed << std::setprecision(2) << "  std::map " << map_ns
+                  << " ns, avl_tree " << avl_ns << " ns (per step)" << std::endl;
+        if (map_sum != avl_sum)
+        {
+            std::cout << "conformance failure in scan at " << n << " elements" << std::endl;
+            failures++;
+        }
+    }
+
+    for (std::size_t n = 1000; n <= max_elements; n *= 10)
+    {
+        rebuild(n);
+    }
+
+    return failures == 0 ? 0 : 1;
+}
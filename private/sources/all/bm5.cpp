@@ -0,0 +1,221 @@
+// The legacy tree checks every rotation with an O(n) assert; measure all containers as they would ship.
+#ifndef NDEBUG
+#define NDEBUG
+#endif
+
+#include "rpnx/experimental/avl_tree.hpp"
+#include "rpnx/experimental/btree_map.hpp"
+#include "rpnx/legacy/avl_tree.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include <vector>
+
+// Ordered index benchmark.
+// Builds rpnx::experimental::btree_map (at several fanouts), rpnx::experimental::avl_tree, the legacy
+// rpnx::avl_tree and std::map from the same random uint64 keys, and reports the heap memory and blocks each
+// holds per element (excluding allocator overhead) along with insert, successful and failing lookup, and
+// iteration times.
+// The legacy tree has no public lookup and inserts far slower than O(log n), so only its footprint and insert
+// time are measured, over at most the first 10000 keys. Those figures are printed below the table rather than in
+// it, since they are not for the same number of elements.
+// Usage: rpnx-core-benchmark5 [elements]
+
+// Live heap bytes and blocks, tracked through a size header in front of every allocation.
+namespace
+{
+    std::size_t g_live_bytes = 0;
+    std::size_t g_live_blocks = 0;
+    constexpr std::size_t header_size = alignof(std::max_align_t);
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    auto* p = static_cast< unsigned char* >(std::malloc(size + header_size));
+    if (p == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    *reinterpret_cast< std::size_t* >(p) = size;
+    g_live_bytes += size;
+    g_live_blocks++;
+    return p + header_size;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    unsigned char* p = static_cast< unsigned char* >(ptr) - header_size;
+    g_live_bytes -= *reinterpret_cast< std::size_t* >(p);
+    g_live_blocks--;
+    std::free(p);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+namespace
+{
+    struct measurement
+    {
+        double m_bytes_per_element = 0;
+        double m_allocations_per_element = 0;
+        double m_insert_ns = 0;
+        double m_find_ns = 0;
+        double m_miss_ns = 0;
+        double m_iterate_ns = 0;
+        std::uint64_t m_checksum = 0;
+    };
+
+    double nanoseconds_per(std::chrono::steady_clock::duration d, std::size_t n)
+    {
+        return double(std::chrono::duration_cast< std::chrono::nanoseconds >(d).count()) / double(n);
+    }
+
+    using legacy_tree = rpnx::avl_tree< std::uint64_t, std::uint64_t >;
+
+    template < typename Map >
+    std::uint64_t lookup(Map& map, std::uint64_t key)
+    {
+        auto it = map.find(key);
+        return it == map.end() ? 0 : it->second;
+    }
+
+    template < typename Map >
+    measurement run(std::vector< std::uint64_t > const& keys, std::vector< std::uint64_t > const& misses)
+    {
+        using clock = std::chrono::steady_clock;
+        measurement result;
+        std::size_t n = keys.size();
+
+        // Deliberately leaked: the legacy tree has no destructor, and the others would only add teardown noise.
+        std::size_t bytes_before = g_live_bytes;
+        std::size_t blocks_before = g_live_blocks;
+        auto* map = new Map();
+        auto t0 = clock::now();
+        for (std::size_t i = 0; i < n; i++)
+        {
+            if constexpr (std::is_same_v< Map, legacy_tree >)
+            {
+                map->insert(keys[i], i);
+            }
+            else
+            {
+                map->insert({keys[i], i});
+            }
+        }
+        auto t1 = clock::now();
+        result.m_insert_ns = nanoseconds_per(t1 - t0, n);
+        result.m_bytes_per_element = double(g_live_bytes - bytes_before - sizeof(Map)) / double(n);
+        result.m_allocations_per_element = double(g_live_blocks - blocks_before - 1) / double(n);
+
+        std::uint64_t sum = 0;
+        if constexpr (!std::is_same_v< Map, legacy_tree >)
+        {
+            t0 = clock::now();
+            for (std::size_t i = 0; i < n; i++)
+            {
+                sum += lookup(*map, keys[(i * 7919) % n]);
+            }
+            t1 = clock::now();
+            result.m_find_ns = nanoseconds_per(t1 - t0, n);
+
+            t0 = clock::now();
+            for (std::size_t i = 0; i < n; i++)
+            {
+                sum += lookup(*map, misses[i]);
+            }
+            t1 = clock::now();
+            result.m_miss_ns = nanoseconds_per(t1 - t0, n);
+
+            t0 = clock::now();
+            for (auto const& x : *map)
+            {
+                sum = sum * 31 + x.first;
+            }
+            t1 = clock::now();
+            result.m_iterate_ns = nanoseconds_per(t1 - t0, n);
+        }
+
+        result.m_checksum = sum;
+        return result;
+    }
+
+    void print(char const* name, measurement const& m)
+    {
+        std::cout << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(1) << std::setw(12) << m.m_bytes_per_element << std::setprecision(3) << std::setw(12)
+                  << m.m_allocations_per_element << std::setprecision(1) << std::setw(12) << m.m_insert_ns << std::setw(12) << m.m_find_ns << std::setw(12) << m.m_miss_ns << std::setw(12)
+                  << m.m_iterate_ns << std::endl;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t n = argc > 1 ? std::stoull(argv[1]) : 1000000;
+
+    // splitmix64 outputs are distinct, and misses come from the same generator further along.
+    std::vector< std::uint64_t > keys(n);
+    std::vector< std::uint64_t > misses(n);
+    std::uint64_t state = 0;
+    auto next = [&] {
+        std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    };
+    for (auto& k : keys)
+    {
+        k = next();
+    }
+    for (auto& k : misses)
+    {
+        k = next();
+    }
+
+    std::cout << n << " random uint64 -> uint64 elements" << std::endl;
+    std::cout << std::left << std::setw(20) << "container" << std::right << std::setw(12) << "bytes/el" << std::setw(12) << "blocks/el" << std::setw(12) << "insert" << std::setw(12) << "find"
+              << std::setw(12) << "miss" << std::setw(12) << "iterate" << "  (ns per element)" << std::endl;
+
+    auto reference = run< std::map< std::uint64_t, std::uint64_t > >(keys, misses);
+    print("std::map", reference);
+    auto avl = run< rpnx::experimental::avl_tree< std::uint64_t, std::uint64_t > >(keys, misses);
+    print("avl_tree", avl);
+    auto btree = run< rpnx::experimental::btree_map< std::uint64_t, std::uint64_t > >(keys, misses);
+    print("btree_map", btree);
+    auto btree16 = run< rpnx::experimental::btree_map< std::uint64_t, std::uint64_t, std::less< std::uint64_t >, std::allocator< std::pair< std::uint64_t const, std::uint64_t > >, 16 > >(keys, misses);
+    print("btree_map<16>", btree16);
+    auto btree64 = run< rpnx::experimental::btree_map< std::uint64_t, std::uint64_t, std::less< std::uint64_t >, std::allocator< std::pair< std::uint64_t const, std::uint64_t > >, 64 > >(keys, misses);
+    print("btree_map<64>", btree64);
+
+    std::vector< std::uint64_t > legacy_keys(keys.begin(), keys.begin() + std::ptrdiff_t(std::min< std::size_t >(n, 10000)));
+    auto legacy = run< legacy_tree >(legacy_keys, misses);
+    std::cout << std::endl
+              << "legacy rpnx::avl_tree, first " << legacy_keys.size() << " keys only, insert only: " << std::setprecision(1) << legacy.m_bytes_per_element << " bytes/el, " << std::setprecision(3)
+              << legacy.m_allocations_per_element << " blocks/el, " << std::setprecision(1) << legacy.m_insert_ns / 1000.0 << " us per insert" << std::endl;
+
+    int failures = 0;
+    for (auto const* m : {&avl, &btree, &btree16, &btree64})
+    {
+        if (m->m_checksum != reference.m_checksum)
+        {
+            failures++;
+        }
+    }
+    if (failures != 0)
+    {
+        std::cout << "conformance failure" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+#include "rpnx/derivator.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Derivator storage benchmark.
+// Fills a queue of messages, copies it and destroys both, using std::variant, rpnx::derivator with every
+// alternative allocated (inline size 0, the previous behaviour), rpnx::derivator (pointer sized values inline) and
+// rpnx::inline_derivator with 16 and 32 bytes of inline storage. Messages are mostly 4 and 16 byte values with an
+// occasional std::string.
+// Usage: rpnx-core-benchmark6 [messages]
+
+namespace
+{
+    struct message
+    {
+        std::int64_t m_id;
+        std::int64_t m_payload;
+    };
+
+    struct measurement
+    {
+        double m_construct_ns = 0;
+        double m_copy_ns = 0;
+        double m_destroy_ns = 0;
+        std::uint64_t m_checksum = 0;
+    };
+
+    double nanoseconds_per(std::chrono::steady_clock::duration d, std::size_t n)
+    {
+        return double(std::chrono::duration_cast< std::chrono::nanoseconds >(d).count()) / double(n);
+    }
+
+    template < typename V >
+    struct is_std_variant : std::false_type
+    {
+    };
+
+    template < typename... Ts >
+    struct is_std_variant< std::variant< Ts... > > : std::true_type
+    {
+    };
+
+    template < typename T, typename V >
+    T const& get_value(V const& v)
+    {
+        if constexpr (is_std_variant< V >::value)
+        {
+            return std::get< T >(v);
+        }
+        else
+        {
+            return v.template get< T >();
+        }
+    }
+
+    template < typename V >
+    measurement run(std::size_t n)
+    {
+        using clock = std::chrono::steady_clock;
+        measurement result;
+
+        std::vector< V >* queue = new std::vector< V >();
+        queue->reserve(n);
+        std::vector< V >* copy = new std::vector< V >();
+        copy->reserve(n);
+
+        auto t0 = clock::now();
+        for (std::size_t i = 0; i < n; i++)
+        {
+            V& v = queue->emplace_back();
+            if (i % 16 == 15)
+            {
+                v.template emplace< std::string >("a message long enough to allocate");
+            }
+            else if (i % 2 == 0)
+            {
+                v.template emplace< std::int32_t >(std::int32_t(i));
+            }
+            else
+            {
+                v.template emplace< message >(message{std::int64_t(i), std::int64_t(i) * 3});
+            }
+        }
+        auto t1 = clock::now();
+        result.m_construct_ns = nanoseconds_per(t1 - t0, n);
+
+        t0 = clock::now();
+        for (V const& v : *queue)
+        {
+            copy->push_back(v);
+        }
+        t1 = clock::now();
+        result.m_copy_ns = nanoseconds_per(t1 - t0, n);
+
+        std::uint64_t sum = 0;
+        for (V const& v : *copy)
+        {
+            switch (v.index())
+            {
+            case 0:
+                sum += std::uint64_t(get_value< std::int32_t >(v));
+                break;
+            case 1:
+                sum += std::uint64_t(get_value< message >(v).m_payload);
+                break;
+            default:
+                sum += get_value< std::string >(v).size();
+                break;
+            }
+        }
+        result.m_checksum = sum;
+
+        t0 = clock::now();
+        delete queue;
+        delete copy;
+        t1 = clock::now();
+        result.m_destroy_ns = nanoseconds_per(t1 - t0, 2 * n);
+        return result;
+    }
+
+    void print(char const* name, std::size_t size, measurement const& m)
+    {
+        std::cout << std::left << std::setw(24) << name << std::right << std::setw(8) << size << std::fixed << std::setprecision(1) << std::setw(12) << m.m_construct_ns << std::setw(12)
+                  << m.m_copy_ns << std::setw(12) << m.m_destroy_ns << std::endl;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t n = argc > 1 ? std::stoull(argv[1]) : 1000000;
+
+    using variant_type = std::variant< std::int32_t, message, std::string >;
+    using heap_type = rpnx::basic_inline_derivator< 0, std::allocator< void >, std::int32_t, message, std::string >;
+    using default_type = rpnx::derivator< std::int32_t, message, std::string >;
+    using inline16_type = rpnx::inline_derivator< 16, std::int32_t, message, std::string >;
+    using inline32_type = rpnx::inline_derivator< 32, std::int32_t, message, std::string >;
+
+    std::cout << n << " messages" << std::endl;
+    std::cout << std::left << std::setw(24) << "container" << std::right << std::setw(8) << "sizeof" << std::setw(12) << "construct" << std::setw(12) << "copy" << std::setw(12) << "destroy"
+              << "  (ns per message)" << std::endl;
+
+    auto reference = run< variant_type >(n);
+    print("std::variant", sizeof(variant_type), reference);
+    auto heap = run< heap_type >(n);
+    print("derivator<0>", sizeof(heap_type), heap);
+    auto standard = run< default_type >(n);
+    print("derivator", sizeof(default_type), standard);
+    auto inline16 = run< inline16_type >(n);
+    print("inline_derivator<16>", sizeof(inline16_type), inline16);
+    auto inline32 = run< inline32_type >(n);
+    print("inline_derivator<32>", sizeof(inline32_type), inline32);
+
+    int failures = 0;
+    for (auto const* m : {&heap, &standard, &inline16, &inline32})
+    {
+        if (m->m_checksum != reference.m_checksum)
+        {
+            failures++;
+        }
+    }
+    if (failures != 0)
+    {
+        std::cout << "conformance failure" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,245 @@
+#include "rpnx/derivator.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <variant>
+#include <vector>
+
+// Derivator dispatch benchmark.
+// Dispatches a queue of random messages through rpnx::visit, a hand-written switch on index(), an if-chain over
+// holds_alternative and std::visit on an equivalent std::variant, then repeats with pairs of messages to compare
+// double visit against nested switches.
+// Usage: rpnx-core-benchmark7 [messages]
+
+namespace
+{
+    struct add
+    {
+        std::int64_t m_value;
+    };
+
+    struct multiply
+    {
+        std::int64_t m_value;
+    };
+
+    struct shift
+    {
+        std::int32_t m_bits;
+    };
+
+    struct reset
+    {
+    };
+
+    using message = rpnx::inline_derivator< 16, add, multiply, shift, reset, std::string >;
+    using variant_message = std::variant< add, multiply, shift, reset, std::string >;
+
+    struct machine
+    {
+        std::uint64_t m_state = 1;
+
+        void operator()(add const& m)
+        {
+            m_state += std::uint64_t(m.m_value);
+        }
+
+        void operator()(multiply const& m)
+        {
+            m_state *= std::uint64_t(m.m_value);
+        }
+
+        void operator()(shift const& m)
+        {
+            m_state ^= m_state >> m.m_bits;
+        }
+
+        void operator()(reset const&)
+        {
+            m_state = 1;
+        }
+
+        void operator()(std::string const& m)
+        {
+            m_state += m.size();
+        }
+
+        template < typename A, typename B >
+        void operator()(A const& a, B const& b)
+        {
+            (*this)(a);
+            (*this)(b);
+        }
+    };
+
+    double nanoseconds_per(std::chrono::steady_clock::duration d, std::size_t n)
+    {
+        return double(std::chrono::duration_cast< std::chrono::nanoseconds >(d).count()) / double(n);
+    }
+
+    void dispatch_switch(machine& m, message const& msg)
+    {
+        switch (msg.index())
+        {
+        case 0:
+            m(msg.as< 0 >());
+            break;
+        case 1:
+            m(msg.as< 1 >());
+            break;
+        case 2:
+            m(msg.as< 2 >());
+            break;
+        case 3:
+            m(msg.as< 3 >());
+            break;
+        default:
+            m(msg.as< 4 >());
+            break;
+        }
+    }
+
+    void dispatch_if(machine& m, message const& msg)
+    {
+        if (msg.holds_alternative< add >())
+        {
+            m(msg.as< add >());
+        }
+        else if (msg.holds_alternative< multiply >())
+        {
+            m(msg.as< multiply >());
+        }
+        else if (msg.holds_alternative< shift >())
+        {
+            m(msg.as< shift >());
+        }
+        else if (msg.holds_alternative< reset >())
+        {
+            m(msg.as< reset >());
+        }
+        else
+        {
+            m(msg.as< std::string >());
+        }
+    }
+
+    template < typename F >
+    double measure(std::size_t n, std::uint64_t& checksum, F f)
+    {
+        machine m;
+        auto t0 = std::chrono::steady_clock::now();
+        f(m);
+        auto t1 = std::chrono::steady_clock::now();
+        if (checksum != 0 && checksum != m.m_state)
+        {
+            std::cout << "conformance failure" << std::endl;
+            std::exit(1);
+        }
+        checksum = m.m_state;
+        return nanoseconds_per(t1 - t0, n);
+    }
+
+    void print(char const* name, double ns)
+    {
+        std::cout << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(2) << std::setw(12) << ns << std::endl;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t n = argc > 1 ? std::stoull(argv[1]) : 1000000;
+
+    std::vector< message > messages(n);
+    std::vector< variant_message > variants(n);
+    std::uint64_t state = 12345;
+    for (std::size_t i = 0; i < n; i++)
+    {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        std::int32_t value = std::int32_t(state >> 40);
+        switch ((state >> 33) % 17)
+        {
+        case 0:
+            messages[i] = std::string("message");
+            variants[i] = std::string("message");
+            break;
+        case 1:
+            messages[i] = reset{};
+            variants[i] = reset{};
+            break;
+        case 2:
+        case 3:
+        case 4:
+        case 5:
+            messages[i] = shift{value % 13 + 1};
+            variants[i] = shift{value % 13 + 1};
+            break;
+        case 6:
+        case 7:
+        case 8:
+        case 9:
+        case 10:
+            messages[i] = multiply{value | 1};
+            variants[i] = multiply{value | 1};
+            break;
+        default:
+            messages[i] = add{value};
+            variants[i] = add{value};
+            break;
+        }
+    }
+
+    std::cout << n << " messages" << std::endl;
+    std::cout << std::left << std::setw(28) << "dispatch" << std::right << std::setw(12) << "ns/message" << std::endl;
+
+    std::uint64_t checksum = 0;
+    print("rpnx::visit", measure(n, checksum, [&](machine& m) {
+              for (auto const& msg : messages)
+              {
+                  rpnx::visit(m, msg);
+              }
+          }));
+    print("switch on index()", measure(n, checksum, [&](machine& m) {
+              for (auto const& msg : messages)
+              {
+                  dispatch_switch(m, msg);
+              }
+          }));
+    print("holds_alternative chain", measure(n, checksum, [&](machine& m) {
+              for (auto const& msg : messages)
+              {
+                  dispatch_if(m, msg);
+              }
+          }));
+    print("std::visit", measure(n, checksum, [&](machine& m) {
+              for (auto const& msg : variants)
+              {
+                  std::visit(m, msg);
+              }
+          }));
+
+    std::uint64_t pair_checksum = 0;
+    print("rpnx::visit (pairs)", measure(n, pair_checksum, [&](machine& m) {
+              for (std::size_t i = 0; i + 1 < n; i += 2)
+              {
+                  rpnx::visit(m, messages[i], messages[i + 1]);
+              }
+          }));
+    print("nested switch (pairs)", measure(n, pair_checksum, [&](machine& m) {
+              for (std::size_t i = 0; i + 1 < n; i += 2)
+              {
+                  dispatch_switch(m, messages[i]);
+                  dispatch_switch(m, messages[i + 1]);
+              }
+          }));
+    print("std::visit (pairs)", measure(n, pair_checksum, [&](machine& m) {
+              for (std::size_t i = 0; i + 1 < n; i += 2)
+              {
+                  std::visit(m, variants[i], variants[i + 1]);
+              }
+          }));
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include "rpnx/derivator.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Derivator keyed lookup benchmark.
+// Builds a routing table keyed by rpnx::derivator message keys (integer ids and string topics) and looks up a
+// random stream of keys through std::map, std::map with derivator_less looking up the alternative's value
+// directly, and std::unordered_map with std::hash and with derivator_hash.
+// Usage: rpnx-core-benchmark8 [routes] [lookups]
+
+namespace
+{
+    using route_key = rpnx::derivator< std::uint32_t, std::string >;
+
+    double nanoseconds_per(std::chrono::steady_clock::duration d, std::size_t n)
+    {
+        return double(std::chrono::duration_cast< std::chrono::nanoseconds >(d).count()) / double(n);
+    }
+
+    template < typename F >
+    double measure(std::size_t n, std::uint64_t& checksum, F f)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        std::uint64_t sum = f();
+        auto t1 = std::chrono::steady_clock::now();
+        if (checksum != 0 && checksum != sum)
+        {
+            std::cout << "conformance failure" << std::endl;
+            std::exit(1);
+        }
+        checksum = sum;
+        return nanoseconds_per(t1 - t0, n);
+    }
+
+    void print(char const* name, double ns)
+    {
+        std::cout << std::left << std::setw(40) << name << std::right << std::fixed << std::setprecision(1) << std::setw(12) << ns << std::endl;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t routes = argc > 1 ? std::stoull(argv[1]) : 10000;
+    std::size_t lookups = argc > 2 ? std::stoull(argv[2]) : 1000000;
+
+    std::vector< route_key > keys(routes);
+    for (std::size_t i = 0; i < routes; i++)
+    {
+        if (i % 2 == 0)
+        {
+            keys[i] = std::uint32_t(i * 2654435761u);
+        }
+        else
+        {
+            keys[i] = "topic/" + std::to_string(i);
+        }
+    }
+
+    std::map< route_key, std::uint64_t > ordered;
+    std::map< route_key, std::uint64_t, rpnx::derivator_less > transparent;
+    std::unordered_map< route_key, std::uint64_t > hashed;
+    std::unordered_map< route_key, std::uint64_t, rpnx::derivator_hash< route_key >, rpnx::derivator_equal_to > transparent_hashed;
+    for (std::size_t i = 0; i < routes; i++)
+    {
+        ordered.emplace(keys[i], i);
+        transparent.emplace(keys[i], i);
+        hashed.emplace(keys[i], i);
+        transparent_hashed.emplace(keys[i], i);
+    }
+
+    std::vector< std::size_t > stream(lookups);
+    std::uint64_t state = 1;
+    for (auto& s : stream)
+    {
+        state = state * 6364136223846793005ull + 1442695040888963407ull;
+        s = std::size_t(state >> 33) % routes;
+    }
+
+    std::cout << routes << " routes, " << lookups << " lookups" << std::endl;
+    std::cout << std::left << std::setw(40) << "table" << std::right << std::setw(12) << "ns/lookup" << std::endl;
+
+    std::uint64_t checksum = 0;
+    print("std::map", measure(lookups, checksum, [&] {
+              std::uint64_t sum = 0;
+              for (std::size_t s : stream)
+              {
+                  sum += ordered.find(keys[s])->second;
+              }
+              return sum;
+          }));
+    print("std::map, derivator_less, by value", measure(lookups, checksum, [&] {
+              std::uint64_t sum = 0;
+              for (std::size_t s : stream)
+              {
+                  route_key const& k = keys[s];
+                  sum += (k.index() == 0 ? transparent.find(k.as< std::uint32_t >()) : transparent.find(k.as< std::string >()))->second;
+              }
+              return sum;
+          }));
+    print("std::unordered_map", measure(lookups, checksum, [&] {
+              std::uint64_t sum = 0;
+              for (std::size_t s : stream)
+              {
+                  sum += hashed.find(keys[s])->second;
+              }
+              return sum;
+          }));
+    print("std::unordered_map, derivator_hash", measure(lookups, checksum, [&] {
+              std::uint64_t sum = 0;
+              for (std::size_t s : stream)
+              {
+                  sum += transparent_hashed.find(keys[s])->second;
+              }
+              return sum;
+          }));
+    return 0;
+}
@@ -0,0 +1,249 @@
+#include "rpnx/experimental/priority_dispatcher.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// priority_dispatcher scaling benchmark.
+// Reports millions of tasks per second for every scheduling mode at 1, 2, 4, ... service threads up to
+// std::thread::hardware_concurrency(), in three workloads:
+//  external: one thread per service thread submits small tasks from outside the dispatcher.
+//  bulk: the same, in batches of 1000 through submit_bulk_n.
+//  fan-out: each task submits two children until the tree has the requested number of tasks, the pattern of
+//           recursive parallel algorithms where nearly every submit comes from a service thread.
+// It then reports submit-to-start latency at low load: with 8 idle service threads, one task is submitted at a
+// time and the submitter waits for it to start. Process CPU time per task is shown next to it, since waking
+// idle threads that find nothing to do burns CPU without helping latency.
+// Usage: rpnx-core-benchmark9 [tasks]
+
+namespace
+{
+    using rpnx::experimental::priority_dispatcher;
+
+    // A few hundred nanoseconds of work, so the benchmark measures scheduling rather than an empty loop.
+    std::uint64_t work(std::uint64_t x)
+    {
+        for (int i = 0; i < 64; i++)
+        {
+            x = x * 6364136223846793005ull + 1442695040888963407ull;
+        }
+        return x;
+    }
+
+    struct state
+    {
+        priority_dispatcher* m_dispatcher;
+        std::atomic< std::uint64_t > m_checksum{0};
+        std::atomic< std::size_t > m_submitted{0};
+    };
+
+    void fan_out(state& s, std::uint64_t node, std::uint64_t tasks)
+    {
+        s.m_checksum.fetch_add(work(node), std::memory_order_relaxed);
+        for (std::uint64_t child = node * 2; child <= node * 2 + 1 && child <= tasks; child++)
+        {
+            s.m_dispatcher->submit(
+                [&s, child, tasks] {
+                    fan_out(s, child, tasks);
+                },
+                std::int64_t(child % 4));
+            s.m_submitted.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    double millions_per_second(std::chrono::steady_clock::duration d, std::size_t n)
+    {
+        return double(n) / double(std::chrono::duration_cast< std::chrono::nanoseconds >(d).count()) * 1000.0;
+    }
+
+    double run_external(priority_dispatcher::scheduling_mode mode, std::size_t threads, std::size_t tasks, std::uint64_t& checksum)
+    {
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        options.m_thread_count = threads;
+        priority_dispatcher dispatcher(options);
+        state s;
+        s.m_dispatcher = &dispatcher;
+
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector< std::thread > submitters;
+        for (std::size_t t = 0; t < threads; t++)
+        {
+            submitters.emplace_back([&, t] {
+                for (std::size_t i = t; i < tasks; i += threads)
+                {
+                    dispatcher.submit(
+                        [&s, i] {
+                            s.m_checksum.fetch_add(work(i + 1), std::memory_order_relaxed);
+                        },
+                        std::int64_t(i % 4));
+                }
+            });
+        }
+        for (auto& th : submitters)
+        {
+            th.join();
+        }
+        dispatcher.finish_all();
+        auto t1 = std::chrono::steady_clock::now();
+        checksum = s.m_checksum;
+        return millions_per_second(t1 - t0, tasks);
+    }
+
+    double run_bulk(priority_dispatcher::scheduling_mode mode, std::size_t threads, std::size_t tasks, std::uint64_t& checksum)
+    {
+        constexpr std::size_t batch = 1000;
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        options.m_thread_count = threads;
+        priority_dispatcher dispatcher(options);
+        state s;
+        s.m_dispatcher = &dispatcher;
+
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector< std::thread > submitters;
+        for (std::size_t t = 0; t < threads; t++)
+        {
+            submitters.emplace_back([&, t] {
+                for (std::size_t first = t * batch; first < tasks; first += threads * batch)
+                {
+                    dispatcher.submit_bulk_n(
+                        [&s, first](std::size_t i) {
+                            s.m_checksum.fetch_add(work(first + i + 1), std::memory_order_relaxed);
+                        },
+                        std::min(batch, tasks - first), std::int64_t(first / batch % 4));
+                }
+            });
+        }
+        for (auto& th : submitters)
+        {
+            th.join();
+        }
+        dispatcher.finish_all();
+        auto t1 = std::chrono::steady_clock::now();
+        checksum = s.m_checksum;
+        return millions_per_second(t1 - t0, tasks);
+    }
+
+    double run_fan_out(priority_dispatcher::scheduling_mode mode, std::size_t threads, std::size_t tasks, std::uint64_t& checksum)
+    {
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        options.m_thread_count = threads;
+        priority_dispatcher dispatcher(options);
+        state s;
+        s.m_dispatcher = &dispatcher;
+
+        auto t0 = std::chrono::steady_clock::now();
+        dispatcher.submit(
+            [&s, tasks] {
+                fan_out(s, 1, tasks);
+            },
+            0);
+        // finish_all may not run concurrently with submit.
+        while (s.m_submitted.load() != tasks - 1)
+        {
+            std::this_thread::yield();
+        }
+        dispatcher.finish_all();
+        auto t1 = std::chrono::steady_clock::now();
+        checksum = s.m_checksum;
+        return millions_per_second(t1 - t0, tasks);
+    }
+    void run_latency(priority_dispatcher::scheduling_mode mode, char const* name)
+    {
+        constexpr int rounds = 20000;
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        options.m_thread_count = 8;
+        priority_dispatcher dispatcher(options);
+        // Let every service thread park.
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        std::chrono::steady_clock::duration total{};
+        std::clock_t c0 = std::clock();
+        for (int i = 0; i < rounds; i++)
+        {
+            std::atomic< bool > started{false};
+            std::chrono::steady_clock::time_point start;
+            auto t0 = std::chrono::steady_clock::now();
+            dispatcher.submit(
+                [&] {
+                    start = std::chrono::steady_clock::now();
+                    started.store(true, std::memory_order_release);
+                },
+                0);
+            while (!started.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+            total += start - t0;
+        }
+        std::clock_t c1 = std::clock();
+        std::cout << std::setw(16) << name << std::setw(16) << std::chrono::duration_cast< std::chrono::nanoseconds >(total).count() / rounds << std::setw(16)
+                  << double(c1 - c0) / CLOCKS_PER_SEC * 1e9 / rounds << std::endl;
+    }
+} // namespace
+
+int main(int argc, char** argv)
+{
+    std::size_t tasks = argc > 1 ? std::stoull(argv[1]) : 1000000;
+    std::size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+
+    std::vector< std::size_t > thread_counts;
+    for (std::size_t t = 1; t < max_threads; t *= 2)
+    {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(max_threads);
+
+    std::cout << tasks << " tasks, millions of tasks per second" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(10) << "workload" << std::setw(10) << "shared" << std::setw(10) << "steal" << std::setw(10) << "banded" << std::endl;
+
+    // Every workload runs work(1) ... work(tasks) exactly once.
+    std::uint64_t reference = 0;
+    for (std::uint64_t i = 1; i <= tasks; i++)
+    {
+        reference += work(i);
+    }
+
+    int failures = 0;
+    using workload = double (*)(priority_dispatcher::scheduling_mode, std::size_t, std::size_t, std::uint64_t&);
+    std::pair< char const*, workload > workloads[] = {{"external", &run_external}, {"bulk", &run_bulk}, {"fan-out", &run_fan_out}};
+    for (std::size_t threads : thread_counts)
+    {
+        for (auto const& [name, run] : workloads)
+        {
+            std::cout << std::setw(8) << threads << std::setw(10) << name << std::fixed << std::setprecision(2);
+            for (auto mode : {priority_dispatcher::scheduling_mode::shared_queue, priority_dispatcher::scheduling_mode::work_stealing, priority_dispatcher::scheduling_mode::banded})
+            {
+                std::uint64_t checksum = 0;
+                std::cout << std::setw(10) << run(mode, threads, tasks, checksum);
+                if (checksum != reference)
+                {
+                    failures++;
+                }
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    std::cout << std::endl << std::setw(16) << "mode" << std::setw(16) << "latency" << std::setw(16) << "cpu/task" << "  (ns)" << std::endl;
+    run_latency(priority_dispatcher::scheduling_mode::shared_queue, "shared");
+    run_latency(priority_dispatcher::scheduling_mode::work_stealing, "steal");
+    run_latency(priority_dispatcher::scheduling_mode::banded, "banded");
+
+    if (failures != 0)
+    {
+        std::cout << "conformance failure" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,302 @@
+#include "rpnx/experimental/pool_allocator.hpp"
+
+#include <array>
+#include <mutex>
+
+namespace rpnx
+{
+    namespace experimental
+    {
+        namespace impl
+        {
+            // Size classes are 16 byte steps up to 256 bytes, then powers of two up to pool_max_class_size.
+            constexpr std::size_t pool_granularity = 16;
+            constexpr std::size_t pool_small_limit = 256;
+            constexpr std::size_t pool_small_classes = pool_small_limit / pool_granularity;
+            constexpr std::size_t pool_class_count = pool_small_classes + 4;
+            constexpr std::size_t pool_slab_size = 64 * 1024;
+
+            static_assert(pool_max_class_size == pool_small_limit << 4);
+            static_assert(alignof(std::max_align_t) <= pool_granularity);
+
+            constexpr std::size_t pool_class_index(std::size_t bytes) noexcept
+            {
+                if (bytes <= pool_small_limit)
+                {
+                    return bytes == 0 ? 0 : (bytes - 1) / pool_granularity;
+                }
+                std::size_t v_index = pool_small_classes;
+                std::size_t v_size = pool_small_limit * 2;
+                while (v_size < bytes)
+                {
+                    v_size *= 2;
+                    v_index++;
+                }
+                return v_index;
+            }
+
+            constexpr std::size_t pool_class_size(std::size_t index) noexcept
+            {
+                if (index < pool_small_classes)
+                {
+                    return (index + 1) * pool_granularity;
+                }
+                return pool_small_limit << (index - pool_small_classes + 1);
+            }
+
+            // Number of blocks moved between a thread cache and the central list at a time.
+            constexpr std::size_t pool_batch_size(std::size_t index) noexcept
+            {
+                std::size_t v_batch = 8192 / pool_class_size(index);
+                return v_batch < 4 ? 4 : v_batch > 64 ? 64 : v_batch;
+            }
+
+            struct free_block
+            {
+                free_block* m_next;
+                // Only meaningful on the first block of a batch held by the central list.
+                free_block* m_next_batch;
+            };
+
+            struct central_list
+            {
+                std::mutex m_mtx;
+                // Full batches of pool_batch_size blocks, linked through m_next_batch.
+                free_block* m_batches = nullptr;
+                // Blocks returned in less than a full batch, e.g. by an exiting thread.
+                free_block* m_loose = nullptr;
+                std::size_t m_loose_count = 0;
+            };
+
+            // Intentionally leaked so that it outlives every thread cache, including those destroyed after main returns.
+            std::array< central_list, pool_class_count >& central_lists()
+            {
+                static auto* s_lists = new std::array< central_list, pool_class_count >();
+                return *s_lists;
+            }
+
+            // Set once the calling thread's cache has been destroyed. Trivially destructible, so it stays readable
+            // for destructors of other thread_local and static objects that run afterwards.
+            thread_local bool t_cache_destroyed = false;
+
+            struct thread_cache
+            {
+                struct bucket
+                {
+                    free_block* m_head = nullptr;
+                    std::size_t m_count = 0;
+                };
+
+                std::array< bucket, pool_class_count > m_buckets;
+
+                ~thread_cache()
+                {
+                    flush();
+                    t_cache_destroyed = true;
+                }
+
+                void* allocate(std::size_t index)
+                {
+                    bucket& v_bucket = m_buckets[index];
+                    if (v_bucket.m_head == nullptr)
+                    {
+                        refill(index);
+                    }
+                    free_block* v_block = v_bucket.m_head;
+                    v_bucket.m_head = v_block->m_next;
+                    v_bucket.m_count--;
+                    return v_block;
+                }
+
+                void deallocate(void* ptr, std::size_t index) noexcept
+                {
+                    bucket& v_bucket = m_buckets[index];
+                    free_block* v_block = ::new (ptr) free_block;
+                    v_block->m_next = v_bucket.m_head;
+                    v_bucket.m_head = v_block;
+                    v_bucket.m_count++;
+                    if (v_bucket.m_count >= 2 * pool_batch_size(index))
+                    {
+                        release_batch(index);
+                    }
+                }
+
+                void flush() noexcept
+                {
+                    for (std::size_t i = 0; i < pool_class_count; i++)
+                    {
+                        bucket& v_bucket = m_buckets[i];
+                        if (v_bucket.m_head == nullptr)
+                        {
+                            continue;
+                        }
+
+                        free_block* v_tail = v_bucket.m_head;
+                        while (v_tail->m_next != nullptr)
+                        {
+                            v_tail = v_tail->m_next;
+                        }
+
+                        central_list& v_central = central_lists()[i];
+                        std::unique_lock v_lock(v_central.m_mtx);
+                        v_tail->m_next = v_central.m_loose;
+                        v_central.m_loose = v_bucket.m_head;
+                        v_central.m_loose_count += v_bucket.m_count;
+                        v_bucket.m_head = nullptr;
+                        v_bucket.m_count = 0;
+                    }
+                }
+
+              private:
+                void refill(std::size_t index)
+                {
+                    bucket& v_bucket = m_buckets[index];
+                    central_list& v_central = central_lists()[index];
+                    {
+                        std::unique_lock v_lock(v_central.m_mtx);
+                        if (v_central.m_batches != nullptr)
+                        {
+                            v_bucket.m_head = v_central.m_batches;
+                            v_bucket.m_count = pool_batch_size(index);
+                            v_central.m_batches = v_central.m_batches->m_next_batch;
+                            return;
+                        }
+                        if (v_central.m_loose != nullptr)
+                        {
+                            std::size_t v_count = 1;
+                            free_block* v_last = v_central.m_loose;
+                            while (v_count < pool_batch_size(index) && v_last->m_next != nullptr)
+                            {
+                                v_last = v_last->m_next;
+                                v_count++;
+                            }
+                            v_bucket.m_head = v_central.m_loose;
+                            v_bucket.m_count = v_count;
+                            v_central.m_loose = v_last->m_next;
+                            v_central.m_loose_count -= v_count;
+                            v_last->m_next = nullptr;
+                            return;
+                        }
+                    }
+
+                    // Nothing to reuse, carve a new slab. Slabs are never freed.
+                    std::size_t v_size = pool_class_size(index);
+                    std::size_t v_slab_size = v_size * pool_batch_size(index) > pool_slab_size ? v_size * pool_batch_size(index) : pool_slab_size;
+                    char* v_slab = static_cast< char* >(::operator new(v_slab_size));
+                    std::size_t v_blocks = v_slab_size / v_size;
+                    for (std::size_t i = v_blocks; i != 0; i--)
+                    {
+                        free_block* v_block = ::new (static_cast< void* >(v_slab + (i - 1) * v_size)) free_block;
+                        v_block->m_next = v_bucket.m_head;
+                        v_bucket.m_head = v_block;
+                    }
+                    v_bucket.m_count = v_blocks;
+                }
+
+                void release_batch(std::size_t index) noexcept
+                {
+                    bucket& v_bucket = m_buckets[index];
+                    std::size_t v_batch_size = pool_batch_size(index);
+
+                    free_block* v_first = v_bucket.m_head;
+                    free_block* v_last = v_first;
+                    for (std::size_t i = 1; i < v_batch_size; i++)
+                    {
+                        v_last = v_last->m_next;
+                    }
+                    v_bucket.m_head = v_last->m_next;
+                    v_bucket.m_count -= v_batch_size;
+                    v_last->m_next = nullptr;
+
+                    central_list& v_central = central_lists()[index];
+                    std::unique_lock v_lock(v_central.m_mtx);
+                    v_first->m_next_batch = v_central.m_batches;
+                    v_central.m_batches = v_first;
+                }
+            };
+
+            thread_cache& local_thread_cache()
+            {
+                static thread_local thread_cache s_cache;
+                return s_cache;
+            }
+
+            // Slow paths for threads whose cache has already been destroyed.
+            void* central_allocate(std::size_t index)
+            {
+                central_list& v_central = central_lists()[index];
+                {
+                    std::unique_lock v_lock(v_central.m_mtx);
+                    if (v_central.m_loose != nullptr)
+                    {
+                        free_block* v_block = v_central.m_loose;
+                        v_central.m_loose = v_block->m_next;
+                        v_central.m_loose_count--;
+                        return v_block;
+                    }
+                }
+                return ::operator new(pool_class_size(index));
+            }
+
+            void central_deallocate(void* ptr, std::size_t index) noexcept
+            {
+                central_list& v_central = central_lists()[index];
+                std::unique_lock v_lock(v_central.m_mtx);
+                free_block* v_block = ::new (ptr) free_block;
+                v_block->m_next = v_central.m_loose;
+                v_central.m_loose = v_block;
+                v_central.m_loose_count++;
+            }
+        } // namespace impl
+    }     // namespace experimental
+} // namespace rpnx
+
+void* rpnx::experimental::pool_allocate(std::size_t bytes, std::size_t alignment)
+{
+    if (bytes > pool_max_class_size || alignment > impl::pool_granularity)
+    {
+        if (alignment > alignof(std::max_align_t))
+        {
+            return ::operator new(bytes, std::align_val_t(alignment));
+        }
+        return ::operator new(bytes);
+    }
+    if (impl::t_cache_destroyed)
+    {
+        return impl::central_allocate(impl::pool_class_index(bytes));
+    }
+    return impl::local_thread_cache().allocate(impl::pool_class_index(bytes));
+}
+
+void rpnx::experimental::pool_deallocate(void* ptr, std::size_t bytes, std::size_t alignment) noexcept
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+    if (bytes > pool_max_class_size || alignment > impl::pool_granularity)
+    {
+        if (alignment > alignof(std::max_align_t))
+        {
+            ::operator delete(ptr, std::align_val_t(alignment));
+            return;
+        }
+        ::operator delete(ptr);
+        return;
+    }
+    if (impl::t_cache_destroyed)
+    {
+        impl::central_deallocate(ptr, impl::pool_class_index(bytes));
+        return;
+    }
+    impl::local_thread_cache().deallocate(ptr, impl::pool_class_index(bytes));
+}
+
+void rpnx::experimental::pool_flush_thread_cache() noexcept
+{
+    if (impl::t_cache_destroyed)
+    {
+        return;
+    }
+    impl::local_thread_cache().flush();
+}
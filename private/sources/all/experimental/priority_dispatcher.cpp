@@ -3,10 +3,36 @@
 //
 #include "rpnx/experimental/priority_dispatcher.hpp"
 #include "rpnx/experimental/scoped_action.hpp"
+#include "rpnx/experimental/bitwise.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
 #include <queue>
 #include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
 #include "rpnx/assert.hpp"
 
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#if defined(RPNX_CPU_IS_X64) || defined(RPNX_CPU_IS_X86)
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
 namespace rpnx
 {
     namespace experimental
@@ -16,9 +42,29 @@ namespace rpnx
             struct submitted_job
             {
                 std::int64_t m_priority;
-                void* m_data;
+                // When the job was queued, in stat_ticks(), if statistics are collected.
+                std::uint64_t m_enqueued = 0;
                 void (*m_exec)(void*);
+                // nullptr for a functor stored in m_inline, which is trivially copyable and needs no cleanup.
                 void (*m_cleanup)(void*, priority_dispatcher::completion_state) noexcept;
+                union
+                {
+                    void* m_data;
+                    alignas(void*) unsigned char m_inline[priority_dispatcher::inline_functor_size];
+                };
+
+                void* data() noexcept
+                {
+                    return m_cleanup != nullptr ? m_data : static_cast< void* >(m_inline);
+                }
+
+                void finish(priority_dispatcher::completion_state a_state) const noexcept
+                {
+                    if (m_cleanup != nullptr)
+                    {
+                        m_cleanup(m_data, a_state);
+                    }
+                }
             };
 
             struct submitted_job_comp
@@ -29,329 +75,2786 @@ namespace rpnx
                 }
             };
 
-            struct priority_dispatcher_impl
+            /** The jobs of one submit_bulk call.
+             */
+            struct job_batch
             {
-                priority_dispatcher_impl()
+                void (*m_exec)(void*);
+                void (*m_cleanup)(void*, priority_dispatcher::completion_state) noexcept;
+                unsigned char* m_first_data;
+                std::size_t m_data_stride;
+                std::size_t m_count;
+                std::int64_t m_priority;
+                std::uint64_t m_enqueued = 0;
+
+                submitted_job operator[](std::size_t a_index) const noexcept
                 {
-                    std::unique_lock v_lock(m_mtx);
-                    m_tc_target = std::thread::hardware_concurrency();
+                    submitted_job v_job;
+                    v_job.m_priority = m_priority;
+                    v_job.m_enqueued = m_enqueued;
+                    v_job.m_exec = m_exec;
+                    v_job.m_cleanup = m_cleanup;
+                    v_job.m_data = m_first_data + a_index * m_data_stride;
+                    return v_job;
+                }
+            };
 
-                    while (m_tc_running < m_tc_target) start_thread(v_lock);
+            /** The queue for scheduling_mode::shared_queue, a binary heap. Equal priorities start in no particular order.
+             */
+            class heap_job_queue
+            {
+                std::vector< submitted_job > m_heap;
+
+              public:
+                bool empty() const noexcept
+                {
+                    return m_heap.empty();
                 }
 
-                ~priority_dispatcher_impl()
+                std::size_t size() const noexcept
                 {
-                    std::unique_lock sc_lock(m_mtx);
-                    scoped_increment_with_lock sc_incr(m_waiting_thread_abort, sc_lock);
+                    return m_heap.size();
+                }
 
-                    m_tc_target = 0;
+                void push(submitted_job const& a_job)
+                {
+                    m_heap.push_back(a_job);
+                    std::push_heap(m_heap.begin(), m_heap.end(), submitted_job_comp());
+                }
 
-                    static_assert(noexcept(m_cond.notify_all()));
-                    m_cond.notify_all();
+                /** Pushes every job of a_batch, or none if this throws. */
+                void push(job_batch const& a_batch)
+                {
+                    m_heap.reserve(m_heap.size() + a_batch.m_count);
+                    for (std::size_t i = 0; i < a_batch.m_count; i++)
+                    {
+                        push(a_batch[i]);
+                    }
+                }
 
-                    // static_assert doesn't work here, but this behavior is guaranteed noexcept by the C++ standard.
-                    // (unless assert failure throws an exception, but we don't talk about that)
-                    m_cond.wait(sc_lock, [&] {
-                        RPNX_ASSERT(m_tc_target == 0);
-                        return m_tc_running == 0;
-                    });
+                submitted_job pop() noexcept
+                {
+                    std::pop_heap(m_heap.begin(), m_heap.end(), submitted_job_comp());
+                    submitted_job v_job = m_heap.back();
+                    m_heap.pop_back();
+                    return v_job;
+                }
 
-                    for (auto& x : m_thread_objects)
+                void count_by_priority(std::map< std::int64_t, std::size_t >& a_counts) const
+                {
+                    for (submitted_job const& v_job : m_heap)
                     {
-                        x.second.join();
+                        a_counts[v_job.m_priority]++;
                     }
-
-                    return;
                 }
+            };
 
-                std::mutex m_mtx;
-                std::condition_variable m_cond;
-                std::priority_queue< submitted_job, std::deque< submitted_job >, submitted_job_comp > m_queue;
-                std::map<std::size_t, std::thread> m_thread_objects;
-                std::deque<std::size_t> m_joinable_threads;
-                std::deque<std::size_t> m_reusable_ids;
-                std::size_t m_thread_min_id = 0;
-                std::size_t m_async_executions = 0;
-                std::size_t m_waiting_completion_routines = 0;
-                std::size_t m_waiting_thread_abort = 0;
-                std::size_t m_tc_running = 0;
-                std::size_t m_tc_target = 0;
+            /** The queue for scheduling_mode::banded: a FIFO queue per priority band, and a bitmap of the non-empty
+             * bands so that both push and pop are O(1).
+             */
+            class banded_job_queue
+            {
+                std::vector< std::deque< submitted_job > > m_bands;
+                std::uint64_t m_non_empty = 0;
+                std::size_t m_size = 0;
 
-                std::size_t alloc_thread_id(std::unique_lock<std::mutex> &)
-                {
+              public:
+                static constexpr std::size_t max_band_count = 64;
 
-                    if (m_reusable_ids.empty())
+                explicit banded_job_queue(std::size_t a_band_count)
+                {
+                    if (a_band_count == 0 || a_band_count > max_band_count)
                     {
-                        if (m_thread_min_id == std::numeric_limits<std::size_t>::max())
-                        {
-                            // If this ever gets called, are you F***-ing nuts?
-                            // This can only happen if you allocate std::numeric_limits<std::size_t>::max()/2 threads simultaneously.
-                            // Not possible today, but who knows what future processors might be able to do?
-                            // In any case, we can't handle this condition.
-                            std::terminate();
-                        }
-
-                        return m_thread_min_id++;
+                        throw std::invalid_argument("priority_dispatcher: band count must be between 1 and 64");
                     }
-
-                    auto id = m_reusable_ids.back();
-                    m_reusable_ids.pop_back();
-                    return id;
+                    m_bands.resize(a_band_count);
                 }
 
-                void start_thread(std::unique_lock<std::mutex> & lock)
+                bool empty() const noexcept
                 {
-                    auto thread_id = alloc_thread_id(lock);
+                    return m_size == 0;
+                }
 
-                    m_thread_objects[thread_id] = std::thread([this, thread_id]{ service_thread(thread_id); });
-                    m_tc_running++;
+                std::size_t size() const noexcept
+                {
+                    return m_size;
                 }
 
-                void join_stopped_threads(std::unique_lock<std::mutex> & sc_lock)
+                std::size_t band(std::int64_t a_priority) const noexcept
                 {
-                    while(!m_joinable_threads.empty())
-                    {
+                    return std::size_t(std::clamp< std::int64_t >(a_priority, 0, std::int64_t(m_bands.size() - 1)));
+                }
 
-                        auto th_id = m_joinable_threads.back();
-                        m_joinable_threads.pop_back();
+                void push(submitted_job const& a_job)
+                {
+                    std::size_t v_band = band(a_job.m_priority);
+                    m_bands[v_band].push_back(a_job);
+                    m_non_empty |= std::uint64_t(1) << v_band;
+                    m_size++;
+                }
 
+                /** Pushes every job of a_batch, or none if this throws. */
+                void push(job_batch const& a_batch)
+                {
+                    std::deque< submitted_job >& v_queue = m_bands[band(a_batch.m_priority)];
+                    std::size_t v_pushed = 0;
+                    try
+                    {
+                        for (; v_pushed < a_batch.m_count; v_pushed++)
                         {
-                            std::thread& th = m_thread_objects[th_id];
-                            RPNX_ASSERT(th.joinable());
-                            th.join();
+                            v_queue.push_back(a_batch[v_pushed]);
                         }
-
-                        m_thread_objects.erase(th_id);
-
-                        if (th_id > std::numeric_limits<std::size_t>::max()/ 2)
+                    }
+                    catch (...)
+                    {
+                        while (v_pushed-- != 0)
                         {
-                            // to avoid the unlikely scenario of duplicating an in-use thread ID,
-                            // there is some limit after which we can begin to recycle thread IDs.
-
-                            m_reusable_ids.push_back(th_id);
+                            v_queue.pop_back();
                         }
+                        throw;
                     }
+                    m_non_empty |= std::uint64_t(1) << band(a_batch.m_priority);
+                    m_size += a_batch.m_count;
                 }
 
-
-                void finish_all()
+                submitted_job pop() noexcept
                 {
-                    std::unique_lock< std::mutex > v_lock(m_mtx);
-                    scoped_increment sc_incr(m_waiting_completion_routines);
-                    m_cond.wait(v_lock, [&]{
-                        return m_async_executions == 0 && m_queue.empty();
-                    });
+                    RPNX_ASSERT(m_non_empty != 0);
+                    std::size_t v_band = 63 - std::size_t(countl_zero(m_non_empty));
+                    std::deque< submitted_job >& v_queue = m_bands[v_band];
+                    submitted_job v_job = v_queue.front();
+                    v_queue.pop_front();
+                    if (v_queue.empty())
+                    {
+                        m_non_empty &= ~(std::uint64_t(1) << v_band);
+                    }
+                    m_size--;
+                    return v_job;
                 }
 
-                void service_thread(std::size_t thread_id)
+                /** Counts jobs by band rather than by the priority they were submitted with. */
+                void count_by_priority(std::map< std::int64_t, std::size_t >& a_counts) const
                 {
-                    while (true)
+                    for (std::size_t v_band = 0; v_band < m_bands.size(); v_band++)
                     {
-                        std::unique_lock< std::mutex > v_lock(m_mtx);
-
-                        m_cond.wait(v_lock, [&] {
-                            return m_tc_running > m_tc_target || !m_queue.empty();
-                        });
-
-                        if (m_tc_running > m_tc_target)
+                        if (!m_bands[v_band].empty())
                         {
-                            m_tc_running--;
-
-                            // we cant join ourselves, so let the struct know we are disposable now
-                            m_joinable_threads.push_back(thread_id);
-
-                            if (m_waiting_thread_abort)
-                            {
-                                m_cond.notify_all();
-                            }
-
-                            return;
+                            a_counts[std::int64_t(v_band)] += m_bands[v_band].size();
                         }
+                    }
+                }
+            };
 
+            /** Runs a job followed by its cleanup, reporting whether it threw. Returns false if it did, after passing
+             * the exception to a_handler if there is one.
+             */
+            bool execute_job(submitted_job& a_job, std::function< void(std::exception_ptr) > const& a_handler) noexcept
+            {
+                try
+                {
+                    a_job.m_exec(a_job.data());
 
-                        if (!m_queue.empty())
+                    static_assert(noexcept(a_job.finish(priority_dispatcher::completion_state::completed)));
+                    a_job.finish(priority_dispatcher::completion_state::completed);
+                    return true;
+                }
+                catch (...)
+                {
+                    if (a_handler)
+                    {
+                        try
                         {
-                            auto item = m_queue.top();
-                            m_queue.pop();
-
-                            {
-                                scoped_increment_with_lock scope_incr(m_async_executions, v_lock);
-                                // using this class because there is a (very small) chance an exception might be thrown by .lock() which
-                                // would cause a race condition with scoped_increment
-                                // Note: scoped_incrment_with_lock will call std::terminate in the failure case.
-
-                                v_lock.unlock();
-                                // The mutex is released in order to allow new items to be submitted to the queue while we are busy executing the function.
-
-                                try
-                                {
-                                    item.m_exec(item.m_data);
+                            a_handler(std::current_exception());
+                        }
+                        catch (...)
+                        {
+                            // The handler has nowhere to report its own failure.
+                        }
+                    }
+                    a_job.finish(priority_dispatcher::completion_state::completed_with_exception);
+                    return false;
+                }
+            }
 
-                                    static_assert(noexcept(item.m_cleanup(item.m_data, priority_dispatcher::completion_state::completed)));
-                                    item.m_cleanup(item.m_data, priority_dispatcher::completion_state::completed);
-                                }
-                                catch (...)
-                                {
-                                    // TODO: Exception handler
-                                    // if (exception_handler)
-                                    item.m_cleanup(item.m_data, priority_dispatcher::completion_state::completed_with_exception);
-                                }
+            /** A cheap timestamp for statistics: the time stamp counter where there is one, otherwise steady_clock
+             * nanoseconds. Converted to nanoseconds only when statistics are read.
+             */
+            std::uint64_t stat_ticks() noexcept
+            {
+#if defined(RPNX_CPU_IS_X64) || defined(RPNX_CPU_IS_X86)
+                return __rdtsc();
+#else
+                return std::uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+            }
+
+            /** The statistics of one service thread. Only the thread holding it writes to it, with relaxed loads and
+             * stores rather than read-modify-writes, and priority_dispatcher::stats() adds them all up. It keeps its
+             * counts when the thread stops, for the next thread to continue.
+             */
+            struct alignas(64) thread_stats
+            {
+                using histogram = std::array< std::atomic< std::uint64_t >, priority_dispatcher::latency_histogram::bucket_count >;
+
+                histogram m_wait{};
+                histogram m_run{};
+                std::atomic< std::uint64_t > m_wait_ticks{0};
+                std::atomic< std::uint64_t > m_run_ticks{0};
+                std::atomic< std::uint64_t > m_exceptions{0};
+                std::atomic< std::uint64_t > m_steals{0};
+                std::atomic< std::uint64_t > m_parks{0};
+                // Of the threads that held this before and stopped.
+                std::atomic< std::uint64_t > m_alive_ticks{0};
+                // When the current holder started, 0 if there is none.
+                std::atomic< std::uint64_t > m_started{0};
+
+                static void add(std::atomic< std::uint64_t >& a_counter, std::uint64_t a_amount = 1) noexcept
+                {
+                    a_counter.store(a_counter.load(std::memory_order_relaxed) + a_amount, std::memory_order_relaxed);
+                }
 
-                                v_lock.lock();
-                            }
+                static std::size_t bucket(std::uint64_t a_ticks) noexcept
+                {
+                    constexpr std::size_t v_bits = priority_dispatcher::latency_histogram::sub_bucket_bits;
+                    constexpr std::uint64_t v_sub_buckets = std::uint64_t(1) << v_bits;
+                    if (a_ticks < v_sub_buckets)
+                    {
+                        return std::size_t(a_ticks);
+                    }
+                    std::size_t v_log = std::size_t(63 - countl_zero(a_ticks));
+                    std::size_t v_index = (v_log - v_bits + 1) * v_sub_buckets + std::size_t((a_ticks >> (v_log - v_bits)) & (v_sub_buckets - 1));
+                    return std::min(v_index, priority_dispatcher::latency_histogram::bucket_count - 1);
+                }
 
-                            // We re-lock the mutex and check if there are cancellors that need to be notified of the queue being emptied by us.
+                /** Records a job queued at a_enqueued that ran from a_start to a_end. */
+                void record(std::uint64_t a_enqueued, std::uint64_t a_start, std::uint64_t a_end, bool a_completed) noexcept
+                {
+                    std::uint64_t v_wait = a_start > a_enqueued ? a_start - a_enqueued : 0;
+                    std::uint64_t v_run = a_end > a_start ? a_end - a_start : 0;
+                    add(m_wait[bucket(v_wait)]);
+                    add(m_wait_ticks, v_wait);
+                    add(m_run[bucket(v_run)]);
+                    add(m_run_ticks, v_run);
+                    if (!a_completed)
+                    {
+                        add(m_exceptions);
+                    }
+                }
+            };
 
-                            if (m_async_executions==0 && m_waiting_completion_routines != 0)
-                            {
-                                m_cond.notify_all();
-                            }
+#if defined(__linux__)
+            /** Parses a kernel CPU or node list such as "0-3,8,10-11". */
+            std::vector< std::size_t > parse_id_list(std::string const& a_list)
+            {
+                std::vector< std::size_t > v_ids;
+                std::size_t v_pos = 0;
+                while (v_pos < a_list.size())
+                {
+                    std::size_t v_end = std::min(a_list.find(',', v_pos), a_list.size());
+                    std::string v_range = a_list.substr(v_pos, v_end - v_pos);
+                    std::size_t v_dash = v_range.find('-');
+                    try
+                    {
+                        std::size_t v_first = std::stoul(v_range.substr(0, v_dash));
+                        std::size_t v_last = v_dash == std::string::npos ? v_first : std::stoul(v_range.substr(v_dash + 1));
+                        for (std::size_t v_id = v_first; v_id <= v_last; v_id++)
+                        {
+                            v_ids.push_back(v_id);
                         }
                     }
-
+                    catch (std::logic_error const&)
+                    {
+                        // An empty list, or one we don't understand.
+                    }
+                    v_pos = v_end + 1;
                 }
+                return v_ids;
+            }
+
+            std::vector< std::size_t > read_id_list(std::string const& a_path)
+            {
+                std::ifstream v_file(a_path);
+                std::string v_line;
+                std::getline(v_file, v_line);
+                return parse_id_list(v_line);
+            }
+
+            /** A dynamically sized cpu_set_t, for machines with more than CPU_SETSIZE CPUs. */
+            class cpu_set
+            {
+                std::size_t m_count;
+                cpu_set_t* m_set;
 
-                void submit(void (*a_exec)(void*), void (*a_cleanup)(void*, priority_dispatcher::completion_state) noexcept,
-                            void* a_data, std::int64_t a_priority)
+              public:
+                explicit cpu_set(std::size_t a_count)
+                    : m_count(a_count), m_set(CPU_ALLOC(a_count))
                 {
-                    std::unique_lock lock(m_mtx);
+                    if (m_set == nullptr)
+                    {
+                        throw std::bad_alloc();
+                    }
+                    CPU_ZERO_S(size(), m_set);
+                }
 
-                    RPNX_ASSERT(m_waiting_completion_routines == 0);
-                    // Race condition
-                    // Use cancel_all_quick if there could be operations submitted at the same time.
+                cpu_set(cpu_set const&) = delete;
+                cpu_set& operator=(cpu_set const&) = delete;
 
-                    submitted_job v_job;
+                ~cpu_set()
+                {
+                    CPU_FREE(m_set);
+                }
 
-                    v_job.m_priority = a_priority;
-                    v_job.m_exec = a_exec;
-                    v_job.m_cleanup = a_cleanup;
-                    v_job.m_data = a_data;
+                std::size_t size() const noexcept
+                {
+                    return CPU_ALLOC_SIZE(m_count);
+                }
 
-                    m_queue.push(v_job);
+                cpu_set_t* get() noexcept
+                {
+                    return m_set;
+                }
 
-                    static_assert(noexcept(m_cond.notify_all()));
-                    // If cond could throw exceptions, the caller wouldn't know if they needed to run the cleanup function or not
+                void set(std::size_t a_cpu) noexcept
+                {
+                    CPU_SET_S(a_cpu, size(), m_set);
+                }
 
-                    m_cond.notify_all();
+                bool is_set(std::size_t a_cpu) const noexcept
+                {
+                    return CPU_ISSET_S(a_cpu, size(), m_set);
                 }
+            };
+#endif
+
+            /** The CPUs this process may run on, grouped by NUMA node. Read once, when first needed.
+             */
+            struct cpu_topology
+            {
+                // By node number, the usable CPUs of that node in increasing order. Empty for nodes without any.
+                std::vector< std::vector< std::size_t > > m_node_cpus;
+                // By CPU number, its node, or priority_dispatcher::any_node for CPUs we may not run on.
+                std::vector< std::size_t > m_cpu_node;
+                std::size_t m_cpu_count = 0;
 
-                void cancel_all_quick()
+                static cpu_topology const& get()
                 {
-                    std::unique_lock lock(m_mtx);
+                    static cpu_topology const s_topology = read();
+                    return s_topology;
+                }
 
-                    RPNX_ASSERT(m_waiting_completion_routines == 0);
+                bool usable(std::size_t a_cpu) const noexcept
+                {
+                    return a_cpu < m_cpu_node.size() && m_cpu_node[a_cpu] != priority_dispatcher::any_node;
+                }
 
-                    while (!m_queue.empty())
+              private:
+                static std::vector< std::size_t > usable_cpus()
+                {
+                    std::vector< std::size_t > v_cpus;
+#if defined(__linux__)
+                    for (std::size_t v_count = 1024; v_count <= (std::size_t(1) << 20); v_count *= 2)
                     {
-                        m_queue.top().m_cleanup(m_queue.top().m_data, priority_dispatcher::completion_state::cancelled);
-                        m_queue.pop();
+                        cpu_set v_set(v_count);
+                        if (sched_getaffinity(0, v_set.size(), v_set.get()) == 0)
+                        {
+                            for (std::size_t v_cpu = 0; v_cpu < v_count; v_cpu++)
+                            {
+                                if (v_set.is_set(v_cpu))
+                                {
+                                    v_cpus.push_back(v_cpu);
+                                }
+                            }
+                            break;
+                        }
+                        if (errno != EINVAL)
+                        {
+                            break;
+                        }
                     }
-
-                    // Technically this would be a race condition, but unsure if there is performance gain by avoiding it.
-                    if (m_async_executions==0  && m_waiting_completion_routines != 0)
+#endif
+                    if (v_cpus.empty())
                     {
-                        m_cond.notify_all();
+                        for (std::size_t v_cpu = 0; v_cpu < std::max< std::size_t >(std::thread::hardware_concurrency(), 1); v_cpu++)
+                        {
+                            v_cpus.push_back(v_cpu);
+                        }
                     }
+                    return v_cpus;
                 }
 
-                void set_service_thread_count(std::size_t ct)
+                static cpu_topology read()
                 {
-                    std::unique_lock sc_lock(m_mtx);
-
-                    // If we call this over and over with different args it could cause a memory leak because we don't wait for threads to actually
-                    // finish when we reduce the thread count, so clean up any immediately joinable threads now
-                    join_stopped_threads(sc_lock);
+                    cpu_topology v_topology;
+                    std::vector< std::size_t > v_cpus = usable_cpus();
+                    v_topology.m_cpu_count = v_cpus.size();
+                    v_topology.m_cpu_node.assign(v_cpus.back() + 1, priority_dispatcher::any_node);
+                    for (std::size_t v_cpu : v_cpus)
+                    {
+                        v_topology.m_cpu_node[v_cpu] = 0;
+                    }
+                    v_topology.m_node_cpus.resize(1);
 
-                    m_tc_target = ct;
+#if defined(__linux__)
+                    for (std::size_t v_node : read_id_list("/sys/devices/system/node/possible"))
+                    {
+                        for (std::size_t v_cpu : read_id_list("/sys/devices/system/node/node" + std::to_string(v_node) + "/cpulist"))
+                        {
+                            if (v_topology.usable(v_cpu))
+                            {
+                                v_topology.m_cpu_node[v_cpu] = v_node;
+                            }
+                        }
+                        v_topology.m_node_cpus.resize(std::max(v_topology.m_node_cpus.size(), v_node + 1));
+                    }
+#endif
 
-                    if (m_tc_running > m_tc_target)
+                    // CPUs sysfs did not place stay on node 0.
+                    for (std::size_t v_cpu : v_cpus)
                     {
-                        m_cond.notify_all();
-                        return;
-                        // the threads will stop by themselves later
-                        // We should wake them up though so they can quit
+                        v_topology.m_node_cpus[v_topology.m_cpu_node[v_cpu]].push_back(v_cpu);
                     }
+                    return v_topology;
+                }
+            };
 
-                    else while (m_tc_running < m_tc_target)
+            /** Where a dispatcher's service threads run, from options::m_affinity and options::m_cpus. Service
+             * threads are numbered from 0 and placed by number, so a thread that replaces a stopped one takes its
+             * place.
+             */
+            class worker_placement
+            {
+                priority_dispatcher::affinity_policy m_policy;
+                bool m_restricted;
+                // The CPUs threads may use, node by node, and the nodes that have any.
+                std::vector< std::size_t > m_cpus;
+                std::vector< std::size_t > m_nodes;
+
+              public:
+                explicit worker_placement(priority_dispatcher::options const& a_options)
+                    : m_policy(a_options.m_affinity), m_restricted(!a_options.m_cpus.empty())
+                {
+                    cpu_topology const& v_topology = cpu_topology::get();
+                    for (std::size_t v_cpu : a_options.m_cpus)
                     {
-                        start_thread(sc_lock);
+                        if (!v_topology.usable(v_cpu))
+                        {
+                            throw std::invalid_argument("priority_dispatcher: options::m_cpus names a CPU this process may not run on");
+                        }
                     }
 
+                    for (std::size_t v_node = 0; v_node < v_topology.m_node_cpus.size(); v_node++)
+                    {
+                        std::size_t v_before = m_cpus.size();
+                        for (std::size_t v_cpu : v_topology.m_node_cpus[v_node])
+                        {
+                            if (!m_restricted || std::find(a_options.m_cpus.begin(), a_options.m_cpus.end(), v_cpu) != a_options.m_cpus.end())
+                            {
+                                m_cpus.push_back(v_cpu);
+                            }
+                        }
+                        if (m_cpus.size() != v_before)
+                        {
+                            m_nodes.push_back(v_node);
+                        }
+                    }
+                }
 
+                std::size_t default_thread_count() const noexcept
+                {
+                    return m_cpus.size();
+                }
 
+                /** The NUMA node of service thread a_index, or any_node if it is not tied to one. */
+                std::size_t node_of(std::size_t a_index) const noexcept
+                {
+                    switch (m_policy)
+                    {
+                    case priority_dispatcher::affinity_policy::per_core:
+                        return cpu_topology::get().m_cpu_node[m_cpus[a_index % m_cpus.size()]];
+                    case priority_dispatcher::affinity_policy::per_node:
+                        return m_nodes[a_index % m_nodes.size()];
+                    default:
+                        return m_nodes.size() == 1 ? m_nodes.front() : priority_dispatcher::any_node;
+                    }
                 }
 
-                void cancel_all()
+                /** Called by service thread a_index as it starts. */
+                void pin(std::size_t a_index) const noexcept
+                {
+#if defined(__linux__)
+                    if (m_policy == priority_dispatcher::affinity_policy::none && !m_restricted)
+                    {
+                        return;
+                    }
+                    try
+                    {
+                        cpu_set v_set(cpu_topology::get().m_cpu_node.size());
+                        std::size_t v_node = node_of(a_index);
+                        for (std::size_t v_cpu : m_cpus)
+                        {
+                            if (m_policy == priority_dispatcher::affinity_policy::per_core ? v_cpu == m_cpus[a_index % m_cpus.size()]
+                                                                                          : v_node == priority_dispatcher::any_node || cpu_topology::get().m_cpu_node[v_cpu] == v_node)
+                            {
+                                v_set.set(v_cpu);
+                            }
+                        }
+                        // Best effort: the thread stays where it is if this fails.
+                        sched_setaffinity(0, v_set.size(), v_set.get());
+                    }
+                    catch (std::bad_alloc const&)
+                    {
+                    }
+#else
+                    (void)a_index;
+#endif
+                }
+            };
+
+            /** How many times an idle service thread polls for work before parking. Spinning only helps when a
+             * submitter can run at the same time, so on a single core service threads park straight away.
+             */
+            int idle_spin_limit()
+            {
+                return cpu_topology::get().m_cpu_count > 1 ? 64 : 0;
+            }
+
+            /** A hierarchical timing wheel over 64 bit ticks: 11 levels of 64 slots. A timer sits in the level of the
+             * highest 6 bit group in which its tick differs from the current tick, in the slot given by its own bits
+             * in that group, and is moved down (cascaded) when the current tick reaches the start of that slot.
+             * Insertion is O(1). Advancing visits only ticks where a slot expires or cascades, found through a
+             * bitmap of occupied slots per level, so idle stretches cost nothing.
+             */
+            class timer_wheel
+            {
+              public:
+                struct timer
+                {
+                    submitted_job m_job;
+                    std::uint64_t m_tick;
+                    timer* m_next;
+                };
+
+                static constexpr std::uint64_t no_tick = std::numeric_limits< std::uint64_t >::max();
+
+                /** Adds a_timer, or returns false without adding it if its tick has already been reached. */
+                bool insert(timer* a_timer) noexcept
+                {
+                    if (a_timer->m_tick <= m_now)
+                    {
+                        return false;
+                    }
+                    std::size_t v_level = std::size_t(63 - countl_zero(std::uint64_t(a_timer->m_tick ^ m_now))) / level_bits;
+                    std::size_t v_slot = std::size_t(a_timer->m_tick >> (v_level * level_bits)) & (slot_count - 1);
+                    a_timer->m_next = m_slots[v_level][v_slot];
+                    m_slots[v_level][v_slot] = a_timer;
+                    m_occupied[v_level] |= std::uint64_t(1) << v_slot;
+                    return true;
+                }
+
+                /** The next tick at which a slot expires or cascades, or no_tick if the wheel is empty. */
+                std::uint64_t next_tick() const noexcept
+                {
+                    for (std::size_t v_level = 0; v_level < level_count; v_level++)
+                    {
+                        std::uint64_t v_bits = m_occupied[v_level];
+                        if (v_bits == 0)
+                        {
+                            continue;
+                        }
+                        // Every occupied slot lies after the current one, and lower levels always come first.
+                        std::uint64_t v_slot = std::uint64_t(63 - countl_zero(std::uint64_t(v_bits & (~v_bits + 1))));
+                        std::size_t v_shift = (v_level + 1) * level_bits;
+                        std::uint64_t v_base = v_shift >= 64 ? 0 : (m_now >> v_shift) << v_shift;
+                        return v_base | (v_slot << (v_level * level_bits));
+                    }
+                    return no_tick;
+                }
+
+                /** Moves the current tick to a_tick and returns the timers that became due, linked through m_next. */
+                timer* advance(std::uint64_t a_tick) noexcept
+                {
+                    timer* v_due = nullptr;
+                    while (true)
+                    {
+                        std::uint64_t v_next = next_tick();
+                        if (v_next > a_tick)
+                        {
+                            m_now = std::max(m_now, a_tick);
+                            return v_due;
+                        }
+                        m_now = v_next;
+
+                        for (std::size_t v_level = level_count; v_level-- > 1;)
+                        {
+                            std::size_t v_shift = v_level * level_bits;
+                            if ((m_now & ((std::uint64_t(1) << v_shift) - 1)) != 0)
+                            {
+                                continue;
+                            }
+                            timer* v_timer = take_slot(v_level, std::size_t(m_now >> v_shift) & (slot_count - 1));
+                            while (v_timer != nullptr)
+                            {
+                                timer* v_next_timer = v_timer->m_next;
+                                if (!insert(v_timer))
+                                {
+                                    v_timer->m_next = v_due;
+                                    v_due = v_timer;
+                                }
+                                v_timer = v_next_timer;
+                            }
+                        }
+
+                        timer* v_timer = take_slot(0, std::size_t(m_now) & (slot_count - 1));
+                        while (v_timer != nullptr)
+                        {
+                            timer* v_next_timer = v_timer->m_next;
+                            v_timer->m_next = v_due;
+                            v_due = v_timer;
+                            v_timer = v_next_timer;
+                        }
+                    }
+                }
+
+                /** Removes and returns every timer, linked through m_next. */
+                timer* take_all() noexcept
+                {
+                    timer* v_all = nullptr;
+                    for (std::size_t v_level = 0; v_level < level_count; v_level++)
+                    {
+                        while (m_occupied[v_level] != 0)
+                        {
+                            std::size_t v_slot = std::size_t(63 - countl_zero(m_occupied[v_level]));
+                            timer* v_timer = take_slot(v_level, v_slot);
+                            while (v_timer != nullptr)
+                            {
+                                timer* v_next_timer = v_timer->m_next;
+                                v_timer->m_next = v_all;
+                                v_all = v_timer;
+                                v_timer = v_next_timer;
+                            }
+                        }
+                    }
+                    return v_all;
+                }
+
+              private:
+                static constexpr std::size_t level_bits = 6;
+                static constexpr std::size_t slot_count = std::size_t(1) << level_bits;
+                static constexpr std::size_t level_count = (64 + level_bits - 1) / level_bits;
+
+                timer* take_slot(std::size_t a_level, std::size_t a_slot) noexcept
+                {
+                    timer* v_timer = m_slots[a_level][a_slot];
+                    m_slots[a_level][a_slot] = nullptr;
+                    m_occupied[a_level] &= ~(std::uint64_t(1) << a_slot);
+                    return v_timer;
+                }
+
+                std::array< std::array< timer*, slot_count >, level_count > m_slots{};
+                std::array< std::uint64_t, level_count > m_occupied{};
+                std::uint64_t m_now = 0;
+            };
+
+            /** The interface every scheduling mode implements; see priority_dispatcher for the contracts.
+             * Delayed jobs are kept here in a timer_wheel. There is no timer thread: one idle service thread at a time
+             * keeps the timers by parking only until the earliest deadline, and busy service threads call
+             * poll_timers between jobs. Service threads pin themselves as m_placement says when they start.
+             */
+            struct dispatcher_impl
+            {
+                using clock = std::chrono::steady_clock;
+
+                static constexpr clock::duration timer_resolution = std::chrono::milliseconds(1);
+
+                dispatcher_impl(worker_placement a_placement, priority_dispatcher::options const& a_options)
+                    : m_placement(std::move(a_placement)), m_collect_stats(a_options.m_collect_stats), m_exception_handler(a_options.m_exception_handler)
+                {
+                }
+
+                virtual ~dispatcher_impl()
+                {
+                    cancel_timers();
+                }
+
+                virtual void submit(submitted_job const& a_job) = 0;
+                virtual void submit_near(submitted_job const& a_job, std::size_t a_node) = 0;
+                virtual void submit_bulk(job_batch const& a_batch) = 0;
+                virtual void cancel_all() = 0;
+                virtual void cancel_all_quick() = 0;
+                virtual void finish_all() = 0;
+                virtual void set_service_thread_count(std::size_t ct) = 0;
+
+                /** Adds the queued jobs to a_counts by priority. */
+                virtual void count_queued(std::map< std::int64_t, std::size_t >& a_counts) = 0;
+
+                /** Queues a job whose timer expired. Unlike submit, this may run concurrently with finish_all.
+                 */
+                virtual void enqueue(submitted_job const& a_job) = 0;
+
+                /** The earliest deadline moved closer: wake the service thread keeping the timers, or one that can
+                 * start keeping them.
+                 */
+                virtual void timer_rearm() noexcept = 0;
+
+                void submit_at(submitted_job const& a_job, clock::time_point a_when)
+                {
+                    pool_allocator< timer_wheel::timer > v_alloc;
+                    timer_wheel::timer* v_timer = v_alloc.allocate(1);
+                    v_timer->m_job = a_job;
+                    v_timer->m_tick = tick_at(a_when);
+
+                    bool v_rearm = false;
+                    {
+                        std::unique_lock v_lock(m_timer_mtx);
+                        if (m_timers.insert(v_timer))
+                        {
+                            std::uint64_t v_next = m_timers.next_tick();
+                            v_rearm = v_next < m_next_timer_tick.load();
+                            m_next_timer_tick.store(v_next);
+                            v_timer = nullptr;
+                        }
+                    }
+
+                    if (v_timer != nullptr)
+                    {
+                        // Already due.
+                        v_alloc.deallocate(v_timer, 1);
+                        submitted_job v_job = a_job;
+                        stamp(v_job);
+                        submit(v_job);
+                    }
+                    else if (v_rearm)
+                    {
+                        timer_rearm();
+                    }
+                }
+
+                worker_placement const m_placement;
+                bool const m_collect_stats;
+                std::function< void(std::exception_ptr) > const m_exception_handler;
+
+                /** Notes when a job is queued, if statistics are collected. */
+                void stamp(submitted_job& a_job) const noexcept
+                {
+                    if (m_collect_stats)
+                    {
+                        a_job.m_enqueued = stat_ticks();
+                    }
+                }
+
+                /** Holds a thread_stats for the lifetime of a service thread, or nothing if statistics are not
+                 * collected.
+                 */
+                class stats_holder
+                {
+                    dispatcher_impl& m_owner;
+                    thread_stats* m_stats = nullptr;
+
+                  public:
+                    explicit stats_holder(dispatcher_impl& a_owner) noexcept
+                        : m_owner(a_owner)
+                    {
+                        if (!m_owner.m_collect_stats)
+                        {
+                            return;
+                        }
+                        std::unique_lock v_lock(m_owner.m_stats_mtx);
+                        try
+                        {
+                            if (m_owner.m_idle_stats.empty())
+                            {
+                                m_owner.m_idle_stats.reserve(m_owner.m_stats.size() + 1);
+                                m_owner.m_stats.push_back(std::make_unique< thread_stats >());
+                                m_owner.m_idle_stats.push_back(m_owner.m_stats.back().get());
+                            }
+                        }
+                        catch (...)
+                        {
+                            // Out of memory, this thread goes uncounted.
+                            return;
+                        }
+                        m_stats = m_owner.m_idle_stats.back();
+                        m_owner.m_idle_stats.pop_back();
+                        m_stats->m_started.store(std::max< std::uint64_t >(stat_ticks(), 1), std::memory_order_relaxed);
+                    }
+
+                    stats_holder(stats_holder const&) = delete;
+                    stats_holder& operator=(stats_holder const&) = delete;
+
+                    ~stats_holder()
+                    {
+                        if (m_stats == nullptr)
+                        {
+                            return;
+                        }
+                        std::unique_lock v_lock(m_owner.m_stats_mtx);
+                        thread_stats::add(m_stats->m_alive_ticks, stat_ticks() - m_stats->m_started.load(std::memory_order_relaxed));
+                        m_stats->m_started.store(0, std::memory_order_relaxed);
+                        // Reserved when m_stats was created.
+                        m_owner.m_idle_stats.push_back(m_stats);
+                    }
+
+                    thread_stats* get() const noexcept
+                    {
+                        return m_stats;
+                    }
+                };
+
+                priority_dispatcher::statistics stats()
+                {
+                    priority_dispatcher::statistics v_result;
+                    std::map< std::int64_t, std::size_t > v_counts;
+                    count_queued(v_counts);
+                    v_result.m_queue_depth.assign(v_counts.rbegin(), v_counts.rend());
+                    if (!m_collect_stats)
+                    {
+                        return v_result;
+                    }
+
+#if defined(RPNX_CPU_IS_X64) || defined(RPNX_CPU_IS_X86)
+                    // Time stamp counter ticks per nanosecond, over the lifetime of the dispatcher so far.
+                    while (clock::now() - m_stats_epoch < std::chrono::milliseconds(1))
+                    {
+                        std::this_thread::yield();
+                    }
+                    std::uint64_t v_ticks = stat_ticks();
+                    clock::duration v_elapsed = clock::now() - m_stats_epoch;
+                    double v_ns_per_tick = double(std::chrono::duration_cast< std::chrono::nanoseconds >(v_elapsed).count()) / double(v_ticks - m_stats_epoch_ticks);
+#else
+                    std::uint64_t v_ticks = stat_ticks();
+                    double v_ns_per_tick = 1;
+#endif
+                    v_result.m_wait.m_ns_per_tick = v_ns_per_tick;
+                    v_result.m_run.m_ns_per_tick = v_ns_per_tick;
+
+                    std::uint64_t v_alive = 0;
+                    std::unique_lock v_lock(m_stats_mtx);
+                    for (auto const& v_stats : m_stats)
+                    {
+                        for (std::size_t i = 0; i < priority_dispatcher::latency_histogram::bucket_count; i++)
+                        {
+                            v_result.m_wait.m_counts[i] += v_stats->m_wait[i].load(std::memory_order_relaxed);
+                            v_result.m_run.m_counts[i] += v_stats->m_run[i].load(std::memory_order_relaxed);
+                        }
+                        v_result.m_wait.m_total_ticks += v_stats->m_wait_ticks.load(std::memory_order_relaxed);
+                        v_result.m_run.m_total_ticks += v_stats->m_run_ticks.load(std::memory_order_relaxed);
+                        v_result.m_exceptions += v_stats->m_exceptions.load(std::memory_order_relaxed);
+                        v_result.m_steals += v_stats->m_steals.load(std::memory_order_relaxed);
+                        v_result.m_parks += v_stats->m_parks.load(std::memory_order_relaxed);
+                        v_alive += v_stats->m_alive_ticks.load(std::memory_order_relaxed);
+                        std::uint64_t v_started = v_stats->m_started.load(std::memory_order_relaxed);
+                        if (v_started != 0 && v_ticks > v_started)
+                        {
+                            v_alive += v_ticks - v_started;
+                        }
+                    }
+                    v_result.m_busy = std::chrono::nanoseconds(std::int64_t(double(v_result.m_run.m_total_ticks) * v_ns_per_tick));
+                    v_result.m_alive = std::chrono::nanoseconds(std::int64_t(double(v_alive) * v_ns_per_tick));
+                    return v_result;
+                }
+
+                bool has_timers() const noexcept
+                {
+                    return m_next_timer_tick.load(std::memory_order_relaxed) != timer_wheel::no_tick;
+                }
+
+                /** When the timer keeper should wake up. Capped so that a far deadline never overflows the clock. */
+                clock::time_point next_timer_deadline() const noexcept
+                {
+                    std::uint64_t v_tick = m_next_timer_tick.load();
+                    clock::time_point v_cap = clock::now() + std::chrono::hours(1);
+                    if (v_tick >= std::uint64_t((v_cap - m_timer_epoch) / timer_resolution))
+                    {
+                        return v_cap;
+                    }
+                    return m_timer_epoch + timer_resolution * std::int64_t(v_tick);
+                }
+
+                /** Queues every job whose deadline has passed. */
+                void poll_timers() noexcept
+                {
+                    if (!has_timers())
+                    {
+                        return;
+                    }
+                    std::uint64_t v_now = std::uint64_t((clock::now() - m_timer_epoch) / timer_resolution);
+                    if (v_now < m_next_timer_tick.load())
+                    {
+                        return;
+                    }
+
+                    timer_wheel::timer* v_due;
+                    {
+                        std::unique_lock v_lock(m_timer_mtx);
+                        v_due = m_timers.advance(v_now);
+                        m_next_timer_tick.store(m_timers.next_tick());
+                    }
+
+                    pool_allocator< timer_wheel::timer > v_alloc;
+                    while (v_due != nullptr)
+                    {
+                        timer_wheel::timer* v_next = v_due->m_next;
+                        try
+                        {
+                            stamp(v_due->m_job);
+                            enqueue(v_due->m_job);
+                        }
+                        catch (...)
+                        {
+                            // Out of memory, there is nowhere to keep the job.
+                            v_due->m_job.finish(priority_dispatcher::completion_state::cancelled);
+                        }
+                        v_alloc.deallocate(v_due, 1);
+                        v_due = v_next;
+                    }
+                }
+
+                void cancel_timers() noexcept
+                {
+                    timer_wheel::timer* v_timer;
+                    {
+                        std::unique_lock v_lock(m_timer_mtx);
+                        v_timer = m_timers.take_all();
+                        m_next_timer_tick.store(timer_wheel::no_tick);
+                    }
+
+                    pool_allocator< timer_wheel::timer > v_alloc;
+                    while (v_timer != nullptr)
+                    {
+                        timer_wheel::timer* v_next = v_timer->m_next;
+                        v_timer->m_job.finish(priority_dispatcher::completion_state::cancelled);
+                        v_alloc.deallocate(v_timer, 1);
+                        v_timer = v_next;
+                    }
+                }
+
+              private:
+                /** The first tick at or after a_when, so that no job runs early. */
+                std::uint64_t tick_at(clock::time_point a_when) const noexcept
+                {
+                    if (a_when <= m_timer_epoch)
+                    {
+                        return 0;
+                    }
+                    clock::duration v_delay = a_when - m_timer_epoch;
+                    std::uint64_t v_tick = std::uint64_t(v_delay / timer_resolution);
+                    return v_delay % timer_resolution == clock::duration::zero() ? v_tick : v_tick + 1;
+                }
+
+                clock::time_point const m_timer_epoch = clock::now();
+                clock::time_point const m_stats_epoch = clock::now();
+                std::uint64_t const m_stats_epoch_ticks = stat_ticks();
+                std::mutex m_stats_mtx;
+                // Every thread_stats ever used, and those no running service thread holds. Guarded by m_stats_mtx.
+                std::vector< std::unique_ptr< thread_stats > > m_stats;
+                std::vector< thread_stats* > m_idle_stats;
+                std::mutex m_timer_mtx;
+                timer_wheel m_timers;
+                // m_timers.next_tick(), readable without m_timer_mtx.
+                std::atomic< std::uint64_t > m_next_timer_tick{timer_wheel::no_tick};
+            };
+
+            /** scheduling_mode::shared_queue and scheduling_mode::banded, which differ only in their Queue.
+             */
+            template < typename Queue >
+            struct priority_dispatcher_impl final : dispatcher_impl
+            {
+                priority_dispatcher_impl(worker_placement a_placement, priority_dispatcher::options const& a_options, std::size_t a_thread_count, Queue a_queue)
+                    : dispatcher_impl(std::move(a_placement), a_options), m_queue(std::move(a_queue))
+                {
+                    std::unique_lock v_lock(m_mtx);
+                    m_tc_target = a_thread_count;
+
+                    while (m_tc_running < m_tc_target) start_thread(v_lock);
+                }
+
+                ~priority_dispatcher_impl() override
                 {
                     std::unique_lock sc_lock(m_mtx);
+                    scoped_increment_with_lock sc_incr(m_waiting_thread_abort, sc_lock);
 
-                    scoped_increment sc_increment(m_waiting_completion_routines);
-                    // We always have the sc_lock
+                    m_tc_target = 0;
+
+                    unpark(m_parked.size());
 
+                    // static_assert doesn't work here, but this behavior is guaranteed noexcept by the C++ standard.
+                    // (unless assert failure throws an exception, but we don't talk about that)
+                    m_done_cond.wait(sc_lock, [&] {
+                        RPNX_ASSERT(m_tc_target == 0);
+                        return m_tc_running == 0;
+                    });
+
+                    for (auto& x : m_thread_objects)
+                    {
+                        x.second.join();
+                    }
+
+                    return;
+                }
+
+                /** An idle service thread waiting to be handed work. Lives on the service thread's stack and is only
+                 * touched under m_mtx.
+                 */
+                struct parked_worker
+                {
+                    std::condition_variable m_cond;
+                    bool m_signalled = false;
+                    std::size_t m_node = priority_dispatcher::any_node;
+                };
+
+                std::mutex m_mtx;
+                // Signalled when the last running job finishes or a service thread exits, for finish_all,
+                // cancel_all and the destructor. Service threads never wait on it.
+                std::condition_variable m_done_cond;
+                Queue m_queue;
+                // m_queue.size(), readable without the mutex by spinning service threads.
+                std::atomic< std::size_t > m_queued{0};
+                // Parked service threads, most recently parked last. Capacity for every service thread is
+                // reserved up front so parking never allocates.
+                std::vector< parked_worker* > m_parked;
+                std::size_t m_spinning = 0;
+                // The parked service thread waiting for the earliest timer, if any. It is also in m_parked.
+                parked_worker* m_timer_keeper = nullptr;
+                int const m_spin_limit = idle_spin_limit();
+                std::map<std::size_t, std::thread> m_thread_objects;
+                std::deque<std::size_t> m_joinable_threads;
+                std::deque<std::size_t> m_reusable_ids;
+                std::size_t m_thread_min_id = 0;
+                std::size_t m_async_executions = 0;
+                std::size_t m_waiting_completion_routines = 0;
+                std::size_t m_waiting_thread_abort = 0;
+                std::size_t m_tc_running = 0;
+                std::size_t m_tc_target = 0;
+
+                std::size_t alloc_thread_id(std::unique_lock<std::mutex> &)
+                {
+
+                    if (m_reusable_ids.empty())
+                    {
+                        if (m_thread_min_id == std::numeric_limits<std::size_t>::max())
+                        {
+                            // If this ever gets called, are you F***-ing nuts?
+                            // This can only happen if you allocate std::numeric_limits<std::size_t>::max()/2 threads simultaneously.
+                            // Not possible today, but who knows what future processors might be able to do?
+                            // In any case, we can't handle this condition.
+                            std::terminate();
+                        }
+
+                        return m_thread_min_id++;
+                    }
+
+                    auto id = m_reusable_ids.back();
+                    m_reusable_ids.pop_back();
+                    return id;
+                }
+
+                void start_thread(std::unique_lock<std::mutex> & lock)
+                {
+                    auto thread_id = alloc_thread_id(lock);
+                    m_parked.reserve(m_tc_running + 1);
+
+                    m_thread_objects[thread_id] = std::thread([this, thread_id]{ service_thread(thread_id); });
+                    m_tc_running++;
+                }
+
+                void join_stopped_threads(std::unique_lock<std::mutex> & sc_lock)
+                {
+                    while(!m_joinable_threads.empty())
+                    {
+
+                        auto th_id = m_joinable_threads.back();
+                        m_joinable_threads.pop_back();
+
+                        {
+                            std::thread& th = m_thread_objects[th_id];
+                            RPNX_ASSERT(th.joinable());
+                            th.join();
+                        }
+
+                        m_thread_objects.erase(th_id);
+
+                        if (th_id > std::numeric_limits<std::size_t>::max()/ 2)
+                        {
+                            // to avoid the unlikely scenario of duplicating an in-use thread ID,
+                            // there is some limit after which we can begin to recycle thread IDs.
+
+                            m_reusable_ids.push_back(th_id);
+                        }
+                    }
+                }
+
+
+                void finish_all() override
+                {
+                    std::unique_lock< std::mutex > v_lock(m_mtx);
+                    scoped_increment sc_incr(m_waiting_completion_routines);
+                    m_done_cond.wait(v_lock, [&]{
+                        return m_async_executions == 0 && m_queue.empty();
+                    });
+                }
+
+                /** Hands new work to one parked service thread, unless a spinning one will find it anyway. That is
+                 * the most recently parked one on a_node if there is one. Called with m_mtx held.
+                 */
+                void wake_one(std::size_t a_node = priority_dispatcher::any_node) noexcept
+                {
+                    if (m_spinning != 0 || m_parked.empty())
+                    {
+                        return;
+                    }
+                    if (a_node != priority_dispatcher::any_node)
+                    {
+                        for (auto v_it = m_parked.end(); v_it != m_parked.begin();)
+                        {
+                            --v_it;
+                            parked_worker* v_worker = *v_it;
+                            if (v_worker->m_node == a_node && v_worker != m_timer_keeper)
+                            {
+                                m_parked.erase(v_it);
+                                v_worker->m_signalled = true;
+                                v_worker->m_cond.notify_one();
+                                return;
+                            }
+                        }
+                    }
+                    unpark(1);
+                }
+
+                /** Wakes up to a_count parked service threads, most recently parked first since their caches are
+                 * the warmest, but the timer keeper last. Called with m_mtx held.
+                 */
+                void unpark(std::size_t a_count) noexcept
+                {
+                    while (a_count-- != 0 && !m_parked.empty())
+                    {
+                        auto v_it = m_parked.end() - 1;
+                        if (*v_it == m_timer_keeper && v_it != m_parked.begin())
+                        {
+                            --v_it;
+                        }
+                        parked_worker* v_worker = *v_it;
+                        m_parked.erase(v_it);
+                        v_worker->m_signalled = true;
+                        v_worker->m_cond.notify_one();
+                    }
+                }
+
+                void timer_rearm() noexcept override
+                {
+                    std::unique_lock v_lock(m_mtx);
+                    if (m_timer_keeper != nullptr)
+                    {
+                        if (!m_timer_keeper->m_signalled)
+                        {
+                            m_parked.erase(std::find(m_parked.begin(), m_parked.end(), m_timer_keeper));
+                            m_timer_keeper->m_signalled = true;
+                            m_timer_keeper->m_cond.notify_one();
+                        }
+                    }
+                    else if (m_spinning == 0)
+                    {
+                        // Whoever we wake finds no work and parks as the timer keeper.
+                        unpark(1);
+                    }
+                }
+
+                /** Polls for work without the mutex for a while before the caller parks. Returns true if there is
+                 * work or the thread should stop.
+                 */
+                bool spin(std::unique_lock< std::mutex >& a_lock)
+                {
+                    if (m_spin_limit == 0)
+                    {
+                        return false;
+                    }
+
+                    m_spinning++;
+                    a_lock.unlock();
+                    for (int i = 0; i < m_spin_limit && m_queued.load(std::memory_order_relaxed) == 0; i++)
+                    {
+                        std::this_thread::yield();
+                    }
+                    a_lock.lock();
+                    m_spinning--;
+
+                    return !m_queue.empty() || m_tc_running > m_tc_target;
+                }
+
+                void service_thread(std::size_t thread_id)
+                {
+                    m_placement.pin(thread_id);
+                    stats_holder v_stats(*this);
+                    parked_worker v_parking;
+                    v_parking.m_node = m_placement.node_of(thread_id);
+                    std::unique_lock< std::mutex > v_lock(m_mtx);
+
+                    while (true)
+                    {
+                        if (m_tc_running > m_tc_target)
+                        {
+                            m_tc_running--;
+
+                            // we cant join ourselves, so let the struct know we are disposable now
+                            m_joinable_threads.push_back(thread_id);
+
+                            if (m_waiting_thread_abort)
+                            {
+                                m_done_cond.notify_all();
+                            }
+
+                            return;
+                        }
+
+                        if (m_queue.empty())
+                        {
+                            if (!spin(v_lock))
+                            {
+                                // Whoever pops us from m_parked sets m_signalled, so a submit wakes exactly one thread.
+                                if (v_stats.get() != nullptr)
+                                {
+                                    thread_stats::add(v_stats.get()->m_parks);
+                                }
+                                v_parking.m_signalled = false;
+                                m_parked.push_back(&v_parking);
+                                if (m_timer_keeper == nullptr && has_timers())
+                                {
+                                    m_timer_keeper = &v_parking;
+                                    v_parking.m_cond.wait_until(v_lock, next_timer_deadline(), [&] {
+                                        return v_parking.m_signalled;
+                                    });
+                                    m_timer_keeper = nullptr;
+
+                                    if (!v_parking.m_signalled)
+                                    {
+                                        m_parked.erase(std::find(m_parked.begin(), m_parked.end(), &v_parking));
+                                    }
+                                    else if (has_timers() && (!m_queue.empty() || m_tc_running > m_tc_target))
+                                    {
+                                        // We are off to run a job or to stop, hand the timers to another thread.
+                                        unpark(1);
+                                    }
+
+                                    v_lock.unlock();
+                                    poll_timers();
+                                    v_lock.lock();
+                                }
+                                else
+                                {
+                                    v_parking.m_cond.wait(v_lock, [&] {
+                                        return v_parking.m_signalled;
+                                    });
+                                }
+                            }
+                            continue;
+                        }
+
+                        auto item = m_queue.pop();
+                        m_queued.store(m_queue.size(), std::memory_order_relaxed);
+
+                        // Several jobs may have been submitted while only we were spinning, pass the rest on.
+                        if (!m_queue.empty())
+                        {
+                            wake_one();
+                        }
+
+                        {
+                            scoped_increment_with_lock scope_incr(m_async_executions, v_lock);
+                            // using this class because there is a (very small) chance an exception might be thrown by .lock() which
+                            // would cause a race condition with scoped_increment
+                            // Note: scoped_incrment_with_lock will call std::terminate in the failure case.
+
+                            v_lock.unlock();
+                            // The mutex is released in order to allow new items to be submitted to the queue while we are busy executing the function.
+
+                            if (v_stats.get() != nullptr)
+                            {
+                                std::uint64_t v_start = stat_ticks();
+                                bool v_completed = execute_job(item, m_exception_handler);
+                                v_stats.get()->record(item.m_enqueued, v_start, stat_ticks(), v_completed);
+                            }
+                            else
+                            {
+                                execute_job(item, m_exception_handler);
+                            }
+                            poll_timers();
+
+                            v_lock.lock();
+                        }
+
+                        // We re-lock the mutex and check if there are cancellors that need to be notified of the queue being emptied by us.
+
+                        if (m_async_executions==0 && m_waiting_completion_routines != 0)
+                        {
+                            m_done_cond.notify_all();
+                        }
+                    }
+
+                }
+
+                void submit(submitted_job const& a_job) override
+                {
+                    std::unique_lock lock(m_mtx);
+
+                    RPNX_ASSERT(m_waiting_completion_routines == 0);
+                    // Race condition
+                    // Use cancel_all_quick if there could be operations submitted at the same time.
+
+                    push(a_job);
+                }
+
+                void submit_near(submitted_job const& a_job, std::size_t a_node) override
+                {
+                    std::unique_lock lock(m_mtx);
+
+                    RPNX_ASSERT(m_waiting_completion_routines == 0);
+
+                    push(a_job, a_node);
+                }
+
+                void enqueue(submitted_job const& a_job) override
+                {
+                    std::unique_lock lock(m_mtx);
+                    push(a_job);
+                }
+
+                /** Called with m_mtx held. */
+                void push(submitted_job const& a_job, std::size_t a_node = priority_dispatcher::any_node)
+                {
+                    m_queue.push(a_job);
+                    m_queued.store(m_queue.size(), std::memory_order_relaxed);
+
+                    static_assert(noexcept(wake_one(a_node)));
+                    // If waking could throw exceptions, the caller wouldn't know if they needed to run the cleanup function or not
+
+                    wake_one(a_node);
+                }
+
+                void submit_bulk(job_batch const& a_batch) override
+                {
+                    std::unique_lock lock(m_mtx);
+
+                    RPNX_ASSERT(m_waiting_completion_routines == 0);
+
+                    m_queue.push(a_batch);
+                    m_queued.store(m_queue.size(), std::memory_order_relaxed);
+
+                    // One thread per job, less the ones already spinning.
+                    if (a_batch.m_count > m_spinning)
+                    {
+                        unpark(a_batch.m_count - m_spinning);
+                    }
+                }
+
+                void cancel_all_quick() override
+                {
+                    cancel_timers();
+
+                    std::unique_lock lock(m_mtx);
+
+                    RPNX_ASSERT(m_waiting_completion_routines == 0);
+
+                    while (!m_queue.empty())
+                    {
+                        submitted_job v_job = m_queue.pop();
+                        v_job.finish(priority_dispatcher::completion_state::cancelled);
+                    }
+                    m_queued.store(0, std::memory_order_relaxed);
+
+                    // Technically this would be a race condition, but unsure if there is performance gain by avoiding it.
+                    if (m_async_executions==0  && m_waiting_completion_routines != 0)
+                    {
+                        m_done_cond.notify_all();
+                    }
+                }
+
+                void set_service_thread_count(std::size_t ct) override
+                {
+                    std::unique_lock sc_lock(m_mtx);
+
+                    // If we call this over and over with different args it could cause a memory leak because we don't wait for threads to actually
+                    // finish when we reduce the thread count, so clean up any immediately joinable threads now
+                    join_stopped_threads(sc_lock);
+
+                    m_tc_target = ct;
+
+                    if (m_tc_running > m_tc_target)
+                    {
+                        unpark(m_tc_running - m_tc_target);
+                        return;
+                        // the threads will stop by themselves later
+                        // We should wake them up though so they can quit
+                    }
+
+                    else while (m_tc_running < m_tc_target)
+                    {
+                        start_thread(sc_lock);
+                    }
+
+
+
+                }
+
+                void count_queued(std::map< std::int64_t, std::size_t >& a_counts) override
+                {
+                    std::unique_lock v_lock(m_mtx);
+                    m_queue.count_by_priority(a_counts);
+                }
+
+                void cancel_all() override
+                {
+                    cancel_timers();
+
+                    std::unique_lock sc_lock(m_mtx);
+
+                    scoped_increment sc_increment(m_waiting_completion_routines);
+                    // We always have the sc_lock
+
+
+                    while (true)
+                    {
+                        // wait is guaranteed not to throw unless the predicate throws. our predicate cannot throw.
+                        m_done_cond.wait(sc_lock, [&] {
+                            return !m_queue.empty() || m_async_executions == 0;
+                        });
+
+                        RPNX_ASSERT(sc_lock.owns_lock());
+                        // Guaranteed to be true by C++ standard, otherwise std::terminate would be called.
+
+                        while (!m_queue.empty())
+                        {
+                            submitted_job v_job = m_queue.pop();
+                            v_job.finish(priority_dispatcher::completion_state::cancelled);
+                        }
+                        m_queued.store(0, std::memory_order_relaxed);
+                        // ! noexcept(m_queue.pop());
+                        // TODO: Under some low memory condition, this might throw? Investigate.
+
+                        if (m_async_executions == 0)
+                            return;
+                    }
+                }
+            };
+
+            /** scheduling_mode::work_stealing
+             * Every service thread owns a worker: a max-heap of jobs behind its own mutex, which is only contended
+             * when another thread steals from it. Jobs submitted from outside the service threads are pushed onto
+             * m_injected, a lock-free list that a worker takes as a whole (so pops never see ABA) and merges into
+             * its heap. A bulk submission is injected as a single record. Idle workers steal up to half of the jobs of the worker advertising the highest priority.
+             */
+            struct work_stealing_dispatcher_impl final : dispatcher_impl
+            {
+                /** One job, or the jobs of one submit_bulk call: m_job is the first, and the data of the others follows
+                 * it m_stride bytes apart, as in job_batch.
+                 */
+                struct injected_job
+                {
+                    submitted_job m_job;
+                    injected_job* m_next;
+                    std::size_t m_count;
+                    std::size_t m_stride;
+
+                    submitted_job operator[](std::size_t a_index) const noexcept
+                    {
+                        if (a_index == 0)
+                        {
+                            return m_job;
+                        }
+                        submitted_job v_job = m_job;
+                        v_job.m_data = static_cast< unsigned char* >(m_job.m_data) + a_index * m_stride;
+                        return v_job;
+                    }
+                };
+
+                struct alignas(64) worker
+                {
+                    std::mutex m_mtx;
+                    // A max-heap ordered by submitted_job_comp, guarded by m_mtx.
+                    std::vector< submitted_job > m_heap;
+                    // The size and top priority of m_heap, published for thieves.
+                    std::atomic< std::size_t > m_count{0};
+                    std::atomic< std::int64_t > m_top{0};
+
+                    // Guarded by the dispatcher's m_mtx.
+                    std::thread m_thread;
+                    bool m_live = false;
+
+                    // Set before the worker is first published, and never changed.
+                    std::size_t m_node = priority_dispatcher::any_node;
+
+                    // The statistics of the service thread running this worker, if collected.
+                    thread_stats* m_stats = nullptr;
+
+                    void publish() noexcept
+                    {
+                        m_count.store(m_heap.size(), std::memory_order_relaxed);
+                        if (!m_heap.empty())
+                        {
+                            m_top.store(m_heap.front().m_priority, std::memory_order_relaxed);
+                        }
+                    }
+
+                    void push(submitted_job const& a_job)
+                    {
+                        m_heap.push_back(a_job);
+                        std::push_heap(m_heap.begin(), m_heap.end(), submitted_job_comp());
+                    }
+
+                    submitted_job pop() noexcept
+                    {
+                        std::pop_heap(m_heap.begin(), m_heap.end(), submitted_job_comp());
+                        submitted_job v_job = m_heap.back();
+                        m_heap.pop_back();
+                        return v_job;
+                    }
+                };
+
+                // Workers are never destroyed or moved before the dispatcher is, so tables only need to grow. A
+                // larger table is published in place of the old one, which is kept until destruction because
+                // thieves may still be reading it.
+                struct worker_table
+                {
+                    std::vector< worker* > m_workers;
+                };
+
+                static constexpr std::size_t max_steal = 32;
+
+                static thread_local work_stealing_dispatcher_impl* t_dispatcher;
+                static thread_local worker* t_worker;
+
+                std::atomic< injected_job* > m_injected{nullptr};
+                std::atomic< worker_table const* > m_table{nullptr};
+
+                // Jobs submitted but not yet finished or cancelled.
+                std::atomic< std::size_t > m_outstanding{0};
+                std::atomic< std::size_t > m_outstanding_waiters{0};
+                std::atomic< bool > m_cancelling{false};
+
+                // Parking: m_epoch changes on every submit so a worker can tell whether work arrived after it
+                // last looked.
+                std::atomic< std::uint64_t > m_epoch{0};
+                std::atomic< std::size_t > m_sleeping{0};
+                std::atomic< std::size_t > m_tc_target{0};
+                int const m_spin_limit = idle_spin_limit();
+                // Rotates submit_near between the workers of a node.
+                std::atomic< std::size_t > m_next_near{0};
+
+                std::mutex m_mtx;
+                // Serializes set_service_thread_count, which joins stopped workers without holding m_mtx: a stopping
+                // worker may still need m_mtx to pass its wakeup on.
+                std::mutex m_resize_mtx;
+                std::condition_variable m_park_cond;
+                std::condition_variable m_done_cond;
+                // The parked worker waiting for the earliest timer, if any, waits on m_timer_cond instead.
+                std::condition_variable m_timer_cond;
+                bool m_timer_keeper = false;
+                bool m_timer_rearmed = false;
+                std::vector< std::unique_ptr< worker > > m_worker_storage;
+                std::vector< std::unique_ptr< worker_table > > m_tables;
+
+                work_stealing_dispatcher_impl(worker_placement a_placement, priority_dispatcher::options const& a_options, std::size_t a_thread_count)
+                    : dispatcher_impl(std::move(a_placement), a_options)
+                {
+                    set_service_thread_count(a_thread_count);
+                }
+
+                ~work_stealing_dispatcher_impl() override
+                {
+                    {
+                        std::unique_lock v_lock(m_mtx);
+                        m_tc_target = 0;
+                        m_park_cond.notify_all();
+                        m_timer_cond.notify_all();
+                    }
+
+                    for (auto& v_worker : m_worker_storage)
+                    {
+                        if (v_worker->m_thread.joinable())
+                        {
+                            v_worker->m_thread.join();
+                        }
+                    }
+
+                    // priority_dispatcher cancels everything before destroying us, but cancel whatever a
+                    // cleanup routine may have submitted since.
+                    cancel_queued();
+                }
+
+                void enqueue(submitted_job const& a_job) override
+                {
+                    submit(a_job);
+                }
+
+                void submit(submitted_job const& a_job) override
+                {
+                    if (t_dispatcher == this)
+                    {
+                        // Submitted by one of our own jobs, keep it local.
+                        worker& v_self = *t_worker;
+                        std::unique_lock v_lock(v_self.m_mtx);
+                        v_self.push(a_job);
+                        m_outstanding.fetch_add(1);
+                        v_self.publish();
+                    }
+                    else
+                    {
+                        pool_allocator< injected_job > v_alloc;
+                        injected_job* v_node = v_alloc.allocate(1);
+                        v_node->m_job = a_job;
+                        v_node->m_count = 1;
+                        v_node->m_stride = 0;
+                        m_outstanding.fetch_add(1);
+                        inject(v_node, v_node);
+                    }
+
+                    wake(1);
+                }
+
+                void submit_near(submitted_job const& a_job, std::size_t a_node) override
+                {
+                    worker* v_target = nullptr;
+                    if (a_node != priority_dispatcher::any_node && !(t_dispatcher == this && t_worker->m_node == a_node))
+                    {
+                        v_target = worker_on(a_node);
+                    }
+                    if (v_target == nullptr)
+                    {
+                        submit(a_job);
+                        return;
+                    }
+
+                    {
+                        std::unique_lock v_lock(v_target->m_mtx);
+                        v_target->push(a_job);
+                        m_outstanding.fetch_add(1);
+                        v_target->publish();
+                    }
+                    wake(1);
+                }
+
+                /** One of the running workers on a_node, taking turns, or nullptr if there is none. */
+                worker* worker_on(std::size_t a_node) noexcept
+                {
+                    worker_table const* v_table = m_table.load(std::memory_order_acquire);
+                    if (v_table == nullptr)
+                    {
+                        return nullptr;
+                    }
+                    std::size_t v_count = std::min(v_table->m_workers.size(), m_tc_target.load(std::memory_order_relaxed));
+                    std::size_t v_start = m_next_near.fetch_add(1, std::memory_order_relaxed);
+                    for (std::size_t i = 0; i < v_count; i++)
+                    {
+                        worker* v_worker = v_table->m_workers[(v_start + i) % v_count];
+                        if (v_worker->m_node == a_node)
+                        {
+                            return v_worker;
+                        }
+                    }
+                    return nullptr;
+                }
+
+                void submit_bulk(job_batch const& a_batch) override
+                {
+                    if (a_batch.m_count == 0)
+                    {
+                        return;
+                    }
+
+                    if (t_dispatcher == this)
+                    {
+                        worker& v_self = *t_worker;
+                        std::unique_lock v_lock(v_self.m_mtx);
+                        v_self.m_heap.reserve(v_self.m_heap.size() + a_batch.m_count);
+                        for (std::size_t i = 0; i < a_batch.m_count; i++)
+                        {
+                            v_self.push(a_batch[i]);
+                        }
+                        m_outstanding.fetch_add(a_batch.m_count);
+                        v_self.publish();
+                    }
+                    else
+                    {
+                        // The batch keeps its contiguous layout, so it takes one record and a single CAS.
+                        pool_allocator< injected_job > v_alloc;
+                        injected_job* v_node = v_alloc.allocate(1);
+                        v_node->m_job = a_batch[0];
+                        v_node->m_count = a_batch.m_count;
+                        v_node->m_stride = a_batch.m_data_stride;
+                        m_outstanding.fetch_add(a_batch.m_count);
+                        inject(v_node, v_node);
+                    }
+
+                    wake(a_batch.m_count);
+                }
+
+                /** Wakes up to a_count parked workers. */
+                void wake(std::size_t a_count) noexcept
+                {
+                    m_epoch.fetch_add(1);
+                    if (m_sleeping.load() != 0)
+                    {
+                        std::unique_lock v_lock(m_mtx);
+                        // The timer keeper waits on its own condition variable, and is woken last.
+                        std::size_t v_sleeping = m_sleeping.load() - (m_timer_keeper ? 1 : 0);
+                        if (m_timer_keeper && a_count > v_sleeping)
+                        {
+                            m_timer_cond.notify_one();
+                        }
+                        if (a_count >= v_sleeping)
+                        {
+                            m_park_cond.notify_all();
+                        }
+                        else
+                        {
+                            while (a_count-- != 0)
+                            {
+                                m_park_cond.notify_one();
+                            }
+                        }
+                    }
+                }
+
+                void timer_rearm() noexcept override
+                {
+                    std::unique_lock v_lock(m_mtx);
+                    if (m_timer_keeper)
+                    {
+                        m_timer_rearmed = true;
+                        m_timer_cond.notify_one();
+                    }
+                    else if (m_sleeping.load() != 0)
+                    {
+                        // Whoever we wake finds no work and parks as the timer keeper.
+                        m_epoch.fetch_add(1);
+                        m_park_cond.notify_one();
+                    }
+                }
+
+                void finish_one() noexcept
+                {
+                    if (m_outstanding.fetch_sub(1) == 1 && m_outstanding_waiters.load() != 0)
+                    {
+                        std::unique_lock v_lock(m_mtx);
+                        m_done_cond.notify_all();
+                    }
+                }
+
+                void run(submitted_job& a_job, thread_stats* a_stats) noexcept
+                {
+                    if (m_cancelling.load(std::memory_order_relaxed))
+                    {
+                        a_job.finish(priority_dispatcher::completion_state::cancelled);
+                    }
+                    else if (a_stats != nullptr)
+                    {
+                        std::uint64_t v_start = stat_ticks();
+                        bool v_completed = execute_job(a_job, m_exception_handler);
+                        a_stats->record(a_job.m_enqueued, v_start, stat_ticks(), v_completed);
+                    }
+                    else
+                    {
+                        execute_job(a_job, m_exception_handler);
+                    }
+                    finish_one();
+                }
+
+                void inject(injected_job* a_first, injected_job* a_last) noexcept
+                {
+                    a_last->m_next = m_injected.load(std::memory_order_relaxed);
+                    while (!m_injected.compare_exchange_weak(a_last->m_next, a_first, std::memory_order_release, std::memory_order_relaxed))
+                    {
+                    }
+                }
+
+                /** Moves the injected jobs into a_self's heap. The caller holds a_self.m_mtx.
+                 */
+                void take_injected(worker& a_self) noexcept
+                {
+                    injected_job* v_node = m_injected.exchange(nullptr, std::memory_order_acquire);
+                    pool_allocator< injected_job > v_alloc;
+                    while (v_node != nullptr)
+                    {
+                        try
+                        {
+                            // Nothing can throw once the heap has room, so a batch is moved whole or not at all.
+                            std::size_t v_size = a_self.m_heap.size() + v_node->m_count;
+                            if (v_size > a_self.m_heap.capacity())
+                            {
+                                a_self.m_heap.reserve(std::max(v_size, 2 * a_self.m_heap.capacity()));
+                            }
+                            for (std::size_t i = 0; i < v_node->m_count; i++)
+                            {
+                                a_self.push((*v_node)[i]);
+                            }
+                        }
+                        catch (...)
+                        {
+                            // Out of memory, leave the rest for later.
+                            injected_job* v_last = v_node;
+                            while (v_last->m_next != nullptr)
+                            {
+                                v_last = v_last->m_next;
+                            }
+                            inject(v_node, v_last);
+                            return;
+                        }
+                        injected_job* v_next = v_node->m_next;
+                        v_alloc.deallocate(v_node, 1);
+                        v_node = v_next;
+                    }
+                }
+
+                /** Takes a job from a_self's heap, then from the injection list, then by stealing.
+                 */
+                bool take_job(worker& a_self, submitted_job& a_job) noexcept
+                {
+                    {
+                        std::unique_lock v_lock(a_self.m_mtx);
+                        if (m_injected.load(std::memory_order_relaxed) != nullptr)
+                        {
+                            take_injected(a_self);
+                        }
+                        if (!a_self.m_heap.empty())
+                        {
+                            a_job = a_self.pop();
+                            a_self.publish();
+                            return true;
+                        }
+                    }
+                    return steal(a_self, a_job);
+                }
+
+                /** Steals from the worker on our own NUMA node advertising the highest priority, or failing that
+                 * from the one on any node.
+                 */
+                bool steal(worker& a_self, submitted_job& a_job) noexcept
+                {
+                    worker_table const* v_table = m_table.load(std::memory_order_acquire);
+                    worker* v_victim = nullptr;
+                    std::int64_t v_victim_top = 0;
+                    worker* v_remote = nullptr;
+                    std::int64_t v_remote_top = 0;
+                    for (worker* v_worker : v_table->m_workers)
+                    {
+                        if (v_worker == &a_self || v_worker->m_count.load(std::memory_order_relaxed) == 0)
+                        {
+                            continue;
+                        }
+                        std::int64_t v_top = v_worker->m_top.load(std::memory_order_relaxed);
+                        if (v_worker->m_node != a_self.m_node)
+                        {
+                            if (v_remote == nullptr || v_top > v_remote_top)
+                            {
+                                v_remote = v_worker;
+                                v_remote_top = v_top;
+                            }
+                        }
+                        else if (v_victim == nullptr || v_top > v_victim_top)
+                        {
+                            v_victim = v_worker;
+                            v_victim_top = v_top;
+                        }
+                    }
+                    if (v_victim == nullptr)
+                    {
+                        v_victim = v_remote;
+                    }
+                    if (v_victim == nullptr)
+                    {
+                        return false;
+                    }
+
+                    std::array< submitted_job, max_steal > v_stolen;
+                    std::size_t v_count = 0;
+                    {
+                        std::unique_lock v_lock(v_victim->m_mtx);
+                        std::size_t v_take = std::min(max_steal, (v_victim->m_heap.size() + 1) / 2);
+                        while (v_count < v_take)
+                        {
+                            v_stolen[v_count++] = v_victim->pop();
+                        }
+                        v_victim->publish();
+                    }
+                    if (v_count == 0)
+                    {
+                        return false;
+                    }
+                    if (a_self.m_stats != nullptr)
+                    {
+                        thread_stats::add(a_self.m_stats->m_steals, v_count);
+                    }
+
+                    a_job = v_stolen[0];
+                    if (v_count > 1)
+                    {
+                        std::unique_lock v_lock(a_self.m_mtx);
+                        std::size_t v_kept = 1;
+                        try
+                        {
+                            for (; v_kept < v_count; v_kept++)
+                            {
+                                a_self.push(v_stolen[v_kept]);
+                            }
+                        }
+                        catch (...)
+                        {
+                            // Out of memory, hand the rest back.
+                            v_lock.unlock();
+                            std::unique_lock v_victim_lock(v_victim->m_mtx);
+                            for (; v_kept < v_count; v_kept++)
+                            {
+                                v_victim->m_heap.push_back(v_stolen[v_kept]);
+                                std::push_heap(v_victim->m_heap.begin(), v_victim->m_heap.end(), submitted_job_comp());
+                            }
+                            v_victim->publish();
+                            return true;
+                        }
+                        a_self.publish();
+                    }
+                    return true;
+                }
+
+                bool has_work() const noexcept
+                {
+                    if (m_injected.load() != nullptr)
+                    {
+                        return true;
+                    }
+                    for (worker* v_worker : m_table.load(std::memory_order_acquire)->m_workers)
+                    {
+                        if (v_worker->m_count.load() != 0)
+                        {
+                            return true;
+                        }
+                    }
+                    return false;
+                }
+
+                void service_thread(std::size_t a_index, worker& a_self)
+                {
+                    m_placement.pin(a_index);
+                    stats_holder v_stats(*this);
+                    a_self.m_stats = v_stats.get();
+                    t_dispatcher = this;
+                    t_worker = &a_self;
+
+                    int v_spins = 0;
+                    while (true)
+                    {
+                        poll_timers();
+
+                        submitted_job v_job;
+                        if (a_index < m_tc_target.load(std::memory_order_relaxed) && take_job(a_self, v_job))
+                        {
+                            run(v_job, v_stats.get());
+                            v_spins = 0;
+                            continue;
+                        }
+
+                        if (a_index < m_tc_target.load(std::memory_order_relaxed) && v_spins++ < m_spin_limit)
+                        {
+                            std::this_thread::yield();
+                            continue;
+                        }
+                        v_spins = 0;
+
+                        std::unique_lock v_lock(m_mtx);
+                        if (a_index >= m_tc_target.load())
+                        {
+                            // Any jobs still in our heap stay there for the remaining workers to steal.
+                            a_self.m_live = false;
+                            v_lock.unlock();
+                            wake(1);
+                            return;
+                        }
+
+                        m_sleeping.fetch_add(1);
+                        std::uint64_t v_epoch = m_epoch.load();
+                        if (!has_work())
+                        {
+                            if (v_stats.get() != nullptr)
+                            {
+                                thread_stats::add(v_stats.get()->m_parks);
+                            }
+                            if (!m_timer_keeper && has_timers())
+                            {
+                                m_timer_keeper = true;
+                                m_timer_rearmed = false;
+                                m_timer_cond.wait_until(v_lock, next_timer_deadline(), [&] {
+                                    return m_epoch.load() != v_epoch || a_index >= m_tc_target.load() || m_timer_rearmed;
+                                });
+                                m_timer_keeper = false;
+
+                                if (!m_timer_rearmed && (m_epoch.load() != v_epoch || a_index >= m_tc_target.load()) && m_sleeping.load() > 1 && has_timers())
+                                {
+                                    // We are off to run a job or to stop, hand the timers to another worker.
+                                    m_epoch.fetch_add(1);
+                                    m_park_cond.notify_one();
+                                }
+                            }
+                            else
+                            {
+                                m_park_cond.wait(v_lock, [&] {
+                                    return m_epoch.load() != v_epoch || a_index >= m_tc_target.load();
+                                });
+                            }
+                        }
+                        m_sleeping.fetch_sub(1);
+                    }
+                }
+
+                /** Cancels every queued job. Running jobs are unaffected.
+                 */
+                void cancel_queued() noexcept
+                {
+                    pool_allocator< injected_job > v_alloc;
+                    injected_job* v_node = m_injected.exchange(nullptr, std::memory_order_acquire);
+                    while (v_node != nullptr)
+                    {
+                        for (std::size_t i = 0; i < v_node->m_count; i++)
+                        {
+                            (*v_node)[i].finish(priority_dispatcher::completion_state::cancelled);
+                            finish_one();
+                        }
+                        injected_job* v_next = v_node->m_next;
+                        v_alloc.deallocate(v_node, 1);
+                        v_node = v_next;
+                    }
+
+                    worker_table const* v_table = m_table.load(std::memory_order_acquire);
+                    if (v_table == nullptr)
+                    {
+                        return;
+                    }
+                    for (worker* v_worker : v_table->m_workers)
+                    {
+                        std::vector< submitted_job > v_jobs;
+                        {
+                            std::unique_lock v_lock(v_worker->m_mtx);
+                            v_jobs.swap(v_worker->m_heap);
+                            v_worker->publish();
+                        }
+                        for (submitted_job const& v_job : v_jobs)
+                        {
+                            v_job.finish(priority_dispatcher::completion_state::cancelled);
+                            finish_one();
+                        }
+                    }
+                }
+
+                void wait_outstanding() noexcept
+                {
+                    std::unique_lock v_lock(m_mtx);
+                    m_outstanding_waiters.fetch_add(1);
+                    m_done_cond.wait(v_lock, [&] {
+                        return m_outstanding.load() == 0;
+                    });
+                    m_outstanding_waiters.fetch_sub(1);
+                }
+
+                void finish_all() override
+                {
+                    wait_outstanding();
+                }
+
+                /** Jobs still on the injection list are not counted, as only the service threads may walk it. */
+                void count_queued(std::map< std::int64_t, std::size_t >& a_counts) override
+                {
+                    worker_table const* v_table = m_table.load(std::memory_order_acquire);
+                    if (v_table == nullptr)
+                    {
+                        return;
+                    }
+                    for (worker* v_worker : v_table->m_workers)
+                    {
+                        std::unique_lock v_lock(v_worker->m_mtx);
+                        for (submitted_job const& v_job : v_worker->m_heap)
+                        {
+                            a_counts[v_job.m_priority]++;
+                        }
+                    }
+                }
+
+                void cancel_all() override
+                {
+                    // Jobs submitted by jobs that are still running are cancelled by whichever worker picks them up.
+                    m_cancelling.store(true);
+                    cancel_timers();
+                    cancel_queued();
+                    wait_outstanding();
+                    m_cancelling.store(false);
+                }
 
-                    while (true)
-                    {
-                        // wait is guaranteed not to throw unless the predicate throws. our predicate cannot throw.
-                        m_cond.wait(sc_lock, [&] {
-                            return !m_queue.empty() || m_async_executions == 0;
-                        });
+                void cancel_all_quick() override
+                {
+                    cancel_timers();
+                    cancel_queued();
+                }
 
-                        RPNX_ASSERT(sc_lock.owns_lock());
-                        // Guaranteed to be true by C++ standard, otherwise std::terminate would be called.
+                void set_service_thread_count(std::size_t ct) override
+                {
+                    std::unique_lock v_resize_lock(m_resize_mtx);
+                    std::unique_lock v_lock(m_mtx);
 
-                        while (!m_queue.empty())
+                    if (m_worker_storage.size() < ct)
+                    {
+                        auto v_table = std::make_unique< worker_table >();
+                        v_table->m_workers.reserve(ct);
+                        m_tables.reserve(m_tables.size() + 1);
+                        m_worker_storage.reserve(ct);
+                        while (m_worker_storage.size() < ct)
                         {
-                            m_queue.top().m_cleanup(m_queue.top().m_data, priority_dispatcher::completion_state::cancelled);
-                            m_queue.pop();
+                            m_worker_storage.push_back(std::make_unique< worker >());
+                            m_worker_storage.back()->m_node = m_placement.node_of(m_worker_storage.size() - 1);
                         }
-                        // ! noexcept(m_queue.pop());
-                        // TODO: Under some low memory condition, this might throw? Investigate.
+                        for (auto& v_worker : m_worker_storage)
+                        {
+                            v_table->m_workers.push_back(v_worker.get());
+                        }
+                        m_table.store(v_table.get(), std::memory_order_release);
+                        m_tables.push_back(std::move(v_table));
+                    }
 
-                        if (m_async_executions == 0)
-                            return;
+                    m_tc_target = ct;
+                    std::vector< std::thread > v_stopped;
+                    v_stopped.reserve(ct);
+                    for (std::size_t v_index = 0; v_index < ct; v_index++)
+                    {
+                        worker& v_worker = *m_worker_storage[v_index];
+                        if (!v_worker.m_live && v_worker.m_thread.joinable())
+                        {
+                            v_stopped.push_back(std::move(v_worker.m_thread));
+                        }
+                    }
+                    if (!v_stopped.empty())
+                    {
+                        // A worker that has just stopped may be waiting for m_mtx in wake().
+                        v_lock.unlock();
+                        for (std::thread& v_thread : v_stopped)
+                        {
+                            v_thread.join();
+                        }
+                        v_lock.lock();
+                    }
+                    for (std::size_t v_index = 0; v_index < ct; v_index++)
+                    {
+                        worker& v_worker = *m_worker_storage[v_index];
+                        if (!v_worker.m_live)
+                        {
+                            v_worker.m_thread = std::thread([this, v_index, &v_worker] { service_thread(v_index, v_worker); });
+                            v_worker.m_live = true;
+                        }
                     }
+
+                    // Wake surplus workers so they can stop.
+                    m_park_cond.notify_all();
+                    m_timer_cond.notify_all();
                 }
             };
+
+            thread_local work_stealing_dispatcher_impl* work_stealing_dispatcher_impl::t_dispatcher = nullptr;
+            thread_local work_stealing_dispatcher_impl::worker* work_stealing_dispatcher_impl::t_worker = nullptr;
+
+            /** Where threads wait for job_futures. Futures hashing to the same slot share its condition variable,
+             * and a woken waiter that finds its own future not ready goes back to sleep.
+             */
+            struct alignas(64) future_parking_slot
+            {
+                std::mutex m_mtx;
+                std::condition_variable m_cond;
+            };
+
+            future_parking_slot& future_parking(void const* a_state) noexcept
+            {
+                static future_parking_slot s_slots[64];
+                return s_slots[(reinterpret_cast< std::uintptr_t >(a_state) / 64) % 64];
+            }
         }
     }
 
 
 }
 
+void rpnx::experimental::job_future_state::wait()
+{
+    if (ready())
+    {
+        return;
+    }
+    impl::future_parking_slot& v_slot = impl::future_parking(this);
+    std::unique_lock v_lock(v_slot.m_mtx);
+    // Set under the slot's mutex, so set_ready either sees it and notifies after we sleep, or happened first.
+    m_status.fetch_or(waiting_bit, std::memory_order_acq_rel);
+    while (!ready())
+    {
+        v_slot.m_cond.wait(v_lock);
+    }
+}
+
+void rpnx::experimental::job_future_state::set_ready() noexcept
+{
+    if ((m_status.fetch_or(ready_bit, std::memory_order_acq_rel) & waiting_bit) != 0)
+    {
+        impl::future_parking_slot& v_slot = impl::future_parking(this);
+        std::unique_lock v_lock(v_slot.m_mtx);
+        v_slot.m_cond.notify_all();
+    }
+}
+
 void rpnx::experimental::priority_dispatcher::cancel_all()
 {
-    reinterpret_cast<impl::priority_dispatcher_impl*>(m_implementation)->cancel_all();
+    reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->cancel_all();
 }
 
 rpnx::experimental::priority_dispatcher::priority_dispatcher()
+    : priority_dispatcher(options())
+{
+}
+
+rpnx::experimental::priority_dispatcher::priority_dispatcher(options const& a_options)
 {
-    m_implementation = new impl::priority_dispatcher_impl;
+    impl::worker_placement v_placement(a_options);
+    std::size_t v_thread_count = a_options.m_thread_count != 0 ? a_options.m_thread_count : v_placement.default_thread_count();
+    impl::dispatcher_impl* v_implementation = nullptr;
+    switch (a_options.m_mode)
+    {
+    case scheduling_mode::work_stealing:
+        v_implementation = new impl::work_stealing_dispatcher_impl(std::move(v_placement), a_options, v_thread_count);
+        break;
+    case scheduling_mode::banded:
+        v_implementation = new impl::priority_dispatcher_impl< impl::banded_job_queue >(std::move(v_placement), a_options, v_thread_count, impl::banded_job_queue(a_options.m_band_count));
+        break;
+    default:
+        v_implementation = new impl::priority_dispatcher_impl< impl::heap_job_queue >(std::move(v_placement), a_options, v_thread_count, impl::heap_job_queue());
+        break;
+    }
+    m_implementation = v_implementation;
 }
 
 rpnx::experimental::priority_dispatcher::~priority_dispatcher()
 {
-    reinterpret_cast<impl::priority_dispatcher_impl*>(m_implementation)->cancel_all();
-    delete reinterpret_cast<impl::priority_dispatcher_impl*>(m_implementation);
+    reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->cancel_all();
+    delete reinterpret_cast<impl::dispatcher_impl*>(m_implementation);
 }
 
 void rpnx::experimental::priority_dispatcher::submit(void (*a_exec)(void*), void (*a_cleanup)(void*, completion_state) noexcept, void* a_caller_data, std::int64_t priority)
 {
     RPNX_ASSERT(m_implementation != nullptr);
-    reinterpret_cast<impl::priority_dispatcher_impl*>(m_implementation)->submit(a_exec, a_cleanup, a_caller_data, priority);
+    impl::submitted_job v_job;
+    v_job.m_priority = priority;
+    v_job.m_exec = a_exec;
+    v_job.m_cleanup = a_cleanup;
+    v_job.m_data = a_caller_data;
+    reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->stamp(v_job);
+    reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->submit(v_job);
+}
+
+void rpnx::experimental::priority_dispatcher::submit_near(void (*a_exec)(void*), void (*a_cleanup)(void*, completion_state) noexcept, void* a_caller_data, std::int64_t priority,
+                                                          std::size_t a_node)
+{
+    RPNX_ASSERT(m_implementation != nullptr);
+    impl::submitted_job v_job;
+    v_job.m_priority = priority;
+    v_job.m_exec = a_exec;
+    v_job.m_cleanup = a_cleanup;
+    v_job.m_data = a_caller_data;
+    reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->stamp(v_job);
+    if (a_node != any_node)
+    {
+        reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->submit_near(v_job, a_node);
+    }
+    else
+    {
+        reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->submit(v_job);
+    }
+}
+
+void rpnx::experimental::priority_dispatcher::submit_at(void (*a_exec)(void*), void (*a_cleanup)(void*, completion_state) noexcept, void* a_caller_data, std::int64_t priority,
+                                                        std::chrono::steady_clock::time_point a_when)
+{
+    RPNX_ASSERT(m_implementation != nullptr);
+    impl::submitted_job v_job;
+    v_job.m_priority = priority;
+    v_job.m_exec = a_exec;
+    v_job.m_cleanup = a_cleanup;
+    v_job.m_data = a_caller_data;
+    reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->submit_at(v_job, a_when);
+}
+
+void rpnx::experimental::priority_dispatcher::submit_inline(void (*a_exec)(void*), void const* a_functor, std::size_t a_size, std::int64_t priority,
+                                                            std::chrono::steady_clock::time_point const* a_when, std::size_t a_node)
+{
+    RPNX_ASSERT(m_implementation != nullptr);
+    RPNX_ASSERT(a_size <= inline_functor_size);
+    impl::submitted_job v_job;
+    v_job.m_priority = priority;
+    v_job.m_exec = a_exec;
+    v_job.m_cleanup = nullptr;
+    std::memcpy(v_job.m_inline, a_functor, a_size);
+    if (a_when != nullptr)
+    {
+        reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->submit_at(v_job, *a_when);
+        return;
+    }
+    reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->stamp(v_job);
+    if (a_node != any_node)
+    {
+        reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->submit_near(v_job, a_node);
+    }
+    else
+    {
+        reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->submit(v_job);
+    }
+}
+
+void rpnx::experimental::priority_dispatcher::submit_bulk(void (*a_exec)(void*), void (*a_cleanup)(void*, completion_state) noexcept, void* a_first_data, std::size_t a_data_stride,
+                                                          std::size_t a_count, std::int64_t a_priority)
+{
+    RPNX_ASSERT(m_implementation != nullptr);
+    impl::job_batch v_batch;
+    v_batch.m_exec = a_exec;
+    v_batch.m_cleanup = a_cleanup;
+    v_batch.m_first_data = static_cast< unsigned char* >(a_first_data);
+    v_batch.m_data_stride = a_data_stride;
+    v_batch.m_count = a_count;
+    v_batch.m_priority = a_priority;
+    if (reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->m_collect_stats)
+    {
+        v_batch.m_enqueued = impl::stat_ticks();
+    }
+    reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->submit_bulk(v_batch);
+}
+
+rpnx::experimental::priority_dispatcher::statistics rpnx::experimental::priority_dispatcher::stats() const
+{
+    RPNX_ASSERT(m_implementation != nullptr);
+    return reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->stats();
+}
+
+std::uint64_t rpnx::experimental::priority_dispatcher::latency_histogram::count() const noexcept
+{
+    std::uint64_t v_count = 0;
+    for (std::uint64_t v_bucket : m_counts)
+    {
+        v_count += v_bucket;
+    }
+    return v_count;
+}
+
+std::chrono::nanoseconds rpnx::experimental::priority_dispatcher::latency_histogram::lower_bound(std::size_t a_bucket) const noexcept
+{
+    constexpr std::size_t v_sub_buckets = std::size_t(1) << sub_bucket_bits;
+    std::uint64_t v_ticks = a_bucket < v_sub_buckets ? a_bucket : std::uint64_t(v_sub_buckets + a_bucket % v_sub_buckets) << (a_bucket / v_sub_buckets - 1);
+    return std::chrono::nanoseconds(std::int64_t(double(v_ticks) * m_ns_per_tick));
+}
+
+std::chrono::nanoseconds rpnx::experimental::priority_dispatcher::latency_histogram::mean() const noexcept
+{
+    std::uint64_t v_count = count();
+    return v_count == 0 ? std::chrono::nanoseconds(0) : std::chrono::nanoseconds(std::int64_t(double(m_total_ticks) * m_ns_per_tick / double(v_count)));
+}
+
+std::chrono::nanoseconds rpnx::experimental::priority_dispatcher::latency_histogram::percentile(double a_fraction) const noexcept
+{
+    std::uint64_t v_count = count();
+    if (v_count == 0)
+    {
+        return std::chrono::nanoseconds(0);
+    }
+    double v_rank = std::ceil(std::clamp(a_fraction, 0.0, 1.0) * double(v_count));
+    std::uint64_t v_target = std::max< std::uint64_t >(std::uint64_t(v_rank), 1);
+    std::uint64_t v_seen = 0;
+    for (std::size_t i = 0; i < bucket_count; i++)
+    {
+        v_seen += m_counts[i];
+        if (v_seen >= v_target)
+        {
+            return i + 1 < bucket_count ? lower_bound(i + 1) : lower_bound(i);
+        }
+    }
+    return lower_bound(bucket_count - 1);
+}
+
+std::size_t rpnx::experimental::priority_dispatcher::numa_node_count() noexcept
+{
+    try
+    {
+        return impl::cpu_topology::get().m_node_cpus.size();
+    }
+    catch (...)
+    {
+        return 1;
+    }
+}
+
+std::size_t rpnx::experimental::priority_dispatcher::current_numa_node() noexcept
+{
+#if defined(__linux__)
+    try
+    {
+        int v_cpu = sched_getcpu();
+        impl::cpu_topology const& v_topology = impl::cpu_topology::get();
+        if (v_cpu >= 0 && v_topology.usable(std::size_t(v_cpu)))
+        {
+            return v_topology.m_cpu_node[std::size_t(v_cpu)];
+        }
+    }
+    catch (...)
+    {
+    }
+    return any_node;
+#else
+    return numa_node_count() == 1 ? 0 : any_node;
+#endif
 }
 
 void rpnx::experimental::priority_dispatcher::cancel_all_quick()
 {
     RPNX_ASSERT(m_implementation != nullptr);
-    reinterpret_cast<impl::priority_dispatcher_impl*>(m_implementation)->cancel_all_quick();
+    reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->cancel_all_quick();
 }
 void rpnx::experimental::priority_dispatcher::finish_all()
 {
     RPNX_ASSERT(m_implementation != nullptr);
-    reinterpret_cast<impl::priority_dispatcher_impl*>(m_implementation)->finish_all();
+    reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->finish_all();
 }
 void rpnx::experimental::priority_dispatcher::set_service_thread_count(std::size_t n)
 {
     RPNX_ASSERT(m_implementation != nullptr);
-    reinterpret_cast<impl::priority_dispatcher_impl*>(m_implementation)->set_service_thread_count(n);
+    reinterpret_cast<impl::dispatcher_impl*>(m_implementation)->set_service_thread_count(n);
+}
+
+/** A job of a task_group. Referenced by the handles to it and, until it finishes, by the dispatcher or by the edges
+ * of its predecessors.
+ */
+struct rpnx::experimental::task_group::node
+{
+    struct edge
+    {
+        node* m_successor;
+        edge* m_next;
+    };
+
+    impl::submitted_job m_job;
+    task_group* m_group;
+    std::atomic< std::size_t > m_refs{2};
+    // Predecessors that have not finished, plus one while add is still linking the job to them.
+    std::atomic< std::size_t > m_pending{1};
+    // The jobs waiting for this one, or finished() once it has finished.
+    std::atomic< edge* > m_successors{nullptr};
+    // Set before this job finishes if it was cancelled, and before it starts if a predecessor was.
+    std::atomic< bool > m_cancelled{false};
+    // Chains jobs cancelled by the same finish, so long chains are cancelled without recursion.
+    node* m_next_cancelled = nullptr;
+
+    node(task_group& a_group, impl::submitted_job const& a_job) noexcept
+        : m_job(a_job), m_group(&a_group)
+    {
+    }
+
+    static edge* finished() noexcept
+    {
+        static edge s_finished{nullptr, nullptr};
+        return &s_finished;
+    }
+
+    static void exec(void* a_node)
+    {
+        node* v_node = static_cast< node* >(a_node);
+        v_node->m_job.m_exec(v_node->m_job.data());
+    }
+
+    static void cleanup(void* a_node, completion_state a_state) noexcept
+    {
+        finish(static_cast< node* >(a_node), a_state);
+    }
+
+    impl::dispatcher_impl* dispatcher() const noexcept
+    {
+        return reinterpret_cast< impl::dispatcher_impl* >(m_group->m_dispatcher);
+    }
+
+    /** What the dispatcher queues for this job once its predecessors have finished. */
+    impl::submitted_job queued_job() noexcept
+    {
+        impl::submitted_job v_job;
+        v_job.m_priority = m_job.m_priority;
+        v_job.m_exec = &exec;
+        v_job.m_cleanup = &cleanup;
+        v_job.m_data = this;
+        dispatcher()->stamp(v_job);
+        return v_job;
+    }
+
+    void release() noexcept
+    {
+        if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            this->~node();
+            pool_deallocate(this, sizeof(node), alignof(node));
+        }
+    }
+
+    static void finish_one(task_group& a_group) noexcept
+    {
+        std::size_t v_outstanding = a_group.m_outstanding.load();
+        while (true)
+        {
+            if (v_outstanding == 1)
+            {
+                std::unique_lock v_lock(a_group.m_mtx);
+                if (a_group.m_outstanding.fetch_sub(1) == 1)
+                {
+                    a_group.m_cond.notify_all();
+                }
+                return;
+            }
+            if (a_group.m_outstanding.compare_exchange_weak(v_outstanding, v_outstanding - 1))
+            {
+                return;
+            }
+        }
+    }
+
+    /** Makes this job wait for a_predecessor, unless it has already finished. a_edge is used or freed. */
+    void link(node* a_predecessor, edge* a_edge) noexcept
+    {
+        m_pending.fetch_add(1, std::memory_order_relaxed);
+        a_edge->m_successor = this;
+        a_edge->m_next = a_predecessor->m_successors.load(std::memory_order_acquire);
+        while (a_edge->m_next != finished())
+        {
+            if (a_predecessor->m_successors.compare_exchange_weak(a_edge->m_next, a_edge, std::memory_order_release, std::memory_order_acquire))
+            {
+                return;
+            }
+        }
+
+        m_pending.fetch_sub(1, std::memory_order_relaxed);
+        if (a_predecessor->m_cancelled.load(std::memory_order_relaxed))
+        {
+            m_cancelled.store(true, std::memory_order_relaxed);
+        }
+        pool_allocator< edge >().deallocate(a_edge, 1);
+    }
+
+    /** Queues a job whose predecessors have all finished. Returns false if it has to be cancelled instead.
+     */
+    bool start() noexcept
+    {
+        if (m_cancelled.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        try
+        {
+            dispatcher()->enqueue(queued_job());
+            return true;
+        }
+        catch (...)
+        {
+            // Out of memory, there is nowhere to keep the job.
+            return false;
+        }
+    }
+
+    /** Runs a_node's cleanup, then starts the successors it was the last predecessor of, or cancels them if a_node
+     * was cancelled.
+     * A successor cancelled here never reaches the dispatcher, which matters because the dispatcher may be
+     * cancelling a_node with its own mutex held.
+     */
+    static void finish(node* a_node, completion_state a_state) noexcept
+    {
+        pool_allocator< edge > v_alloc;
+        node* v_cancelled = nullptr;
+        while (true)
+        {
+            bool v_cancel = a_state == completion_state::cancelled;
+            a_node->m_job.finish(a_state);
+            if (v_cancel)
+            {
+                a_node->m_cancelled.store(true, std::memory_order_relaxed);
+            }
+
+            edge* v_edge = a_node->m_successors.exchange(finished(), std::memory_order_acq_rel);
+            while (v_edge != nullptr)
+            {
+                node* v_successor = v_edge->m_successor;
+                edge* v_next = v_edge->m_next;
+                v_alloc.deallocate(v_edge, 1);
+                if (v_cancel)
+                {
+                    v_successor->m_cancelled.store(true, std::memory_order_relaxed);
+                }
+                if (v_successor->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1 && !v_successor->start())
+                {
+                    v_successor->m_next_cancelled = v_cancelled;
+                    v_cancelled = v_successor;
+                }
+                v_edge = v_next;
+            }
+
+            task_group& v_group = *a_node->m_group;
+            a_node->release();
+            finish_one(v_group);
+
+            if (v_cancelled == nullptr)
+            {
+                return;
+            }
+            a_node = v_cancelled;
+            v_cancelled = a_node->m_next_cancelled;
+            a_state = completion_state::cancelled;
+        }
+    }
+
+    static task add(task_group& a_group, impl::submitted_job const& a_job, task const* a_after, std::size_t a_after_count)
+    {
+        // Every edge is allocated up front, since once linked to a predecessor an edge cannot be taken back.
+        pool_allocator< edge > v_alloc;
+        node* v_node = nullptr;
+        edge* v_edges = nullptr;
+        try
+        {
+            v_node = static_cast< node* >(pool_allocate(sizeof(node), alignof(node)));
+            for (std::size_t i = 0; i < a_after_count; i++)
+            {
+                if (a_after[i].m_node != nullptr)
+                {
+                    edge* v_edge = v_alloc.allocate(1);
+                    v_edge->m_next = v_edges;
+                    v_edges = v_edge;
+                }
+            }
+        }
+        catch (...)
+        {
+            while (v_edges != nullptr)
+            {
+                edge* v_next = v_edges->m_next;
+                v_alloc.deallocate(v_edges, 1);
+                v_edges = v_next;
+            }
+            if (v_node != nullptr)
+            {
+                pool_deallocate(v_node, sizeof(node), alignof(node));
+            }
+            throw;
+        }
+
+        new (v_node) node(a_group, a_job);
+        a_group.m_outstanding.fetch_add(1);
+        for (std::size_t i = 0; i < a_after_count; i++)
+        {
+            if (a_after[i].m_node != nullptr)
+            {
+                edge* v_edge = v_edges;
+                v_edges = v_edge->m_next;
+                v_node->link(static_cast< node* >(a_after[i].m_node), v_edge);
+            }
+        }
+
+        if (v_node->m_pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            if (v_node->m_cancelled.load(std::memory_order_relaxed))
+            {
+                finish(v_node, completion_state::cancelled);
+            }
+            else
+            {
+                try
+                {
+                    v_node->dispatcher()->enqueue(v_node->queued_job());
+                }
+                catch (...)
+                {
+                    // Nothing else refers to the job yet.
+                    v_node->~node();
+                    pool_deallocate(v_node, sizeof(node), alignof(node));
+                    finish_one(a_group);
+                    throw;
+                }
+            }
+        }
+        return task(v_node);
+    }
+};
+
+rpnx::experimental::task_group::task::task(task const& other) noexcept
+    : m_node(other.m_node)
+{
+    if (m_node != nullptr)
+    {
+        static_cast< node* >(m_node)->m_refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+rpnx::experimental::task_group::task::task(task&& other) noexcept
+    : m_node(other.m_node)
+{
+    other.m_node = nullptr;
+}
+
+rpnx::experimental::task_group::task& rpnx::experimental::task_group::task::operator=(task other) noexcept
+{
+    std::swap(m_node, other.m_node);
+    return *this;
+}
+
+rpnx::experimental::task_group::task::~task()
+{
+    if (m_node != nullptr)
+    {
+        static_cast< node* >(m_node)->release();
+    }
+}
+
+bool rpnx::experimental::task_group::task::done() const noexcept
+{
+    return m_node != nullptr && static_cast< node* >(m_node)->m_successors.load(std::memory_order_acquire) == node::finished();
+}
+
+rpnx::experimental::task_group::task_group(priority_dispatcher& dispatcher)
+    : m_dispatcher(dispatcher.m_implementation)
+{
+}
+
+rpnx::experimental::task_group::~task_group()
+{
+    wait();
+}
+
+rpnx::experimental::task_group::task rpnx::experimental::task_group::add(void (*a_exec)(void*), void (*a_cleanup)(void*, completion_state) noexcept, void* a_caller_data, std::int64_t a_priority,
+                                                                         task const* a_after, std::size_t a_after_count)
+{
+    impl::submitted_job v_job;
+    v_job.m_priority = a_priority;
+    v_job.m_exec = a_exec;
+    v_job.m_cleanup = a_cleanup;
+    v_job.m_data = a_caller_data;
+    return node::add(*this, v_job, a_after, a_after_count);
+}
+
+rpnx::experimental::task_group::task rpnx::experimental::task_group::add_inline(void (*a_exec)(void*), void const* a_functor, std::size_t a_size, std::int64_t a_priority, task const* a_after,
+                                                                                std::size_t a_after_count)
+{
+    RPNX_ASSERT(a_size <= priority_dispatcher::inline_functor_size);
+    impl::submitted_job v_job;
+    v_job.m_priority = a_priority;
+    v_job.m_exec = a_exec;
+    v_job.m_cleanup = nullptr;
+    std::memcpy(v_job.m_inline, a_functor, a_size);
+    return node::add(*this, v_job, a_after, a_after_count);
+}
+
+void rpnx::experimental::task_group::wait()
+{
+    std::unique_lock v_lock(m_mtx);
+    m_cond.wait(v_lock, [&] {
+        return m_outstanding.load() == 0;
+    });
+}
+
+bool rpnx::experimental::task_group::done() const noexcept
+{
+    return m_outstanding.load() == 0;
 }
@@ -0,0 +1,158 @@
+#include "rpnx/experimental/bimonoque.hpp"
+
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::size_t g_block_allocations = 0;
+
+template < typename T >
+struct counting_allocator
+{
+    using value_type = T;
+
+    counting_allocator() noexcept = default;
+
+    template < typename T2 >
+    counting_allocator(counting_allocator< T2 > const&) noexcept
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        g_block_allocations++;
+        return std::allocator< T >().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        std::allocator< T >().deallocate(p, n);
+    }
+
+    bool operator==(counting_allocator const&) const noexcept
+    {
+        return true;
+    }
+
+    bool operator!=(counting_allocator const&) const noexcept
+    {
+        return false;
+    }
+};
+
+int main()
+{
+    // Random operations at both ends against std::deque
+    {
+        rpnx::experimental::bimonoque< std::string > m;
+        std::deque< std::string > d;
+        std::mt19937 rng(42);
+
+        for (int i = 0; i < 200000; i++)
+        {
+            auto op = rng() % 4;
+            if (op == 0)
+            {
+                m.push_back(std::to_string(i));
+                d.push_back(std::to_string(i));
+            }
+            else if (op == 1)
+            {
+                m.push_front(std::to_string(i));
+                d.push_front(std::to_string(i));
+            }
+            else if (op == 2 && !d.empty())
+            {
+                m.pop_back();
+                d.pop_back();
+            }
+            else if (op == 3 && !d.empty())
+            {
+                m.pop_front();
+                d.pop_front();
+            }
+
+            RPNX_ASSERT(m.size() == d.size());
+            if (!d.empty())
+            {
+                RPNX_ASSERT(m.front() == d.front());
+                RPNX_ASSERT(m.back() == d.back());
+                [[maybe_unused]] std::size_t idx = rng() % d.size();
+                RPNX_ASSERT(m[idx] == d[idx]);
+            }
+        }
+
+        RPNX_ASSERT(std::equal(m.begin(), m.end(), d.begin(), d.end()));
+        RPNX_ASSERT(std::equal(m.rbegin(), m.rend(), d.rbegin(), d.rend()));
+
+        auto copy = m;
+        RPNX_ASSERT(std::equal(copy.cbegin(), copy.cend(), d.begin(), d.end()));
+        std::cout << "random operations: ok (" << m.size() << " elements)" << std::endl;
+    }
+
+    // Addresses are stable while the window slides
+    {
+        rpnx::experimental::bimonoque< int > m;
+        std::deque< int* > addresses;
+        for (int i = 0; i < 1000; i++)
+        {
+            m.push_back(i);
+            addresses.push_back(&m.back());
+        }
+        for (int i = 1000; i < 100000; i++)
+        {
+            m.pop_front();
+            addresses.pop_front();
+            m.push_back(i);
+            addresses.push_back(&m.back());
+            RPNX_ASSERT(&m.front() == addresses.front());
+            RPNX_ASSERT(*addresses.front() == i - 999);
+        }
+        for (std::size_t i = 0; i < addresses.size(); i += 97)
+        {
+            RPNX_ASSERT(&m[i] == addresses[i]);
+        }
+        std::cout << "stable addresses: ok" << std::endl;
+    }
+
+    // A steady state sliding window recycles blocks instead of allocating
+    for (bool forward : {true, false})
+    {
+        rpnx::experimental::bimonoque< std::uint64_t, counting_allocator< std::uint64_t > > window;
+        std::size_t const window_size = 4096;
+
+        auto slide = [&](std::uint64_t value) {
+            if (forward)
+            {
+                window.push_back(value);
+                if (window.size() > window_size)
+                    window.pop_front();
+            }
+            else
+            {
+                window.push_front(value);
+                if (window.size() > window_size)
+                    window.pop_back();
+            }
+        };
+
+        for (std::uint64_t i = 0; i < 8 * window_size; i++)
+            slide(i);
+
+        std::size_t allocations_after_warmup = g_block_allocations;
+
+        for (std::uint64_t i = 8 * window_size; i < 1000 * window_size; i++)
+            slide(i);
+
+        RPNX_ASSERT(g_block_allocations == allocations_after_warmup);
+        RPNX_ASSERT(window.size() == window_size);
+        RPNX_ASSERT((forward ? window.front() : window.back()) == 1000 * window_size - window_size);
+        std::cout << (forward ? "forward" : "backward") << " sliding window: ok, " << allocations_after_warmup << " block allocations during warmup, "
+                  << g_block_allocations - allocations_after_warmup << " after" << std::endl;
+        g_block_allocations = 0;
+    }
+
+    return 0;
+}
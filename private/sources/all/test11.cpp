@@ -0,0 +1,137 @@
+#include "rpnx/experimental/conveyor.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+static std::size_t g_allocations = 0;
+static std::size_t g_deallocations = 0;
+static int g_live_objects = 0;
+
+template < typename T >
+struct counting_allocator
+{
+    using value_type = T;
+
+    counting_allocator() noexcept = default;
+
+    template < typename T2 >
+    counting_allocator(counting_allocator< T2 > const&) noexcept
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        g_allocations++;
+        return std::allocator< T >().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        g_deallocations++;
+        std::allocator< T >().deallocate(p, n);
+    }
+
+    bool operator==(counting_allocator const&) const noexcept
+    {
+        return true;
+    }
+
+    bool operator!=(counting_allocator const&) const noexcept
+    {
+        return false;
+    }
+};
+
+struct request_node
+{
+    std::string m_name;
+    request_node* m_parent;
+
+    request_node(std::string name, request_node* parent) : m_name(std::move(name)), m_parent(parent)
+    {
+        g_live_objects++;
+    }
+
+    ~request_node()
+    {
+        g_live_objects--;
+    }
+};
+
+struct point
+{
+    double x;
+    double y;
+};
+
+int main()
+{
+    // Non-trivial objects are destroyed on reset, and blocks are reused afterwards
+    {
+        rpnx::experimental::conveyor< request_node, counting_allocator< request_node > > arena(4096);
+
+        for (int round = 0; round < 10; round++)
+        {
+            request_node* parent = nullptr;
+            for (int i = 0; i < 1000; i++)
+            {
+                parent = arena.emplace("node " + std::to_string(i), parent);
+            }
+            RPNX_ASSERT(g_live_objects == 1000);
+            RPNX_ASSERT(parent->m_parent->m_name == "node 998");
+
+            std::size_t allocations_before_reset = g_allocations;
+            arena.reset();
+            RPNX_ASSERT(g_live_objects == 0);
+
+            if (round == 0)
+            {
+                std::cout << "first round used " << allocations_before_reset << " blocks of " << arena.block_capacity() << " objects" << std::endl;
+            }
+        }
+        RPNX_ASSERT(g_allocations == (1000 + arena.block_capacity() - 1) / arena.block_capacity());
+    }
+    RPNX_ASSERT(g_allocations == g_deallocations);
+    std::cout << "non-trivial reset: ok" << std::endl;
+
+    // Trivially destructible objects and raw aligned storage
+    {
+        g_allocations = 0;
+        g_deallocations = 0;
+        rpnx::experimental::conveyor< std::byte, counting_allocator< std::byte > > bytes;
+        for (int round = 0; round < 100; round++)
+        {
+            for (int i = 0; i < 5000; i++)
+            {
+                std::size_t alignment = std::size_t(1) << (i % 7);
+                std::byte* p = bytes.allocate(1 + i % 100, alignment);
+                RPNX_ASSERT(reinterpret_cast< std::uintptr_t >(p) % alignment == 0);
+                p[0] = std::byte(i);
+            }
+            std::byte* big = bytes.allocate(1 << 20, 64);
+            RPNX_ASSERT(reinterpret_cast< std::uintptr_t >(big) % 64 == 0);
+            big[(1 << 20) - 1] = std::byte(1);
+            bytes.reset();
+        }
+
+        // one oversized block per round, regular blocks only during the first round
+        std::size_t regular_blocks = g_allocations - 100;
+        RPNX_ASSERT(regular_blocks < 10);
+        std::cout << "raw storage: ok (" << regular_blocks << " regular blocks)" << std::endl;
+
+        rpnx::experimental::conveyor< point > points(256);
+        [[maybe_unused]] point* first = points.emplace(point{1, 2});
+        for (int i = 0; i < 100; i++)
+            points.emplace(point{double(i), double(i)});
+        RPNX_ASSERT(first->x == 1 && first->y == 2);
+
+        auto moved = std::move(points);
+        RPNX_ASSERT(first->x == 1);
+        moved.reset();
+    }
+    RPNX_ASSERT(g_allocations == g_deallocations);
+    std::cout << "trivial reset: ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include "rpnx/experimental/conveyor_resource.hpp"
+#include "rpnx/experimental/monoque.hpp"
+#include "rpnx/serial_traits.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <vector>
+
+static std::size_t g_allocations = 0;
+
+template < typename T >
+struct counting_allocator
+{
+    using value_type = T;
+
+    counting_allocator() noexcept = default;
+
+    template < typename T2 >
+    counting_allocator(counting_allocator< T2 > const&) noexcept
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        g_allocations++;
+        return std::allocator< T >().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        std::allocator< T >().deallocate(p, n);
+    }
+
+    bool operator==(counting_allocator const&) const noexcept
+    {
+        return true;
+    }
+
+    bool operator!=(counting_allocator const&) const noexcept
+    {
+        return false;
+    }
+};
+
+int main()
+{
+    using resource_type = rpnx::experimental::basic_conveyor_resource< counting_allocator< std::byte > >;
+    resource_type resource;
+
+    // std::pmr containers; after the first round the arena's blocks are reused
+    [[maybe_unused]] std::size_t first_round_allocations = 0;
+    for (int round = 0; round < 10; round++)
+    {
+        {
+            std::pmr::vector< std::pmr::string > names(&resource);
+            std::pmr::map< int, std::pmr::string > by_id(&resource);
+            for (int i = 0; i < 200; i++)
+            {
+                names.emplace_back("a string long enough to defeat the small string optimization " + std::to_string(i));
+                by_id.emplace(i, names.back());
+            }
+            RPNX_ASSERT(names[150] == by_id.at(150));
+            RPNX_ASSERT(names[150].get_allocator().resource() == &resource);
+        }
+        resource.reset();
+        if (round == 0)
+        {
+            first_round_allocations = g_allocations;
+        }
+    }
+    RPNX_ASSERT(g_allocations == first_round_allocations);
+    std::size_t warm_allocations = g_allocations;
+    std::cout << "pmr containers: ok (" << warm_allocations << " upstream allocations)" << std::endl;
+
+    // Classic allocator adapter with rpnx and std containers
+    for (int round = 0; round < 10; round++)
+    {
+        {
+            using allocator = rpnx::experimental::conveyor_allocator< std::uint64_t, counting_allocator< std::byte > >;
+            rpnx::experimental::monoque< std::uint64_t, allocator > values{allocator(resource)};
+            std::map< int, int, std::less< int >, rpnx::experimental::conveyor_allocator< std::pair< int const, int >, counting_allocator< std::byte > > > squares{
+                allocator(resource)};
+            for (int i = 0; i < 500; i++)
+            {
+                values.push_back(i);
+                squares.emplace(i, i * i);
+            }
+            RPNX_ASSERT(values[499] == 499);
+            RPNX_ASSERT(squares.at(20) == 400);
+            RPNX_ASSERT(values.get_allocator() == squares.get_allocator());
+        }
+        resource.reset();
+    }
+    RPNX_ASSERT(g_allocations - warm_allocations < 10);
+    std::cout << "classic allocator: ok (" << g_allocations - warm_allocations << " additional upstream allocations)" << std::endl;
+
+    // Deserialize into an arena-backed container
+    {
+        std::vector< std::uint32_t > original;
+        for (std::uint32_t i = 0; i < 100; i++)
+        {
+            original.push_back(i * 7919);
+        }
+        std::vector< std::uint8_t > bytes;
+        rpnx::quick_iterator_serialize(original, std::back_inserter(bytes));
+
+        std::pmr::vector< std::uint32_t > decoded(&resource);
+        std::size_t used = 0;
+        rpnx::quick_generator_deserialize(decoded, [&](std::size_t n) {
+            auto it = bytes.cbegin() + used;
+            used += n;
+            RPNX_ASSERT(used <= bytes.size());
+            return it;
+        });
+        RPNX_ASSERT(decoded.size() == original.size());
+        RPNX_ASSERT(std::equal(decoded.begin(), decoded.end(), original.begin()));
+    }
+    resource.release();
+    std::cout << "deserialize: ok" << std::endl;
+
+    // Allocations larger than a block and over-aligned allocations
+    {
+        std::pmr::memory_resource* r = &resource;
+        [[maybe_unused]] void* big = r->allocate(1 << 16, 64);
+        RPNX_ASSERT(reinterpret_cast< std::uintptr_t >(big) % 64 == 0);
+        [[maybe_unused]] void* small = r->allocate(3, 1);
+        RPNX_ASSERT(small != nullptr);
+        RPNX_ASSERT(r->is_equal(resource));
+        rpnx::experimental::conveyor_resource other;
+        RPNX_ASSERT(!r->is_equal(other));
+        resource.reset();
+    }
+    std::cout << "raw resource: ok" << std::endl;
+
+    return 0;
+}
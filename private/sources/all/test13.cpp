@@ -0,0 +1,157 @@
+#include "rpnx/derivator.hpp"
+#include "rpnx/experimental/channel.hpp"
+#include "rpnx/experimental/pool_allocator.hpp"
+#include "rpnx/experimental/priority_dispatcher.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <list>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Blocks are exchanged between threads through a shared table of slots, so most blocks are freed
+// by a different thread than the one that allocated them.
+void cross_thread_exchange()
+{
+    constexpr std::size_t slot_count = 1024;
+    constexpr std::size_t sizes[] = {1, 16, 17, 48, 100, 256, 300, 1000, 4096, 5000};
+    constexpr std::size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+
+    struct slot
+    {
+        std::atomic< unsigned char* > m_ptr{nullptr};
+    };
+    std::vector< slot > slots(slot_count * size_count);
+
+    std::size_t thread_count = std::max(4u, std::thread::hardware_concurrency());
+    std::vector< std::thread > threads;
+    for (std::size_t t = 0; t < thread_count; t++)
+    {
+        threads.emplace_back([&, t] {
+            std::uint64_t x = 0x9E3779B97F4A7C15ull * (t + 1);
+            for (int i = 0; i < 200000; i++)
+            {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                std::size_t size_index = x % size_count;
+                std::size_t size = sizes[size_index];
+                auto* p = static_cast< unsigned char* >(rpnx::experimental::pool_allocate(size));
+                RPNX_ASSERT(reinterpret_cast< std::uintptr_t >(p) % alignof(std::max_align_t) == 0);
+                std::memset(p, int(size & 0xFF), size);
+
+                unsigned char* old = slots[size_index * slot_count + (x >> 32) % slot_count].m_ptr.exchange(p);
+                if (old != nullptr)
+                {
+                    RPNX_ASSERT(old[0] == (size & 0xFF) && old[size - 1] == (size & 0xFF));
+                    rpnx::experimental::pool_deallocate(old, size);
+                }
+            }
+        });
+    }
+    for (auto& th : threads)
+    {
+        th.join();
+    }
+
+    for (std::size_t i = 0; i < slots.size(); i++)
+    {
+        if (unsigned char* p = slots[i].m_ptr.load())
+        {
+            rpnx::experimental::pool_deallocate(p, sizes[i / slot_count]);
+        }
+    }
+    std::cout << "cross thread exchange: ok (" << thread_count << " threads)" << std::endl;
+}
+
+struct payload
+{
+    std::string m_name;
+    int m_value;
+};
+
+int main()
+{
+    cross_thread_exchange();
+
+    // Standard containers
+    {
+        std::list< int, rpnx::experimental::pool_allocator< int > > values;
+        std::map< int, std::string, std::less< int >, rpnx::experimental::pool_allocator< std::pair< int const, std::string > > > names;
+        for (int i = 0; i < 10000; i++)
+        {
+            values.push_back(i);
+            names.emplace(i, std::to_string(i));
+        }
+        RPNX_ASSERT(values.back() == 9999);
+        RPNX_ASSERT(names.at(1234) == "1234");
+
+        // Over-aligned types fall back to the aligned global allocator
+        struct alignas(64) wide
+        {
+            char m_bytes[64];
+        };
+        std::vector< wide, rpnx::experimental::pool_allocator< wide > > aligned(3);
+        RPNX_ASSERT(reinterpret_cast< std::uintptr_t >(aligned.data()) % 64 == 0);
+    }
+    std::cout << "standard containers: ok" << std::endl;
+
+    // derivator with a pool allocator
+    {
+        using pool_derivator = rpnx::basic_derivator< rpnx::experimental::pool_allocator< void >, void, int, payload >;
+        pool_derivator a;
+        RPNX_ASSERT(!a.has_value());
+        a = payload{"first", 1};
+        pool_derivator b = a;
+        RPNX_ASSERT(b.get< payload >().m_name == "first");
+        b = 42;
+        RPNX_ASSERT(b.get< int >() == 42);
+        b = a;
+        RPNX_ASSERT(b.get< payload >().m_value == 1);
+        pool_derivator c = std::move(b);
+        RPNX_ASSERT(c.get< payload >().m_name == "first");
+        c.emplace< int >(7);
+        RPNX_ASSERT(c.index() == 1);
+    }
+    std::cout << "derivator: ok" << std::endl;
+
+    // channel with a pool allocator
+    {
+        rpnx::experimental::channel< payload, rpnx::experimental::pool_allocator< payload > > chan;
+        std::thread producer([&] {
+            for (int i = 0; i < 10000; i++)
+            {
+                chan.submit(payload{"value", i});
+            }
+        });
+        long long sum = 0;
+        for (int i = 0; i < 10000; i++)
+        {
+            sum += chan.receive().m_value;
+        }
+        producer.join();
+        RPNX_ASSERT(sum == 9999ll * 10000 / 2);
+
+        chan.submit(payload{"left in the channel", 0});
+    }
+    std::cout << "channel: ok" << std::endl;
+
+    // priority_dispatcher functor copies come from the pool
+    {
+        std::atomic< int > count{0};
+        rpnx::experimental::priority_dispatcher dispatcher;
+        for (int i = 0; i < 10000; i++)
+        {
+            dispatcher.submit([&count, text = std::string(40, 'x')] { count += int(text.size()); }, i % 3);
+        }
+        dispatcher.finish_all();
+        RPNX_ASSERT(count == 400000);
+    }
+    std::cout << "priority_dispatcher: ok" << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,361 @@
+#include "rpnx/experimental/avl_tree.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::size_t g_live_allocations = 0;
+
+template < typename T >
+struct counting_allocator
+{
+    using value_type = T;
+
+    counting_allocator() noexcept = default;
+
+    template < typename T2 >
+    counting_allocator(counting_allocator< T2 > const&) noexcept
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        g_live_allocations++;
+        return std::allocator< T >().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        g_live_allocations--;
+        std::allocator< T >().deallocate(p, n);
+    }
+
+    bool operator==(counting_allocator const&) const noexcept
+    {
+        return true;
+    }
+
+    bool operator!=(counting_allocator const&) const noexcept
+    {
+        return false;
+    }
+};
+
+using tree_type = rpnx::experimental::avl_tree< int, std::string, std::less< int >, counting_allocator< std::pair< int const, std::string > > >;
+
+// A node with 8 byte keys and values fits in one cache line on 64 bit targets.
+static_assert(sizeof(void*) != 8 || sizeof(rpnx::experimental::avl_tree_node< std::int64_t, std::int64_t, std::less< std::int64_t >, std::allocator< std::pair< std::int64_t const, std::int64_t > > >) == 64);
+
+template < typename Tree >
+bool matches(Tree const& tree, std::map< int, std::string > const& reference)
+{
+    return tree.size() == reference.size() && std::equal(tree.begin(), tree.end(), reference.begin(), reference.end());
+}
+
+int main()
+{
+    {
+        tree_type tree;
+        std::map< int, std::string > reference;
+        std::mt19937 rng(1234);
+
+        for (int i = 0; i < 200000; i++)
+        {
+            int key = int(rng() % 5000);
+            switch (rng() % 6)
+            {
+            case 0:
+            case 1:
+            {
+                [[maybe_unused]] auto a = tree.insert({key, std::to_string(i)});
+                [[maybe_unused]] auto b = reference.insert({key, std::to_string(i)});
+                RPNX_ASSERT(a.second == b.second && a.first->second == b.first->second);
+                break;
+            }
+            case 2:
+            {
+                [[maybe_unused]] auto a = tree.try_emplace(key, "try");
+                [[maybe_unused]] auto b = reference.try_emplace(key, "try");
+                RPNX_ASSERT(a.second == b.second);
+                break;
+            }
+            case 3:
+            {
+                [[maybe_unused]] std::size_t a = tree.erase(key);
+                [[maybe_unused]] std::size_t b = reference.erase(key);
+                RPNX_ASSERT(a == b);
+                break;
+            }
+            case 4:
+            {
+                auto a = tree.lower_bound(key);
+                auto b = reference.lower_bound(key);
+                RPNX_ASSERT((a == tree.end()) == (b == reference.end()));
+                if (a != tree.end())
+                {
+                    RPNX_ASSERT(a->first == b->first);
+                    [[maybe_unused]] auto c = tree.upper_bound(key);
+                    [[maybe_unused]] auto d = reference.upper_bound(key);
+                    RPNX_ASSERT((c == tree.end()) == (d == reference.end()));
+                    // erase through an iterator, checking the returned successor
+                    [[maybe_unused]] auto next_a = tree.erase(a);
+                    [[maybe_unused]] auto next_b = reference.erase(b);
+                    RPNX_ASSERT((next_a == tree.end()) == (next_b == reference.end()));
+                    RPNX_ASSERT(next_a == tree.end() || next_a->first == next_b->first);
+                }
+                break;
+            }
+            case 5:
+            {
+                tree[key] += "x";
+                reference[key] += "x";
+                RPNX_ASSERT(tree.at(key) == reference.at(key));
+                break;
+            }
+            }
+
+            if (i % 10000 == 0)
+            {
+                RPNX_ASSERT(tree.is_valid());
+                RPNX_ASSERT(matches(tree, reference));
+            }
+        }
+        RPNX_ASSERT(tree.is_valid());
+        RPNX_ASSERT(matches(tree, reference));
+        RPNX_ASSERT(g_live_allocations == tree.size());
+        std::cout << "random operations: ok (" << tree.size() << " elements)" << std::endl;
+
+        // Reverse iteration and iterator stability
+        auto it = tree.end();
+        auto rit = reference.end();
+        while (it != tree.begin())
+        {
+            --it;
+            --rit;
+            RPNX_ASSERT(it->first == rit->first);
+        }
+        RPNX_ASSERT(std::equal(tree.rbegin(), tree.rend(), reference.rbegin()));
+
+        auto stable = tree.find(tree.begin()->first);
+        [[maybe_unused]] std::string* stable_value = &stable->second;
+        for (int i = 0; i < 1000; i++)
+        {
+            tree.erase(int(rng() % 5000) + 1 + stable->first);
+        }
+        RPNX_ASSERT(&tree.find(stable->first)->second == stable_value);
+
+        // Copy, move and erase of ranges
+        tree_type copy = tree;
+        RPNX_ASSERT(copy.is_valid() && copy == tree);
+        tree_type moved = std::move(copy);
+        RPNX_ASSERT(copy.empty() && moved == tree);
+        copy = moved;
+        moved.erase(moved.lower_bound(1000), moved.lower_bound(3000));
+        RPNX_ASSERT(moved.is_valid());
+        RPNX_ASSERT(moved.lower_bound(1000) == moved.lower_bound(3000));
+        RPNX_ASSERT(copy == tree);
+        swap(copy, moved);
+        RPNX_ASSERT(moved == tree && copy != tree);
+    }
+    RPNX_ASSERT(g_live_allocations == 0);
+
+    // Sequential inserts stay balanced
+    {
+        rpnx::experimental::avl_tree< std::uint64_t, std::uint64_t > tree;
+        for (std::uint64_t i = 0; i < 100000; i++)
+        {
+            tree.emplace(i, i * i);
+        }
+        RPNX_ASSERT(tree.is_valid());
+        RPNX_ASSERT(tree.find(99999)->second == 99999ull * 99999ull);
+        for (std::uint64_t i = 0; i < 100000; i += 2)
+        {
+            tree.erase(i);
+        }
+        RPNX_ASSERT(tree.is_valid() && tree.size() == 50000);
+        RPNX_ASSERT(tree.begin()->first == 1);
+        RPNX_ASSERT(tree.count(2) == 0 && tree.contains(3));
+    }
+    std::cout << "sequential operations: ok" << std::endl;
+
+    // Order statistics
+    {
+        rpnx::experimental::avl_tree< int, int > tree;
+        std::map< int, int > reference;
+        std::mt19937 rng(99);
+        for (int i = 0; i < 20000; i++)
+        {
+            int key = int(rng() % 10000);
+            if (rng() % 3 == 0)
+            {
+                tree.erase(key);
+                reference.erase(key);
+            }
+            else
+            {
+                tree.emplace(key, i);
+                reference.emplace(key, i);
+            }
+
+            if (i % 100 == 0)
+            {
+                int low = int(rng() % 10000);
+                int high = int(rng() % 10000);
+                [[maybe_unused]] std::size_t expected_rank = std::size_t(std::distance(reference.begin(), reference.lower_bound(low)));
+                RPNX_ASSERT(tree.rank(low) == expected_rank);
+                [[maybe_unused]] std::size_t expected_count = low < high ? std::size_t(std::distance(reference.lower_bound(low), reference.lower_bound(high))) : 0;
+                RPNX_ASSERT(tree.count_range(low, high) == expected_count);
+
+                if (!reference.empty())
+                {
+                    std::size_t index = rng() % reference.size();
+                    [[maybe_unused]] auto it = tree.nth(index);
+                    RPNX_ASSERT(it->first == std::next(reference.begin(), std::ptrdiff_t(index))->first);
+                    RPNX_ASSERT(tree.index_of(it) == index);
+                }
+                RPNX_ASSERT(tree.nth(tree.size()) == tree.end());
+                RPNX_ASSERT(tree.index_of(tree.end()) == tree.size());
+            }
+        }
+        RPNX_ASSERT(tree.is_valid());
+
+        // A copy keeps the subtree sizes
+        auto const copy = tree;
+        RPNX_ASSERT(copy.is_valid());
+        for (std::size_t i = 0; i < copy.size(); i += 97)
+        {
+            RPNX_ASSERT(copy.index_of(copy.nth(i)) == i);
+        }
+    }
+    std::cout << "order statistics: ok" << std::endl;
+
+    // Split, join and range erase
+    {
+        std::mt19937 rng(7);
+        for (int round = 0; round < 200; round++)
+        {
+            tree_type tree;
+            std::map< int, std::string > reference;
+            int n = int(rng() % 3000);
+            for (int i = 0; i < n; i++)
+            {
+                int key = int(rng() % 10000);
+                tree.emplace(key, "v");
+                reference.emplace(key, "v");
+            }
+
+            int pivot = int(rng() % 10000);
+            tree_type upper = tree.split(pivot);
+            RPNX_ASSERT(tree.is_valid() && upper.is_valid());
+            RPNX_ASSERT(tree.size() + upper.size() == reference.size());
+            RPNX_ASSERT(std::equal(tree.begin(), tree.end(), reference.begin(), reference.lower_bound(pivot)));
+            RPNX_ASSERT(std::equal(upper.begin(), upper.end(), reference.lower_bound(pivot), reference.end()));
+
+            // Joining in the wrong order is rejected and leaves both trees unchanged
+            if (!tree.empty() && !upper.empty())
+            {
+                [[maybe_unused]] bool threw = false;
+                try
+                {
+                    upper.join(std::move(tree));
+                }
+                catch (std::invalid_argument const&)
+                {
+                    threw = true;
+                }
+                RPNX_ASSERT(threw && !tree.empty());
+            }
+            tree.join(std::move(upper));
+            RPNX_ASSERT(upper.empty());
+            RPNX_ASSERT(tree.is_valid() && matches(tree, reference));
+
+            int low = int(rng() % 10000);
+            int high = low + int(rng() % 3000);
+            [[maybe_unused]] std::size_t erased = tree.erase_range(low, high);
+            RPNX_ASSERT(erased == std::size_t(std::distance(reference.lower_bound(low), reference.lower_bound(high))));
+            reference.erase(reference.lower_bound(low), reference.lower_bound(high));
+            RPNX_ASSERT(tree.is_valid() && matches(tree, reference));
+        }
+
+        // Joining trees of very different heights
+        tree_type small;
+        tree_type large;
+        small.emplace(-1, "small");
+        for (int i = 0; i < 10000; i++)
+        {
+            large.emplace(i, "large");
+        }
+        tree_type large_copy = large;
+        small.join(std::move(large));
+        RPNX_ASSERT(small.is_valid() && small.size() == 10001 && small.begin()->first == -1);
+        large_copy.join(std::move(tree_type{{20000, "tail"}}));
+        RPNX_ASSERT(large_copy.is_valid() && large_copy.rbegin()->first == 20000);
+    }
+    RPNX_ASSERT(g_live_allocations == 0);
+    std::cout << "split and join: ok" << std::endl;
+
+    // Bulk load from sorted input
+    {
+        std::vector< std::pair< int, std::string > > sorted;
+        for (int i = 0; i < 100000; i++)
+        {
+            sorted.emplace_back(i * 3, std::to_string(i));
+        }
+
+        tree_type tree(rpnx::experimental::sorted_unique, sorted.begin(), sorted.end());
+        RPNX_ASSERT(tree.is_valid() && tree.size() == sorted.size());
+        RPNX_ASSERT(std::equal(tree.begin(), tree.end(), sorted.begin(), sorted.end(), [](auto const& a, auto const& b) {
+            return a.first == b.first && a.second == b.second;
+        }));
+        // The slab, its header and the tree's list of slabs are the only allocations
+        RPNX_ASSERT(g_live_allocations == 3);
+
+        // Slab nodes mix with individually allocated ones
+        tree.emplace(1, "one");
+        tree.erase(3);
+        tree.erase_range(3000, 9000);
+        tree_type upper = tree.split(150000);
+        RPNX_ASSERT(tree.is_valid() && upper.is_valid());
+        upper.clear();
+        tree.join(std::move(upper));
+
+        // Copies allocate each node on their own
+        [[maybe_unused]] std::size_t before_copy = g_live_allocations;
+        tree_type copy = tree;
+        RPNX_ASSERT(copy == tree && copy.is_valid());
+        RPNX_ASSERT(g_live_allocations == before_copy + copy.size());
+
+        // Unsorted or duplicate input is rejected and leaves the tree unchanged
+        sorted[500].first = sorted[499].first;
+        [[maybe_unused]] bool threw = false;
+        try
+        {
+            copy.assign_sorted(sorted.begin(), sorted.end());
+        }
+        catch (std::invalid_argument const&)
+        {
+            threw = true;
+        }
+        RPNX_ASSERT(threw && copy == tree);
+
+        sorted.resize(499);
+        copy.assign_sorted(sorted.begin(), sorted.end());
+        RPNX_ASSERT(copy.is_valid() && copy.size() == 499 && copy.nth(498)->first == 498 * 3);
+
+        for (int i = 0; i < 300000; i += 3)
+        {
+            tree.erase(i);
+        }
+        RPNX_ASSERT(tree.size() == 1);
+        // Erasing the last slab node returned the slab. What is left is one node and one list of slabs per tree,
+        // and the slab behind the copy.
+        RPNX_ASSERT(g_live_allocations == 2 + 3);
+    }
+    RPNX_ASSERT(g_live_allocations == 0);
+    std::cout << "bulk load: ok" << std::endl;
+
+    return 0;
+}
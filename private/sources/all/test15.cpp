@@ -0,0 +1,300 @@
+#include "rpnx/experimental/persistent_avl_tree.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+static std::atomic< std::size_t > g_live_allocations{0};
+
+template < typename T >
+struct counting_allocator
+{
+    using value_type = T;
+
+    counting_allocator() noexcept = default;
+
+    template < typename T2 >
+    counting_allocator(counting_allocator< T2 > const&) noexcept
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        g_live_allocations++;
+        return std::allocator< T >().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        g_live_allocations--;
+        std::allocator< T >().deallocate(p, n);
+    }
+
+    bool operator==(counting_allocator const&) const noexcept
+    {
+        return true;
+    }
+
+    bool operator!=(counting_allocator const&) const noexcept
+    {
+        return false;
+    }
+};
+
+using tree_type = rpnx::experimental::persistent_avl_tree< int, std::string, std::less< int >, counting_allocator< std::pair< int const, std::string > > >;
+
+template < typename Tree, typename Map >
+bool matches(Tree const& tree, Map const& reference)
+{
+    return tree.size() == reference.size() && std::equal(tree.begin(), tree.end(), reference.begin(), reference.end());
+}
+
+// Copying this throws once g_throw_countdown reaches zero.
+static int g_throw_countdown = -1;
+
+struct fragile
+{
+    int m_value = 0;
+
+    fragile(int value) : m_value(value)
+    {
+    }
+
+    fragile(fragile const& other) : m_value(other.m_value)
+    {
+        if (g_throw_countdown >= 0 && g_throw_countdown-- == 0)
+        {
+            throw std::runtime_error("fragile copy");
+        }
+    }
+
+    fragile& operator=(fragile const&) = default;
+
+    bool operator==(fragile const& other) const
+    {
+        return m_value == other.m_value;
+    }
+};
+
+int main()
+{
+    // Random operations against std::map, keeping old versions around and checking that they never change.
+    {
+        tree_type tree;
+        std::map< int, std::string > reference;
+        std::vector< std::pair< tree_type, std::map< int, std::string > > > history;
+        std::mt19937 rng(1234);
+
+        for (int i = 0; i < 100000; i++)
+        {
+            int key = int(rng() % 3000);
+            switch (rng() % 5)
+            {
+            case 0:
+            case 1:
+            {
+                [[maybe_unused]] bool a = tree.insert({key, std::to_string(i)});
+                [[maybe_unused]] bool b = reference.insert({key, std::to_string(i)}).second;
+                RPNX_ASSERT(a == b);
+                break;
+            }
+            case 2:
+            {
+                [[maybe_unused]] bool a = tree.insert_or_assign(key, std::to_string(i));
+                [[maybe_unused]] bool b = reference.insert_or_assign(key, std::to_string(i)).second;
+                RPNX_ASSERT(a == b);
+                break;
+            }
+            default:
+            {
+                [[maybe_unused]] std::size_t a = tree.erase(key);
+                [[maybe_unused]] std::size_t b = reference.erase(key);
+                RPNX_ASSERT(a == b);
+                break;
+            }
+            }
+
+            if (i % 1000 == 0)
+            {
+                RPNX_ASSERT(tree.is_valid());
+                RPNX_ASSERT(matches(tree, reference));
+                history.emplace_back(tree, reference);
+            }
+        }
+
+        for ([[maybe_unused]] auto const& [old_tree, old_reference] : history)
+        {
+            RPNX_ASSERT(old_tree.is_valid());
+            RPNX_ASSERT(matches(old_tree, old_reference));
+        }
+
+        for (int key = -1; key < 3001; key++)
+        {
+            [[maybe_unused]] auto it = tree.lower_bound(key);
+            auto ref = reference.lower_bound(key);
+            RPNX_ASSERT((it == tree.end()) == (ref == reference.end()));
+            if (ref != reference.end())
+            {
+                RPNX_ASSERT(it->first == ref->first);
+                RPNX_ASSERT(std::equal(it, tree.end(), ref, reference.end()));
+            }
+            RPNX_ASSERT(tree.rank(key) == std::size_t(std::distance(reference.begin(), ref)));
+            RPNX_ASSERT(tree.contains(key) == (reference.count(key) != 0));
+        }
+        for (std::size_t i = 0; i < tree.size(); i += 7)
+        {
+            RPNX_ASSERT(tree.nth(i) == *std::next(reference.begin(), std::ptrdiff_t(i)));
+        }
+    }
+    RPNX_ASSERT(g_live_allocations == 0);
+
+    // Copies are O(1) and modifications copy only a path.
+    {
+        tree_type tree;
+        for (int i = 0; i < 100000; i++)
+        {
+            tree.insert({i, "x"});
+        }
+        [[maybe_unused]] std::size_t nodes = g_live_allocations;
+        RPNX_ASSERT(nodes == 100000);
+
+        tree_type copy = tree;
+        RPNX_ASSERT(g_live_allocations == nodes);
+        RPNX_ASSERT(copy.shares_root_with(tree));
+
+        copy.insert_or_assign(500, "y");
+        RPNX_ASSERT(!copy.shares_root_with(tree));
+        RPNX_ASSERT(g_live_allocations - nodes <= 20);
+        RPNX_ASSERT(tree.at(500) == "x" && copy.at(500) == "y");
+
+        // Once the path is unshared it is modified in place.
+        [[maybe_unused]] std::size_t before = g_live_allocations;
+        copy.insert_or_assign(500, "z");
+        RPNX_ASSERT(g_live_allocations == before);
+
+        copy.erase(12345);
+        RPNX_ASSERT(copy.is_valid() && tree.is_valid());
+        RPNX_ASSERT(copy.size() == 99999 && tree.size() == 100000 && tree.contains(12345));
+
+        tree.clear();
+        RPNX_ASSERT(copy.is_valid() && copy.at(0) == "x");
+    }
+    RPNX_ASSERT(g_live_allocations == 0);
+
+    // A throwing copy leaves both the tree and the versions it shares nodes with unchanged.
+    {
+        using fragile_tree = rpnx::experimental::persistent_avl_tree< int, fragile >;
+        fragile_tree tree;
+        std::map< int, int > reference;
+        for (int i = 0; i < 1000; i++)
+        {
+            tree.insert({i, fragile(i)});
+            reference.emplace(i, i);
+        }
+
+        int failures = 0;
+        for (int attempt = 0; attempt < 40; attempt++)
+        {
+            fragile_tree copy = tree;
+            int key = attempt * 25;
+            g_throw_countdown = attempt % 8;
+            try
+            {
+                if (attempt % 2 == 0)
+                {
+                    copy.erase(key);
+                }
+                else
+                {
+                    copy.insert({key + 10000, fragile(key)});
+                }
+            }
+            catch (std::runtime_error const&)
+            {
+                failures++;
+                RPNX_ASSERT(copy.is_valid() && copy == tree);
+            }
+            g_throw_countdown = -1;
+            RPNX_ASSERT(tree.is_valid() && tree.size() == 1000);
+        }
+        RPNX_ASSERT(failures > 0);
+    }
+
+    // One writer publishes versions while readers take snapshots. Version v holds exactly the keys [v - 1000, v).
+    {
+        constexpr int versions = 20000;
+        rpnx::experimental::atomic_snapshot< tree_type > published;
+        std::atomic< bool > done{false};
+
+        std::size_t reader_count = std::max(2u, std::thread::hardware_concurrency() - 1);
+        std::vector< std::thread > readers;
+        std::atomic< std::size_t > snapshots_checked{0};
+        for (std::size_t r = 0; r < reader_count; r++)
+        {
+            readers.emplace_back([&] {
+                while (!done.load())
+                {
+                    std::shared_ptr< tree_type const > snapshot = published.load();
+                    if (snapshot->empty())
+                    {
+                        continue;
+                    }
+                    [[maybe_unused]] int last = snapshot->nth(snapshot->size() - 1).first;
+                    [[maybe_unused]] int first = snapshot->begin()->first;
+                    RPNX_ASSERT(first == std::max(0, last - 999));
+                    RPNX_ASSERT(snapshot->size() == std::size_t(last - first + 1));
+                    RPNX_ASSERT(snapshot->at(first) == std::to_string(first));
+
+                    tree_type copy = published.snapshot();
+                    RPNX_ASSERT(copy.is_valid());
+                    snapshots_checked++;
+                }
+            });
+        }
+
+        tree_type tree;
+        for (int v = 0; v < versions; v++)
+        {
+            tree.insert({v, std::to_string(v)});
+            if (v >= 1000)
+            {
+                tree.erase(v - 1000);
+            }
+            published.store(tree);
+        }
+        done = true;
+        for (auto& th : readers)
+        {
+            th.join();
+        }
+        RPNX_ASSERT(snapshots_checked > 0);
+
+        // update() retries against concurrent writers.
+        std::vector< std::thread > writers;
+        for (int w = 0; w < 4; w++)
+        {
+            writers.emplace_back([&, w] {
+                for (int i = 0; i < 500; i++)
+                {
+                    published.update([&](tree_type& t) {
+                        t.insert_or_assign(100000 + w * 1000 + i, "w");
+                    });
+                }
+            });
+        }
+        for (auto& th : writers)
+        {
+            th.join();
+        }
+        RPNX_ASSERT(published.load()->size() == 1000 + 4 * 500);
+    }
+    RPNX_ASSERT(g_live_allocations == 0);
+
+    std::cout << "persistent_avl_tree tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,306 @@
+#include "rpnx/experimental/btree_map.hpp"
+#include "rpnx/serial_traits.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+static std::size_t g_live_allocations = 0;
+
+template < typename T >
+struct counting_allocator
+{
+    using value_type = T;
+
+    counting_allocator() noexcept = default;
+
+    template < typename T2 >
+    counting_allocator(counting_allocator< T2 > const&) noexcept
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        g_live_allocations++;
+        return std::allocator< T >().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        g_live_allocations--;
+        std::allocator< T >().deallocate(p, n);
+    }
+
+    bool operator==(counting_allocator const&) const noexcept
+    {
+        return true;
+    }
+
+    bool operator!=(counting_allocator const&) const noexcept
+    {
+        return false;
+    }
+};
+
+template < typename Tree, typename Map >
+bool matches(Tree const& tree, Map const& reference)
+{
+    return tree.size() == reference.size() && std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()) &&
+           std::equal(tree.rbegin(), tree.rend(), reference.rbegin(), reference.rend());
+}
+
+// Random operations against std::map. Small fanouts split and merge constantly.
+template < typename Tree, typename Key, typename MakeKey >
+void random_operations(MakeKey make_key, int operations, int key_range)
+{
+    {
+        Tree tree;
+        std::map< Key, std::string > reference;
+        std::mt19937 rng(1234);
+
+        for (int i = 0; i < operations; i++)
+        {
+            Key key = make_key(int(rng() % key_range));
+            switch (rng() % 7)
+            {
+            case 0:
+            case 1:
+            {
+                [[maybe_unused]] auto a = tree.insert({key, std::to_string(i)});
+                [[maybe_unused]] auto b = reference.insert({key, std::to_string(i)});
+                RPNX_ASSERT(a.second == b.second && a.first->second == b.first->second);
+                break;
+            }
+            case 2:
+            {
+                [[maybe_unused]] auto a = tree.insert_or_assign(key, std::to_string(i));
+                [[maybe_unused]] auto b = reference.insert_or_assign(key, std::to_string(i));
+                RPNX_ASSERT(a.second == b.second && a.first->first == key);
+                break;
+            }
+            case 3:
+            {
+                [[maybe_unused]] std::size_t a = tree.erase(key);
+                [[maybe_unused]] std::size_t b = reference.erase(key);
+                RPNX_ASSERT(a == b);
+                break;
+            }
+            case 4:
+            {
+                // erase(iterator) returns the following element.
+                auto a = tree.lower_bound(key);
+                auto b = reference.lower_bound(key);
+                RPNX_ASSERT((a == tree.end()) == (b == reference.end()));
+                if (b != reference.end())
+                {
+                    a = tree.erase(a);
+                    b = reference.erase(b);
+                    RPNX_ASSERT((a == tree.end()) == (b == reference.end()));
+                    RPNX_ASSERT(b == reference.end() || a->first == b->first);
+                }
+                break;
+            }
+            case 5:
+            {
+                [[maybe_unused]] auto a = tree.upper_bound(key);
+                [[maybe_unused]] auto b = reference.upper_bound(key);
+                RPNX_ASSERT((a == tree.end()) == (b == reference.end()));
+                RPNX_ASSERT(b == reference.end() || a->first == b->first);
+                RPNX_ASSERT(tree.contains(key) == (reference.count(key) != 0));
+                break;
+            }
+            default:
+                tree[key] += "x";
+                reference[key] += "x";
+                break;
+            }
+
+            if (i % 997 == 0)
+            {
+                RPNX_ASSERT(tree.is_valid());
+                RPNX_ASSERT(matches(tree, reference));
+            }
+        }
+        RPNX_ASSERT(tree.is_valid());
+        RPNX_ASSERT(matches(tree, reference));
+
+        // Erase everything in random order through the key, then the rest by range.
+        std::vector< Key > keys;
+        for (auto const& x : reference)
+        {
+            keys.push_back(x.first);
+        }
+        std::shuffle(keys.begin(), keys.end(), rng);
+        keys.resize(keys.size() / 2);
+        for (auto const& key : keys)
+        {
+            [[maybe_unused]] std::size_t erased = tree.erase(key);
+            RPNX_ASSERT(erased == 1);
+            reference.erase(key);
+        }
+        RPNX_ASSERT(tree.is_valid() && matches(tree, reference));
+
+        auto first = std::next(tree.begin(), std::ptrdiff_t(tree.size() / 4));
+        auto last = std::next(first, std::ptrdiff_t(tree.size() / 2));
+        Key first_key = first->first;
+        bool last_is_end = last == tree.end();
+        Key last_key = last_is_end ? Key() : last->first;
+        [[maybe_unused]] auto after = tree.erase(first, last);
+        reference.erase(reference.find(first_key), last_is_end ? reference.end() : reference.find(last_key));
+        RPNX_ASSERT(tree.is_valid() && matches(tree, reference));
+        RPNX_ASSERT(last_is_end ? after == tree.end() : after->first == last_key);
+
+        tree.erase(tree.begin(), tree.end());
+        RPNX_ASSERT(tree.empty() && tree.is_valid() && tree.begin() == tree.end());
+    }
+    RPNX_ASSERT(g_live_allocations == 0);
+}
+
+int main()
+{
+    auto int_key = [](int x) { return std::int32_t(x); };
+    auto u64_key = [](int x) { return std::uint64_t(x) * 0x9E3779B97F4A7C15ull; };
+    auto string_key = [](int x) { return "key" + std::to_string(x); };
+
+    using small_int_tree = rpnx::experimental::btree_map< std::int32_t, std::string, std::less< std::int32_t >, counting_allocator< std::pair< std::int32_t const, std::string > >, 4 >;
+    using odd_int_tree = rpnx::experimental::btree_map< std::int32_t, std::string, std::less< std::int32_t >, counting_allocator< std::pair< std::int32_t const, std::string > >, 7 >;
+    using default_u64_tree = rpnx::experimental::btree_map< std::uint64_t, std::string, std::less< std::uint64_t >, counting_allocator< std::pair< std::uint64_t const, std::string > > >;
+    using string_tree = rpnx::experimental::btree_map< std::string, std::string, std::less< std::string >, counting_allocator< std::pair< std::string const, std::string > >, 5 >;
+
+    random_operations< small_int_tree, std::int32_t >(int_key, 100000, 3000);
+    random_operations< odd_int_tree, std::int32_t >(int_key, 100000, 3000);
+    random_operations< default_u64_tree, std::uint64_t >(u64_key, 200000, 20000);
+    random_operations< string_tree, std::string >(string_key, 50000, 2000);
+
+    // The SIMD search agrees with a plain scan, including negative and unsigned keys with the top bit set.
+    {
+        [[maybe_unused]] std::int32_t signed_keys[] = {-100, -5, 0, 3, 3, 7, 1000, 2000000000, 2000000001};
+        [[maybe_unused]] std::uint64_t unsigned_keys[] = {0, 1, 5, 1ull << 63, (1ull << 63) + 1, ~0ull - 1};
+        using signed_search [[maybe_unused]] = rpnx::experimental::btree_key_search< std::int32_t, std::less< std::int32_t > >;
+        using unsigned_search [[maybe_unused]] = rpnx::experimental::btree_key_search< std::uint64_t, std::less< std::uint64_t > >;
+        for ([[maybe_unused]] std::int32_t key : {-101, -100, -6, 0, 3, 4, 999, 2000000000, 2147483647})
+        {
+            for (std::size_t n = 0; n <= 9; n++)
+            {
+                RPNX_ASSERT(signed_search::count< false >({}, signed_keys, n, key) == std::size_t(std::lower_bound(signed_keys, signed_keys + n, key) - signed_keys));
+                RPNX_ASSERT(signed_search::count< true >({}, signed_keys, n, key) == std::size_t(std::upper_bound(signed_keys, signed_keys + n, key) - signed_keys));
+            }
+        }
+        for ([[maybe_unused]] std::uint64_t key : {0ull, 2ull, 1ull << 63, (1ull << 63) + 2, ~0ull})
+        {
+            for (std::size_t n = 0; n <= 6; n++)
+            {
+                RPNX_ASSERT(unsigned_search::count< false >({}, unsigned_keys, n, key) == std::size_t(std::lower_bound(unsigned_keys, unsigned_keys + n, key) - unsigned_keys));
+                RPNX_ASSERT(unsigned_search::count< true >({}, unsigned_keys, n, key) == std::size_t(std::upper_bound(unsigned_keys, unsigned_keys + n, key) - unsigned_keys));
+            }
+        }
+
+        // 64 bit keys whose halves order differently, for the compare built from 32 bit halves.
+        [[maybe_unused]] std::int64_t wide_keys[] = {std::numeric_limits< std::int64_t >::min(), -(std::int64_t(1) << 32), -1, 0, 0xffffffffll, std::int64_t(1) << 32, (std::int64_t(1) << 32) + 0x80000000ll};
+        using wide_search [[maybe_unused]] = rpnx::experimental::btree_key_search< std::int64_t, std::less< std::int64_t > >;
+        std::int64_t wide_probes[] = {std::numeric_limits< std::int64_t >::min(), -(std::int64_t(1) << 32) - 1, -2, -1, 0, 0x7fffffffll, 0xffffffffll, 0x100000000ll, 0x17fffffffll, std::numeric_limits< std::int64_t >::max()};
+        for ([[maybe_unused]] std::int64_t key : wide_probes)
+        {
+            for (std::size_t n = 0; n <= 7; n++)
+            {
+                RPNX_ASSERT(wide_search::count< false >({}, wide_keys, n, key) == std::size_t(std::lower_bound(wide_keys, wide_keys + n, key) - wide_keys));
+                RPNX_ASSERT(wide_search::count< true >({}, wide_keys, n, key) == std::size_t(std::upper_bound(wide_keys, wide_keys + n, key) - wide_keys));
+            }
+        }
+    }
+
+    // Sorted input fills every leaf; copies, moves and swaps.
+    {
+        using tree_type = rpnx::experimental::btree_map< std::int64_t, std::int64_t, std::less< std::int64_t >, counting_allocator< std::pair< std::int64_t const, std::int64_t > > >;
+        tree_type tree;
+        for (std::int64_t i = 0; i < 100000; i++)
+        {
+            tree.emplace_hint(tree.end(), i, i * 2);
+        }
+        RPNX_ASSERT(tree.is_valid() && tree.size() == 100000);
+        [[maybe_unused]] std::size_t leaves = (100000 + tree_type::fanout - 1) / tree_type::fanout;
+        RPNX_ASSERT(g_live_allocations <= leaves + leaves / (tree_type::fanout / 4));
+
+        // Descending input fills leaves from the front.
+        tree_type descending;
+        for (std::int64_t i = 100000; i-- > 0;)
+        {
+            descending.emplace(i, i * 2);
+        }
+        RPNX_ASSERT(descending.is_valid() && descending == tree);
+
+        tree_type copy = tree;
+        RPNX_ASSERT(copy.is_valid() && copy == tree);
+        copy.erase(500);
+        RPNX_ASSERT(copy != tree && tree.at(500) == 1000);
+
+        tree_type moved = std::move(copy);
+        RPNX_ASSERT(copy.empty() && moved.size() == 99999 && moved.is_valid());
+        swap(moved, copy);
+        RPNX_ASSERT(moved.empty() && copy.size() == 99999);
+        copy = tree;
+        RPNX_ASSERT(copy == tree);
+
+        [[maybe_unused]] bool threw = false;
+        try
+        {
+            tree.at(-1);
+        }
+        catch (std::out_of_range const&)
+        {
+            threw = true;
+        }
+        RPNX_ASSERT(threw);
+    }
+    RPNX_ASSERT(g_live_allocations == 0);
+
+    // Serializes like std::map.
+    {
+        rpnx::experimental::btree_map< std::uint32_t, std::string > tree;
+        std::map< std::uint32_t, std::string > reference;
+        for (std::uint32_t i = 0; i < 1000; i++)
+        {
+            tree.emplace(i * 7, std::to_string(i));
+            reference.emplace(i * 7, std::to_string(i));
+        }
+        std::vector< std::uint8_t > tree_bytes;
+        std::vector< std::uint8_t > map_bytes;
+        rpnx::quick_iterator_serialize(tree, std::back_inserter(tree_bytes));
+        rpnx::synchronous_iterator_map_serial_traits< std::uint32_t, std::string, std::back_insert_iterator< std::vector< std::uint8_t > > >::serialize(reference, std::back_inserter(map_bytes));
+        RPNX_ASSERT(tree_bytes == map_bytes);
+        RPNX_ASSERT(rpnx::get_serial_size(tree) == tree_bytes.size());
+
+        rpnx::experimental::btree_map< std::uint32_t, std::string > result;
+        rpnx::quick_iterator_deserialize(result, tree_bytes.begin());
+        RPNX_ASSERT(result == tree && result.is_valid());
+
+        rpnx::experimental::btree_map< std::uint32_t, std::uint32_t > fixed;
+        for (std::uint32_t i = 0; i < 100; i++)
+        {
+            fixed.emplace(i, i * i);
+        }
+        std::vector< std::uint8_t > fixed_bytes;
+        rpnx::quick_generator_serialize(fixed, [&](std::size_t n) {
+            std::size_t offset = fixed_bytes.size();
+            fixed_bytes.resize(offset + n);
+            return fixed_bytes.begin() + std::ptrdiff_t(offset);
+        });
+        RPNX_ASSERT(fixed_bytes.size() == rpnx::get_serial_size(fixed));
+
+        rpnx::experimental::btree_map< std::uint32_t, std::uint32_t > fixed_result;
+        std::size_t position = 0;
+        rpnx::quick_generator_deserialize(fixed_result, [&](std::size_t n) {
+            auto it = fixed_bytes.begin() + std::ptrdiff_t(position);
+            position += n;
+            return it;
+        });
+        RPNX_ASSERT(fixed_result == fixed && position == fixed_bytes.size());
+    }
+
+    std::cout << "btree_map tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,263 @@
+#include "rpnx/derivator.hpp"
+
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <utility>
+
+static std::size_t g_live_allocations = 0;
+
+template < typename T >
+struct counting_allocator
+{
+    using value_type = T;
+
+    counting_allocator() noexcept = default;
+
+    template < typename T2 >
+    counting_allocator(counting_allocator< T2 > const&) noexcept
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        g_live_allocations++;
+        return std::allocator< T >().allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        g_live_allocations--;
+        std::allocator< T >().deallocate(p, n);
+    }
+
+    bool operator==(counting_allocator const&) const noexcept
+    {
+        return true;
+    }
+
+    bool operator!=(counting_allocator const&) const noexcept
+    {
+        return false;
+    }
+};
+
+static int g_live_objects = 0;
+
+// Small enough to be stored inline, but only if its move constructor is noexcept.
+template < bool NothrowMove >
+struct tracked
+{
+    std::int32_t m_value;
+
+    tracked(std::int32_t value) : m_value(value)
+    {
+        g_live_objects++;
+    }
+
+    tracked(tracked const& other) : m_value(other.m_value)
+    {
+        g_live_objects++;
+    }
+
+    tracked(tracked&& other) noexcept(NothrowMove) : m_value(other.m_value)
+    {
+        g_live_objects++;
+    }
+
+    ~tracked()
+    {
+        g_live_objects--;
+    }
+};
+
+// Copying this throws once g_throw_countdown reaches zero.
+static int g_throw_countdown = -1;
+
+struct fragile
+{
+    std::int64_t m_value;
+
+    fragile(std::int64_t value) : m_value(value)
+    {
+    }
+
+    fragile(fragile const& other) : m_value(other.m_value)
+    {
+        if (g_throw_countdown >= 0 && g_throw_countdown-- == 0)
+        {
+            throw std::runtime_error("fragile copy");
+        }
+    }
+
+    fragile(fragile&&) noexcept = default;
+};
+
+struct node;
+
+// A recursive type: inline storage has a fixed size, so the alternatives may still be incomplete here.
+using node_derivator = rpnx::basic_inline_derivator< 16, counting_allocator< void >, void, std::int64_t, node >;
+
+struct node
+{
+    node_derivator m_child;
+};
+
+using big = std::array< std::int64_t, 8 >;
+using small_derivator = rpnx::basic_inline_derivator< 16, counting_allocator< void >, void, std::int32_t, std::pair< std::int64_t, std::int64_t >, tracked< true >, tracked< false >, big, std::string, fragile >;
+
+int main()
+{
+    static_assert(sizeof(rpnx::derivator< int, std::string >) == 2 * sizeof(void*));
+    static_assert(sizeof(small_derivator) == sizeof(void*) + 16);
+    static_assert(small_derivator::stores_inline< std::int32_t > && small_derivator::stores_inline< std::pair< std::int64_t, std::int64_t > >);
+    static_assert(small_derivator::stores_inline< tracked< true > > && !small_derivator::stores_inline< tracked< false > >);
+    static_assert(!small_derivator::stores_inline< big > && !small_derivator::stores_inline< void >);
+    static_assert(!rpnx::basic_inline_derivator< 0, std::allocator< void >, int >::stores_inline< int >);
+    static_assert(std::is_nothrow_move_constructible_v< small_derivator > && std::is_nothrow_move_assignable_v< small_derivator >);
+
+    // Inline alternatives never allocate; the others allocate exactly once.
+    {
+        small_derivator a;
+        RPNX_ASSERT(!a.has_value() && a.index() == 0);
+        a = std::int32_t(5);
+        a.emplace< std::pair< std::int64_t, std::int64_t > >(1, 2);
+        a.emplace< tracked< true > >(3);
+        RPNX_ASSERT(g_live_allocations == 0 && g_live_objects == 1);
+
+        small_derivator b = a;
+        small_derivator c = std::move(b);
+        RPNX_ASSERT(!b.has_value() && c.get< tracked< true > >().m_value == 3 && g_live_objects == 2);
+        RPNX_ASSERT(g_live_allocations == 0);
+
+        a.emplace< tracked< false > >(4);
+        RPNX_ASSERT(g_live_allocations == 1 && g_live_objects == 2);
+        a = big{1, 2, 3, 4, 5, 6, 7, 8};
+        RPNX_ASSERT(g_live_allocations == 1 && g_live_objects == 1);
+
+        // A heap value keeps its address across moves; an inline value moves with the derivator.
+        [[maybe_unused]] big* address = &a.get< big >();
+        small_derivator d = std::move(a);
+        RPNX_ASSERT(&d.get< big >() == address && g_live_allocations == 1);
+        a = std::move(d);
+        RPNX_ASSERT(&a.get< big >() == address && !d.has_value());
+
+        // Swap every combination of inline, heap and empty values.
+        a.swap(c);
+        RPNX_ASSERT(a.get< tracked< true > >().m_value == 3 && c.get< big >()[7] == 8);
+        c.swap(d);
+        RPNX_ASSERT(!c.has_value() && d.get< big >()[0] == 1);
+        a.swap(c);
+        RPNX_ASSERT(!a.has_value() && c.get< tracked< true > >().m_value == 3);
+        c.swap(c);
+        RPNX_ASSERT(c.get< tracked< true > >().m_value == 3 && g_live_objects == 1);
+
+        // Copy assignment in both directions.
+        a = d;
+        RPNX_ASSERT(a.get< big >()[3] == 4 && g_live_allocations == 2);
+        a = c;
+        RPNX_ASSERT(a.get< tracked< true > >().m_value == 3 && g_live_allocations == 1 && g_live_objects == 2);
+        a = a;
+        RPNX_ASSERT(a.get< tracked< true > >().m_value == 3);
+
+        a.emplace< std::string >(100, 'x');
+        RPNX_ASSERT(a.get< std::string >().size() == 100 && g_live_allocations == 2);
+    }
+    RPNX_ASSERT(g_live_allocations == 0 && g_live_objects == 0);
+
+    // The argument may refer into the value being replaced.
+    {
+        small_derivator a;
+        a.emplace< std::pair< std::int64_t, std::int64_t > >(7, 8);
+        a.emplace< std::int32_t >(std::int32_t(a.get< std::pair< std::int64_t, std::int64_t > >().second));
+        RPNX_ASSERT(a.get< std::int32_t >() == 8);
+        a = big{};
+        a.get< big >()[2] = 9;
+        a.emplace< std::pair< std::int64_t, std::int64_t > >(a.get< big >()[2], a.get< big >()[2]);
+        RPNX_ASSERT((a.get< std::pair< std::int64_t, std::int64_t > >().first == 9));
+    }
+
+    // A throwing copy leaves the target unchanged.
+    {
+        small_derivator a;
+        small_derivator b;
+        a.emplace< fragile >(1);
+        b.emplace< tracked< true > >(2);
+        g_throw_countdown = 0;
+        [[maybe_unused]] bool threw = false;
+        try
+        {
+            b = a;
+        }
+        catch (std::runtime_error const&)
+        {
+            threw = true;
+        }
+        g_throw_countdown = -1;
+        RPNX_ASSERT(threw && b.get< tracked< true > >().m_value == 2);
+
+        g_throw_countdown = 0;
+        threw = false;
+        try
+        {
+            b.emplace< fragile >(a.get< fragile >());
+        }
+        catch (std::runtime_error const&)
+        {
+            threw = true;
+        }
+        g_throw_countdown = -1;
+        RPNX_ASSERT(threw && b.get< tracked< true > >().m_value == 2);
+    }
+    RPNX_ASSERT(g_live_allocations == 0 && g_live_objects == 0);
+
+    // Recursive alternatives, including moving a derivator out of its own value.
+    {
+        node_derivator root;
+        root.emplace< node >();
+        root.get< node >().m_child.emplace< node >();
+        root.get< node >().m_child.get< node >().m_child = std::int64_t(42);
+        RPNX_ASSERT(g_live_allocations == 2);
+
+        root = std::move(root.get< node >().m_child);
+        RPNX_ASSERT(root.get< node >().m_child.get< std::int64_t >() == 42 && g_live_allocations == 1);
+        root = std::move(root.get< node >().m_child);
+        RPNX_ASSERT(root.get< std::int64_t >() == 42 && g_live_allocations == 0);
+    }
+    RPNX_ASSERT(g_live_allocations == 0);
+
+    // visit sees the same values whether they are inline or not.
+    {
+        small_derivator a;
+        std::int64_t sum = 0;
+        auto visitor = [&](auto const& value) {
+            using T = std::decay_t< decltype(value) >;
+            if constexpr (std::is_same_v< T, std::int32_t >)
+            {
+                sum += value;
+            }
+            else if constexpr (std::is_same_v< T, big >)
+            {
+                sum += value[0];
+            }
+        };
+        struct overloaded : decltype(visitor)
+        {
+            using decltype(visitor)::operator();
+            void operator()() const
+            {
+            }
+        };
+        overloaded v{visitor};
+        rpnx::visit(v, a);
+        a = std::int32_t(3);
+        rpnx::visit(v, a);
+        a = big{10};
+        rpnx::visit(v, a);
+        RPNX_ASSERT(sum == 13);
+    }
+
+    std::cout << "inline derivator tests passed" << std::endl;
+    return 0;
+}
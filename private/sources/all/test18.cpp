@@ -0,0 +1,171 @@
+#include "rpnx/derivator.hpp"
+
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using message = rpnx::derivator< void, int, std::string, std::vector< int > >;
+using shape = rpnx::inline_derivator< 16, double, std::pair< double, double > >;
+
+// Names the alternatives it was called with, in order.
+struct namer
+{
+    std::string operator()() const
+    {
+        return "()";
+    }
+
+    template < typename... Ts >
+    std::string operator()(Ts const&... values) const
+    {
+        return ("(" + ... + name(values)) + ")";
+    }
+
+    static std::string name(int const&)
+    {
+        return "int";
+    }
+
+    static std::string name(std::string const&)
+    {
+        return "string";
+    }
+
+    static std::string name(std::vector< int > const&)
+    {
+        return "vector";
+    }
+
+    static std::string name(double const&)
+    {
+        return "double";
+    }
+
+    static std::string name(std::pair< double, double > const&)
+    {
+        return "pair";
+    }
+};
+
+// Appends to strings and ignores everything else.
+struct appender
+{
+    void operator()() const
+    {
+    }
+
+    void operator()(std::string& value) const
+    {
+        value += " world";
+    }
+
+    template < typename T >
+    void operator()(T&) const
+    {
+    }
+};
+
+int main()
+{
+    // Single visit, including the valueless alternative and a visitor returning a value.
+    {
+        message m;
+        RPNX_ASSERT(rpnx::visit(namer(), m) == "()");
+        m = 5;
+        RPNX_ASSERT(rpnx::visit(namer(), m) == "(int)");
+        m = std::string("hello");
+        RPNX_ASSERT(rpnx::visit(namer(), std::as_const(m)) == "(string)");
+
+        // The value is passed by reference and can be modified.
+        rpnx::visit(appender(), m);
+        RPNX_ASSERT(m.get< std::string >() == "hello world");
+    }
+
+    // Rvalue derivators pass rvalues, so values can be moved out.
+    {
+        message m;
+        m.emplace< std::vector< int > >(100, 7);
+        std::vector< int > taken;
+        rpnx::visit(
+            [&](auto&&... values) {
+                if constexpr (sizeof...(values) == 1)
+                {
+                    if constexpr ((std::is_same_v< decltype(values), std::vector< int >&& > && ...))
+                    {
+                        taken = std::move(values...);
+                    }
+                }
+            },
+            std::move(m));
+        RPNX_ASSERT(taken.size() == 100 && m.get< std::vector< int > >().empty());
+    }
+
+    // Every combination of alternatives of three derivators reaches the matching overload.
+    {
+        message a;
+        message b;
+        shape c;
+        std::string names[] = {"", "int", "string", "vector"};
+        for (int i = 0; i < 4; i++)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                for (int k = 0; k < 2; k++)
+                {
+                    for (auto [d, index] : {std::pair< message*, int >(&a, i), std::pair< message*, int >(&b, j)})
+                    {
+                        switch (index)
+                        {
+                        case 0:
+                            d->emplace< void >();
+                            break;
+                        case 1:
+                            *d = 1;
+                            break;
+                        case 2:
+                            *d = std::string("x");
+                            break;
+                        default:
+                            d->emplace< std::vector< int > >();
+                            break;
+                        }
+                    }
+                    if (k == 0)
+                    {
+                        c = 1.0;
+                    }
+                    else
+                    {
+                        c = std::pair< double, double >(1.0, 2.0);
+                    }
+                    std::string expected = "(" + names[i] + names[j] + (k == 0 ? "double" : "pair") + ")";
+                    RPNX_ASSERT(rpnx::visit(namer(), a, b, c) == expected);
+                }
+            }
+        }
+    }
+
+    // Results of other types convert to the result for alternative 0.
+    {
+        shape s;
+        s = std::pair< double, double >(3.0, 4.0);
+        auto area = rpnx::visit(
+            [](auto const& value) {
+                if constexpr (std::is_same_v< std::decay_t< decltype(value) >, double >)
+                {
+                    return value * value;
+                }
+                else
+                {
+                    return float(value.first * value.second);
+                }
+            },
+            s);
+        static_assert(std::is_same_v< decltype(area), double >);
+        RPNX_ASSERT(area == 12.0);
+    }
+
+    std::cout << "derivator visit tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,158 @@
+#include "rpnx/derivator.hpp"
+
+#include <iostream>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using key = rpnx::derivator< void, int, std::string, double >;
+using inline_key = rpnx::inline_derivator< 32, void, int, std::string >;
+
+struct opaque
+{
+    int m_value;
+};
+
+using opaque_key = rpnx::derivator< int, opaque >;
+
+// std::hash of a derivator is only enabled when all its alternatives are hashable.
+static_assert(std::is_default_constructible_v< std::hash< key > >);
+static_assert(!std::is_default_constructible_v< std::hash< rpnx::derivator< int, std::vector< int > > > >);
+static_assert(!std::is_default_constructible_v< std::hash< opaque_key > >);
+
+template < typename Key >
+Key make(int i)
+{
+    Key k;
+    switch (i % 3)
+    {
+    case 0:
+        k.template emplace< void >();
+        break;
+    case 1:
+        k = i;
+        break;
+    default:
+        k = std::to_string(i / 3);
+        break;
+    }
+    return k;
+}
+
+int main()
+{
+    // Ordering by index, then value, like std::variant.
+    {
+        key empty;
+        key one;
+        one = 1;
+        key two;
+        two = 2;
+        key text;
+        text = std::string("a");
+        key real;
+        real = 1.5;
+
+        RPNX_ASSERT(empty == key() && !(empty < key()) && empty <= key());
+        RPNX_ASSERT(empty < one && one < two && two < text && text < real);
+        RPNX_ASSERT(real > text && text >= two && !(one >= two) && one != two);
+        key other_text;
+        other_text = std::string("b");
+        RPNX_ASSERT(text < other_text && text != other_text);
+        other_text.get< std::string >() = "a";
+        RPNX_ASSERT(text == other_text && !(text < other_text) && !(other_text < text));
+
+        // Comparisons that don't hash still compile for alternatives without std::hash.
+        opaque_key a;
+        a = 5;
+        RPNX_ASSERT(a.index() == 0);
+    }
+
+    // Hashes agree with equality, and equal values of different alternatives hash differently.
+    {
+        key a;
+        key b;
+        a = 7;
+        b = 7;
+        RPNX_ASSERT(a.hash() == b.hash() && std::hash< key >()(a) == a.hash());
+        rpnx::derivator< int, long > as_int;
+        rpnx::derivator< int, long > as_long;
+        as_int = 7;
+        as_long = 7l;
+        RPNX_ASSERT(as_int != as_long && as_int.hash() != as_long.hash());
+        RPNX_ASSERT(key().hash() == key().hash());
+    }
+
+    // Hashed and ordered containers agree with each other.
+    {
+        std::unordered_map< key, int > hashed;
+        std::map< key, int > ordered;
+        std::map< key, int, rpnx::derivator_less > transparent;
+        for (int i = 0; i < 3000; i++)
+        {
+            key k = make< key >(i % 1000);
+            hashed[k] += i;
+            ordered[k] += i;
+            transparent[k] += i;
+        }
+        RPNX_ASSERT(hashed.size() == 1 + 333 + 333 && ordered.size() == hashed.size() && transparent.size() == hashed.size());
+        for ([[maybe_unused]] auto const& [k, v] : ordered)
+        {
+            RPNX_ASSERT(hashed.at(k) == v && transparent.at(k) == v);
+        }
+        RPNX_ASSERT(!ordered.begin()->first.has_value());
+
+        // Heterogeneous lookup by the alternative's value.
+        RPNX_ASSERT(transparent.find(4) != transparent.end() && transparent.find(4)->second == ordered.at(make< key >(4)));
+        RPNX_ASSERT(transparent.find(3) == transparent.end());
+        RPNX_ASSERT(transparent.find(std::string("10")) != transparent.end());
+        RPNX_ASSERT(transparent.find(std::string("xyz")) == transparent.end());
+        RPNX_ASSERT(transparent.lower_bound(std::string()) == transparent.find(std::string("0")));
+        RPNX_ASSERT(transparent.count(1.5) == 0);
+    }
+
+    // The transparent hash and equality hash a value the same as a derivator holding it.
+    {
+        [[maybe_unused]] rpnx::derivator_hash< inline_key > hash;
+        [[maybe_unused]] rpnx::derivator_equal_to equal;
+        std::unordered_set< inline_key, rpnx::derivator_hash< inline_key >, rpnx::derivator_equal_to > set;
+        for (int i = 0; i < 300; i++)
+        {
+            inline_key k = make< inline_key >(i);
+            set.insert(k);
+            if (k.holds_alternative< int >())
+            {
+                RPNX_ASSERT(hash(i) == hash(k) && equal(k, i) && equal(i, k) && !equal(k, i + 1));
+            }
+            else if (k.holds_alternative< std::string >())
+            {
+                RPNX_ASSERT(hash(std::to_string(i / 3)) == hash(k) && equal(k, std::to_string(i / 3)));
+                RPNX_ASSERT(!equal(k, i));
+            }
+        }
+        RPNX_ASSERT(set.size() == 201 && set.count(make< inline_key >(5)) == 1 && set.count(make< inline_key >(0)) == 1);
+
+        [[maybe_unused]] rpnx::derivator_less less;
+        inline_key k = make< inline_key >(1);
+        RPNX_ASSERT(less(k, 2) && !less(k, 1) && less(0, k) && less(k, std::string()) && !less(std::string(), k));
+    }
+
+    // Alternatives whose operator== and operator< are declared but do not compile, like std::vector of a type
+    // without them, are fine as long as the derivator is not compared.
+    {
+        rpnx::derivator< int, std::vector< opaque > > held;
+        held = std::vector< opaque >{{1}, {2}};
+        rpnx::derivator< int, std::vector< opaque > > copy(held);
+        rpnx::derivator< int, std::vector< opaque > > assigned;
+        assigned = copy;
+        assigned = 3;
+        assigned = std::move(copy);
+        RPNX_ASSERT(assigned.holds_alternative< std::vector< opaque > >() && assigned.get< std::vector< opaque > >()[1].m_value == 2);
+    }
+
+    std::cout << "derivator hash tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,1087 @@
+#include "rpnx/assert.hpp"
+#include "rpnx/experimental/priority_dispatcher.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <random>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+using rpnx::experimental::priority_dispatcher;
+
+namespace
+{
+    struct counters
+    {
+        std::atomic< int > m_completed{0};
+        std::atomic< int > m_failed{0};
+        std::atomic< int > m_cancelled{0};
+    };
+
+    struct job
+    {
+        counters* m_counters;
+        bool m_throw;
+    };
+
+    void run_job(void* data)
+    {
+        if (static_cast< job* >(data)->m_throw)
+        {
+            throw std::runtime_error("job failed");
+        }
+    }
+
+    void cleanup_job(void* data, priority_dispatcher::completion_state state) noexcept
+    {
+        auto* j = static_cast< job* >(data);
+        switch (state)
+        {
+        case priority_dispatcher::completion_state::completed:
+            j->m_counters->m_completed++;
+            break;
+        case priority_dispatcher::completion_state::completed_with_exception:
+            j->m_counters->m_failed++;
+            break;
+        case priority_dispatcher::completion_state::cancelled:
+            j->m_counters->m_cancelled++;
+            break;
+        }
+        delete j;
+    }
+
+    // Runs 2^depth - 1 jobs in total, all but the first submitted from inside a service thread. finish_all may not
+    // run concurrently with submit, so callers wait for every submit to return first.
+    void fan_out(priority_dispatcher& dispatcher, std::atomic< int >& count, std::atomic< int >& submitted, int depth)
+    {
+        count++;
+        if (depth > 1)
+        {
+            for (int i = 0; i < 2; i++)
+            {
+                dispatcher.submit(
+                    [&dispatcher, &count, &submitted, depth] {
+                        fan_out(dispatcher, count, submitted, depth - 1);
+                    },
+                    depth);
+                submitted++;
+            }
+        }
+    }
+
+    void test_mode(priority_dispatcher::scheduling_mode mode)
+    {
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        options.m_thread_count = 4;
+
+        // Every job runs exactly once and exceptions are reported through the cleanup routine.
+        {
+            priority_dispatcher dispatcher(options);
+            counters c;
+            for (int i = 0; i < 20000; i++)
+            {
+                dispatcher.submit(&run_job, &cleanup_job, new job{&c, i % 100 == 0}, i % 7);
+            }
+            dispatcher.finish_all();
+            RPNX_ASSERT(c.m_completed == 19800 && c.m_failed == 200 && c.m_cancelled == 0);
+        }
+
+        // Jobs submitted from jobs, from several external threads at once.
+        {
+            priority_dispatcher dispatcher(options);
+            std::atomic< int > count{0};
+            std::atomic< int > submitted{0};
+            std::thread submitters[3];
+            for (auto& th : submitters)
+            {
+                th = std::thread([&] {
+                    for (int i = 0; i < 4; i++)
+                    {
+                        dispatcher.submit(
+                            [&] {
+                                fan_out(dispatcher, count, submitted, 10);
+                            },
+                            0);
+                        submitted++;
+                    }
+                });
+            }
+            for (auto& th : submitters)
+            {
+                th.join();
+            }
+            while (submitted != 12 * 1023)
+            {
+                std::this_thread::yield();
+            }
+            dispatcher.finish_all();
+            RPNX_ASSERT(count == 12 * 1023);
+        }
+
+        // cancel_all cancels queued jobs and waits for the running ones.
+        {
+            priority_dispatcher dispatcher(options);
+            counters c;
+            std::atomic< bool > release{false};
+            std::atomic< int > started{0};
+            for (int i = 0; i < 4; i++)
+            {
+                dispatcher.submit(
+                    [&] {
+                        started++;
+                        while (!release)
+                        {
+                            std::this_thread::yield();
+                        }
+                    },
+                    100);
+            }
+            while (started != 4)
+            {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < 1000; i++)
+            {
+                dispatcher.submit(&run_job, &cleanup_job, new job{&c, false}, 0);
+            }
+            std::thread releaser([&] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                release = true;
+            });
+            dispatcher.cancel_all();
+            RPNX_ASSERT(release);
+            releaser.join();
+            RPNX_ASSERT(c.m_cancelled + c.m_completed == 1000);
+            RPNX_ASSERT(c.m_cancelled > 0);
+
+            // The dispatcher is still usable afterwards.
+            for (int i = 0; i < 100; i++)
+            {
+                dispatcher.submit(&run_job, &cleanup_job, new job{&c, false}, 0);
+            }
+            dispatcher.finish_all();
+            RPNX_ASSERT(c.m_cancelled + c.m_completed == 1100);
+        }
+
+        // Changing the thread count while jobs are queued, including down to zero and back.
+        {
+            priority_dispatcher dispatcher(options);
+            counters c;
+            for (std::size_t threads : {1, 8, 0, 3, 2, 6})
+            {
+                dispatcher.set_service_thread_count(threads);
+                for (int i = 0; i < 2000; i++)
+                {
+                    dispatcher.submit(&run_job, &cleanup_job, new job{&c, false}, i);
+                }
+            }
+            dispatcher.finish_all();
+            RPNX_ASSERT(c.m_completed == 12000);
+        }
+
+        // Shrinking and growing straight away, while the other workers are parked, must not wait on a stopping
+        // worker that still needs the dispatcher's lock to pass its wakeup on.
+        {
+            priority_dispatcher dispatcher(options);
+            counters c;
+            dispatcher.set_service_thread_count(4);
+            for (int round = 0; round < 200; round++)
+            {
+                if (round % 20 == 0)
+                {
+                    // Long enough for the idle workers to stop spinning and park.
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                }
+                dispatcher.set_service_thread_count(1);
+                if (round % 2 == 0)
+                {
+                    // Gives the surplus workers a chance to be part way through stopping.
+                    std::this_thread::yield();
+                }
+                dispatcher.set_service_thread_count(4);
+            }
+            for (int i = 0; i < 1000; i++)
+            {
+                dispatcher.submit(&run_job, &cleanup_job, new job{&c, false}, i);
+            }
+            dispatcher.finish_all();
+            RPNX_ASSERT(c.m_completed == 1000);
+        }
+
+        // Bulk submission, from outside and from inside service threads.
+        {
+            priority_dispatcher dispatcher(options);
+            std::atomic< std::uint64_t > sum{0};
+            std::atomic< int > submitted{0};
+            std::vector< std::atomic< int > > hits(5000);
+            dispatcher.submit_bulk_n(
+                [&hits](std::size_t i) {
+                    hits[i]++;
+                },
+                hits.size(), 1);
+
+            std::vector< std::function< void() > > functors;
+            for (int i = 1; i <= 100; i++)
+            {
+                functors.push_back([&, i] {
+                    sum += std::uint64_t(i);
+                    dispatcher.submit_bulk_n(
+                        [&sum](std::size_t j) {
+                            sum += j;
+                        },
+                        10, i);
+                    submitted++;
+                });
+            }
+            dispatcher.submit_bulk(functors.begin(), functors.end(), 2);
+
+            counters c;
+            std::vector< job > jobs(1000, job{&c, false});
+            jobs[500].m_throw = true;
+            dispatcher.submit_bulk(
+                &run_job,
+                [](void* data, priority_dispatcher::completion_state state) noexcept {
+                    // The records belong to the caller here, so only count them.
+                    job copy = *static_cast< job* >(data);
+                    cleanup_job(new job(copy), state);
+                },
+                jobs.data(), sizeof(job), jobs.size(), 0);
+
+            while (submitted != 100)
+            {
+                std::this_thread::yield();
+            }
+            dispatcher.finish_all();
+            for ([[maybe_unused]] auto const& h : hits)
+            {
+                RPNX_ASSERT(h == 1);
+            }
+            RPNX_ASSERT(sum == 5050 + 100 * 45);
+            RPNX_ASSERT(c.m_completed == 999 && c.m_failed == 1);
+        }
+
+        // Cancelled bulk jobs release their shared storage.
+        {
+            auto shared = std::make_shared< int >(0);
+            {
+                priority_dispatcher dispatcher(options);
+                dispatcher.set_service_thread_count(0);
+                dispatcher.submit_bulk_n(
+                    [shared](std::size_t) {
+                    },
+                    1000, 0);
+                std::vector< std::function< void() > > functors(100, [shared] {});
+                dispatcher.submit_bulk(functors.begin(), functors.end(), 0);
+                functors.clear();
+                RPNX_ASSERT(shared.use_count() == 102);
+            }
+            RPNX_ASSERT(shared.use_count() == 1);
+        }
+
+        // Functors stored inline and in the pool, run and cancelled.
+        {
+            std::atomic< std::uint64_t > sum{0};
+            std::array< std::uint64_t, 5 > small{1, 2, 3, 4, 5};
+            std::array< std::uint64_t, 8 > large{1, 2, 3, 4, 5, 6, 7, 8};
+            auto shared = std::make_shared< int >(0);
+            {
+                priority_dispatcher dispatcher(options);
+                auto small_job = [&sum, small] {
+                    sum += small[4];
+                };
+                auto large_job = [&sum, large] {
+                    sum += large[7];
+                };
+                static_assert(std::is_trivially_copyable_v< decltype(small_job) > && sizeof(small_job) <= priority_dispatcher::inline_functor_size);
+                static_assert(sizeof(large_job) > priority_dispatcher::inline_functor_size);
+                for (int i = 0; i < 1000; i++)
+                {
+                    dispatcher.submit(small_job, i % 3);
+                    dispatcher.submit(large_job, i % 3);
+                    dispatcher.submit(
+                        [&sum, shared] {
+                            sum += 100;
+                        },
+                        i % 3);
+                }
+                dispatcher.finish_all();
+                RPNX_ASSERT(sum == 1000 * 113);
+                RPNX_ASSERT(shared.use_count() == 1);
+
+                dispatcher.set_service_thread_count(0);
+                for (int i = 0; i < 100; i++)
+                {
+                    dispatcher.submit(small_job, 0);
+                    dispatcher.submit(large_job, 0);
+                    dispatcher.submit(
+                        [&sum, shared] {
+                            sum += 100;
+                        },
+                        0);
+                }
+            }
+            RPNX_ASSERT(sum == 1000 * 113);
+            RPNX_ASSERT(shared.use_count() == 1);
+        }
+
+        // Destroying the dispatcher cancels whatever is still queued.
+        {
+            counters c;
+            {
+                priority_dispatcher dispatcher(options);
+                dispatcher.set_service_thread_count(0);
+                for (int i = 0; i < 100; i++)
+                {
+                    dispatcher.submit(&run_job, &cleanup_job, new job{&c, false}, 0);
+                }
+            }
+            RPNX_ASSERT(c.m_cancelled == 100);
+        }
+    }
+    bool wait_for(std::atomic< int > const& value, int expected, std::chrono::steady_clock::duration limit)
+    {
+        auto deadline = std::chrono::steady_clock::now() + limit;
+        while (value.load() != expected)
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+            {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return true;
+    }
+
+    void test_timers(priority_dispatcher::scheduling_mode mode)
+    {
+        using clock = std::chrono::steady_clock;
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        options.m_thread_count = 3;
+
+        // Many timers fire, none early.
+        {
+            priority_dispatcher dispatcher(options);
+            constexpr int count = 100000;
+            std::atomic< int > fired{0};
+            std::atomic< int > early{0};
+            std::mt19937 rng(42);
+            auto start = clock::now();
+            for (int i = 0; i < count; i++)
+            {
+                auto when = start + std::chrono::microseconds(rng() % 300000);
+                dispatcher.submit_at(
+                    [&fired, &early, when] {
+                        if (clock::now() < when)
+                        {
+                            early++;
+                        }
+                        fired++;
+                    },
+                    when, i % 4);
+            }
+            // Due immediately.
+            dispatcher.submit_at(
+                [&fired] {
+                    fired++;
+                },
+                start - std::chrono::seconds(1), 0);
+            [[maybe_unused]] bool all_fired = wait_for(fired, count + 1, std::chrono::seconds(30));
+            RPNX_ASSERT(all_fired);
+            RPNX_ASSERT(early == 0);
+        }
+
+        // A closer deadline wakes the thread sleeping until a later one, and finish_all ignores timers that are
+        // not yet due.
+        {
+            priority_dispatcher dispatcher(options);
+            counters c;
+            dispatcher.submit_at(&run_job, &cleanup_job, new job{&c, false}, 0, clock::now() + std::chrono::hours(2));
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            std::atomic< int > fired{0};
+            [[maybe_unused]] auto t0 = clock::now();
+            dispatcher.submit_after(
+                [&fired] {
+                    fired++;
+                },
+                std::chrono::milliseconds(10), 0);
+            [[maybe_unused]] bool closer_fired = wait_for(fired, 1, std::chrono::seconds(5));
+            RPNX_ASSERT(closer_fired);
+            RPNX_ASSERT(clock::now() - t0 >= std::chrono::milliseconds(10));
+            dispatcher.finish_all();
+            RPNX_ASSERT(c.m_completed == 0 && c.m_cancelled == 0);
+
+            // cancel_all cancels pending timers, from milliseconds to years away.
+            for (int i = 0; i < 1000; i++)
+            {
+                dispatcher.submit_at(&run_job, &cleanup_job, new job{&c, false}, 0, clock::now() + std::chrono::seconds(10) * (i * i + 1));
+            }
+            dispatcher.cancel_all();
+            RPNX_ASSERT(c.m_cancelled == 1001 && c.m_completed == 0);
+
+            // The destructor cancels them too.
+            dispatcher.submit_after(
+                [shared = std::make_shared< int >(0)] {
+                },
+                std::chrono::hours(1), 0);
+        }
+    }
+    void test_task_groups(priority_dispatcher::scheduling_mode mode)
+    {
+        using rpnx::experimental::task_group;
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        options.m_thread_count = 4;
+
+        // A random graph: every job starts after each of its predecessors has finished.
+        {
+            priority_dispatcher dispatcher(options);
+            constexpr int count = 3000;
+            std::vector< std::atomic< int > > finished_at(count);
+            std::vector< std::vector< int > > predecessors(count);
+            std::atomic< int > clock{0};
+            std::atomic< int > violations{0};
+            std::mt19937 rng(7);
+            {
+                task_group group(dispatcher);
+                std::vector< task_group::task > tasks;
+                for (int i = 0; i < count; i++)
+                {
+                    std::vector< task_group::task > after;
+                    for (int j = 0, n = i == 0 ? 0 : int(rng() % 4); j < n; j++)
+                    {
+                        int p = int(rng() % unsigned(i));
+                        predecessors[std::size_t(i)].push_back(p);
+                        after.push_back(tasks[std::size_t(p)]);
+                    }
+                    tasks.push_back(group.add(
+                        [&, i] {
+                            for (int p : predecessors[std::size_t(i)])
+                            {
+                                if (finished_at[std::size_t(p)].load() == 0)
+                                {
+                                    violations++;
+                                }
+                            }
+                            finished_at[std::size_t(i)] = ++clock;
+                        },
+                        int(rng() % 8), after.data(), after.size()));
+                }
+                group.wait();
+                RPNX_ASSERT(group.done());
+                for ([[maybe_unused]] auto const& t : tasks)
+                {
+                    RPNX_ASSERT(t.done());
+                }
+            }
+            RPNX_ASSERT(clock == count && violations == 0);
+        }
+
+        // Groups are waited for separately: one finishes while another is held up.
+        {
+            priority_dispatcher dispatcher(options);
+            std::atomic< bool > gate{false};
+            std::atomic< int > ran{0};
+            task_group held(dispatcher);
+            task_group pipeline(dispatcher);
+
+            auto blocker = held.add(
+                [&] {
+                    while (!gate.load())
+                    {
+                        std::this_thread::yield();
+                    }
+                },
+                0);
+            held.add(
+                [&] {
+                    ran++;
+                },
+                0, {blocker});
+
+            auto stage = pipeline.add(
+                [&] {
+                    ran++;
+                },
+                0);
+            for (int i = 0; i < 100; i++)
+            {
+                stage = pipeline.add(
+                    [&] {
+                        ran++;
+                    },
+                    i, {stage});
+            }
+            pipeline.wait();
+            RPNX_ASSERT(ran == 101 && !held.done() && !blocker.done());
+            gate = true;
+            held.wait();
+            RPNX_ASSERT(ran == 102);
+        }
+
+        // Predecessors that already finished, that threw, and that were cancelled.
+        {
+            priority_dispatcher dispatcher(options);
+            counters c;
+            task_group group(dispatcher);
+            auto thrower = group.add(&run_job, &cleanup_job, new job{&c, true}, 0);
+            group.wait();
+            RPNX_ASSERT(c.m_failed == 1 && thrower.done());
+            task_group::task after[] = {thrower, task_group::task()};
+            group.add(&run_job, &cleanup_job, new job{&c, false}, 0, after, 2);
+            group.wait();
+            RPNX_ASSERT(c.m_completed == 1);
+
+            // Nothing runs: the root and everything after it is cancelled, and group.wait() returns.
+            dispatcher.set_service_thread_count(0);
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            auto root = group.add(&run_job, &cleanup_job, new job{&c, false}, 0);
+            auto last = root;
+            for (int i = 0; i < 10000; i++)
+            {
+                task_group::task both[] = {last, root};
+                last = group.add(&run_job, &cleanup_job, new job{&c, false}, 0, both, 2);
+            }
+            RPNX_ASSERT(!group.done());
+            dispatcher.cancel_all();
+            group.wait();
+            RPNX_ASSERT(c.m_cancelled == 10001 && c.m_completed == 1);
+
+            // A job added after a cancelled one is cancelled straight away.
+            group.add(&run_job, &cleanup_job, new job{&c, false}, 0, &last, 1);
+            RPNX_ASSERT(c.m_cancelled == 10002 && group.done());
+            dispatcher.set_service_thread_count(2);
+        }
+
+        // finish_all waits for the whole graph, including jobs added by jobs.
+        {
+            priority_dispatcher dispatcher(options);
+            std::atomic< int > ran{0};
+            task_group group(dispatcher);
+            auto first = group.add(
+                [&] {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+                    ran++;
+                },
+                0);
+            auto second = group.add(
+                [&] {
+                    ran++;
+                    group.add(
+                        [&] {
+                            ran++;
+                        },
+                        0);
+                },
+                0, {first});
+            group.add(
+                [&] {
+                    ran++;
+                },
+                0, {first, second});
+            dispatcher.finish_all();
+            RPNX_ASSERT(ran == 4 && group.done());
+        }
+    }
+    void test_affinity(priority_dispatcher::scheduling_mode mode)
+    {
+        std::size_t nodes = priority_dispatcher::numa_node_count();
+        RPNX_ASSERT(nodes >= 1);
+        std::size_t here = priority_dispatcher::current_numa_node();
+        RPNX_ASSERT(here == priority_dispatcher::any_node || here < nodes);
+
+        for (auto policy : {priority_dispatcher::affinity_policy::none, priority_dispatcher::affinity_policy::per_core, priority_dispatcher::affinity_policy::per_node})
+        {
+            priority_dispatcher::options options;
+            options.m_mode = mode;
+            options.m_affinity = policy;
+            options.m_thread_count = 3;
+            priority_dispatcher dispatcher(options);
+            std::atomic< int > ran{0};
+            for (std::size_t node : {std::size_t(0), nodes - 1, nodes + 5, priority_dispatcher::any_node})
+            {
+                for (int i = 0; i < 100; i++)
+                {
+                    dispatcher.submit_near(
+                        [&ran] {
+                            ran++;
+                        },
+                        i, node);
+                }
+            }
+            counters c;
+            dispatcher.submit_near(&run_job, &cleanup_job, new job{&c, false}, 0, here);
+            dispatcher.finish_all();
+            RPNX_ASSERT(ran == 400 && c.m_completed == 1);
+        }
+
+#if defined(__linux__)
+        // Pinned to a single CPU, every job runs there.
+        {
+            cpu_set_t allowed;
+            [[maybe_unused]] int got = sched_getaffinity(0, sizeof(allowed), &allowed);
+            RPNX_ASSERT(got == 0);
+            std::size_t cpu = 0;
+            while (!CPU_ISSET(cpu, &allowed))
+            {
+                cpu++;
+            }
+
+            for (auto policy : {priority_dispatcher::affinity_policy::none, priority_dispatcher::affinity_policy::per_core, priority_dispatcher::affinity_policy::per_node})
+            {
+                priority_dispatcher::options options;
+                options.m_mode = mode;
+                options.m_affinity = policy;
+                options.m_cpus = {cpu};
+                priority_dispatcher dispatcher(options);
+                std::atomic< int > elsewhere{0};
+                for (int i = 0; i < 200; i++)
+                {
+                    dispatcher.submit(
+                        [&elsewhere, cpu] {
+                            if (sched_getcpu() != int(cpu))
+                            {
+                                elsewhere++;
+                            }
+                        },
+                        0);
+                }
+                dispatcher.finish_all();
+                RPNX_ASSERT(elsewhere == 0);
+            }
+        }
+#endif
+
+        [[maybe_unused]] bool threw = false;
+        try
+        {
+            priority_dispatcher::options options;
+            options.m_mode = mode;
+            options.m_cpus = {std::size_t(1) << 30};
+            priority_dispatcher dispatcher(options);
+        }
+        catch (std::invalid_argument const&)
+        {
+            threw = true;
+        }
+        RPNX_ASSERT(threw);
+    }
+
+    void test_stats(priority_dispatcher::scheduling_mode mode)
+    {
+        // Counts, exceptions and the idle time between jobs.
+        {
+            priority_dispatcher::options options;
+            options.m_mode = mode;
+            options.m_thread_count = 2;
+            options.m_collect_stats = true;
+            priority_dispatcher dispatcher(options);
+            counters c;
+            std::atomic< int > ran{0};
+            for (int i = 0; i < 1000; i++)
+            {
+                dispatcher.submit(
+                    [&ran] {
+                        ran++;
+                    },
+                    i % 7);
+            }
+            for (int i = 0; i < 10; i++)
+            {
+                dispatcher.submit(&run_job, &cleanup_job, new job{&c, true}, 0);
+            }
+            dispatcher.finish_all();
+            RPNX_ASSERT(ran == 1000 && c.m_failed == 10);
+
+            priority_dispatcher::statistics stats = dispatcher.stats();
+            RPNX_ASSERT(stats.m_wait.count() == 1010 && stats.m_run.count() == 1010);
+            RPNX_ASSERT(stats.m_exceptions == 10);
+            RPNX_ASSERT(mode == priority_dispatcher::scheduling_mode::work_stealing || stats.m_steals == 0);
+            RPNX_ASSERT(stats.m_queue_depth.empty());
+            RPNX_ASSERT(stats.m_run.percentile(0) <= stats.m_run.percentile(0.5) && stats.m_run.percentile(0.5) <= stats.m_run.percentile(1));
+            RPNX_ASSERT(stats.m_alive >= stats.m_busy && stats.utilization() <= 1.0);
+
+            // Idle service threads go to sleep.
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            priority_dispatcher::statistics later = dispatcher.stats();
+            RPNX_ASSERT(later.m_parks > 0 && later.m_run.count() == 1010);
+            RPNX_ASSERT(later.m_alive > stats.m_alive);
+        }
+
+        // Run and wait times: one service thread runs five jobs of at least 2 ms in turn.
+        {
+            priority_dispatcher::options options;
+            options.m_mode = mode;
+            options.m_thread_count = 1;
+            options.m_collect_stats = true;
+            priority_dispatcher dispatcher(options);
+            for (int i = 0; i < 5; i++)
+            {
+                dispatcher.submit(
+                    [] {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                    },
+                    0);
+            }
+            dispatcher.finish_all();
+            priority_dispatcher::statistics stats = dispatcher.stats();
+            RPNX_ASSERT(stats.m_run.count() == 5);
+            RPNX_ASSERT(stats.m_run.percentile(0.5) >= std::chrono::milliseconds(2) && stats.m_run.percentile(0.5) < std::chrono::seconds(10));
+            RPNX_ASSERT(stats.m_run.mean() >= std::chrono::milliseconds(2));
+            RPNX_ASSERT(stats.m_busy >= std::chrono::milliseconds(10));
+            // The last job waited for the four before it.
+            RPNX_ASSERT(stats.m_wait.percentile(1) >= std::chrono::milliseconds(8));
+        }
+
+        // Queue depth is reported with or without statistics.
+        for (bool collect : {false, true})
+        {
+            priority_dispatcher::options options;
+            options.m_mode = mode;
+            options.m_band_count = 8;
+            options.m_collect_stats = collect;
+            priority_dispatcher dispatcher(options);
+            dispatcher.set_service_thread_count(0);
+            std::atomic< int > ran{0};
+            for (std::int64_t priority : {1, 5, 1, 5, 1, 20})
+            {
+                dispatcher.submit(
+                    [&ran] {
+                        ran++;
+                    },
+                    priority);
+            }
+
+            priority_dispatcher::statistics stats = dispatcher.stats();
+            RPNX_ASSERT(stats.m_run.count() == 0 && stats.m_wait.count() == 0 && stats.m_parks == 0);
+            using depth [[maybe_unused]] = std::vector< std::pair< std::int64_t, std::size_t > >;
+            if (mode == priority_dispatcher::scheduling_mode::shared_queue)
+            {
+                RPNX_ASSERT((stats.m_queue_depth == depth{{20, 1}, {5, 2}, {1, 3}}));
+            }
+            else if (mode == priority_dispatcher::scheduling_mode::banded)
+            {
+                RPNX_ASSERT((stats.m_queue_depth == depth{{7, 1}, {5, 2}, {1, 3}}));
+            }
+            else
+            {
+                // Submitted from outside, so still on the injection list.
+                RPNX_ASSERT(stats.m_queue_depth.empty());
+            }
+
+            dispatcher.set_service_thread_count(1);
+            dispatcher.finish_all();
+            RPNX_ASSERT(ran == 6);
+            stats = dispatcher.stats();
+            RPNX_ASSERT(stats.m_queue_depth.empty());
+            RPNX_ASSERT(stats.m_run.count() == (collect ? 6u : 0u));
+        }
+
+        // Bucket bounds are log-linear.
+        {
+            priority_dispatcher::latency_histogram histogram;
+            RPNX_ASSERT(histogram.lower_bound(15) == std::chrono::nanoseconds(15) && histogram.lower_bound(16) == std::chrono::nanoseconds(16));
+            RPNX_ASSERT(histogram.lower_bound(32) == std::chrono::nanoseconds(32) && histogram.lower_bound(33) == std::chrono::nanoseconds(34));
+            RPNX_ASSERT(histogram.percentile(0.5) == std::chrono::nanoseconds(0) && histogram.mean() == std::chrono::nanoseconds(0));
+            histogram.m_counts[20] = 3;
+            histogram.m_counts[40] = 1;
+            histogram.m_total_ticks = 20 * 3 + 48;
+            RPNX_ASSERT(histogram.count() == 4);
+            RPNX_ASSERT(histogram.percentile(0.75) == histogram.lower_bound(21) && histogram.percentile(1) == histogram.lower_bound(41));
+            RPNX_ASSERT(histogram.mean() == std::chrono::nanoseconds(27));
+        }
+    }
+
+    void test_results(priority_dispatcher::scheduling_mode mode)
+    {
+        std::atomic< int > handled{0};
+        priority_dispatcher::options options;
+        options.m_mode = mode;
+        options.m_thread_count = 2;
+        options.m_exception_handler = [&handled](std::exception_ptr e) {
+            try
+            {
+                std::rethrow_exception(e);
+            }
+            catch (std::runtime_error const& ex)
+            {
+                RPNX_ASSERT(std::string(ex.what()) == "job failed");
+                handled++;
+            }
+            // Exceptions from the handler itself are discarded.
+            throw std::logic_error("handler failed");
+        };
+        priority_dispatcher dispatcher(options);
+
+        // Values, void and exceptions, and moving a future.
+        {
+            std::vector< rpnx::experimental::job_future< int > > futures;
+            for (int i = 0; i < 1000; i++)
+            {
+                futures.push_back(dispatcher.submit_with_result(
+                    [i] {
+                        return i * 3;
+                    },
+                    i % 5));
+            }
+            auto nothing = dispatcher.submit_with_result([] {}, 0);
+            auto failure = dispatcher.submit_with_result(
+                []() -> std::string {
+                    throw std::runtime_error("result failed");
+                },
+                0);
+            auto unique = dispatcher.submit_with_result(
+                [p = std::make_unique< int >(7)]() mutable {
+                    return std::move(p);
+                },
+                0);
+
+            long sum = 0;
+            for (auto& f : futures)
+            {
+                RPNX_ASSERT(f.valid());
+                sum += f.get().get();
+                RPNX_ASSERT(!f.valid());
+            }
+            RPNX_ASSERT(sum == 3L * 999 * 1000 / 2);
+            nothing.get().get();
+
+            rpnx::experimental::job_future< std::string > moved = std::move(failure);
+            RPNX_ASSERT(!failure.valid() && moved.valid());
+            moved.wait();
+            RPNX_ASSERT(moved.ready());
+            [[maybe_unused]] bool threw = false;
+            try
+            {
+                moved.get().get();
+            }
+            catch (std::runtime_error const& ex)
+            {
+                threw = std::string(ex.what()) == "result failed";
+            }
+            RPNX_ASSERT(threw);
+            rpnx::experimental::result< std::unique_ptr< int > > seven = unique.get();
+            RPNX_ASSERT(*seven.get() == 7);
+        }
+
+        // The handler sees exceptions from other jobs, before their cleanup.
+        {
+            counters c;
+            for (int i = 0; i < 20; i++)
+            {
+                dispatcher.submit(&run_job, &cleanup_job, new job{&c, i % 2 == 0}, 0);
+            }
+            dispatcher.finish_all();
+            RPNX_ASSERT(c.m_failed == 10 && c.m_completed == 10 && handled == 10);
+        }
+
+        // Another thread waits until the job runs, and a dropped future still runs its job.
+        {
+            dispatcher.set_service_thread_count(0);
+            std::atomic< int > ran{0};
+            auto f = dispatcher.submit_with_result(
+                [&ran] {
+                    return ++ran;
+                },
+                0);
+            dispatcher.submit_with_result(
+                [&ran] {
+                    ran++;
+                },
+                0);
+            int seen = 0;
+            std::thread waiter([&] {
+                seen = f.get().get();
+            });
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            RPNX_ASSERT(seen == 0);
+            dispatcher.set_service_thread_count(2);
+            waiter.join();
+            dispatcher.finish_all();
+            RPNX_ASSERT(seen >= 1 && ran == 2);
+        }
+
+        // Cancelled jobs break their promise.
+        {
+            dispatcher.set_service_thread_count(0);
+            auto f = dispatcher.submit_with_result(
+                [] {
+                    return 1;
+                },
+                0);
+            dispatcher.cancel_all();
+            RPNX_ASSERT(f.ready());
+            [[maybe_unused]] bool broken = false;
+            try
+            {
+                f.get().get();
+            }
+            catch (std::future_error const& ex)
+            {
+                broken = ex.code() == std::future_errc::broken_promise;
+            }
+            RPNX_ASSERT(broken);
+            dispatcher.set_service_thread_count(2);
+        }
+        RPNX_ASSERT(handled == 10);
+    }
+} // namespace
+
+int main()
+{
+    test_mode(priority_dispatcher::scheduling_mode::shared_queue);
+    test_mode(priority_dispatcher::scheduling_mode::work_stealing);
+    test_mode(priority_dispatcher::scheduling_mode::banded);
+    test_timers(priority_dispatcher::scheduling_mode::shared_queue);
+    test_timers(priority_dispatcher::scheduling_mode::work_stealing);
+    test_timers(priority_dispatcher::scheduling_mode::banded);
+    test_task_groups(priority_dispatcher::scheduling_mode::shared_queue);
+    test_task_groups(priority_dispatcher::scheduling_mode::work_stealing);
+    test_task_groups(priority_dispatcher::scheduling_mode::banded);
+    test_affinity(priority_dispatcher::scheduling_mode::shared_queue);
+    test_affinity(priority_dispatcher::scheduling_mode::work_stealing);
+    test_affinity(priority_dispatcher::scheduling_mode::banded);
+    test_stats(priority_dispatcher::scheduling_mode::shared_queue);
+    test_stats(priority_dispatcher::scheduling_mode::work_stealing);
+    test_stats(priority_dispatcher::scheduling_mode::banded);
+    test_results(priority_dispatcher::scheduling_mode::shared_queue);
+    test_results(priority_dispatcher::scheduling_mode::work_stealing);
+    test_results(priority_dispatcher::scheduling_mode::banded);
+
+    // Timers more than 4096 ticks away are cascaded down two levels of the timing wheel before they fire.
+    {
+        priority_dispatcher dispatcher;
+        std::atomic< int > fired{0};
+        std::atomic< int > early{0};
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < 100; i++)
+        {
+            auto when = start + std::chrono::milliseconds(4100 + i * 3);
+            dispatcher.submit_at(
+                [&fired, &early, when] {
+                    if (std::chrono::steady_clock::now() < when)
+                    {
+                        early++;
+                    }
+                    fired++;
+                },
+                when, 0);
+        }
+        [[maybe_unused]] bool all_fired = wait_for(fired, 100, std::chrono::seconds(30));
+        RPNX_ASSERT(all_fired);
+        RPNX_ASSERT(early == 0);
+    }
+
+    // Banded mode starts higher bands first and each band in submission order, clamping out of range priorities.
+    {
+        priority_dispatcher::options options;
+        options.m_mode = priority_dispatcher::scheduling_mode::banded;
+        options.m_thread_count = 1;
+        options.m_band_count = 4;
+        priority_dispatcher dispatcher(options);
+        std::atomic< bool > release{false};
+        std::atomic< bool > started{false};
+        dispatcher.submit(
+            [&] {
+                started = true;
+                while (!release)
+                {
+                    std::this_thread::yield();
+                }
+            },
+            0);
+        while (!started)
+        {
+            std::this_thread::yield();
+        }
+        std::vector< std::pair< std::int64_t, int > > order;
+        for (int i = 0; i < 300; i++)
+        {
+            std::int64_t priority = std::int64_t(i * 7 % 6) - 1;
+            dispatcher.submit(
+                [&order, priority, i] {
+                    order.emplace_back(std::clamp< std::int64_t >(priority, 0, 3), i);
+                },
+                priority);
+        }
+        release = true;
+        dispatcher.finish_all();
+        RPNX_ASSERT(order.size() == 300);
+        for (std::size_t i = 1; i < order.size(); i++)
+        {
+            RPNX_ASSERT(order[i - 1].first > order[i].first || (order[i - 1].first == order[i].first && order[i - 1].second < order[i].second));
+        }
+
+        for (std::size_t bands : {std::size_t(0), std::size_t(65)})
+        {
+            options.m_band_count = bands;
+            [[maybe_unused]] bool threw = false;
+            try
+            {
+                priority_dispatcher invalid(options);
+            }
+            catch (std::invalid_argument const&)
+            {
+                threw = true;
+            }
+            RPNX_ASSERT(threw);
+        }
+    }
+
+    // Only one service thread, so jobs queued behind a running job start in priority order.
+    {
+        priority_dispatcher::options options;
+        options.m_mode = priority_dispatcher::scheduling_mode::work_stealing;
+        options.m_thread_count = 1;
+        priority_dispatcher dispatcher(options);
+        std::atomic< bool > release{false};
+        std::atomic< bool > started{false};
+        dispatcher.submit(
+            [&] {
+                started = true;
+                while (!release)
+                {
+                    std::this_thread::yield();
+                }
+            },
+            0);
+        while (!started)
+        {
+            std::this_thread::yield();
+        }
+        std::vector< int > order;
+        for (int i = 0; i < 100; i++)
+        {
+            dispatcher.submit(
+                [&order, i] {
+                    order.push_back(i);
+                },
+                (i * 37) % 100);
+        }
+        release = true;
+        dispatcher.finish_all();
+        RPNX_ASSERT(order.size() == 100);
+        for (std::size_t i = 1; i < order.size(); i++)
+        {
+            RPNX_ASSERT((order[i - 1] * 37) % 100 > (order[i] * 37) % 100);
+        }
+    }
+
+    std::cout << "priority_dispatcher tests passed" << std::endl;
+    return 0;
+}
@@ -2,12 +2,16 @@
 // All rights reserved
 // See rpnx-core/LICENSE.txt
 
-// Warning: basic_derivator custom allocators DO NOT currently work.
+// Warning: basic_derivator and basic_inline_derivator only support stateless custom allocators (is_always_equal), such as rpnx::experimental::pool_allocator.
 
 #ifndef RPNX_DERIVATOR_HPP
 #define RPNX_DERIVATOR_HPP
 
+#include <array>
+#include <cstdint>
 #include <memory>
+#include <new>
+#include <stdexcept>
 #include <tuple>
 #include <type_traits>
 #include <typeindex>
@@ -20,168 +24,334 @@
 namespace rpnx
 {
 
+    /** Type-erased operations on one alternative of a basic_inline_derivator.
+     * Each operation works on the derivator's storage, which holds either the value itself (m_inline) or a pointer to
+     * it. Comparison and hashing are not here, see detail::derivator_equals_table.
+     */
     template < typename Allocator >
     struct derivator_vtab
     {
-        void (*m_deleter)(Allocator const& a, typename std::allocator_traits< Allocator >::void_pointer) = nullptr;
-        void* (*m_construct_copy)(Allocator const & alloc, typename std::allocator_traits< Allocator >::const_void_pointer) = nullptr;
-        void* (*m_construct_move)(Allocator const & alloc, typename std::allocator_traits< Allocator >::void_pointer) = nullptr;
-        bool (*m_equals)(typename std::allocator_traits< Allocator >::void_pointer, typename std::allocator_traits< Allocator >::void_pointer) = nullptr;
-        bool (*m_less)(void const*, void const*) = nullptr;
+        void (*m_deleter)(Allocator const& alloc, void* storage) = nullptr;
+        void (*m_construct_copy)(Allocator const& alloc, void* storage, void const* src_storage) = nullptr;
+        /** Moves the value from src_storage into storage and ends its lifetime in src_storage. */
+        void (*m_relocate)(void* storage, void* src_storage) noexcept = nullptr;
         int m_index = -1;
         bool is_void = false;
+        bool m_inline = false;
     };
 
     namespace detail
     {
+        /** True if T is stored in the derivator's own storage instead of being allocated.
+         * Types that might throw on move stay on the heap, so moving and swapping derivators never throws.
+         */
+        template < typename T, std::size_t InlineSize >
+        constexpr bool derivator_stores_inline()
+        {
+            if constexpr (std::is_void_v< T >)
+            {
+                return false;
+            }
+            else
+            {
+                return sizeof(T) <= InlineSize && alignof(T) <= alignof(void*) && std::is_nothrow_move_constructible_v< T >;
+            }
+        }
 
-        // There is some bug in visual studio that causes this not to work
-        template < typename T, typename Alloc >
-        void derivator_deletor(Alloc const & alloc, void* src)
+        template < typename T >
+        T* derivator_heap_pointer(void* storage) noexcept
+        {
+            return *std::launder(reinterpret_cast< T** >(storage));
+        }
+
+        template < typename T, std::size_t InlineSize >
+        T const* derivator_value(void const* storage) noexcept
+        {
+            if constexpr (derivator_stores_inline< T, InlineSize >())
+            {
+                return std::launder(reinterpret_cast< T const* >(storage));
+            }
+            else
+            {
+                return derivator_heap_pointer< T >(const_cast< void* >(storage));
+            }
+        }
+
+        // void alternatives are trivially equal, ordered and hashable.
+        template < typename T, typename = void >
+        struct derivator_has_equals : std::is_void< T >
+        {
+        };
+
+        template < typename T >
+        struct derivator_has_equals< T, std::void_t< decltype(bool(std::declval< T const& >() == std::declval< T const& >())) > > : std::true_type
+        {
+        };
+
+        template < typename T, typename = void >
+        struct derivator_has_less : std::is_void< T >
+        {
+        };
+
+        template < typename T >
+        struct derivator_has_less< T, std::void_t< decltype(bool(std::declval< T const& >() < std::declval< T const& >())) > > : std::true_type
+        {
+        };
+
+        template < typename T, typename = void >
+        struct derivator_has_hash : std::is_void< T >
+        {
+        };
+
+        template < typename T >
+        struct derivator_has_hash< T, std::void_t< decltype(std::size_t(std::hash< T >()(std::declval< T const& >()))) > > : std::true_type
+        {
+        };
+
+        template < typename T, std::size_t InlineSize >
+        bool derivator_equals(void const* storage, void const* other_storage)
         {
-            if constexpr (!std::is_void_v< T >)
+            if constexpr (std::is_void_v< T >)
             {
-                ((T*)src)->T::~T();
-                (typename std::allocator_traits< Alloc >::template rebind_alloc< T >(alloc)).deallocate((T*)src, sizeof(T));
+                return true;
+            }
+            else
+            {
+                return *derivator_value< T, InlineSize >(storage) == *derivator_value< T, InlineSize >(other_storage);
             }
         }
 
-        template <typename T, typename Alloc>
-        void * derivator_construct_copy(Alloc const & alloc, void const * src)
+        template < typename T, std::size_t InlineSize >
+        bool derivator_less(void const* storage, void const* other_storage)
         {
-            if constexpr (!std::is_void_v< T >)
+            if constexpr (std::is_void_v< T >)
             {
-                void* dest = (typename std::allocator_traits< Alloc >::template rebind_alloc< T >(alloc)).allocate(sizeof(T));
-                try
-                {
-                    return (void*)new (dest) T(*reinterpret_cast< T const* >(src));
-                }
-                catch (...)
-                {
-                    (typename std::allocator_traits< Alloc >::template rebind_alloc< T >(alloc)).deallocate((T*)dest, sizeof(T));
-                    throw;
-                }
+                return false;
             }
             else
-                return nullptr;
+            {
+                return *derivator_value< T, InlineSize >(storage) < *derivator_value< T, InlineSize >(other_storage);
+            }
         }
 
-        template <typename T, typename Alloc>
-        void * derivator_construct_move(Alloc const & alloc, void * src)
+        template < typename T, std::size_t InlineSize >
+        std::size_t derivator_hash(void const* storage)
         {
-            if constexpr (!std::is_void_v< T >)
+            if constexpr (std::is_void_v< T >)
             {
-                void* dest = (typename std::allocator_traits< Alloc >::template rebind_alloc< T >(alloc)).allocate(sizeof(T));
+                return 0;
+            }
+            else
+            {
+                return std::hash< T >()(*derivator_value< T, InlineSize >(storage));
+            }
+        }
+
+        /** operator== of each alternative, indexed like the alternatives.
+         * The comparison tables live apart from derivator_vtab, which every derivator instantiates, so that they are
+         * only instantiated for derivators that are compared or hashed. The traits above can not tell whether an
+         * operator compiles, only whether it is declared: std::vector<S> has operator== for any S.
+         */
+        template < std::size_t InlineSize, typename... Types >
+        struct derivator_equals_table
+        {
+            static constexpr std::array< bool (*)(void const*, void const*), sizeof...(Types) > table = {{&derivator_equals< Types, InlineSize >...}};
+        };
+
+        /** operator< of each alternative, see derivator_equals_table. */
+        template < std::size_t InlineSize, typename... Types >
+        struct derivator_less_table
+        {
+            static constexpr std::array< bool (*)(void const*, void const*), sizeof...(Types) > table = {{&derivator_less< Types, InlineSize >...}};
+        };
+
+        /** std::hash of each alternative, see derivator_equals_table. */
+        template < std::size_t InlineSize, typename... Types >
+        struct derivator_hash_table
+        {
+            static constexpr std::array< std::size_t (*)(void const*), sizeof...(Types) > table = {{&derivator_hash< Types, InlineSize >...}};
+        };
+
+        /** Combines the index of an alternative with the hash of its value, so equal values of different
+         * alternatives hash differently.
+         */
+        inline std::size_t derivator_hash_combine(int index, std::size_t value_hash) noexcept
+        {
+            return value_hash ^ (std::size_t(index + 1) * std::size_t(0x9E3779B97F4A7C15ull));
+        }
+
+        // There is some bug in visual studio that causes this not to work
+        template < typename T, typename Alloc, std::size_t InlineSize >
+        void derivator_deletor(Alloc const & alloc, void* storage)
+        {
+            if constexpr (derivator_stores_inline< T, InlineSize >())
+            {
+                std::launder(reinterpret_cast< T* >(storage))->T::~T();
+            }
+            else if constexpr (!std::is_void_v< T >)
+            {
+                T* src = derivator_heap_pointer< T >(storage);
+                src->T::~T();
+                (typename std::allocator_traits< Alloc >::template rebind_alloc< T >(alloc)).deallocate(src, 1);
+            }
+        }
+
+        template < typename T, typename Alloc, std::size_t InlineSize >
+        void derivator_construct_copy(Alloc const & alloc, void* storage, void const* src_storage)
+        {
+            if constexpr (derivator_stores_inline< T, InlineSize >())
+            {
+                new (storage) T(*std::launder(reinterpret_cast< T const* >(src_storage)));
+            }
+            else if constexpr (!std::is_void_v< T >)
+            {
+                T const* src = derivator_heap_pointer< T >(const_cast< void* >(src_storage));
+                T* dest = (typename std::allocator_traits< Alloc >::template rebind_alloc< T >(alloc)).allocate(1);
                 try
                 {
-                    return (void*)new (dest) T(std::move(*reinterpret_cast< T const* >(src)));
+                    new (dest) T(*src);
                 }
                 catch (...)
                 {
-                    (typename std::allocator_traits< Alloc >::template rebind_alloc< T >(alloc)).deallocate((T*)dest, sizeof(T));
+                    (typename std::allocator_traits< Alloc >::template rebind_alloc< T >(alloc)).deallocate(dest, 1);
                     throw;
                 }
+                new (storage) T*(dest);
+            }
+        }
+
+        template < typename T, std::size_t InlineSize >
+        void derivator_relocate(void* storage, void* src_storage) noexcept
+        {
+            if constexpr (derivator_stores_inline< T, InlineSize >())
+            {
+                T* src = std::launder(reinterpret_cast< T* >(src_storage));
+                new (storage) T(std::move(*src));
+                src->T::~T();
+            }
+            else if constexpr (!std::is_void_v< T >)
+            {
+                new (storage) T*(derivator_heap_pointer< T >(src_storage));
             }
-            else
-                return nullptr;
         }
     } // namespace detail
     
     
-    template < int I, typename T, typename Allocator >
+    template < int I, typename T, typename Allocator, std::size_t InlineSize >
     constexpr derivator_vtab< Allocator > init_vtab_for()
     {
         derivator_vtab< Allocator > tb;
            
-        tb.m_construct_copy = &detail::derivator_construct_copy< T, Allocator >;
-        tb.m_construct_move = &detail::derivator_construct_move< T, Allocator >;
-        tb.m_deleter = &detail::derivator_deletor< T, Allocator >;
-        
-        // TODO: It would be nice to support comparisons where possible, fix this.
-        tb.m_equals = nullptr;
-        tb.m_less = nullptr;
+        tb.m_construct_copy = &detail::derivator_construct_copy< T, Allocator, InlineSize >;
+        tb.m_relocate = &detail::derivator_relocate< T, InlineSize >;
+        tb.m_deleter = &detail::derivator_deletor< T, Allocator, InlineSize >;
 
         tb.m_index = I;
         tb.is_void = std::is_void_v<T>;
+        tb.m_inline = detail::derivator_stores_inline< T, InlineSize >();
 
         return tb;
     }
 
-    template < int I, typename T, typename Allocator >
-    inline constexpr const derivator_vtab< Allocator > derivator_vtab_v = init_vtab_for< I, T, Allocator >();
-
-    template < typename Allocator, typename... Types >
-    class basic_derivator : private Allocator
+    template < int I, typename T, typename Allocator, std::size_t InlineSize >
+    inline constexpr const derivator_vtab< Allocator > derivator_vtab_v = init_vtab_for< I, T, Allocator, InlineSize >();
+
+    /** A derivator that stores alternatives of up to InlineSize bytes in place instead of allocating them.
+     * Alternatives are stored inline when they fit in InlineSize bytes, are no more aligned than a pointer, and have a
+     * non-throwing move constructor; all others are allocated through Allocator as before. The storage is always at
+     * least large enough to hold that pointer, so sizeof is max(InlineSize, sizeof(void*)) plus one vtab pointer.
+     * Inline values move with the derivator, so references to them do not survive a move or swap of the derivator.
+     * InlineSize 0 allocates every alternative.
+     */
+    template < std::size_t InlineSize, typename Allocator, typename... Types >
+    class basic_inline_derivator : private Allocator
     {
-        static_assert(std::is_same_v<std::allocator<void>, Allocator>, "Custom allocators don't work yet.");
+        static_assert(std::allocator_traits< Allocator >::is_always_equal::value, "Stateful allocators are not supported yet.");
+
+        static constexpr std::size_t storage_size = InlineSize < sizeof(void*) ? sizeof(void*) : InlineSize;
 
-        typename std::allocator_traits< Allocator >::void_pointer m_value;
         derivator_vtab< Allocator > const* m_vtab;
+        alignas(void*) unsigned char m_storage[storage_size];
+
       private:
-        void make_void()
+        template < std::size_t I >
+        using alternative_type = std::tuple_element_t< I, std::tuple< Types... > >;
+
+        static derivator_vtab< Allocator > const* void_vtab() noexcept
+        {
+            return &derivator_vtab_v< tuple_type_index< void, std::tuple< Types... > >::value, void, Allocator, InlineSize >;
+        }
+
+        void make_void() noexcept
         {
-            m_vtab = &derivator_vtab_v< tuple_type_index<void, std::tuple<Types...>>::value, void, Allocator >;
-            m_value = nullptr;
+            m_vtab = void_vtab();
         }
 
         void destroy()
         {
-            if (m_value && m_vtab)
+            if (!m_vtab->is_void)
             {
-                m_vtab->m_deleter(get_allocator(), m_value);
+                m_vtab->m_deleter(get_allocator(), m_storage);
             }
             make_void();
         }
 
+        template < typename T >
+        T* pointer() noexcept
+        {
+            return const_cast< T* >(detail::derivator_value< T, InlineSize >(m_storage));
+        }
+
+        template < typename T >
+        T const* pointer() const noexcept
+        {
+            return const_cast< basic_inline_derivator* >(this)->template pointer< T >();
+        }
+
       public:
         using allocator_type = Allocator;
 
-        basic_derivator() noexcept(noexcept(Allocator()))
-            : m_value(nullptr), m_vtab(nullptr) { emplace< 0 >(); }
-        ~basic_derivator() { destroy(); }
+        static constexpr std::size_t inline_size = InlineSize;
 
-        basic_derivator(basic_derivator<Allocator, Types...> const& other) 
-            : Allocator(other), m_value(nullptr), m_vtab(nullptr)
+        /** True if the alternative T is stored inline rather than allocated. */
+        template < typename T >
+        static constexpr bool stores_inline = detail::derivator_stores_inline< T, InlineSize >();
+
+        basic_inline_derivator() noexcept(noexcept(Allocator()))
+            : m_vtab(void_vtab()) { emplace< 0 >(); }
+        ~basic_inline_derivator() { destroy(); }
+
+        basic_inline_derivator(basic_inline_derivator<InlineSize, Allocator, Types...> const& other) 
+            : Allocator(other), m_vtab(other.m_vtab)
         {
-            if (other.m_value)
+            if (!m_vtab->is_void)
             {
-                m_value = other.m_vtab->m_construct_copy(get_allocator(), other.m_value);
-                m_vtab = other.m_vtab;
+                m_vtab->m_construct_copy(get_allocator(), m_storage, other.m_storage);
             }
         }
 
-        basic_derivator(basic_derivator<Allocator, Types...> && other )
-        : Allocator(other.get_allocator())
-        {
-            make_void();
-            std::swap(m_vtab, other.m_vtab);
-            std::swap(m_value, other.m_value);
-
-        }
-
-        basic_derivator<Allocator, Types...> & operator =(basic_derivator<Allocator, Types...> && other)
+        basic_inline_derivator(basic_inline_derivator<InlineSize, Allocator, Types...> && other ) noexcept
+        : Allocator(other.get_allocator()), m_vtab(other.m_vtab)
         {
-            static_assert(std::is_same_v<Allocator, std::allocator<void>>, "Not implemented");
-            /*
-            if constexpr (std::allocator_traits<allocator_type>::propagate_on_container_move_assignment::value)
+            if (!m_vtab->is_void)
             {
-                //if (get_allocator() != other.get_allocator())
-                *(allocator_type*)this = static_cast<allocator_type&>(other); 
+                m_vtab->m_relocate(m_storage, other.m_storage);
             }
-            */
-           std::swap(m_value, other.m_value);
-           std::swap(m_vtab, other.m_vtab);
+            other.make_void();
+        }
 
-           return *this;
+        basic_inline_derivator<InlineSize, Allocator, Types...> & operator =(basic_inline_derivator<InlineSize, Allocator, Types...> && other) noexcept
+        {
+            // Moving out first keeps this correct when other is owned by the current value.
+            basic_inline_derivator<InlineSize, Allocator, Types...> moved(std::move(other));
+            swap(moved);
+            return *this;
         }
 
-        basic_derivator<Allocator, Types...> & operator =(basic_derivator<Allocator, Types...> const & other)
+        basic_inline_derivator<InlineSize, Allocator, Types...> & operator =(basic_inline_derivator<InlineSize, Allocator, Types...> const & other)
         {
-            static_assert(std::is_same_v<Allocator, std::allocator<void>>, "Not implemented");
-            assert(other.m_vtab != nullptr);
-            void *value = other.m_vtab->m_construct_copy(other, other.m_value );
-            m_value = value;
-            m_vtab = other.m_vtab;
+            basic_inline_derivator<InlineSize, Allocator, Types...> copy(other);
+            swap(copy);
             return *this;
         }
 
@@ -200,77 +370,62 @@ namespace rpnx
         }
 
         template <typename T>
-        basic_derivator<Allocator, Types...> & operator=(T const & value)
+        basic_inline_derivator<InlineSize, Allocator, Types...> & operator=(T const & value)
         {
             constexpr const int I = tuple_type_index<T, std::tuple<Types...> >::value;
             static_assert(I != -1, "Cannot assign type T to incompatible derivator");
 
-            void* ptr = (typename std::allocator_traits< Allocator >::template rebind_alloc< T >(get_allocator())).allocate(sizeof(T));
-            try
-            {
-                ptr = (void*)new (ptr) T(value);
-            }
-            catch (...)
-            {
-                (typename std::allocator_traits< Allocator >::template rebind_alloc< T >(get_allocator())).deallocate((T*)ptr, sizeof(T));
-                throw;
-            }
-
-            destroy();
-            m_vtab = &derivator_vtab_v< I, T, Allocator >;
-            m_value = reinterpret_cast< void* >(ptr);
-
+            emplace< I >(value);
             return *this;
         }
 
-        template <typename T>
-        basic_derivator<Allocator, Types...> & operator=(T && value)
+        template <typename T, typename = std::enable_if_t< !std::is_same_v< std::decay_t< T >, basic_inline_derivator<InlineSize, Allocator, Types...> > > >
+        basic_inline_derivator<InlineSize, Allocator, Types...> & operator=(T && value)
         {
-            constexpr const int I = tuple_type_index<T, std::tuple<Types...> >::value;
+            using U = std::decay_t< T >;
+            constexpr const int I = tuple_type_index<U, std::tuple<Types...> >::value;
             static_assert(I != -1, "Cannot assign type T to incompatible derivator");
 
-            void* ptr = (typename std::allocator_traits< Allocator >::template rebind_alloc< T >(get_allocator())).allocate(sizeof(T));
-            try
-            {
-                ptr = (void*)new (ptr) T(std::move(value));
-            }
-            catch (...)
-            {
-                (typename std::allocator_traits< Allocator >::template rebind_alloc< T >(get_allocator())).deallocate((T*)ptr, sizeof(T));
-                throw;
-            }
-
-            destroy();
-            m_vtab = &derivator_vtab_v< I, T, Allocator >;
-            m_value = reinterpret_cast< void* >(ptr);
+            emplace< I >(std::forward< T >(value));
             return *this;
         }
 
+        /** Replaces the value with alternative I constructed from ts.
+         * The new value is constructed before the old one is destroyed, so ts may refer into the current value, and
+         * the derivator is unchanged if construction throws.
+         */
         template < size_t I, typename... Ts >
         void emplace(Ts&&... ts)
         {
-            if constexpr (std::is_void_v< std::tuple_element_t< I, std::tuple< Types... > > >)
+            using T = alternative_type< I >;
+            if constexpr (std::is_void_v< T >)
+            {
+                destroy();
+                m_vtab = &derivator_vtab_v< I, T, Allocator, InlineSize >;
+            }
+            else if constexpr (stores_inline< T >)
             {
+                T value(std::forward< Ts >(ts)...);
                 destroy();
-                m_vtab = &derivator_vtab_v< I, std::tuple_element_t< I, std::tuple< Types... > >, Allocator >;
+                new (m_storage) T(std::move(value));
+                m_vtab = &derivator_vtab_v< I, T, Allocator, InlineSize >;
             }
             else
             {
-                using T = std::tuple_element_t< I, std::tuple< Types... > >;
-                void* ptr = (typename std::allocator_traits< Allocator >::template rebind_alloc< T >(get_allocator())).allocate(sizeof(T));
+                T* ptr = (typename std::allocator_traits< Allocator >::template rebind_alloc< T >(get_allocator())).allocate(1);
                 try
                 {
-                    ptr = (void*)new (ptr) T(std::forward< Ts >(ts)...);
+                    new (ptr) T(std::forward< Ts >(ts)...);
                 }
                 catch (...)
                 {
-                    (typename std::allocator_traits< Allocator >::template rebind_alloc< T >(get_allocator())).deallocate((T*)ptr, sizeof(T));
+                    (typename std::allocator_traits< Allocator >::template rebind_alloc< T >(get_allocator())).deallocate(ptr, 1);
                     throw;
                 }
 
                 destroy();
-                m_vtab = &derivator_vtab_v< I, std::tuple_element_t< I, std::tuple< Types... > >, Allocator >;
-                m_value = reinterpret_cast< void* >(ptr);
+                new (m_storage) T*(ptr);
+                m_vtab = &derivator_vtab_v< I, T, Allocator, InlineSize >;
             }
         }
 
@@ -284,7 +439,7 @@ namespace rpnx
         {
             if (m_vtab->m_index != I) throw std::invalid_argument("derivator");
 
-            return *reinterpret_cast< std::tuple_element_t< I, std::tuple< Types... > >* >(m_value);
+            return *pointer< alternative_type< I > >();
         }
 
         template < int I >
@@ -292,7 +447,7 @@ namespace rpnx
         {
             if (m_vtab->m_index != I) throw std::invalid_argument("derivator");
 
-            return *reinterpret_cast< std::tuple_element_t< I, std::tuple< Types... > > const* >(m_value);
+            return *pointer< alternative_type< I > >();
         }
 
         template < typename T >
@@ -314,13 +469,13 @@ namespace rpnx
         template < int I >
         std::tuple_element_t< I, std::tuple< Types... > >& as()
         {
-            return *reinterpret_cast< std::tuple_element_t< I, std::tuple< Types... > >* >(m_value);
+            return *pointer< alternative_type< I > >();
         }
 
         template < int I >
         std::tuple_element_t< I, std::tuple< Types... > > const& as() const
         {
-            return *reinterpret_cast< std::tuple_element_t< I, std::tuple< Types... > > const* >(m_value);
+            return *pointer< alternative_type< I > >();
         }
 
         template < typename T >
@@ -339,10 +494,8 @@ namespace rpnx
             return as< tuple_type_index< T, std::tuple< Types... > >::value >();
         }
 
-        void swap(basic_derivator< Allocator, Types... >& other) noexcept
+        void swap(basic_inline_derivator< InlineSize, Allocator, Types... >& other) noexcept
         {
-            // TODO: this should only be noexcept if the allocator void_pointer type is
-            // noexcept swappable
             if constexpr (std::allocator_traits<allocator_type>::propagate_on_container_swap::value)
             {
                 std::swap(static_cast<allocator_type&>(*this),static_cast<allocator_type&>(other));
@@ -352,8 +505,24 @@ namespace rpnx
                 // Swap with incompatible allocators is undefined per standard.
                 RPNX_ASSERT(static_cast<allocator_type&>(*this) == static_cast<allocator_type&>(other));
             }
+            if (this == &other)
+            {
+                return;
+            }
+            alignas(void*) unsigned char temporary[storage_size];
+            if (!m_vtab->is_void)
+            {
+                m_vtab->m_relocate(temporary, m_storage);
+            }
+            if (!other.m_vtab->is_void)
+            {
+                other.m_vtab->m_relocate(m_storage, other.m_storage);
+            }
+            if (!m_vtab->is_void)
+            {
+                m_vtab->m_relocate(other.m_storage, temporary);
+            }
             std::swap(m_vtab, other.m_vtab);
-            std::swap(m_value, other.m_value);
         }
 
         template < typename T >
@@ -364,14 +533,72 @@ namespace rpnx
 
         bool has_value() const noexcept
         {
-            return m_value != nullptr;
+            return !m_vtab->is_void;
+        }
+
+        /** Hashes the held alternative's index and value; this is what std::hash of the derivator returns.
+         * Every alternative must be void or have std::hash enabled.
+         */
+        std::size_t hash() const
+        {
+            static_assert((detail::derivator_has_hash< Types >::value && ...), "Every alternative of a hashed derivator must have std::hash enabled");
+            return detail::derivator_hash_combine(m_vtab->m_index, m_vtab->is_void ? 0 : detail::derivator_hash_table< InlineSize, Types... >::table[m_vtab->m_index](m_storage));
+        }
+
+        /** Derivators compare equal if they hold the same alternative with equal values.
+         * Every alternative must be void or have operator==.
+         */
+        friend bool operator==(basic_inline_derivator< InlineSize, Allocator, Types... > const& a, basic_inline_derivator< InlineSize, Allocator, Types... > const& b)
+        {
+            static_assert((detail::derivator_has_equals< Types >::value && ...), "Every alternative of a compared derivator must have operator==");
+            return a.m_vtab->m_index == b.m_vtab->m_index && (a.m_vtab->is_void || detail::derivator_equals_table< InlineSize, Types... >::table[a.m_vtab->m_index](a.m_storage, b.m_storage));
+        }
+
+        friend bool operator!=(basic_inline_derivator< InlineSize, Allocator, Types... > const& a, basic_inline_derivator< InlineSize, Allocator, Types... > const& b)
+        {
+            return !(a == b);
+        }
+
+        /** Derivators order by the index of the held alternative, then by value, like std::variant.
+         * Every alternative must be void or have operator<.
+         */
+        friend bool operator<(basic_inline_derivator< InlineSize, Allocator, Types... > const& a, basic_inline_derivator< InlineSize, Allocator, Types... > const& b)
+        {
+            static_assert((detail::derivator_has_less< Types >::value && ...), "Every alternative of an ordered derivator must have operator<");
+            if (a.m_vtab->m_index != b.m_vtab->m_index)
+            {
+                return a.m_vtab->m_index < b.m_vtab->m_index;
+            }
+            return !a.m_vtab->is_void && detail::derivator_less_table< InlineSize, Types... >::table[a.m_vtab->m_index](a.m_storage, b.m_storage);
+        }
+
+        friend bool operator>(basic_inline_derivator< InlineSize, Allocator, Types... > const& a, basic_inline_derivator< InlineSize, Allocator, Types... > const& b)
+        {
+            return b < a;
+        }
+
+        friend bool operator<=(basic_inline_derivator< InlineSize, Allocator, Types... > const& a, basic_inline_derivator< InlineSize, Allocator, Types... > const& b)
+        {
+            return !(b < a);
+        }
+
+        friend bool operator>=(basic_inline_derivator< InlineSize, Allocator, Types... > const& a, basic_inline_derivator< InlineSize, Allocator, Types... > const& b)
+        {
+            return !(a < b);
         }
     };
 
+    /** basic_derivator stores alternatives no larger than a pointer in the space the pointer would take, and
+     * allocates the rest through Allocator.
+     */
+    template < typename Allocator, typename... Types >
+    using basic_derivator = basic_inline_derivator< sizeof(void*), Allocator, Types... >;
+
     /** The class rpnx::derivator is a bit like std::variant, except that it
      * allocates memory indirectly. This allows derivators that can refer to the
      * enclosing class, and also can save memory if some possible values are much
      * larger than others (variant always allocates enough space for the largest).
+     * Alternatives no larger than a pointer are stored in place without allocating.
      * If you need control over memory allocation, use
      * rpnx::basic_derivator<Allocator, Types...>
      *
@@ -379,97 +606,249 @@ namespace rpnx
     template < typename... Ts >
     using derivator = basic_derivator< std::allocator< void >, Ts... >;
 
+    /** A derivator that stores alternatives of up to InlineSize bytes in place, see basic_inline_derivator. */
+    template < std::size_t InlineSize, typename... Ts >
+    using inline_derivator = basic_inline_derivator< InlineSize, std::allocator< void >, Ts... >;
+
     namespace detail
     {
-        template<size_t I, typename Derivator>
+        template < size_t I, typename Derivator >
         struct derivator_element;
 
-      
-        template<typename Visitor, typename Derivator, size_t I>
-        void derivator_dispatch(Visitor && visitor, Derivator && derivator)
+        template < size_t I, std::size_t InlineSize, typename Allocator, typename... Types >
+        struct derivator_element< I, basic_inline_derivator< InlineSize, Allocator, Types... > >
         {
-            using derivator_t = std::remove_all_extents_t<std::remove_reference_t<Derivator>>;
-            if constexpr (! std::is_void_v< typename derivator_element<I, derivator_t>::type >)
+            using type = typename std::tuple_element< I, std::tuple< Types... > >::type;
+        };
+
+        template < typename Derivator >
+        struct derivator_size
+        {
+            static constexpr bool is_derivator = false;
+        };
+
+        template < std::size_t InlineSize, typename Allocator, typename... Types >
+        struct derivator_size< basic_inline_derivator< InlineSize, Allocator, Types... > >
+        {
+            static constexpr bool is_derivator = true;
+            static constexpr std::size_t value = sizeof...(Types);
+        };
+
+        template < typename Derivator >
+        using derivator_type_t = std::remove_cv_t< std::remove_reference_t< Derivator > >;
+
+        /** The arguments alternative I of derivator contributes to a visitor call: none for void, otherwise the value,
+         * as an rvalue if the derivator is one.
+         */
+        template < std::size_t I, typename Derivator >
+        auto derivator_arguments(Derivator&& derivator) noexcept
+        {
+            if constexpr (std::is_void_v< typename derivator_element< I, derivator_type_t< Derivator > >::type >)
+            {
+                return std::tuple<>();
+            }
+            else if constexpr (std::is_lvalue_reference_v< Derivator >)
             {
-                std::forward<Visitor>(visitor)(std::forward<Derivator>(derivator).template as<I>());
+                return std::forward_as_tuple(derivator.template as< I >());
             }
             else
             {
-                std::forward<Visitor>(visitor)();
+                return std::forward_as_tuple(std::move(derivator.template as< I >()));
             }
         }
 
-
-        template <size_t I, typename Allocator, typename ... Types>
-        struct derivator_element<I, basic_derivator<Allocator, Types...>>
+        /** One visitor call per combination of alternatives, indexed by the alternatives' indices in row major order.
+         * The result type is that of the call for alternative 0 of every derivator; the others must convert to it.
+         */
+        template < typename Visitor, typename... Derivators >
+        struct derivator_visit_table
         {
-            using type = typename std::tuple_element<I, std::tuple<Types...>>::type;
-        };
+            static constexpr std::size_t sizes[] = {derivator_size< derivator_type_t< Derivators > >::value...};
+            static constexpr std::size_t count = (derivator_size< derivator_type_t< Derivators > >::value * ... * 1);
 
+            using result_type = decltype(std::apply(std::declval< Visitor >(), std::tuple_cat(derivator_arguments< 0 >(std::declval< Derivators >())...)));
+            using dispatch_function = result_type (*)(Visitor&&, Derivators&&...);
 
-
-        template<typename Visitor, typename Derivator, size_t N>
-        struct derivator_dispatch_table
-        {
-            using dispatch_function = void(*)(Visitor &&, Derivator&&);
-            dispatch_function dispatch_array[N];
-
-            constexpr derivator_dispatch_table()
-            :dispatch_array()
+            static constexpr std::size_t stride(std::size_t k) noexcept
             {
-                for (int i = 0; i < N; i++)
+                std::size_t result = 1;
+                for (std::size_t i = k + 1; i < sizeof...(Derivators); i++)
                 {
-                    dispatch_array[i] = nullptr;
+                    result *= sizes[i];
                 }
+                return result;
             }
 
-            template <size_t I>
-            static constexpr void fill_dispatch_table(derivator_dispatch_table<Visitor, Derivator, N> & table)
+            template < std::size_t Flat, std::size_t... Ks >
+            static result_type dispatch_at(std::index_sequence< Ks... >, Visitor&& visitor, Derivators&&... derivators)
             {
-                table.dispatch_array[I] = &derivator_dispatch<Visitor, Derivator, I>;
-                if constexpr (I+1 != N)
+                auto arguments = std::tuple_cat(derivator_arguments< (Flat / stride(Ks)) % sizes[Ks] >(std::forward< Derivators >(derivators))...);
+                if constexpr (std::is_void_v< result_type >)
                 {
-                    fill_dispatch_table<I+1>(table);
+                    std::apply(std::forward< Visitor >(visitor), std::move(arguments));
+                }
+                else
+                {
+                    return std::apply(std::forward< Visitor >(visitor), std::move(arguments));
                 }
             }
-            static constexpr derivator_dispatch_table<Visitor, Derivator, N> generate()
+
+            template < std::size_t Flat >
+            static result_type dispatch(Visitor&& visitor, Derivators&&... derivators)
             {
-                derivator_dispatch_table<Visitor, Derivator, N> result;
-                fill_dispatch_table<0>(result);
-                return result;
+                return dispatch_at< Flat >(std::index_sequence_for< Derivators... >(), std::forward< Visitor >(visitor), std::forward< Derivators >(derivators)...);
             }
+
+            template < std::size_t... Flats >
+            static constexpr std::array< dispatch_function, count > generate(std::index_sequence< Flats... >) noexcept
+            {
+                return {{&dispatch< Flats >...}};
+            }
+
+            static constexpr std::array< dispatch_function, count > table = generate(std::make_index_sequence< count >());
         };
+    } // namespace detail
 
-        
+    /** Calls visitor with the current value of each derivator, like std::visit.
+     * Alternatives of type void contribute no argument, so visiting a single valueless derivator calls visitor().
+     * Values are passed as rvalues from rvalue derivators. The combination of alternatives is looked up in one
+     * table, so a visit costs a single indirect call however many derivators are visited.
+     * All calls must return a type convertible to the one returned for alternative 0 of every derivator.
+     * Every derivator must hold an alternative, that is index() != -1.
+     */
+    template < typename Visitor, typename... Derivators, typename = std::enable_if_t< (sizeof...(Derivators) != 0) && (detail::derivator_size< detail::derivator_type_t< Derivators > >::is_derivator && ...) > >
+    decltype(auto) visit(Visitor&& visitor, Derivators&&... derivators)
+    {
+        using table_type = detail::derivator_visit_table< Visitor, Derivators... >;
+
+        int const indices[] = {derivators.index()...};
+        std::size_t index = 0;
+        for (std::size_t k = 0; k < sizeof...(Derivators); k++)
+        {
+            RPNX_ASSERT(indices[k] != -1);
+            index = index * table_type::sizes[k] + std::size_t(indices[k]);
+        }
+        return table_type::table[index](std::forward< Visitor >(visitor), std::forward< Derivators >(derivators)...);
     }
 
-    template <typename Visitor, typename Allocator, typename ... Types>
-    void visit(Visitor && vistor, basic_derivator<Allocator, Types...> && derivator)
+    namespace detail
     {
-        static const constexpr auto dispatch_table = detail::derivator_dispatch_table<Visitor, basic_derivator<Allocator, Types...> &&, std::tuple_size<std::tuple<Types...>>::value>::generate();
-        RPNX_ASSERT(derivator.index() != -1);
-        auto function_pointer = dispatch_table[derivator.index()];
-        function_pointer(std::forward<Visitor>(vistor), std::forward<basic_derivator<Allocator, Types...> &&>(derivator));        
-    }
+        template < typename T, typename Derivator >
+        struct derivator_alternative_index;
 
-    template <typename Visitor, typename Allocator, typename ... Types>
-    void visit(Visitor && vistor, basic_derivator<Allocator, Types...> const & derivator)
+        template < typename T, std::size_t InlineSize, typename Allocator, typename... Types >
+        struct derivator_alternative_index< T, basic_inline_derivator< InlineSize, Allocator, Types... > >
+        {
+            static constexpr int value = tuple_type_index< T, std::tuple< Types... > >::value;
+            static_assert(value != -1, "The key type must be one of the derivator's alternatives");
+        };
+
+        /** R, if Derivator is a derivator and Key is one of its alternatives rather than another derivator. */
+        template < typename Derivator, typename Key, typename R >
+        using derivator_key_result_t = std::enable_if_t< derivator_size< Derivator >::is_derivator && !derivator_size< Key >::is_derivator, R >;
+
+        template < typename Derivator, bool Enabled >
+        struct derivator_std_hash
+        {
+            derivator_std_hash() = delete;
+            derivator_std_hash(derivator_std_hash const&) = delete;
+            derivator_std_hash& operator=(derivator_std_hash const&) = delete;
+        };
+
+        template < typename Derivator >
+        struct derivator_std_hash< Derivator, true >
+        {
+            std::size_t operator()(Derivator const& derivator) const
+            {
+                return derivator.hash();
+            }
+        };
+    } // namespace detail
+
+    /** Transparent ordering of derivators, which also compares a derivator with a value of one of its alternatives
+     * as if the value were held by a derivator. std::map< derivator, V, derivator_less >::find can then look up a
+     * value without constructing a derivator.
+     */
+    struct derivator_less
     {
-        static const constexpr auto dispatch_table = detail::derivator_dispatch_table<Visitor, basic_derivator<Allocator, Types...> const&, std::tuple_size<std::tuple<Types...>>::value>::generate();
-        RPNX_ASSERT(derivator.index() != -1);
-        auto  function_pointer = dispatch_table[derivator.index()];
-        function_pointer(std::forward<Visitor>(vistor), std::forward<basic_derivator<Allocator, Types...> const &>(derivator));        
-    }
+        using is_transparent = void;
+
+        template < std::size_t InlineSize, typename Allocator, typename... Types >
+        bool operator()(basic_inline_derivator< InlineSize, Allocator, Types... > const& a, basic_inline_derivator< InlineSize, Allocator, Types... > const& b) const
+        {
+            return a < b;
+        }
 
-    template <typename Visitor, typename Allocator, typename ... Types>
-    void visit(Visitor && vistor, basic_derivator<Allocator, Types...> & derivator)
+        template < typename Derivator, typename T >
+        auto operator()(Derivator const& a, T const& b) const -> detail::derivator_key_result_t< Derivator, T, bool >
+        {
+            constexpr int I = detail::derivator_alternative_index< T, Derivator >::value;
+            return a.index() != I ? a.index() < I : bool(a.template as< I >() < b);
+        }
+
+        template < typename T, typename Derivator >
+        auto operator()(T const& a, Derivator const& b) const -> detail::derivator_key_result_t< Derivator, T, bool >
+        {
+            constexpr int I = detail::derivator_alternative_index< T, Derivator >::value;
+            return I != b.index() ? I < b.index() : bool(a < b.template as< I >());
+        }
+    };
+
+    /** Transparent equality of derivators, and of a derivator with a value of one of its alternatives. */
+    struct derivator_equal_to
     {
-        static const constexpr auto dispatch_table = detail::derivator_dispatch_table<Visitor, basic_derivator<Allocator, Types...> &, std::tuple_size<std::tuple<Types...>>::value>::generate();
-        RPNX_ASSERT(derivator.index() != -1);
-        auto const & function_pointer = dispatch_table.dispatch_array[derivator.index()];
-        function_pointer(std::forward<Visitor>(vistor), std::forward<basic_derivator<Allocator, Types...> &>(derivator));        
-    }
+        using is_transparent = void;
+
+        template < std::size_t InlineSize, typename Allocator, typename... Types >
+        bool operator()(basic_inline_derivator< InlineSize, Allocator, Types... > const& a, basic_inline_derivator< InlineSize, Allocator, Types... > const& b) const
+        {
+            return a == b;
+        }
+
+        template < typename Derivator, typename T >
+        auto operator()(Derivator const& a, T const& b) const -> detail::derivator_key_result_t< Derivator, T, bool >
+        {
+            constexpr int I = detail::derivator_alternative_index< T, Derivator >::value;
+            return a.index() == I && bool(a.template as< I >() == b);
+        }
+
+        template < typename T, typename Derivator >
+        auto operator()(T const& a, Derivator const& b) const -> detail::derivator_key_result_t< Derivator, T, bool >
+        {
+            return (*this)(b, a);
+        }
+    };
+
+    /** Transparent hash of Derivator. A value of one of the alternatives hashes the same as a derivator holding it,
+     * so together with derivator_equal_to it allows heterogeneous lookup in unordered containers that support it.
+     */
+    template < typename Derivator >
+    struct derivator_hash
+    {
+        using is_transparent = void;
+
+        std::size_t operator()(Derivator const& derivator) const
+        {
+            return derivator.hash();
+        }
+
+        template < typename T >
+        auto operator()(T const& value) const -> detail::derivator_key_result_t< Derivator, T, std::size_t >
+        {
+            return detail::derivator_hash_combine(detail::derivator_alternative_index< T, Derivator >::value, std::hash< T >()(value));
+        }
+    };
 
 } // namespace rpnx
 
+namespace std
+{
+    /** Enabled when every alternative is void or has std::hash enabled. */
+    template < std::size_t InlineSize, typename Allocator, typename... Types >
+    struct hash< rpnx::basic_inline_derivator< InlineSize, Allocator, Types... > >
+        : rpnx::detail::derivator_std_hash< rpnx::basic_inline_derivator< InlineSize, Allocator, Types... >, (rpnx::detail::derivator_has_hash< Types >::value && ...) >
+    {
+    };
+} // namespace std
+
 #endif
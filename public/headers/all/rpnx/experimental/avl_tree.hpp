@@ -1,8 +1,23 @@
 #ifndef RPNX_AVL_TREE_IMPLEMENTATION2_HPP
 #define RPNX_AVL_TREE_IMPLEMENTATION2_HPP
 
-#include <utility>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
 #include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
 #include "rpnx/assert.hpp"
 
 namespace rpnx::experimental
@@ -21,6 +36,40 @@ namespace rpnx::experimental
     template <typename K, typename T, typename Compare, typename Allocator>
     class avl_tree_node;
 
+    /** Tag type selecting the constructors of ordered containers that take input which is already sorted and free
+     * of duplicate keys.
+     */
+    struct sorted_unique_t
+    {
+        explicit sorted_unique_t() = default;
+    };
+
+    inline constexpr sorted_unique_t sorted_unique{};
+
+    /*
+      A contiguous block of nodes created by a bulk load. Nodes do not point back to their slab; each tree keeps the
+      slabs its nodes may come from sorted by address and finds a node's slab by searching that list.
+      The block is returned to the allocator once the last node in it is erased, so a single surviving node keeps
+      the whole block allocated. Trees produced by split() share slabs, so both counts are atomic. The header itself
+      lives until the last tree listing it lets go.
+     */
+    template< typename K, typename T, typename Compare, typename Allocator>
+    struct avl_tree_slab
+    {
+        // Nodes still constructed in the block. Once this reaches zero the block has been freed.
+        std::atomic<std::size_t> m_live {0};
+        // Trees listing this slab.
+        std::atomic<std::size_t> m_owners {1};
+        avl_tree_node<K, T, Compare, Allocator> * m_nodes = nullptr;
+        std::size_t m_capacity = 0;
+    };
+
+    /*
+      The link and balance fields take 48 bytes on a 64 bit target, with the subtree height packed into the top
+      byte of the subtree size. A node with an 8 byte key and an 8 byte mapped value is therefore 64 bytes, and
+      fits in one cache line when the allocator aligns it to one. Larger values spill into the next line, but the
+      fields used to descend the tree and step through the threads still come first.
+     */
     template< typename K, typename T, typename Compare, typename Allocator>
     class avl_tree_node
     {
@@ -28,36 +77,215 @@ namespace rpnx::experimental
         friend class avl_tree_const_iterator<K, T, Compare, Allocator>;
         friend class avl_tree<K, T, Compare, Allocator>;
 
+        using node = avl_tree_node<K, T, Compare, Allocator>;
+        using value_type = std::pair<K const, T>;
+
+        std::array<node*, 2> m_child {};
+        node * m_parent {};
+        // In order predecessor ([0]) and successor ([1]), so iteration never walks the tree.
+        std::array<node*, 2> m_thread {};
+        // Number of nodes in the subtree rooted here, used for order statistic queries.
+        std::size_t m_size : std::numeric_limits<std::size_t>::digits - 8;
+        // An AVL tree of 2^56 nodes is less than 82 levels high.
+        std::size_t m_height : 8;
+        value_type m_value;
+
+      public:
+        template <typename ... Ts>
+        explicit avl_tree_node(Ts && ... ts)
+        : m_size(1), m_height(1), m_value(std::forward<Ts>(ts)...)
+        {
+        }
+    };
+
+    template <typename K, typename T, typename Compare, typename Allocator>
+    class avl_tree_iterator
+    {
+        friend class avl_tree<K, T, Compare, Allocator>;
+        friend class avl_tree_const_iterator<K, T, Compare, Allocator>;
+
+        using node = avl_tree_node<K, T, Compare, Allocator>;
         using tree = avl_tree<K, T, Compare, Allocator>;
 
+        node * m_node = nullptr;
+        tree const * m_tree = nullptr;
+
+        avl_tree_iterator(node * n, tree const * t) noexcept
+        : m_node(n), m_tree(t)
+        {
+        }
+
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<K const, T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type *;
+        using reference = value_type &;
+
+        avl_tree_iterator() noexcept = default;
+
+        reference operator*() const noexcept
+        {
+            return m_node->m_value;
+        }
+
+        pointer operator->() const noexcept
+        {
+            return std::addressof(m_node->m_value);
+        }
+
+        avl_tree_iterator & operator++() noexcept
+        {
+            m_node = tree::next_node(m_node, 1);
+            return *this;
+        }
+
+        avl_tree_iterator operator++(int) noexcept
+        {
+            avl_tree_iterator v_copy = *this;
+            ++*this;
+            return v_copy;
+        }
+
+        avl_tree_iterator & operator--() noexcept
+        {
+            m_node = m_node == nullptr ? m_tree->extreme_node(1) : tree::next_node(m_node, 0);
+            return *this;
+        }
+
+        avl_tree_iterator operator--(int) noexcept
+        {
+            avl_tree_iterator v_copy = *this;
+            --*this;
+            return v_copy;
+        }
+
+        bool operator==(avl_tree_iterator const & other) const noexcept
+        {
+            return m_node == other.m_node;
+        }
+
+        bool operator!=(avl_tree_iterator const & other) const noexcept
+        {
+            return m_node != other.m_node;
+        }
+    };
+
+    template <typename K, typename T, typename Compare, typename Allocator>
+    class avl_tree_const_iterator
+    {
+        friend class avl_tree<K, T, Compare, Allocator>;
+
         using node = avl_tree_node<K, T, Compare, Allocator>;
-        using value_type = typename tree::value_type;
+        using tree = avl_tree<K, T, Compare, Allocator>;
 
+        node const * m_node = nullptr;
+        tree const * m_tree = nullptr;
 
-        value_type m_value;
-        std::array<node*, 2> m_child {};
-        node * m_parent {};
+        avl_tree_const_iterator(node const * n, tree const * t) noexcept
+        : m_node(n), m_tree(t)
+        {
+        }
+
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<K const, T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type const *;
+        using reference = value_type const &;
+
+        avl_tree_const_iterator() noexcept = default;
+
+        avl_tree_const_iterator(avl_tree_iterator<K, T, Compare, Allocator> const & other) noexcept
+        : m_node(other.m_node), m_tree(other.m_tree)
+        {
+        }
+
+        reference operator*() const noexcept
+        {
+            return m_node->m_value;
+        }
+
+        pointer operator->() const noexcept
+        {
+            return std::addressof(m_node->m_value);
+        }
+
+        avl_tree_const_iterator & operator++() noexcept
+        {
+            m_node = tree::next_node(const_cast<node*>(m_node), 1);
+            return *this;
+        }
 
-        avl_tree_node(value_type const & val)
-        : m_value(val)
+        avl_tree_const_iterator operator++(int) noexcept
         {
+            avl_tree_const_iterator v_copy = *this;
+            ++*this;
+            return v_copy;
+        }
 
+        avl_tree_const_iterator & operator--() noexcept
+        {
+            m_node = m_node == nullptr ? m_tree->extreme_node(1) : tree::next_node(const_cast<node*>(m_node), 0);
+            return *this;
         }
 
+        avl_tree_const_iterator operator--(int) noexcept
+        {
+            avl_tree_const_iterator v_copy = *this;
+            --*this;
+            return v_copy;
+        }
 
+        bool operator==(avl_tree_const_iterator const & other) const noexcept
+        {
+            return m_node == other.m_node;
+        }
 
+        bool operator!=(avl_tree_const_iterator const & other) const noexcept
+        {
+            return m_node != other.m_node;
+        }
     };
 
+    /*
+      An ordered map implemented as an AVL tree.
+
+      The interface follows std::map: iterators and references stay valid until the element they refer to is
+      erased, and insert/find/erase are O(log n). Rebalancing walks the parent links from the modified node to the
+      root, so every operation touches O(log n) nodes and never allocates except for the inserted node itself.
+
+      Each node also tracks the size of its subtree, which makes positional queries (nth, rank, index_of,
+      count_range) O(log n) as well, and is threaded to its in order neighbours, which makes incrementing and
+      decrementing iterators O(1) in the worst case.
+
+      Sorted input can be bulk loaded in O(n) with assign_sorted or the sorted_unique constructor, which build a
+      perfectly balanced tree out of a single contiguous slab of nodes. The slab is freed only once every node in it
+      has been erased. Copies are also built in O(n), but allocate each node on its own, like insert.
+     */
     template <typename K, typename T, typename Compare, typename Allocator>
     class avl_tree
         :
         private Compare,
         private Allocator
     {
+        friend class avl_tree_iterator<K, T, Compare, Allocator>;
+        friend class avl_tree_const_iterator<K, T, Compare, Allocator>;
+
       public:
+        using key_type = K;
+        using mapped_type = T;
         using value_type = std::pair<K const, T>;
+        using size_type = std::size_t;
+        using difference_type = std::ptrdiff_t;
+        using key_compare = Compare;
+        using allocator_type = Allocator;
+        using reference = value_type &;
+        using const_reference = value_type const &;
         using iterator = avl_tree_iterator<K,T,Compare, Allocator>;
         using const_iterator = avl_tree_const_iterator<K,T,Compare, Allocator>;
+        using reverse_iterator = std::reverse_iterator<iterator>;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
 
       private:
@@ -65,73 +293,1472 @@ namespace rpnx::experimental
         using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<node>;
 
         using node_allocator_traits = std::allocator_traits<node_allocator>;
+        using slab = avl_tree_slab<K, T, Compare, Allocator>;
+        using slab_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<slab>;
+        using slab_allocator_traits = std::allocator_traits<slab_allocator>;
+        using slab_list = std::vector<slab *, typename std::allocator_traits<Allocator>::template rebind_alloc<slab *>>;
 
       public:
-        inline avl_tree() noexcept(noexcept(Allocator()))
+        inline avl_tree() noexcept(noexcept(Allocator()) && noexcept(Compare()))
+        {}
+
+        explicit avl_tree(Compare const & comp, Allocator const & alloc = Allocator())
+        : Compare(comp), Allocator(alloc)
         {}
 
-        // TODO: Copy constructor
-        inline avl_tree(avl_tree const & ) = delete;
+        explicit avl_tree(Allocator const & alloc)
+        : Allocator(alloc)
+        {}
+
+        template <typename InputIt>
+        avl_tree(InputIt first, InputIt last, Compare const & comp = Compare(), Allocator const & alloc = Allocator())
+        : Compare(comp), Allocator(alloc)
+        {
+            insert(first, last);
+        }
+
+        /** Builds the tree from [first, last), which must be sorted by key with no duplicate keys, in O(n).
+         * Throws std::invalid_argument if the input is not strictly increasing.
+         */
+        template <typename ForwardIt>
+        avl_tree(sorted_unique_t, ForwardIt first, ForwardIt last, Compare const & comp = Compare(), Allocator const & alloc = Allocator())
+        : Compare(comp), Allocator(alloc)
+        {
+            std::size_t v_count = static_cast<std::size_t>(std::distance(first, last));
+            m_root = build_sorted(first, v_count, true, true);
+            m_size = v_count;
+        }
+
+        avl_tree(std::initializer_list<value_type> init, Compare const & comp = Compare(), Allocator const & alloc = Allocator())
+        : Compare(comp), Allocator(alloc)
+        {
+            insert(init.begin(), init.end());
+        }
+
+        avl_tree(avl_tree const & other)
+        : Compare(other.key_comp()), Allocator(std::allocator_traits<Allocator>::select_on_container_copy_construction(other.get_allocator()))
+        {
+            m_root = build_sorted(other.begin(), other.m_size, false, false);
+            m_size = other.m_size;
+        }
+
+        avl_tree(avl_tree && other) noexcept
+        : Compare(std::move(static_cast<Compare&>(other))), Allocator(std::move(static_cast<Allocator&>(other)))
+        {
+            steal(other);
+        }
+
+        ~avl_tree()
+        {
+            clear();
+        }
+
+        avl_tree & operator=(avl_tree const & other)
+        {
+            if (this == &other)
+            {
+                return *this;
+            }
+            clear();
+            if constexpr (std::allocator_traits<Allocator>::propagate_on_container_copy_assignment::value)
+            {
+                static_cast<Allocator&>(*this) = static_cast<Allocator const&>(other);
+            }
+            static_cast<Compare&>(*this) = static_cast<Compare const&>(other);
+            m_root = build_sorted(other.begin(), other.m_size, false, false);
+            m_size = other.m_size;
+            return *this;
+        }
+
+        avl_tree & operator=(avl_tree && other) noexcept(std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value || std::allocator_traits<Allocator>::is_always_equal::value)
+        {
+            if (this == &other)
+            {
+                return *this;
+            }
+            clear();
+            static_cast<Compare&>(*this) = std::move(static_cast<Compare&>(other));
+            if constexpr (std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value)
+            {
+                static_cast<Allocator&>(*this) = std::move(static_cast<Allocator&>(other));
+                steal(other);
+            }
+            else if constexpr (std::allocator_traits<Allocator>::is_always_equal::value)
+            {
+                steal(other);
+            }
+            else
+            {
+                if (get_allocator() == other.get_allocator())
+                {
+                    steal(other);
+                }
+                else
+                {
+                    for (auto & x : other)
+                    {
+                        emplace(std::move(const_cast<K&>(x.first)), std::move(x.second));
+                    }
+                    other.clear();
+                }
+            }
+            return *this;
+        }
+
+        avl_tree & operator=(std::initializer_list<value_type> init)
+        {
+            clear();
+            insert(init.begin(), init.end());
+            return *this;
+        }
 
         Allocator get_allocator() const
         {
-            return static_cast<Allocator&>(*this);
+            return static_cast<Allocator const &>(*this);
         }
 
-        iterator insert(value_type const & value_to_insert)
+        Compare key_comp() const
         {
-            node* node_to_insert = create_node(value_to_insert);
+            return static_cast<Compare const &>(*this);
+        }
 
+        iterator begin() noexcept
+        {
+            return iterator(extreme_node(0), this);
+        }
 
+        const_iterator begin() const noexcept
+        {
+            return const_iterator(extreme_node(0), this);
+        }
 
+        const_iterator cbegin() const noexcept
+        {
+            return begin();
+        }
 
+        iterator end() noexcept
+        {
+            return iterator(nullptr, this);
+        }
 
+        const_iterator end() const noexcept
+        {
+            return const_iterator(nullptr, this);
         }
 
-      private:
+        const_iterator cend() const noexcept
+        {
+            return end();
+        }
 
-        template <typename T2>
-        auto get_rebound_allocator() const noexcept
+        reverse_iterator rbegin() noexcept
         {
-            typename std::allocator_traits<Allocator>::template rebind_alloc<T2> rebound_alloc(get_allocator());
-            return rebound_alloc;
+            return reverse_iterator(end());
         }
 
-        auto get_node_allocator() const noexcept
+        const_reverse_iterator rbegin() const noexcept
         {
-            return get_rebound_allocator<node>();
+            return const_reverse_iterator(end());
         }
 
-        node * create_node(value_type const & value)
+        reverse_iterator rend() noexcept
         {
-            node_allocator node_alloc = get_node_allocator();
-            node * nptr = node_alloc.allocate(1);
-            try
+            return reverse_iterator(begin());
+        }
+
+        const_reverse_iterator rend() const noexcept
+        {
+            return const_reverse_iterator(begin());
+        }
+
+        bool empty() const noexcept
+        {
+            return m_size == 0;
+        }
+
+        size_type size() const noexcept
+        {
+            return m_size;
+        }
+
+        size_type max_size() const noexcept
+        {
+            return node_allocator_traits::max_size(get_node_allocator());
+        }
+
+        void clear() noexcept
+        {
+            destroy_subtree(m_root);
+            m_root = nullptr;
+            m_size = 0;
+            release_slabs();
+        }
+
+        /** Replaces the contents with [first, last), which must be sorted by key with no duplicate keys.
+         * Runs in O(n) and allocates every node from one contiguous slab, which is freed once all of them have been
+         * erased. If the input is not strictly increasing, throws std::invalid_argument and leaves the tree
+         * unchanged.
+         */
+        template <typename ForwardIt>
+        void assign_sorted(ForwardIt first, ForwardIt last)
+        {
+            std::size_t v_count = static_cast<std::size_t>(std::distance(first, last));
+            avl_tree v_built(key_comp(), get_allocator());
+            v_built.m_root = v_built.build_sorted(first, v_count, true, true);
+            v_built.m_size = v_count;
+            clear();
+            steal(v_built);
+        }
+
+        std::pair<iterator, bool> insert(value_type const & value)
+        {
+            return emplace_unique(value.first, value);
+        }
+
+        std::pair<iterator, bool> insert(value_type && value)
+        {
+            return emplace_unique(value.first, std::move(value));
+        }
+
+        template <typename P, typename = std::enable_if_t< std::is_constructible_v<value_type, P&&> > >
+        std::pair<iterator, bool> insert(P && value)
+        {
+            return emplace(std::forward<P>(value));
+        }
+
+        iterator insert(const_iterator, value_type const & value)
+        {
+            return insert(value).first;
+        }
+
+        template <typename InputIt>
+        void insert(InputIt first, InputIt last)
+        {
+            for (; first != last; ++first)
             {
-                node_allocator_traits::construct(node_alloc, nptr, value_to_insert);
+                emplace(*first);
             }
-            catch (...)
+        }
+
+        void insert(std::initializer_list<value_type> init)
+        {
+            insert(init.begin(), init.end());
+        }
+
+        template <typename ... Ts>
+        std::pair<iterator, bool> emplace(Ts && ... ts)
+        {
+            node * v_node = create_node(std::forward<Ts>(ts)...);
+            auto [v_parent, v_dir, v_found] = find_insert_position(v_node->m_value.first);
+            if (v_found != nullptr)
             {
-                node_alloc.deallocate(nptr, 1);
-                throw;
+                delete_node(v_node);
+                return {iterator(v_found, this), false};
             }
-            return std::launder(nptr);
+            attach(v_node, v_parent, v_dir);
+            return {iterator(v_node, this), true};
         }
 
-        void delete_node(node * n) noexcept
+        template <typename ... Ts>
+        std::pair<iterator, bool> try_emplace(K const & key, Ts && ... ts)
         {
-            node_allocator node_alloc = get_node_allocator();
-            node_allocator_traits::destroy(node_alloc, nptr);
-            node_allocator_traits::deallocate(node_alloc, nptr);
+            return emplace_unique(key, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Ts>(ts)...));
         }
 
-      private:
-        node * m_root = nullptr;
-        std::size_t m_size = 0;
+        template <typename ... Ts>
+        std::pair<iterator, bool> try_emplace(K && key, Ts && ... ts)
+        {
+            return emplace_unique(key, std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Ts>(ts)...));
+        }
 
-    };
+        template <typename M>
+        std::pair<iterator, bool> insert_or_assign(K const & key, M && value)
+        {
+            auto v_result = try_emplace(key, std::forward<M>(value));
+            if (!v_result.second)
+            {
+                v_result.first->second = std::forward<M>(value);
+            }
+            return v_result;
+        }
+
+        template <typename M>
+        std::pair<iterator, bool> insert_or_assign(K && key, M && value)
+        {
+            auto v_result = try_emplace(std::move(key), std::forward<M>(value));
+            if (!v_result.second)
+            {
+                v_result.first->second = std::forward<M>(value);
+            }
+            return v_result;
+        }
+
+        T & operator[](K const & key)
+        {
+            return try_emplace(key).first->second;
+        }
+
+        T & operator[](K && key)
+        {
+            return try_emplace(std::move(key)).first->second;
+        }
+
+        T & at(K const & key)
+        {
+            node * v_node = find_node(key);
+            if (v_node == nullptr)
+            {
+                throw std::out_of_range("avl_tree::at");
+            }
+            return v_node->m_value.second;
+        }
+
+        T const & at(K const & key) const
+        {
+            node * v_node = find_node(key);
+            if (v_node == nullptr)
+            {
+                throw std::out_of_range("avl_tree::at");
+            }
+            return v_node->m_value.second;
+        }
+
+        iterator find(K const & key)
+        {
+            return iterator(find_node(key), this);
+        }
+
+        const_iterator find(K const & key) const
+        {
+            return const_iterator(find_node(key), this);
+        }
+
+        bool contains(K const & key) const
+        {
+            return find_node(key) != nullptr;
+        }
+
+        size_type count(K const & key) const
+        {
+            return find_node(key) != nullptr ? 1 : 0;
+        }
+
+        iterator lower_bound(K const & key)
+        {
+            return iterator(lower_bound_node(key), this);
+        }
+
+        const_iterator lower_bound(K const & key) const
+        {
+            return const_iterator(lower_bound_node(key), this);
+        }
+
+        iterator upper_bound(K const & key)
+        {
+            return iterator(upper_bound_node(key), this);
+        }
+
+        const_iterator upper_bound(K const & key) const
+        {
+            return const_iterator(upper_bound_node(key), this);
+        }
+
+        std::pair<iterator, iterator> equal_range(K const & key)
+        {
+            return {lower_bound(key), upper_bound(key)};
+        }
+
+        std::pair<const_iterator, const_iterator> equal_range(K const & key) const
+        {
+            return {lower_bound(key), upper_bound(key)};
+        }
+
+        /** Returns an iterator to the element at in order position i, or end() if i >= size().
+         */
+        iterator nth(size_type i)
+        {
+            return iterator(nth_node(i), this);
+        }
+
+        const_iterator nth(size_type i) const
+        {
+            return const_iterator(nth_node(i), this);
+        }
+
+        /** Returns the number of elements with keys less than key.
+         * This is the position key has, or would have if inserted.
+         */
+        size_type rank(K const & key) const
+        {
+            size_type v_rank = 0;
+            node * n = m_root;
+            while (n != nullptr)
+            {
+                if (less(n->m_value.first, key))
+                {
+                    v_rank += subtree_size(n->m_child[0]) + 1;
+                    n = n->m_child[1];
+                }
+                else
+                {
+                    n = n->m_child[0];
+                }
+            }
+            return v_rank;
+        }
+
+        /** Returns the in order position of the element pos refers to, or size() for end().
+         */
+        size_type index_of(const_iterator pos) const noexcept
+        {
+            node const * n = pos.m_node;
+            if (n == nullptr)
+            {
+                return m_size;
+            }
+            size_type v_index = subtree_size(n->m_child[0]);
+            while (n->m_parent != nullptr)
+            {
+                if (n->m_parent->m_child[1] == n)
+                {
+                    v_index += subtree_size(n->m_parent->m_child[0]) + 1;
+                }
+                n = n->m_parent;
+            }
+            return v_index;
+        }
+
+        /** Returns the number of elements with keys in [low, high).
+         */
+        size_type count_range(K const & low, K const & high) const
+        {
+            if (!less(low, high))
+            {
+                return 0;
+            }
+            return rank(high) - rank(low);
+        }
+
+        iterator erase(const_iterator pos)
+        {
+            RPNX_ASSERT(pos.m_node != nullptr);
+            node * v_node = const_cast<node*>(pos.m_node);
+            node * v_next = next_node(v_node, 1);
+            unlink(v_node);
+            delete_node(v_node);
+            return iterator(v_next, this);
+        }
+
+        iterator erase(iterator pos)
+        {
+            return erase(const_iterator(pos));
+        }
+
+        iterator erase(const_iterator first, const_iterator last)
+        {
+            while (first != last)
+            {
+                first = erase(first);
+            }
+            return iterator(const_cast<node*>(last.m_node), this);
+        }
+
+        size_type erase(K const & key)
+        {
+            node * v_node = find_node(key);
+            if (v_node == nullptr)
+            {
+                return 0;
+            }
+            unlink(v_node);
+            delete_node(v_node);
+            return 1;
+        }
+
+        /** Moves every element with a key greater than or equal to key into a new tree, which is returned.
+         * Runs in O(log n), plus the number of bulk loaded slabs, which both trees go on sharing. No elements are
+         * copied or reallocated, so references remain valid, but iterators to moved elements should not be
+         * decremented from the end of either tree.
+         */
+        avl_tree split(K const & key)
+        {
+            avl_tree v_result(key_comp(), get_allocator());
+            // Either half may hold nodes from any of our slabs. Copied first, as it is the only step that can throw.
+            prune_slabs();
+            v_result.m_slabs = m_slabs;
+            for (slab * v_slab : v_result.m_slabs)
+            {
+                v_slab->m_owners.fetch_add(1, std::memory_order_relaxed);
+            }
+            node * v_root = m_root;
+            node * v_left;
+            node * v_right;
+            m_root = nullptr;
+            split_nodes(v_root, key, v_left, v_right);
+
+            if (v_left != nullptr)
+            {
+                subtree_extreme(v_left, 1)->m_thread[1] = nullptr;
+            }
+            if (v_right != nullptr)
+            {
+                subtree_extreme(v_right, 0)->m_thread[0] = nullptr;
+            }
+
+            m_root = v_left;
+            m_size = subtree_size(v_left);
+            v_result.m_root = v_right;
+            v_result.m_size = subtree_size(v_right);
+            return v_result;
+        }
+
+        /** Moves every element of other into this tree in O(log n), plus the number of bulk loaded slabs.
+         * Every key in other must be greater than every key in this tree, and the allocators must compare equal.
+         * Throws std::invalid_argument if the keys are not ordered.
+         */
+        void join(avl_tree && other)
+        {
+            RPNX_ASSERT(get_allocator() == other.get_allocator());
+            if (other.m_root == nullptr)
+            {
+                return;
+            }
+            if (m_root != nullptr && !less(extreme_node(1)->m_value.first, other.extreme_node(0)->m_value.first))
+            {
+                throw std::invalid_argument("avl_tree::join: keys are not ordered");
+            }
+
+            merge_slabs(other);
+            node * v_left = m_root;
+            node * v_right = other.m_root;
+            std::size_t v_size = m_size + other.m_size;
+            link_threads(v_left == nullptr ? nullptr : subtree_extreme(v_left, 1), subtree_extreme(v_right, 0));
+            other.m_root = nullptr;
+            other.m_size = 0;
+
+            m_root = concat_nodes(v_left, v_right);
+            m_size = v_size;
+        }
+
+        /** Erases every element with a key in [low, high). Returns the number of elements erased.
+         * The tree is restructured in O(log n); destroying the k erased elements takes O(k).
+         */
+        size_type erase_range(K const & low, K const & high)
+        {
+            if (!less(low, high))
+            {
+                return 0;
+            }
+
+            node * v_root = m_root;
+            node * v_below;
+            node * v_rest;
+            node * v_erased;
+            node * v_above;
+            m_root = nullptr;
+            split_nodes(v_root, low, v_below, v_rest);
+            split_nodes(v_rest, high, v_erased, v_above);
+
+            size_type v_count = subtree_size(v_erased);
+            destroy_subtree(v_erased);
+            link_threads(v_below == nullptr ? nullptr : subtree_extreme(v_below, 1), v_above == nullptr ? nullptr : subtree_extreme(v_above, 0));
+            m_root = concat_nodes(v_below, v_above);
+            m_size -= v_count;
+            return v_count;
+        }
+
+        void swap(avl_tree & other) noexcept
+        {
+            using std::swap;
+            if constexpr (std::allocator_traits<Allocator>::propagate_on_container_swap::value)
+            {
+                swap(static_cast<Allocator&>(*this), static_cast<Allocator&>(other));
+            }
+            else
+            {
+                // Swap with unequal allocators is undefined per standard.
+                RPNX_ASSERT(get_allocator() == other.get_allocator());
+            }
+            swap(static_cast<Compare&>(*this), static_cast<Compare&>(other));
+            swap(m_root, other.m_root);
+            swap(m_size, other.m_size);
+            m_slabs.swap(other.m_slabs);
+        }
+
+        /** Checks the structural invariants of the tree: parent links, ordering, stored heights and balance factors.
+         * This is O(n) and intended for tests.
+         */
+        bool is_valid() const
+        {
+            std::size_t v_count = 0;
+            if (m_root != nullptr && m_root->m_parent != nullptr)
+            {
+                return false;
+            }
+            node const * v_previous = nullptr;
+            if (!check_threads(m_root, v_previous) || (v_previous != nullptr && v_previous->m_thread[1] != nullptr))
+            {
+                return false;
+            }
+            return check_subtree(m_root, v_count) >= 0 && v_count == m_size;
+        }
+
+        friend bool operator==(avl_tree const & a, avl_tree const & b)
+        {
+            return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+        }
+
+        friend bool operator!=(avl_tree const & a, avl_tree const & b)
+        {
+            return !(a == b);
+        }
+
+      private:
+        bool less(K const & a, K const & b) const
+        {
+            return static_cast<Compare const&>(*this)(a, b);
+        }
+
+        static std::int32_t height(node const * n) noexcept
+        {
+            return n != nullptr ? static_cast<std::int32_t>(n->m_height) : 0;
+        }
+
+        static std::size_t subtree_size(node const * n) noexcept
+        {
+            return n != nullptr ? n->m_size : 0;
+        }
+
+        static void update(node * n) noexcept
+        {
+            n->m_height = static_cast<std::size_t>(1 + std::max(height(n->m_child[0]), height(n->m_child[1])));
+            n->m_size = 1 + subtree_size(n->m_child[0]) + subtree_size(n->m_child[1]);
+        }
+
+        node * nth_node(size_type i) const noexcept
+        {
+            if (i >= m_size)
+            {
+                return nullptr;
+            }
+            node * n = m_root;
+            while (true)
+            {
+                size_type v_left = subtree_size(n->m_child[0]);
+                if (i < v_left)
+                {
+                    n = n->m_child[0];
+                }
+                else if (i == v_left)
+                {
+                    return n;
+                }
+                else
+                {
+                    i -= v_left + 1;
+                    n = n->m_child[1];
+                }
+            }
+        }
+
+        /** Returns the in order neighbour of n in direction dir (1 for the successor, 0 for the predecessor).
+         */
+        static node * next_node(node * n, int dir) noexcept
+        {
+            return n->m_thread[dir];
+        }
+
+        /** Makes a and b in order neighbours. Either may be nullptr.
+         */
+        static void link_threads(node * a, node * b) noexcept
+        {
+            if (a != nullptr)
+            {
+                a->m_thread[1] = b;
+            }
+            if (b != nullptr)
+            {
+                b->m_thread[0] = a;
+            }
+        }
+
+        static node * subtree_extreme(node * n, int dir) noexcept
+        {
+            while (n->m_child[dir] != nullptr)
+            {
+                n = n->m_child[dir];
+            }
+            return n;
+        }
+
+        /** Returns the first (dir = 0) or last (dir = 1) node.
+         */
+        node * extreme_node(int dir) const noexcept
+        {
+            return m_root == nullptr ? nullptr : subtree_extreme(m_root, dir);
+        }
+
+        void replace_child(node * parent, node * old_child, node * new_child) noexcept
+        {
+            if (parent == nullptr)
+            {
+                m_root = new_child;
+            }
+            else
+            {
+                parent->m_child[parent->m_child[1] == old_child] = new_child;
+            }
+            if (new_child != nullptr)
+            {
+                new_child->m_parent = parent;
+            }
+        }
+
+        /** Rotates n down in direction dir, lifting its child on the opposite side. Returns the new subtree root.
+         */
+        node * rotate(node * n, int dir) noexcept
+        {
+            node * v_child = n->m_child[!dir];
+            RPNX_ASSERT(v_child != nullptr);
+            node * v_inner = v_child->m_child[dir];
+
+            replace_child(n->m_parent, n, v_child);
+
+            n->m_child[!dir] = v_inner;
+            if (v_inner != nullptr)
+            {
+                v_inner->m_parent = n;
+            }
+            v_child->m_child[dir] = n;
+            n->m_parent = v_child;
+
+            update(n);
+            update(v_child);
+            return v_child;
+        }
+
+        /** Restores the AVL property at n, whose children are balanced and have correct heights. Returns the subtree root.
+         */
+        node * rebalance(node * n) noexcept
+        {
+            std::int32_t v_balance = height(n->m_child[1]) - height(n->m_child[0]);
+            if (v_balance > 1 || v_balance < -1)
+            {
+                int v_heavy = v_balance > 1 ? 1 : 0;
+                node * v_child = n->m_child[v_heavy];
+                if (height(v_child->m_child[!v_heavy]) > height(v_child->m_child[v_heavy]))
+                {
+                    rotate(v_child, v_heavy);
+                }
+                return rotate(n, !v_heavy);
+            }
+            update(n);
+            return n;
+        }
+
+        /** Updates and rebalances every node from n to the root. Returns the root, or nullptr if n is nullptr.
+         */
+        node * fix_up(node * n) noexcept
+        {
+            node * v_top = nullptr;
+            while (n != nullptr)
+            {
+                v_top = rebalance(n);
+                n = v_top->m_parent;
+            }
+            return v_top;
+        }
+
+        /*
+          Split and join work on detached subtrees (subtree roots with no parent). Rotations at the top of a detached
+          subtree overwrite m_root, so the public operations assign m_root only once they are done.
+         */
+
+        /** Joins the subtrees left and right using mid as the separating node, where every key in left is less than
+         * mid's key and every key in right is greater. Runs in O(|height(left) - height(right)| + 1).
+         */
+        node * join_nodes(node * left, node * mid, node * right) noexcept
+        {
+            if (height(left) > height(right) + 1)
+            {
+                return join_spine(left, mid, right, 1);
+            }
+            if (height(right) > height(left) + 1)
+            {
+                return join_spine(right, mid, left, 0);
+            }
+            mid->m_child = {left, right};
+            mid->m_parent = nullptr;
+            if (left != nullptr)
+            {
+                left->m_parent = mid;
+            }
+            if (right != nullptr)
+            {
+                right->m_parent = mid;
+            }
+            update(mid);
+            return mid;
+        }
+
+        /** Descends the dir side spine of tall until a subtree no more than one level taller than short_tree, and
+         * replaces it with mid, which takes the subtree and short_tree as children.
+         */
+        node * join_spine(node * tall, node * mid, node * short_tree, int dir) noexcept
+        {
+            node * v_parent = nullptr;
+            node * v_spine = tall;
+            while (height(v_spine) > height(short_tree) + 1)
+            {
+                v_parent = v_spine;
+                v_spine = v_spine->m_child[dir];
+            }
+            RPNX_ASSERT(v_parent != nullptr);
+
+            mid->m_child[!dir] = v_spine;
+            mid->m_child[dir] = short_tree;
+            if (v_spine != nullptr)
+            {
+                v_spine->m_parent = mid;
+            }
+            if (short_tree != nullptr)
+            {
+                short_tree->m_parent = mid;
+            }
+            update(mid);
+
+            v_parent->m_child[dir] = mid;
+            mid->m_parent = v_parent;
+            return fix_up(v_parent);
+        }
+
+        /** Splits the detached subtree root into nodes with keys less than key (left) and the rest (right).
+         */
+        void split_nodes(node * root, K const & key, node * & left, node * & right) noexcept
+        {
+            if (root == nullptr)
+            {
+                left = nullptr;
+                right = nullptr;
+                return;
+            }
+
+            node * v_left = root->m_child[0];
+            node * v_right = root->m_child[1];
+            if (v_left != nullptr)
+            {
+                v_left->m_parent = nullptr;
+            }
+            if (v_right != nullptr)
+            {
+                v_right->m_parent = nullptr;
+            }
+
+            if (less(root->m_value.first, key))
+            {
+                node * v_middle;
+                split_nodes(v_right, key, v_middle, right);
+                left = join_nodes(v_left, root, v_middle);
+            }
+            else
+            {
+                node * v_middle;
+                split_nodes(v_left, key, left, v_middle);
+                right = join_nodes(v_middle, root, v_right);
+            }
+        }
+
+        /** Removes the first (dir = 0) or last (dir = 1) node of the detached subtree root and stores it in removed.
+         * Returns the new root.
+         */
+        node * remove_extreme(node * root, int dir, node * & removed) noexcept
+        {
+            node * v_extreme = root;
+            while (v_extreme->m_child[dir] != nullptr)
+            {
+                v_extreme = v_extreme->m_child[dir];
+            }
+
+            node * v_parent = v_extreme->m_parent;
+            node * v_child = v_extreme->m_child[!dir];
+            if (v_child != nullptr)
+            {
+                v_child->m_parent = v_parent;
+            }
+            if (v_parent == nullptr)
+            {
+                root = v_child;
+            }
+            else
+            {
+                v_parent->m_child[dir] = v_child;
+                root = fix_up(v_parent);
+            }
+
+            // The removed node stays threaded to its neighbours, it is always relinked as the join separator.
+            v_extreme->m_child = {};
+            v_extreme->m_parent = nullptr;
+            removed = v_extreme;
+            return root;
+        }
+
+        /** Concatenates two detached subtrees, where every key in left is less than every key in right.
+         */
+        node * concat_nodes(node * left, node * right) noexcept
+        {
+            if (left == nullptr)
+            {
+                return right;
+            }
+            if (right == nullptr)
+            {
+                return left;
+            }
+            node * v_mid;
+            if (height(left) >= height(right))
+            {
+                left = remove_extreme(left, 1, v_mid);
+            }
+            else
+            {
+                right = remove_extreme(right, 0, v_mid);
+            }
+            return join_nodes(left, v_mid, right);
+        }
+
+        std::tuple<node *, int, node *> find_insert_position(K const & key) const
+        {
+            node * v_parent = nullptr;
+            int v_dir = 0;
+            node * n = m_root;
+            while (n != nullptr)
+            {
+                if (less(key, n->m_value.first))
+                {
+                    v_dir = 0;
+                }
+                else if (less(n->m_value.first, key))
+                {
+                    v_dir = 1;
+                }
+                else
+                {
+                    return {v_parent, v_dir, n};
+                }
+                v_parent = n;
+                n = n->m_child[v_dir];
+            }
+            return {v_parent, v_dir, nullptr};
+        }
+
+        void attach(node * n, node * parent, int dir) noexcept
+        {
+            n->m_parent = parent;
+            if (parent == nullptr)
+            {
+                m_root = n;
+            }
+            else
+            {
+                parent->m_child[dir] = n;
+                // A new leaf sits between its parent and the parent's previous neighbour on the same side.
+                node * v_outer = parent->m_thread[dir];
+                if (dir == 1)
+                {
+                    link_threads(parent, n);
+                    link_threads(n, v_outer);
+                }
+                else
+                {
+                    link_threads(v_outer, n);
+                    link_threads(n, parent);
+                }
+            }
+            m_size++;
+            fix_up(parent);
+        }
+
+        template <typename ... Ts>
+        std::pair<iterator, bool> emplace_unique(K const & key, Ts && ... ts)
+        {
+            auto [v_parent, v_dir, v_found] = find_insert_position(key);
+            if (v_found != nullptr)
+            {
+                return {iterator(v_found, this), false};
+            }
+            node * v_node = create_node(std::forward<Ts>(ts)...);
+            attach(v_node, v_parent, v_dir);
+            return {iterator(v_node, this), true};
+        }
+
+        /** Removes n from the tree without destroying it.
+         */
+        void unlink(node * n) noexcept
+        {
+            node * v_fix_from;
+            link_threads(n->m_thread[0], n->m_thread[1]);
+            if (n->m_child[0] != nullptr && n->m_child[1] != nullptr)
+            {
+                // Move the successor into n's position rather than swapping values, so iterators to it stay valid.
+                node * v_successor = n->m_thread[1];
+
+                if (v_successor->m_parent == n)
+                {
+                    v_fix_from = v_successor;
+                }
+                else
+                {
+                    v_fix_from = v_successor->m_parent;
+                    replace_child(v_successor->m_parent, v_successor, v_successor->m_child[1]);
+                    v_successor->m_child[1] = n->m_child[1];
+                    v_successor->m_child[1]->m_parent = v_successor;
+                }
+                v_successor->m_child[0] = n->m_child[0];
+                v_successor->m_child[0]->m_parent = v_successor;
+                replace_child(n->m_parent, n, v_successor);
+                v_successor->m_height = n->m_height;
+            }
+            else
+            {
+                v_fix_from = n->m_parent;
+                replace_child(n->m_parent, n, n->m_child[n->m_child[0] == nullptr]);
+            }
+
+            n->m_child = {};
+            n->m_thread = {};
+            n->m_parent = nullptr;
+            m_size--;
+            fix_up(v_fix_from);
+        }
+
+        node * find_node(K const & key) const
+        {
+            node * n = m_root;
+            while (n != nullptr)
+            {
+                if (less(key, n->m_value.first))
+                {
+                    n = n->m_child[0];
+                }
+                else if (less(n->m_value.first, key))
+                {
+                    n = n->m_child[1];
+                }
+                else
+                {
+                    return n;
+                }
+            }
+            return nullptr;
+        }
+
+        node * lower_bound_node(K const & key) const
+        {
+            node * v_result = nullptr;
+            node * n = m_root;
+            while (n != nullptr)
+            {
+                if (less(n->m_value.first, key))
+                {
+                    n = n->m_child[1];
+                }
+                else
+                {
+                    v_result = n;
+                    n = n->m_child[0];
+                }
+            }
+            return v_result;
+        }
+
+        node * upper_bound_node(K const & key) const
+        {
+            node * v_result = nullptr;
+            node * n = m_root;
+            while (n != nullptr)
+            {
+                if (less(key, n->m_value.first))
+                {
+                    v_result = n;
+                    n = n->m_child[0];
+                }
+                else
+                {
+                    n = n->m_child[1];
+                }
+            }
+            return v_result;
+        }
+
+        /** Returns the height of the subtree at n, or -1 if it violates an invariant.
+         */
+        std::int32_t check_subtree(node const * n, std::size_t & count) const
+        {
+            if (n == nullptr)
+            {
+                return 0;
+            }
+            count++;
+            for (int dir = 0; dir < 2; dir++)
+            {
+                node const * v_child = n->m_child[dir];
+                if (v_child == nullptr)
+                {
+                    continue;
+                }
+                if (v_child->m_parent != n)
+                {
+                    return -1;
+                }
+                if (dir == 0 ? !less(v_child->m_value.first, n->m_value.first) : !less(n->m_value.first, v_child->m_value.first))
+                {
+                    return -1;
+                }
+            }
+            std::int32_t v_left = check_subtree(n->m_child[0], count);
+            std::int32_t v_right = check_subtree(n->m_child[1], count);
+            if (v_left < 0 || v_right < 0 || v_left - v_right > 1 || v_right - v_left > 1)
+            {
+                return -1;
+            }
+            if (n->m_height != 1 + std::max(v_left, v_right))
+            {
+                return -1;
+            }
+            if (n->m_size != 1 + subtree_size(n->m_child[0]) + subtree_size(n->m_child[1]))
+            {
+                return -1;
+            }
+            // Children being ordered relative to their parent is not enough, check the whole subtree range.
+            if (n->m_child[0] != nullptr && !less(extreme_of(n->m_child[0], 1)->m_value.first, n->m_value.first))
+            {
+                return -1;
+            }
+            if (n->m_child[1] != nullptr && !less(n->m_value.first, extreme_of(n->m_child[1], 0)->m_value.first))
+            {
+                return -1;
+            }
+            return static_cast<std::int32_t>(n->m_height);
+        }
+
+        /** Checks that the threads of the subtree at n match an in order traversal, where previous is the node
+         * visited before the subtree.
+         */
+        static bool check_threads(node const * n, node const * & previous) noexcept
+        {
+            if (n == nullptr)
+            {
+                return true;
+            }
+            if (!check_threads(n->m_child[0], previous))
+            {
+                return false;
+            }
+            if (n->m_thread[0] != previous || (previous != nullptr && previous->m_thread[1] != n))
+            {
+                return false;
+            }
+            previous = n;
+            return check_threads(n->m_child[1], previous);
+        }
+
+        static node const * extreme_of(node const * n, int dir) noexcept
+        {
+            while (n->m_child[dir] != nullptr)
+            {
+                n = n->m_child[dir];
+            }
+            return n;
+        }
+
+        void steal(avl_tree & other) noexcept
+        {
+            m_root = other.m_root;
+            m_size = other.m_size;
+            other.m_root = nullptr;
+            other.m_size = 0;
+            // This tree was just cleared, so it lists no slabs.
+            m_slabs.swap(other.m_slabs);
+        }
+
+        /** The slab n was carved from, or nullptr if it was allocated on its own. */
+        slab * find_slab(node const * n) const noexcept
+        {
+            auto v_it = std::upper_bound(m_slabs.begin(), m_slabs.end(), n, [](node const * a, slab const * b) {
+                return std::less<node const *>()(a, b->m_nodes);
+            });
+            if (v_it == m_slabs.begin())
+            {
+                return nullptr;
+            }
+            slab * v_slab = *--v_it;
+            // A slab freed through another tree may still be listed here, and its memory reused for n.
+            if (!std::less<node const *>()(n, v_slab->m_nodes + v_slab->m_capacity) || v_slab->m_live.load(std::memory_order_acquire) == 0)
+            {
+                return nullptr;
+            }
+            return v_slab;
+        }
+
+        void release_slab(slab * a_slab) noexcept
+        {
+            if (a_slab->m_owners.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                slab_allocator v_slab_alloc = get_rebound_allocator<slab>();
+                slab_allocator_traits::destroy(v_slab_alloc, a_slab);
+                slab_allocator_traits::deallocate(v_slab_alloc, a_slab, 1);
+            }
+        }
+
+        void release_slabs() noexcept
+        {
+            for (slab * v_slab : m_slabs)
+            {
+                release_slab(v_slab);
+            }
+            // An empty tree holds no memory. Shrinking an empty vector does not allocate.
+            m_slabs.clear();
+            m_slabs.shrink_to_fit();
+        }
+
+        /** Drops the slabs whose nodes have all been erased, so that no listed range overlaps memory that has since
+         * been reused.
+         */
+        void prune_slabs() noexcept
+        {
+            auto v_end = std::remove_if(m_slabs.begin(), m_slabs.end(), [this](slab * v_slab) {
+                if (v_slab->m_live.load(std::memory_order_acquire) != 0)
+                {
+                    return false;
+                }
+                release_slab(v_slab);
+                return true;
+            });
+            m_slabs.erase(v_end, m_slabs.end());
+        }
+
+        /** Takes over the slabs listed by other, whose nodes are about to join this tree. */
+        void merge_slabs(avl_tree & other)
+        {
+            if (other.m_slabs.empty())
+            {
+                return;
+            }
+            prune_slabs();
+            other.prune_slabs();
+            slab_list v_merged(get_rebound_allocator<slab *>());
+            v_merged.reserve(m_slabs.size() + other.m_slabs.size());
+            auto v_by_address = [](slab const * a, slab const * b) {
+                return std::less<node const *>()(a->m_nodes, b->m_nodes);
+            };
+            std::merge(m_slabs.begin(), m_slabs.end(), other.m_slabs.begin(), other.m_slabs.end(), std::back_inserter(v_merged), v_by_address);
+            // Slabs shared since a split are listed by both.
+            auto v_end = std::unique(v_merged.begin(), v_merged.end());
+            for (auto v_it = v_end; v_it != v_merged.end(); ++v_it)
+            {
+                release_slab(*v_it);
+            }
+            v_merged.erase(v_end, v_merged.end());
+            m_slabs.swap(v_merged);
+            other.m_slabs.clear();
+        }
+
+        /** Constructs count nodes from the sorted range starting at first, and links them into a perfectly
+         * balanced tree. Returns the root. With use_slab the nodes are carved from one slab, otherwise each is
+         * allocated on its own.
+         */
+        template <typename ForwardIt>
+        node * build_sorted(ForwardIt first, std::size_t count, bool check_order, bool use_slab)
+        {
+            if (count == 0)
+            {
+                return nullptr;
+            }
+
+            slab * v_slab = nullptr;
+            if (use_slab)
+            {
+                m_slabs.reserve(m_slabs.size() + 1);
+                slab_allocator v_slab_alloc = get_rebound_allocator<slab>();
+                node_allocator v_node_alloc = get_node_allocator();
+                v_slab = slab_allocator_traits::allocate(v_slab_alloc, 1);
+                slab_allocator_traits::construct(v_slab_alloc, v_slab);
+                try
+                {
+                    v_slab->m_nodes = node_allocator_traits::allocate(v_node_alloc, count);
+                }
+                catch (...)
+                {
+                    slab_allocator_traits::destroy(v_slab_alloc, v_slab);
+                    slab_allocator_traits::deallocate(v_slab_alloc, v_slab, 1);
+                    throw;
+                }
+                v_slab->m_capacity = count;
+                // Pruned only now, since a slab freed by a tree on another thread may have handed this one its
+                // memory.
+                prune_slabs();
+                m_slabs.insert(std::upper_bound(m_slabs.begin(), m_slabs.end(), v_slab,
+                                                [](slab const * a, slab const * b) {
+                                                    return std::less<node const *>()(a->m_nodes, b->m_nodes);
+                                                }),
+                               v_slab);
+            }
+
+            // Nodes are constructed in key order, each threaded to the one before, so that a failure can walk back
+            // through them.
+            node * v_last = nullptr;
+            try
+            {
+                return build_balanced(first, count, nullptr, v_slab, v_last, check_order);
+            }
+            catch (...)
+            {
+                if (v_slab != nullptr && v_last == nullptr)
+                {
+                    node_allocator v_node_alloc = get_node_allocator();
+                    node_allocator_traits::deallocate(v_node_alloc, v_slab->m_nodes, v_slab->m_capacity);
+                    m_slabs.erase(std::find(m_slabs.begin(), m_slabs.end(), v_slab));
+                    release_slab(v_slab);
+                }
+                // Deleting the last node of the slab returns it.
+                while (v_last != nullptr)
+                {
+                    node * v_previous = v_last->m_thread[0];
+                    delete_node(v_last);
+                    v_last = v_previous;
+                }
+                throw;
+            }
+        }
+
+        /** Builds the next count elements of the range into a balanced subtree under parent, in order, and returns
+         * its root. Subtree sizes at each level differ by at most one, so the heights of siblings do too.
+         */
+        template <typename ForwardIt>
+        node * build_balanced(ForwardIt & first, std::size_t count, node * parent, slab * a_slab, node * & last, bool check_order)
+        {
+            if (count == 0)
+            {
+                return nullptr;
+            }
+            std::size_t v_mid = count / 2;
+            node * v_left = build_balanced(first, v_mid, nullptr, a_slab, last, check_order);
+
+            node * n;
+            if (a_slab != nullptr)
+            {
+                node_allocator v_node_alloc = get_node_allocator();
+                n = a_slab->m_nodes + a_slab->m_live.load(std::memory_order_relaxed);
+                node_allocator_traits::construct(v_node_alloc, n, *first);
+                a_slab->m_live.fetch_add(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                n = create_node(*first);
+            }
+            ++first;
+            link_threads(last, n);
+            node * v_previous = last;
+            last = n;
+            if (check_order && v_previous != nullptr && !less(v_previous->m_value.first, n->m_value.first))
+            {
+                throw std::invalid_argument("avl_tree: input is not sorted and unique");
+            }
+
+            n->m_parent = parent;
+            n->m_child[0] = v_left;
+            if (v_left != nullptr)
+            {
+                v_left->m_parent = n;
+            }
+            n->m_child[1] = build_balanced(first, count - v_mid - 1, n, a_slab, last, check_order);
+            update(n);
+            return n;
+        }
+
+        void destroy_subtree(node * n) noexcept
+        {
+            while (n != nullptr)
+            {
+                // Rotate left children up so that the walk needs no stack.
+                if (n->m_child[0] != nullptr)
+                {
+                    node * v_left = n->m_child[0];
+                    n->m_child[0] = v_left->m_child[1];
+                    v_left->m_child[1] = n;
+                    n = v_left;
+                }
+                else
+                {
+                    node * v_right = n->m_child[1];
+                    delete_node(n);
+                    n = v_right;
+                }
+            }
+        }
+
+        template <typename T2>
+        auto get_rebound_allocator() const noexcept
+        {
+            typename std::allocator_traits<Allocator>::template rebind_alloc<T2> rebound_alloc(get_allocator());
+            return rebound_alloc;
+        }
+
+        auto get_node_allocator() const noexcept
+        {
+            return get_rebound_allocator<node>();
+        }
+
+        template <typename ... Ts>
+        node * create_node(Ts && ... ts)
+        {
+            node_allocator node_alloc = get_node_allocator();
+            node * nptr = node_allocator_traits::allocate(node_alloc, 1);
+            try
+            {
+                node_allocator_traits::construct(node_alloc, nptr, std::forward<Ts>(ts)...);
+            }
+            catch (...)
+            {
+                node_allocator_traits::deallocate(node_alloc, nptr, 1);
+                throw;
+            }
+            return std::launder(nptr);
+        }
+
+        void delete_node(node * nptr) noexcept
+        {
+            node_allocator node_alloc = get_node_allocator();
+            slab * v_slab = m_slabs.empty() ? nullptr : find_slab(nptr);
+            node_allocator_traits::destroy(node_alloc, nptr);
+            if (v_slab == nullptr)
+            {
+                node_allocator_traits::deallocate(node_alloc, nptr, 1);
+            }
+            else if (v_slab->m_live.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                node_allocator_traits::deallocate(node_alloc, v_slab->m_nodes, v_slab->m_capacity);
+                m_slabs.erase(std::find(m_slabs.begin(), m_slabs.end(), v_slab));
+                release_slab(v_slab);
+            }
+        }
+
+      private:
+        node * m_root = nullptr;
+        std::size_t m_size = 0;
+        // Sorted by address.
+        slab_list m_slabs { get_rebound_allocator<slab *>() };
+
+    };
+
+    template <typename K, typename T, typename Compare, typename Allocator>
+    void swap(avl_tree<K, T, Compare, Allocator> & a, avl_tree<K, T, Compare, Allocator> & b) noexcept
+    {
+        a.swap(b);
+    }
 
 }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,670 @@
+/*
+Bi-Monoque Data Structure
+
+Copyright (c) 2021 Ryan P. Nicholl <rnicholl@protonmail.com> http://rpnx.net/
+
+All rights reserved.
+
+See rpnx-core/LICENSE.txt
+*/
+
+#ifndef RPNXCORE_BIMONOQUE_HPP
+#define RPNXCORE_BIMONOQUE_HPP
+
+#include <array>
+#include <climits>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+#include "rpnx/assert.hpp"
+#include "rpnx/experimental/bitwise.hpp"
+
+namespace rpnx
+{
+    namespace experimental
+    {
+        /*
+          A double ended monoque.
+
+          Like monoque, elements are stored in blocks of size 2, 2, 4, 8, 16 ... which are located in O(1) by a count
+          leading zeros operation, and elements are never moved once they have been constructed.
+
+          The container is made of three segments:
+            * The front segment, a stack which grows towards the front of the container.
+            * The middle segment, which is only ever consumed from either end.
+            * The back segment, a stack which grows towards the back of the container.
+
+          When an element is popped from one end and the segments on that side are empty, the stack on the opposite
+          side is relabeled as the middle segment (by swapping block tables, not by moving elements), and the stack
+          takes over the block table of the previously drained middle segment. This keeps the positions of a sliding
+          window bounded, and blocks released by the middle segment are reused by the stacks, so a steady state sliding
+          window does not allocate.
+         */
+        template < typename T, typename Alloc >
+        class bimonoque_iterator;
+
+        template < typename T, typename Alloc = std::allocator< T > >
+        class bimonoque : private Alloc
+        {
+            friend class bimonoque_iterator< T, Alloc >;
+            friend class bimonoque_iterator< T const, Alloc >;
+
+            static_assert(std::is_same_v< typename std::allocator_traits< Alloc >::pointer, T* >, "Not implemented");
+
+          public:
+            using value_type = T;
+            using allocator_type = Alloc;
+            using size_type = std::size_t;
+            using difference_type = std::ptrdiff_t;
+            using reference = T&;
+            using const_reference = T const&;
+            using pointer = T*;
+            using const_pointer = T const*;
+
+            using iterator = bimonoque_iterator< T, Alloc >;
+            using const_iterator = bimonoque_iterator< T const, Alloc >;
+            using reverse_iterator = std::reverse_iterator< iterator >;
+            using const_reverse_iterator = std::reverse_iterator< const_iterator >;
+
+          private:
+            static constexpr std::size_t block_count = sizeof(std::size_t) * CHAR_BIT;
+
+            using block_allocator = typename std::allocator_traits< Alloc >::template rebind_alloc< T >;
+            using block_allocator_traits = std::allocator_traits< block_allocator >;
+
+            struct segment
+            {
+                std::array< T*, block_count > m_blocks{};
+                std::size_t m_begin = 0;
+                std::size_t m_end = 0;
+
+                std::size_t size() const noexcept
+                {
+                    return m_end - m_begin;
+                }
+            };
+
+            segment m_front;
+            segment m_middle;
+            segment m_back;
+            bool m_middle_reversed = false;
+
+            static inline std::size_t block_index(std::size_t position) noexcept
+            {
+                return block_count - 1 - countl_zero(position | 1);
+            }
+
+            static inline std::size_t block_offset(std::size_t position) noexcept
+            {
+                return position - ((std::size_t(1) << block_index(position)) & ~std::size_t(1));
+            }
+
+            static inline std::size_t block_first(std::size_t index) noexcept
+            {
+                return (std::size_t(1) << index) & ~std::size_t(1);
+            }
+
+            static inline std::size_t size_of_block(std::size_t index) noexcept
+            {
+                return index == 0 ? 2 : std::size_t(1) << index;
+            }
+
+            static inline T* element(segment const& seg, std::size_t position) noexcept
+            {
+                T* v_block = seg.m_blocks[block_index(position)];
+                RPNX_ASSERT(v_block != nullptr);
+                return std::launder(v_block + block_offset(position));
+            }
+
+            block_allocator get_block_allocator() const noexcept
+            {
+                return block_allocator(get_allocator());
+            }
+
+            // Returns true if block "index" of the middle segment holds no live elements.
+            bool middle_block_unused(std::size_t index) const noexcept
+            {
+                if (m_middle.size() == 0)
+                    return true;
+                std::size_t v_first = block_first(index);
+                std::size_t v_last = v_first + size_of_block(index);
+                return v_last <= m_middle.m_begin || v_first >= m_middle.m_end;
+            }
+
+            // Ensures that the stack segment "seg" has storage for "position", preferring
+            // blocks that the middle segment no longer uses over fresh allocations.
+            void ensure_block(segment& seg, std::size_t position)
+            {
+                std::size_t v_index = block_index(position);
+                if (seg.m_blocks[v_index] != nullptr)
+                    return;
+
+                if (m_middle.m_blocks[v_index] != nullptr && middle_block_unused(v_index))
+                {
+                    seg.m_blocks[v_index] = m_middle.m_blocks[v_index];
+                    m_middle.m_blocks[v_index] = nullptr;
+                    return;
+                }
+
+                block_allocator v_alloc = get_block_allocator();
+                seg.m_blocks[v_index] = block_allocator_traits::allocate(v_alloc, size_of_block(v_index));
+            }
+
+            void destroy_at(T* ptr) noexcept
+            {
+                block_allocator v_alloc = get_block_allocator();
+                block_allocator_traits::destroy(v_alloc, ptr);
+            }
+
+            // Relabels a stack segment as the (empty) middle segment. No elements are moved.
+            void stack_to_middle(segment& seg, bool reversed) noexcept
+            {
+                RPNX_ASSERT(m_middle.size() == 0);
+                std::swap(seg.m_blocks, m_middle.m_blocks);
+                m_middle.m_begin = 0;
+                m_middle.m_end = seg.m_end;
+                m_middle_reversed = reversed;
+                seg.m_end = 0;
+            }
+
+            void middle_consumed() noexcept
+            {
+                if (m_middle.size() == 0)
+                {
+                    m_middle.m_begin = 0;
+                    m_middle.m_end = 0;
+                }
+            }
+
+            void destroy_segment(segment& seg) noexcept
+            {
+                if constexpr (!std::is_trivially_destructible_v< T >)
+                {
+                    for (std::size_t i = seg.m_begin; i != seg.m_end; i++)
+                    {
+                        destroy_at(element(seg, i));
+                    }
+                }
+                seg.m_begin = 0;
+                seg.m_end = 0;
+            }
+
+            void deallocate_segment(segment& seg) noexcept
+            {
+                block_allocator v_alloc = get_block_allocator();
+                for (std::size_t i = 0; i < block_count; i++)
+                {
+                    if (seg.m_blocks[i] != nullptr)
+                    {
+                        block_allocator_traits::deallocate(v_alloc, seg.m_blocks[i], size_of_block(i));
+                        seg.m_blocks[i] = nullptr;
+                    }
+                }
+            }
+
+            // Releases blocks of a segment that do not hold any live element.
+            void trim_segment(segment& seg) noexcept
+            {
+                block_allocator v_alloc = get_block_allocator();
+                for (std::size_t i = 0; i < block_count; i++)
+                {
+                    if (seg.m_blocks[i] == nullptr)
+                        continue;
+                    std::size_t v_first = block_first(i);
+                    std::size_t v_last = v_first + size_of_block(i);
+                    if (seg.size() == 0 || v_last <= seg.m_begin || v_first >= seg.m_end)
+                    {
+                        block_allocator_traits::deallocate(v_alloc, seg.m_blocks[i], size_of_block(i));
+                        seg.m_blocks[i] = nullptr;
+                    }
+                }
+            }
+
+            T* locate(std::size_t n) const noexcept
+            {
+                RPNX_ASSERT(n < size());
+                std::size_t v_front_size = m_front.m_end;
+                if (n < v_front_size)
+                {
+                    return element(m_front, v_front_size - 1 - n);
+                }
+                n -= v_front_size;
+
+                std::size_t v_middle_size = m_middle.size();
+                if (n < v_middle_size)
+                {
+                    return element(m_middle, m_middle_reversed ? m_middle.m_end - 1 - n : m_middle.m_begin + n);
+                }
+                n -= v_middle_size;
+
+                return element(m_back, n);
+            }
+
+          public:
+            bimonoque() noexcept(noexcept(Alloc()))
+            {
+            }
+
+            explicit bimonoque(Alloc const& alloc) noexcept : Alloc(alloc)
+            {
+            }
+
+            bimonoque(std::initializer_list< T > ilist, Alloc const& alloc = Alloc()) : Alloc(alloc)
+            {
+                for (auto const& x : ilist)
+                    push_back(x);
+            }
+
+            template < typename It >
+            bimonoque(It first, It last, Alloc const& alloc = Alloc()) : Alloc(alloc)
+            {
+                for (; first != last; ++first)
+                    emplace_back(*first);
+            }
+
+            bimonoque(bimonoque< T, Alloc > const& other)
+                : Alloc(std::allocator_traits< Alloc >::select_on_container_copy_construction(other.get_allocator()))
+            {
+                for (auto const& x : other)
+                    emplace_back(x);
+            }
+
+            bimonoque(bimonoque< T, Alloc >&& other) noexcept : Alloc(other.get_allocator())
+            {
+                swap(other);
+            }
+
+            ~bimonoque()
+            {
+                clear();
+                deallocate_segment(m_front);
+                deallocate_segment(m_middle);
+                deallocate_segment(m_back);
+            }
+
+            bimonoque< T, Alloc >& operator=(bimonoque< T, Alloc > const& other)
+            {
+                if (this != &other)
+                {
+                    bimonoque< T, Alloc > v_copy(other);
+                    swap(v_copy);
+                }
+                return *this;
+            }
+
+            bimonoque< T, Alloc >& operator=(bimonoque< T, Alloc >&& other) noexcept
+            {
+                swap(other);
+                return *this;
+            }
+
+            Alloc get_allocator() const noexcept
+            {
+                return static_cast< Alloc const& >(*this);
+            }
+
+            std::size_t size() const noexcept
+            {
+                return m_front.m_end + m_middle.size() + m_back.m_end;
+            }
+
+            bool empty() const noexcept
+            {
+                return size() == 0;
+            }
+
+            template < typename... Ts >
+            T& emplace_back(Ts&&... ts)
+            {
+                ensure_block(m_back, m_back.m_end);
+                T* v_location = m_back.m_blocks[block_index(m_back.m_end)] + block_offset(m_back.m_end);
+                block_allocator v_alloc = get_block_allocator();
+                block_allocator_traits::construct(v_alloc, v_location, std::forward< Ts >(ts)...);
+                m_back.m_end++;
+                return *std::launder(v_location);
+            }
+
+            template < typename... Ts >
+            T& emplace_front(Ts&&... ts)
+            {
+                ensure_block(m_front, m_front.m_end);
+                T* v_location = m_front.m_blocks[block_index(m_front.m_end)] + block_offset(m_front.m_end);
+                block_allocator v_alloc = get_block_allocator();
+                block_allocator_traits::construct(v_alloc, v_location, std::forward< Ts >(ts)...);
+                m_front.m_end++;
+                return *std::launder(v_location);
+            }
+
+            void push_back(T const& value)
+            {
+                emplace_back(value);
+            }
+
+            void push_back(T&& value)
+            {
+                emplace_back(std::move(value));
+            }
+
+            void push_front(T const& value)
+            {
+                emplace_front(value);
+            }
+
+            void push_front(T&& value)
+            {
+                emplace_front(std::move(value));
+            }
+
+            void pop_back() noexcept
+            {
+                RPNX_ASSERT(!empty());
+                if (m_back.m_end != 0)
+                {
+                    destroy_at(element(m_back, --m_back.m_end));
+                    return;
+                }
+
+                if (m_middle.size() == 0)
+                {
+                    stack_to_middle(m_front, true);
+                }
+
+                destroy_at(element(m_middle, m_middle_reversed ? m_middle.m_begin++ : --m_middle.m_end));
+                middle_consumed();
+            }
+
+            void pop_front() noexcept
+            {
+                RPNX_ASSERT(!empty());
+                if (m_front.m_end != 0)
+                {
+                    destroy_at(element(m_front, --m_front.m_end));
+                    return;
+                }
+
+                if (m_middle.size() == 0)
+                {
+                    stack_to_middle(m_back, false);
+                }
+
+                destroy_at(element(m_middle, m_middle_reversed ? --m_middle.m_end : m_middle.m_begin++));
+                middle_consumed();
+            }
+
+            T& operator[](std::size_t n) noexcept
+            {
+                return *locate(n);
+            }
+
+            T const& operator[](std::size_t n) const noexcept
+            {
+                return *locate(n);
+            }
+
+            T& at(std::size_t n)
+            {
+                if (n >= size())
+                    throw std::out_of_range("bimonoque::at");
+                return *locate(n);
+            }
+
+            T const& at(std::size_t n) const
+            {
+                if (n >= size())
+                    throw std::out_of_range("bimonoque::at");
+                return *locate(n);
+            }
+
+            T& front() noexcept
+            {
+                return *locate(0);
+            }
+
+            T const& front() const noexcept
+            {
+                return *locate(0);
+            }
+
+            T& back() noexcept
+            {
+                return *locate(size() - 1);
+            }
+
+            T const& back() const noexcept
+            {
+                return *locate(size() - 1);
+            }
+
+            /** Destroys all elements. Storage blocks are kept for reuse, use shrink_to_fit to release them.
+             */
+            void clear() noexcept
+            {
+                destroy_segment(m_front);
+                destroy_segment(m_middle);
+                destroy_segment(m_back);
+                m_middle_reversed = false;
+            }
+
+            /** Releases storage blocks that do not currently hold any elements.
+             */
+            void shrink_to_fit() noexcept
+            {
+                trim_segment(m_front);
+                trim_segment(m_middle);
+                trim_segment(m_back);
+            }
+
+            void swap(bimonoque< T, Alloc >& other) noexcept
+            {
+                if constexpr (std::allocator_traits< Alloc >::propagate_on_container_swap::value)
+                {
+                    std::swap(static_cast< Alloc& >(*this), static_cast< Alloc& >(other));
+                }
+                std::swap(m_front, other.m_front);
+                std::swap(m_middle, other.m_middle);
+                std::swap(m_back, other.m_back);
+                std::swap(m_middle_reversed, other.m_middle_reversed);
+            }
+
+            friend void swap(bimonoque< T, Alloc >& a, bimonoque< T, Alloc >& b) noexcept
+            {
+                a.swap(b);
+            }
+
+            iterator begin() noexcept
+            {
+                return iterator(this, 0);
+            }
+
+            iterator end() noexcept
+            {
+                return iterator(this, size());
+            }
+
+            const_iterator begin() const noexcept
+            {
+                return cbegin();
+            }
+
+            const_iterator end() const noexcept
+            {
+                return cend();
+            }
+
+            const_iterator cbegin() const noexcept
+            {
+                return const_iterator(this, 0);
+            }
+
+            const_iterator cend() const noexcept
+            {
+                return const_iterator(this, size());
+            }
+
+            reverse_iterator rbegin() noexcept
+            {
+                return reverse_iterator(end());
+            }
+
+            reverse_iterator rend() noexcept
+            {
+                return reverse_iterator(begin());
+            }
+
+            const_reverse_iterator rbegin() const noexcept
+            {
+                return const_reverse_iterator(end());
+            }
+
+            const_reverse_iterator rend() const noexcept
+            {
+                return const_reverse_iterator(begin());
+            }
+        };
+
+        template < typename T, typename Alloc >
+        class bimonoque_iterator
+        {
+            friend class bimonoque< std::remove_const_t< T >, Alloc >;
+            friend class bimonoque_iterator< std::remove_const_t< T >, Alloc >;
+            friend class bimonoque_iterator< T const, Alloc >;
+
+            using container = std::conditional_t< std::is_const_v< T >, bimonoque< std::remove_const_t< T >, Alloc > const, bimonoque< T, Alloc > >;
+
+          public:
+            using value_type = std::remove_const_t< T >;
+            using difference_type = std::ptrdiff_t;
+            using pointer = T*;
+            using reference = T&;
+            using iterator_category = std::random_access_iterator_tag;
+
+          private:
+            container* m_which = nullptr;
+            std::size_t m_index = 0;
+
+            bimonoque_iterator(container* which, std::size_t index) noexcept : m_which(which), m_index(index)
+            {
+            }
+
+          public:
+            bimonoque_iterator() noexcept = default;
+
+            template < typename T2, typename = std::enable_if_t< std::is_const_v< T > && std::is_same_v< T2, std::remove_const_t< T > > > >
+            bimonoque_iterator(bimonoque_iterator< T2, Alloc > const& other) noexcept : m_which(other.m_which), m_index(other.m_index)
+            {
+            }
+
+            reference operator*() const noexcept
+            {
+                RPNX_ASSERT(m_which != nullptr);
+                return *m_which->locate(m_index);
+            }
+
+            pointer operator->() const noexcept
+            {
+                return &**this;
+            }
+
+            reference operator[](difference_type n) const noexcept
+            {
+                return *(*this + n);
+            }
+
+            bimonoque_iterator& operator++() noexcept
+            {
+                m_index++;
+                return *this;
+            }
+
+            bimonoque_iterator operator++(int) noexcept
+            {
+                bimonoque_iterator v_copy = *this;
+                m_index++;
+                return v_copy;
+            }
+
+            bimonoque_iterator& operator--() noexcept
+            {
+                m_index--;
+                return *this;
+            }
+
+            bimonoque_iterator operator--(int) noexcept
+            {
+                bimonoque_iterator v_copy = *this;
+                m_index--;
+                return v_copy;
+            }
+
+            bimonoque_iterator& operator+=(difference_type n) noexcept
+            {
+                m_index += n;
+                return *this;
+            }
+
+            bimonoque_iterator& operator-=(difference_type n) noexcept
+            {
+                m_index -= n;
+                return *this;
+            }
+
+            bimonoque_iterator operator+(difference_type n) const noexcept
+            {
+                return bimonoque_iterator(m_which, m_index + n);
+            }
+
+            bimonoque_iterator operator-(difference_type n) const noexcept
+            {
+                return bimonoque_iterator(m_which, m_index - n);
+            }
+
+            friend bimonoque_iterator operator+(difference_type n, bimonoque_iterator const& it) noexcept
+            {
+                return it + n;
+            }
+
+            difference_type operator-(bimonoque_iterator const& other) const noexcept
+            {
+                RPNX_ASSERT(m_which == other.m_which);
+                return difference_type(m_index) - difference_type(other.m_index);
+            }
+
+            bool operator==(bimonoque_iterator const& other) const noexcept
+            {
+                RPNX_ASSERT(m_which == other.m_which);
+                return m_index == other.m_index;
+            }
+
+            bool operator!=(bimonoque_iterator const& other) const noexcept
+            {
+                return !(*this == other);
+            }
+
+            bool operator<(bimonoque_iterator const& other) const noexcept
+            {
+                RPNX_ASSERT(m_which == other.m_which);
+                return m_index < other.m_index;
+            }
+
+            bool operator>(bimonoque_iterator const& other) const noexcept
+            {
+                return other < *this;
+            }
+
+            bool operator<=(bimonoque_iterator const& other) const noexcept
+            {
+                return !(other < *this);
+            }
+
+            bool operator>=(bimonoque_iterator const& other) const noexcept
+            {
+                return !(*this < other);
+            }
+        };
+    } // namespace experimental
+} // namespace rpnx
+
+#endif // RPNXCORE_BIMONOQUE_HPP
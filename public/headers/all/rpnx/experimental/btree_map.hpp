@@ -0,0 +1,1693 @@
+#ifndef RPNXCORE_BTREE_MAP_HPP
+#define RPNXCORE_BTREE_MAP_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RPNX_BTREE_SSE2
+#endif
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#define RPNX_BTREE_SSE42
+#endif
+
+#include "rpnx/assert.hpp"
+#include "rpnx/serial_traits.hpp"
+
+namespace rpnx::experimental
+{
+    /** The default number of values per leaf and children per internal node, chosen so that the values of a leaf
+     * take at most 512 bytes, 8 cache lines. The leaf's links add 32 bytes on 64 bit targets.
+     */
+    template <typename K, typename T>
+    inline constexpr std::size_t btree_default_fanout = std::clamp< std::size_t >(512 / sizeof(std::pair<K, T>), 8, 64);
+
+    template <typename K, typename T, typename Compare = std::less<K>, typename Allocator = std::allocator< std::pair< K const, T > >, std::size_t Fanout = btree_default_fanout<K, T> >
+    class btree_map;
+
+    template <typename K, typename T, std::size_t Fanout>
+    struct btree_map_internal;
+
+    template <typename K, typename T, std::size_t Fanout>
+    struct btree_map_node
+    {
+        btree_map_internal<K, T, Fanout> * m_parent = nullptr;
+        // The number of values in a leaf, or of keys in an internal node (one less than its children).
+        std::uint16_t m_count = 0;
+        bool m_leaf;
+
+        explicit btree_map_node(bool leaf) noexcept
+        : m_leaf(leaf)
+        {
+        }
+    };
+
+    /*
+      Leaves hold the values, and are linked to their neighbours for iteration.
+
+      Values are stored as std::pair<K, T> and handed out as std::pair<K const, T>, the same layout trick the
+      standard library's node based maps use, so that shifting values within and between nodes can move keys
+      rather than copy them.
+     */
+    template <typename K, typename T, std::size_t Fanout>
+    struct btree_map_leaf : btree_map_node<K, T, Fanout>
+    {
+        using slot_type = std::pair<K, T>;
+        using value_type = std::pair<K const, T>;
+
+        btree_map_leaf * m_prev = nullptr;
+        btree_map_leaf * m_next = nullptr;
+        alignas(slot_type) unsigned char m_storage[sizeof(slot_type) * Fanout];
+
+        btree_map_leaf() noexcept
+        : btree_map_node<K, T, Fanout>(true)
+        {
+        }
+
+        slot_type * slot(std::size_t i) noexcept
+        {
+            return std::launder(reinterpret_cast<slot_type *>(m_storage) + i);
+        }
+
+        slot_type const * slot(std::size_t i) const noexcept
+        {
+            return std::launder(reinterpret_cast<slot_type const *>(m_storage) + i);
+        }
+
+        value_type & value(std::size_t i) noexcept
+        {
+            return reinterpret_cast<value_type &>(*slot(i));
+        }
+
+        value_type const & value(std::size_t i) const noexcept
+        {
+            return reinterpret_cast<value_type const &>(*slot(i));
+        }
+
+        K const & key(std::size_t i) const noexcept
+        {
+            return slot(i)->first;
+        }
+    };
+
+    /*
+      Internal nodes hold separator keys in a contiguous array, so that searching them touches as few cache lines
+      as possible and can use SIMD compares. All keys in child i are less than key i, and all keys in child i + 1
+      are greater or equal. There is room for one key and child more than Fanout allows, which lets an insertion
+      overflow a node before it is split.
+     */
+    template <typename K, typename T, std::size_t Fanout>
+    struct btree_map_internal : btree_map_node<K, T, Fanout>
+    {
+        alignas(K) unsigned char m_key_storage[sizeof(K) * Fanout];
+        std::array<btree_map_node<K, T, Fanout> *, Fanout + 1> m_children {};
+
+        btree_map_internal() noexcept
+        : btree_map_node<K, T, Fanout>(false)
+        {
+        }
+
+        K * keys() noexcept
+        {
+            return std::launder(reinterpret_cast<K *>(m_key_storage));
+        }
+
+        K const * keys() const noexcept
+        {
+            return std::launder(reinterpret_cast<K const *>(m_key_storage));
+        }
+
+        std::size_t child_index(btree_map_node<K, T, Fanout> const * child) const noexcept
+        {
+            std::size_t i = 0;
+            while (m_children[i] != child)
+            {
+                i++;
+            }
+            return i;
+        }
+    };
+
+    /** Searches sorted arrays of keys within a node. Integral keys ordered by std::less are counted with a
+     * branchless linear scan, using SSE2 for 32 bit keys and SSE4.2 for 64 bit keys when available. Node sized
+     * arrays fit in a handful of cache lines, where this beats a binary search's unpredictable branches.
+     * Other keys use a binary search.
+     *
+     * SSE2 has no 64 bit compare. Building one from 32 bit compares takes about ten instructions per pair of keys,
+     * which measured slower than the scalar compare and add, so without SSE4.2 64 bit keys use the scalar scan.
+     */
+    template <typename K, typename Compare>
+    struct btree_key_search
+    {
+        static constexpr bool linear = std::is_integral_v<K> && !std::is_same_v<K, bool> && (std::is_same_v<Compare, std::less<K>> || std::is_same_v<Compare, std::less<>>);
+
+        /** Returns the number of keys less than key, for inclusive false, or not greater than key, for inclusive true.
+         */
+        template <bool inclusive>
+        static std::size_t count(Compare const & comp, K const * keys, std::size_t n, K const & key) noexcept(linear)
+        {
+            if constexpr (linear)
+            {
+                return scan<inclusive, sizeof(K)>(reinterpret_cast<unsigned char const *>(keys), n, key);
+            }
+            else if constexpr (inclusive)
+            {
+                return static_cast<std::size_t>(std::upper_bound(keys, keys + n, key, comp) - keys);
+            }
+            else
+            {
+                return static_cast<std::size_t>(std::lower_bound(keys, keys + n, key, comp) - keys);
+            }
+        }
+
+        /** As count, over the keys of a leaf's values, which lie between the mapped values and are scanned in
+         * place.
+         */
+        template <bool inclusive, typename Leaf>
+        static std::size_t count_leaf(Compare const & comp, Leaf const & leaf, K const & key) noexcept(linear)
+        {
+            std::size_t n = leaf.m_count;
+            if constexpr (linear)
+            {
+                return scan<inclusive, sizeof(typename Leaf::slot_type)>(reinterpret_cast<unsigned char const *>(std::addressof(leaf.key(0))), n, key);
+            }
+            else
+            {
+                std::size_t v_low = 0;
+                while (n != 0)
+                {
+                    std::size_t v_half = n / 2;
+                    bool v_before = inclusive ? !comp(key, leaf.key(v_low + v_half)) : comp(leaf.key(v_low + v_half), key);
+                    if (v_before)
+                    {
+                        v_low += v_half + 1;
+                        n -= v_half + 1;
+                    }
+                    else
+                    {
+                        n = v_half;
+                    }
+                }
+                return v_low;
+            }
+        }
+
+      private:
+        static K load(unsigned char const * p) noexcept
+        {
+            K v_key;
+            std::memcpy(&v_key, p, sizeof(K));
+            return v_key;
+        }
+
+        /** The linear count, over n keys Stride bytes apart starting at keys. Only contiguous keys are compared a
+         * vector at a time: gathering the keys of a leaf from between its values measured slower than comparing
+         * them one by one, which needs no copy of the keys either.
+         */
+        template <bool inclusive, std::size_t Stride>
+        static std::size_t scan(unsigned char const * keys, std::size_t n, K const & key) noexcept
+        {
+            std::size_t v_count = 0;
+            std::size_t i = 0;
+#ifdef RPNX_BTREE_SSE2
+            if constexpr (sizeof(K) == 4 && Stride == sizeof(K))
+            {
+                // Flipping the sign bit turns unsigned order into signed order for the signed compare.
+                __m128i v_bias = _mm_set1_epi32(std::is_signed_v<K> ? 0 : std::numeric_limits<std::int32_t>::min());
+                __m128i v_key = _mm_xor_si128(_mm_set1_epi32(static_cast<std::int32_t>(key)), v_bias);
+                // Compared lanes are all ones, so subtracting the masks counts them per lane without a popcount.
+                __m128i v_matches = _mm_setzero_si128();
+                for (; i + 4 <= n; i += 4)
+                {
+                    __m128i v_keys = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(keys + i * Stride)), v_bias);
+                    v_matches = _mm_sub_epi32(v_matches, inclusive ? _mm_cmpgt_epi32(v_keys, v_key) : _mm_cmpgt_epi32(v_key, v_keys));
+                }
+                alignas(16) std::uint32_t v_lanes[4];
+                _mm_store_si128(reinterpret_cast<__m128i *>(v_lanes), v_matches);
+                std::size_t v_bits = std::size_t(v_lanes[0]) + v_lanes[1] + v_lanes[2] + v_lanes[3];
+                v_count = inclusive ? i - v_bits : v_bits;
+            }
+#endif
+#ifdef RPNX_BTREE_SSE42
+            if constexpr (sizeof(K) == 8 && Stride == sizeof(K))
+            {
+                __m128i v_bias = _mm_set1_epi64x(std::is_signed_v<K> ? 0 : std::numeric_limits<std::int64_t>::min());
+                __m128i v_key = _mm_xor_si128(_mm_set1_epi64x(static_cast<std::int64_t>(key)), v_bias);
+                __m128i v_matches = _mm_setzero_si128();
+                for (; i + 2 <= n; i += 2)
+                {
+                    __m128i v_keys = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(keys + i * Stride)), v_bias);
+                    v_matches = _mm_sub_epi64(v_matches, inclusive ? _mm_cmpgt_epi64(v_keys, v_key) : _mm_cmpgt_epi64(v_key, v_keys));
+                }
+                alignas(16) std::uint64_t v_lanes[2];
+                _mm_store_si128(reinterpret_cast<__m128i *>(v_lanes), v_matches);
+                std::size_t v_bits = static_cast<std::size_t>(v_lanes[0] + v_lanes[1]);
+                v_count = inclusive ? i - v_bits : v_bits;
+            }
+#endif
+            for (; i < n; i++)
+            {
+                K v_other = load(keys + i * Stride);
+                v_count += inclusive ? !(key < v_other) : v_other < key;
+            }
+            return v_count;
+        }
+    };
+
+    template <typename K, typename T, std::size_t Fanout>
+    class btree_map_const_iterator;
+
+    template <typename K, typename T, std::size_t Fanout>
+    class btree_map_iterator
+    {
+        template <typename, typename, typename, typename, std::size_t>
+        friend class btree_map;
+        friend class btree_map_const_iterator<K, T, Fanout>;
+
+        using leaf = btree_map_leaf<K, T, Fanout>;
+
+        leaf * m_leaf = nullptr;
+        std::size_t m_index = 0;
+
+        btree_map_iterator(leaf * l, std::size_t index) noexcept
+        : m_leaf(l), m_index(index)
+        {
+        }
+
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<K const, T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type *;
+        using reference = value_type &;
+
+        btree_map_iterator() noexcept = default;
+
+        reference operator*() const noexcept
+        {
+            return m_leaf->value(m_index);
+        }
+
+        pointer operator->() const noexcept
+        {
+            return std::addressof(m_leaf->value(m_index));
+        }
+
+        btree_map_iterator & operator++() noexcept
+        {
+            if (++m_index == m_leaf->m_count && m_leaf->m_next != nullptr)
+            {
+                m_leaf = m_leaf->m_next;
+                m_index = 0;
+            }
+            return *this;
+        }
+
+        btree_map_iterator operator++(int) noexcept
+        {
+            btree_map_iterator v_copy = *this;
+            ++*this;
+            return v_copy;
+        }
+
+        btree_map_iterator & operator--() noexcept
+        {
+            if (m_index == 0)
+            {
+                m_leaf = m_leaf->m_prev;
+                m_index = m_leaf->m_count;
+            }
+            m_index--;
+            return *this;
+        }
+
+        btree_map_iterator operator--(int) noexcept
+        {
+            btree_map_iterator v_copy = *this;
+            --*this;
+            return v_copy;
+        }
+
+        bool operator==(btree_map_iterator const & other) const noexcept
+        {
+            return m_leaf == other.m_leaf && m_index == other.m_index;
+        }
+
+        bool operator!=(btree_map_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+    };
+
+    template <typename K, typename T, std::size_t Fanout>
+    class btree_map_const_iterator
+    {
+        template <typename, typename, typename, typename, std::size_t>
+        friend class btree_map;
+
+        using leaf = btree_map_leaf<K, T, Fanout>;
+
+        leaf const * m_leaf = nullptr;
+        std::size_t m_index = 0;
+
+        btree_map_const_iterator(leaf const * l, std::size_t index) noexcept
+        : m_leaf(l), m_index(index)
+        {
+        }
+
+      public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = std::pair<K const, T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type const *;
+        using reference = value_type const &;
+
+        btree_map_const_iterator() noexcept = default;
+
+        btree_map_const_iterator(btree_map_iterator<K, T, Fanout> const & other) noexcept
+        : m_leaf(other.m_leaf), m_index(other.m_index)
+        {
+        }
+
+        reference operator*() const noexcept
+        {
+            return m_leaf->value(m_index);
+        }
+
+        pointer operator->() const noexcept
+        {
+            return std::addressof(m_leaf->value(m_index));
+        }
+
+        btree_map_const_iterator & operator++() noexcept
+        {
+            if (++m_index == m_leaf->m_count && m_leaf->m_next != nullptr)
+            {
+                m_leaf = m_leaf->m_next;
+                m_index = 0;
+            }
+            return *this;
+        }
+
+        btree_map_const_iterator operator++(int) noexcept
+        {
+            btree_map_const_iterator v_copy = *this;
+            ++*this;
+            return v_copy;
+        }
+
+        btree_map_const_iterator & operator--() noexcept
+        {
+            if (m_index == 0)
+            {
+                m_leaf = m_leaf->m_prev;
+                m_index = m_leaf->m_count;
+            }
+            m_index--;
+            return *this;
+        }
+
+        btree_map_const_iterator operator--(int) noexcept
+        {
+            btree_map_const_iterator v_copy = *this;
+            --*this;
+            return v_copy;
+        }
+
+        bool operator==(btree_map_const_iterator const & other) const noexcept
+        {
+            return m_leaf == other.m_leaf && m_index == other.m_index;
+        }
+
+        bool operator!=(btree_map_const_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+    };
+
+    /*
+      An ordered map implemented as a B+ tree.
+
+      Each leaf holds up to Fanout values and each internal node up to Fanout children, so a lookup touches
+      log_Fanout(n) nodes instead of the log_2(n) nodes of a binary tree, and each node is a few adjacent cache
+      lines rather than a separate allocation per key. Per value overhead is a small fraction of a pointer,
+      where avl_tree spends five pointers, a height and a size.
+
+      The interface follows std::map, except that like other B-trees, any insertion or erasure invalidates all
+      iterators and references into the map. Keys and mapped values must be nothrow move constructible, since
+      they are moved between nodes as the tree splits and merges. If an insertion or erasure throws, the map is
+      unchanged.
+
+      Inserting at the end (or the beginning) of the map leaves the split leaf full, so building a map from
+      sorted input, including copying, fills every leaf.
+     */
+    template <typename K, typename T, typename Compare, typename Allocator, std::size_t Fanout>
+    class btree_map
+        :
+        private Compare,
+        private Allocator
+    {
+        static_assert(Fanout >= 4 && Fanout <= std::numeric_limits<std::uint16_t>::max() - 1, "Fanout must be between 4 and 65534, so that node counts fit in 16 bits");
+        static_assert(std::is_nothrow_move_constructible_v<K> && std::is_nothrow_move_constructible_v<T>, "btree_map moves keys and values between nodes");
+
+      public:
+        using key_type = K;
+        using mapped_type = T;
+        using value_type = std::pair<K const, T>;
+        using size_type = std::size_t;
+        using difference_type = std::ptrdiff_t;
+        using key_compare = Compare;
+        using allocator_type = Allocator;
+        using reference = value_type &;
+        using const_reference = value_type const &;
+        using iterator = btree_map_iterator<K, T, Fanout>;
+        using const_iterator = btree_map_const_iterator<K, T, Fanout>;
+        using reverse_iterator = std::reverse_iterator<iterator>;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+        static constexpr std::size_t fanout = Fanout;
+
+      private:
+        using node = btree_map_node<K, T, Fanout>;
+        using leaf = btree_map_leaf<K, T, Fanout>;
+        using internal = btree_map_internal<K, T, Fanout>;
+        using slot_type = std::pair<K, T>;
+        using search = btree_key_search<K, Compare>;
+        using leaf_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<leaf>;
+        using leaf_allocator_traits = std::allocator_traits<leaf_allocator>;
+        using internal_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<internal>;
+        using internal_allocator_traits = std::allocator_traits<internal_allocator>;
+
+        // Nodes other than the root are merged or refilled from a sibling when they drop below this many values
+        // (leaves) or children (internal nodes).
+        static constexpr std::size_t min_fill = Fanout / 2;
+        // Enough for any tree that fits in memory, since every internal node but the root has at least 2 children.
+        static constexpr std::size_t max_height = 64;
+
+      public:
+        inline btree_map() noexcept(noexcept(Allocator()) && noexcept(Compare()))
+        {}
+
+        explicit btree_map(Compare const & comp, Allocator const & alloc = Allocator())
+        : Compare(comp), Allocator(alloc)
+        {}
+
+        explicit btree_map(Allocator const & alloc)
+        : Allocator(alloc)
+        {}
+
+        template <typename InputIt>
+        btree_map(InputIt first, InputIt last, Compare const & comp = Compare(), Allocator const & alloc = Allocator())
+        : Compare(comp), Allocator(alloc)
+        {
+            insert(first, last);
+        }
+
+        btree_map(std::initializer_list<value_type> init, Compare const & comp = Compare(), Allocator const & alloc = Allocator())
+        : Compare(comp), Allocator(alloc)
+        {
+            insert(init.begin(), init.end());
+        }
+
+        btree_map(btree_map const & other)
+        : Compare(other.key_comp()), Allocator(std::allocator_traits<Allocator>::select_on_container_copy_construction(other.get_allocator()))
+        {
+            append_all(other);
+        }
+
+        btree_map(btree_map && other) noexcept
+        : Compare(std::move(static_cast<Compare&>(other))), Allocator(std::move(static_cast<Allocator&>(other)))
+        {
+            steal(other);
+        }
+
+        ~btree_map()
+        {
+            clear();
+        }
+
+        btree_map & operator=(btree_map const & other)
+        {
+            if (this == &other)
+            {
+                return *this;
+            }
+            clear();
+            if constexpr (std::allocator_traits<Allocator>::propagate_on_container_copy_assignment::value)
+            {
+                static_cast<Allocator&>(*this) = static_cast<Allocator const&>(other);
+            }
+            static_cast<Compare&>(*this) = static_cast<Compare const&>(other);
+            append_all(other);
+            return *this;
+        }
+
+        btree_map & operator=(btree_map && other) noexcept(std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value || std::allocator_traits<Allocator>::is_always_equal::value)
+        {
+            if (this == &other)
+            {
+                return *this;
+            }
+            clear();
+            static_cast<Compare&>(*this) = std::move(static_cast<Compare&>(other));
+            if constexpr (std::allocator_traits<Allocator>::propagate_on_container_move_assignment::value)
+            {
+                static_cast<Allocator&>(*this) = std::move(static_cast<Allocator&>(other));
+                steal(other);
+            }
+            else if constexpr (std::allocator_traits<Allocator>::is_always_equal::value)
+            {
+                steal(other);
+            }
+            else
+            {
+                if (get_allocator() == other.get_allocator())
+                {
+                    steal(other);
+                }
+                else
+                {
+                    for (auto & x : other)
+                    {
+                        emplace_hint(end(), std::move(const_cast<K&>(x.first)), std::move(x.second));
+                    }
+                    other.clear();
+                }
+            }
+            return *this;
+        }
+
+        btree_map & operator=(std::initializer_list<value_type> init)
+        {
+            clear();
+            insert(init.begin(), init.end());
+            return *this;
+        }
+
+        Allocator get_allocator() const
+        {
+            return static_cast<Allocator const &>(*this);
+        }
+
+        Compare key_comp() const
+        {
+            return static_cast<Compare const &>(*this);
+        }
+
+        iterator begin() noexcept
+        {
+            return iterator(m_first, 0);
+        }
+
+        const_iterator begin() const noexcept
+        {
+            return const_iterator(m_first, 0);
+        }
+
+        const_iterator cbegin() const noexcept
+        {
+            return begin();
+        }
+
+        iterator end() noexcept
+        {
+            return iterator(m_last, m_last != nullptr ? m_last->m_count : 0);
+        }
+
+        const_iterator end() const noexcept
+        {
+            return const_iterator(m_last, m_last != nullptr ? m_last->m_count : 0);
+        }
+
+        const_iterator cend() const noexcept
+        {
+            return end();
+        }
+
+        reverse_iterator rbegin() noexcept
+        {
+            return reverse_iterator(end());
+        }
+
+        const_reverse_iterator rbegin() const noexcept
+        {
+            return const_reverse_iterator(end());
+        }
+
+        reverse_iterator rend() noexcept
+        {
+            return reverse_iterator(begin());
+        }
+
+        const_reverse_iterator rend() const noexcept
+        {
+            return const_reverse_iterator(begin());
+        }
+
+        bool empty() const noexcept
+        {
+            return m_size == 0;
+        }
+
+        size_type size() const noexcept
+        {
+            return m_size;
+        }
+
+        size_type max_size() const noexcept
+        {
+            return static_cast<size_type>(std::numeric_limits<difference_type>::max()) / sizeof(value_type);
+        }
+
+        void clear() noexcept
+        {
+            if (m_root != nullptr)
+            {
+                destroy_subtree(m_root);
+            }
+            m_root = nullptr;
+            m_first = nullptr;
+            m_last = nullptr;
+            m_size = 0;
+        }
+
+        std::pair<iterator, bool> insert(value_type const & value)
+        {
+            return emplace_unique(value.first, value);
+        }
+
+        std::pair<iterator, bool> insert(value_type && value)
+        {
+            return emplace_unique(value.first, std::move(value));
+        }
+
+        template <typename P, typename = std::enable_if_t< std::is_constructible_v<value_type, P&&> > >
+        std::pair<iterator, bool> insert(P && value)
+        {
+            return emplace(std::forward<P>(value));
+        }
+
+        iterator insert(const_iterator hint, value_type const & value)
+        {
+            return emplace_hint(hint, value);
+        }
+
+        template <typename InputIt>
+        void insert(InputIt first, InputIt last)
+        {
+            for (; first != last; ++first)
+            {
+                emplace_hint(end(), *first);
+            }
+        }
+
+        void insert(std::initializer_list<value_type> init)
+        {
+            insert(init.begin(), init.end());
+        }
+
+        template <typename ... Ts>
+        std::pair<iterator, bool> emplace(Ts && ... ts)
+        {
+            slot_type v_value(std::forward<Ts>(ts)...);
+            auto [v_leaf, v_index] = leaf_lower_bound(v_value.first);
+            if (v_leaf != nullptr && v_index != v_leaf->m_count && !less(v_value.first, v_leaf->key(v_index)))
+            {
+                return {iterator(v_leaf, v_index), false};
+            }
+            return {insert_at(v_leaf, v_index, v_value), true};
+        }
+
+        /** Like emplace, but appends in O(1) amortized without searching when hint is end() and the key is greater
+         * than every key in the map.
+         */
+        template <typename ... Ts>
+        iterator emplace_hint(const_iterator hint, Ts && ... ts)
+        {
+            if (hint != cend() || m_last == nullptr)
+            {
+                return emplace(std::forward<Ts>(ts)...).first;
+            }
+            slot_type v_value(std::forward<Ts>(ts)...);
+            if (!less(m_last->key(m_last->m_count - 1u), v_value.first))
+            {
+                return emplace(std::move(v_value)).first;
+            }
+            return insert_at(m_last, m_last->m_count, v_value);
+        }
+
+        template <typename ... Ts>
+        std::pair<iterator, bool> try_emplace(K const & key, Ts && ... ts)
+        {
+            return emplace_unique(key, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Ts>(ts)...));
+        }
+
+        template <typename ... Ts>
+        std::pair<iterator, bool> try_emplace(K && key, Ts && ... ts)
+        {
+            return emplace_unique(key, std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Ts>(ts)...));
+        }
+
+        template <typename M>
+        std::pair<iterator, bool> insert_or_assign(K const & key, M && value)
+        {
+            auto v_result = try_emplace(key, std::forward<M>(value));
+            if (!v_result.second)
+            {
+                v_result.first->second = std::forward<M>(value);
+            }
+            return v_result;
+        }
+
+        template <typename M>
+        std::pair<iterator, bool> insert_or_assign(K && key, M && value)
+        {
+            auto v_result = try_emplace(std::move(key), std::forward<M>(value));
+            if (!v_result.second)
+            {
+                v_result.first->second = std::forward<M>(value);
+            }
+            return v_result;
+        }
+
+        T & operator[](K const & key)
+        {
+            return try_emplace(key).first->second;
+        }
+
+        T & operator[](K && key)
+        {
+            return try_emplace(std::move(key)).first->second;
+        }
+
+        T & at(K const & key)
+        {
+            iterator v_it = find(key);
+            if (v_it == end())
+            {
+                throw std::out_of_range("btree_map::at");
+            }
+            return v_it->second;
+        }
+
+        T const & at(K const & key) const
+        {
+            const_iterator v_it = find(key);
+            if (v_it == end())
+            {
+                throw std::out_of_range("btree_map::at");
+            }
+            return v_it->second;
+        }
+
+        iterator find(K const & key)
+        {
+            auto [v_leaf, v_index] = leaf_lower_bound(key);
+            if (v_leaf == nullptr || v_index == v_leaf->m_count || less(key, v_leaf->key(v_index)))
+            {
+                return end();
+            }
+            return iterator(v_leaf, v_index);
+        }
+
+        const_iterator find(K const & key) const
+        {
+            return const_cast<btree_map*>(this)->find(key);
+        }
+
+        bool contains(K const & key) const
+        {
+            return find(key) != end();
+        }
+
+        size_type count(K const & key) const
+        {
+            return contains(key) ? 1 : 0;
+        }
+
+        iterator lower_bound(K const & key)
+        {
+            auto [v_leaf, v_index] = leaf_lower_bound(key);
+            return normalize(v_leaf, v_index);
+        }
+
+        const_iterator lower_bound(K const & key) const
+        {
+            return const_cast<btree_map*>(this)->lower_bound(key);
+        }
+
+        iterator upper_bound(K const & key)
+        {
+            leaf * v_leaf = find_leaf(key);
+            if (v_leaf == nullptr)
+            {
+                return end();
+            }
+            return normalize(v_leaf, search::template count_leaf<true>(*this, *v_leaf, key));
+        }
+
+        const_iterator upper_bound(K const & key) const
+        {
+            return const_cast<btree_map*>(this)->upper_bound(key);
+        }
+
+        std::pair<iterator, iterator> equal_range(K const & key)
+        {
+            iterator v_it = lower_bound(key);
+            if (v_it != end() && !less(key, v_it->first))
+            {
+                return {v_it, std::next(v_it)};
+            }
+            return {v_it, v_it};
+        }
+
+        std::pair<const_iterator, const_iterator> equal_range(K const & key) const
+        {
+            auto [v_first, v_last] = const_cast<btree_map*>(this)->equal_range(key);
+            return {v_first, v_last};
+        }
+
+        /** Erases the element at pos and returns an iterator to the element after it.
+         */
+        iterator erase(const_iterator pos)
+        {
+            return erase_at(const_cast<leaf*>(pos.m_leaf), pos.m_index);
+        }
+
+        iterator erase(iterator pos)
+        {
+            return erase(const_iterator(pos));
+        }
+
+        iterator erase(const_iterator first, const_iterator last)
+        {
+            // Erasing invalidates last, so count the elements first.
+            std::size_t v_count = static_cast<std::size_t>(std::distance(first, last));
+            iterator v_it(const_cast<leaf*>(first.m_leaf), first.m_index);
+            for (std::size_t i = 0; i != v_count; i++)
+            {
+                v_it = erase(v_it);
+            }
+            return v_it;
+        }
+
+        size_type erase(K const & key)
+        {
+            iterator v_it = find(key);
+            if (v_it == end())
+            {
+                return 0;
+            }
+            erase(v_it);
+            return 1;
+        }
+
+        void swap(btree_map & other) noexcept
+        {
+            using std::swap;
+            if constexpr (std::allocator_traits<Allocator>::propagate_on_container_swap::value)
+            {
+                swap(static_cast<Allocator&>(*this), static_cast<Allocator&>(other));
+            }
+            else
+            {
+                RPNX_ASSERT(get_allocator() == other.get_allocator());
+            }
+            swap(static_cast<Compare&>(*this), static_cast<Compare&>(other));
+            swap(m_root, other.m_root);
+            swap(m_first, other.m_first);
+            swap(m_last, other.m_last);
+            swap(m_size, other.m_size);
+        }
+
+        /** The number of levels in the tree, 0 when empty.
+         */
+        size_type height() const noexcept
+        {
+            size_type v_height = 0;
+            for (node const * n = m_root; n != nullptr; n = n->m_leaf ? nullptr : static_cast<internal const *>(n)->m_children[0])
+            {
+                v_height++;
+            }
+            return v_height;
+        }
+
+        /** Checks the structural invariants: key order and separators, node fill, parent and sibling links,
+         * uniform leaf depth and the element count. O(n), intended for tests.
+         */
+        bool is_valid() const
+        {
+            if (m_root == nullptr)
+            {
+                return m_first == nullptr && m_last == nullptr && m_size == 0;
+            }
+            if (m_root->m_parent != nullptr)
+            {
+                return false;
+            }
+            std::size_t v_depth = 0;
+            std::size_t v_count = 0;
+            leaf const * v_previous = nullptr;
+            if (!check_node(m_root, nullptr, nullptr, 1, v_depth, v_count, v_previous))
+            {
+                return false;
+            }
+            return v_count == m_size && v_previous == m_last && m_first->m_prev == nullptr;
+        }
+
+        friend bool operator==(btree_map const & a, btree_map const & b)
+        {
+            return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin());
+        }
+
+        friend bool operator!=(btree_map const & a, btree_map const & b)
+        {
+            return !(a == b);
+        }
+
+      private:
+        bool less(K const & a, K const & b) const
+        {
+            return static_cast<Compare const&>(*this)(a, b);
+        }
+
+        static leaf * leftmost_leaf(node * n) noexcept
+        {
+            while (!n->m_leaf)
+            {
+                n = static_cast<internal *>(n)->m_children[0];
+            }
+            return static_cast<leaf *>(n);
+        }
+
+        leaf * find_leaf(K const & key) const
+        {
+            node * n = m_root;
+            if (n == nullptr)
+            {
+                return nullptr;
+            }
+            while (!n->m_leaf)
+            {
+                internal * v_internal = static_cast<internal *>(n);
+                n = v_internal->m_children[search::template count<true>(*this, v_internal->keys(), v_internal->m_count, key)];
+            }
+            return static_cast<leaf *>(n);
+        }
+
+        /** Returns the leaf key belongs in and the index of the first value not less than it, which may be
+         * one past the leaf's last value.
+         */
+        std::pair<leaf *, std::size_t> leaf_lower_bound(K const & key) const
+        {
+            leaf * v_leaf = find_leaf(key);
+            if (v_leaf == nullptr)
+            {
+                return {nullptr, 0};
+            }
+            return {v_leaf, search::template count_leaf<false>(*this, *v_leaf, key)};
+        }
+
+        /** Moves a position one past the end of a leaf to the start of the next leaf.
+         */
+        static iterator normalize(leaf * l, std::size_t index) noexcept
+        {
+            if (l != nullptr && index == l->m_count && l->m_next != nullptr)
+            {
+                return iterator(l->m_next, 0);
+            }
+            return iterator(l, index);
+        }
+
+        template <typename ... Ts>
+        std::pair<iterator, bool> emplace_unique(K const & key, Ts && ... ts)
+        {
+            auto [v_leaf, v_index] = leaf_lower_bound(key);
+            if (v_leaf != nullptr && v_index != v_leaf->m_count && !less(key, v_leaf->key(v_index)))
+            {
+                return {iterator(v_leaf, v_index), false};
+            }
+            slot_type v_value(std::forward<Ts>(ts)...);
+            return {insert_at(v_leaf, v_index, v_value), true};
+        }
+
+        /** Moves count slots starting at from to to, which may overlap in either direction.
+         */
+        static void move_slots(leaf * from_leaf, std::size_t from, leaf * to_leaf, std::size_t to, std::size_t count) noexcept
+        {
+            if (from_leaf == to_leaf && to > from)
+            {
+                for (std::size_t i = count; i != 0; i--)
+                {
+                    relocate(from_leaf->slot(from + i - 1), to_leaf->slot(to + i - 1));
+                }
+            }
+            else
+            {
+                for (std::size_t i = 0; i != count; i++)
+                {
+                    relocate(from_leaf->slot(from + i), to_leaf->slot(to + i));
+                }
+            }
+        }
+
+        template <typename U>
+        static void relocate(U * from, U * to) noexcept
+        {
+            ::new (static_cast<void*>(to)) U(std::move(*from));
+            from->~U();
+        }
+
+        static void move_keys(internal * from_node, std::size_t from, internal * to_node, std::size_t to, std::size_t count) noexcept
+        {
+            if (from_node == to_node && to > from)
+            {
+                for (std::size_t i = count; i != 0; i--)
+                {
+                    relocate(from_node->keys() + from + i - 1, to_node->keys() + to + i - 1);
+                }
+            }
+            else
+            {
+                for (std::size_t i = 0; i != count; i++)
+                {
+                    relocate(from_node->keys() + from + i, to_node->keys() + to + i);
+                }
+            }
+        }
+
+        static void move_children(internal * from_node, std::size_t from, internal * to_node, std::size_t to, std::size_t count) noexcept
+        {
+            if (from_node == to_node && to > from)
+            {
+                std::copy_backward(from_node->m_children.begin() + from, from_node->m_children.begin() + from + count, to_node->m_children.begin() + to + count);
+            }
+            else
+            {
+                std::copy(from_node->m_children.begin() + from, from_node->m_children.begin() + from + count, to_node->m_children.begin() + to);
+            }
+            if (from_node != to_node)
+            {
+                for (std::size_t i = 0; i != count; i++)
+                {
+                    to_node->m_children[to + i]->m_parent = to_node;
+                }
+            }
+        }
+
+        /** Inserts value at index of l, which is where lower_bound placed its key.
+         * Every node a split could need is allocated up front, so nothing after that can throw.
+         */
+        iterator insert_at(leaf * l, std::size_t index, slot_type & value)
+        {
+            if (l == nullptr)
+            {
+                leaf * v_leaf = create_leaf();
+                ::new (static_cast<void*>(v_leaf->slot(0))) slot_type(std::move(value));
+                v_leaf->m_count = 1;
+                m_root = m_first = m_last = v_leaf;
+                m_size = 1;
+                return iterator(v_leaf, 0);
+            }
+
+            if (l->m_count < Fanout)
+            {
+                move_slots(l, index, l, index + 1, l->m_count - index);
+                ::new (static_cast<void*>(l->slot(index))) slot_type(std::move(value));
+                l->m_count++;
+                m_size++;
+                return iterator(l, index);
+            }
+
+            // Appending to the last leaf or prepending to the first moves nothing, so sorted input fills leaves.
+            std::size_t v_split = Fanout / 2;
+            if (l == m_last && index == Fanout)
+            {
+                v_split = Fanout;
+            }
+            else if (l == m_first && index == 0)
+            {
+                v_split = 0;
+            }
+            K v_separator(v_split < Fanout ? l->key(v_split) : value.first);
+
+            std::array<internal *, max_height> v_spares {};
+            std::size_t v_spare_count = 0;
+            leaf * v_right = create_leaf();
+            try
+            {
+                internal * v_parent = l->m_parent;
+                while (v_parent != nullptr && v_parent->m_count == Fanout - 1)
+                {
+                    v_spares[v_spare_count++] = create_internal();
+                    v_parent = v_parent->m_parent;
+                }
+                if (v_parent == nullptr)
+                {
+                    v_spares[v_spare_count++] = create_internal();
+                }
+            }
+            catch (...)
+            {
+                for (std::size_t i = 0; i != v_spare_count; i++)
+                {
+                    delete_internal(v_spares[i]);
+                }
+                delete_leaf(v_right);
+                throw;
+            }
+
+            move_slots(l, v_split, v_right, 0, Fanout - v_split);
+            v_right->m_count = static_cast<std::uint16_t>(Fanout - v_split);
+            l->m_count = static_cast<std::uint16_t>(v_split);
+
+            v_right->m_prev = l;
+            v_right->m_next = l->m_next;
+            if (l->m_next != nullptr)
+            {
+                l->m_next->m_prev = v_right;
+            }
+            else
+            {
+                m_last = v_right;
+            }
+            l->m_next = v_right;
+
+            iterator v_result;
+            if (index < v_split || (index == v_split && v_split < Fanout))
+            {
+                move_slots(l, index, l, index + 1, l->m_count - index);
+                ::new (static_cast<void*>(l->slot(index))) slot_type(std::move(value));
+                l->m_count++;
+                v_result = iterator(l, index);
+            }
+            else
+            {
+                std::size_t v_index = index - v_split;
+                move_slots(v_right, v_index, v_right, v_index + 1, v_right->m_count - v_index);
+                ::new (static_cast<void*>(v_right->slot(v_index))) slot_type(std::move(value));
+                v_right->m_count++;
+                v_result = iterator(v_right, v_index);
+            }
+            m_size++;
+
+            insert_into_parent(l, std::move(v_separator), v_right, v_spares.data());
+            return v_result;
+        }
+
+        /** Adds right as the sibling after left, separated by separator, splitting ancestors as needed using the
+         * preallocated spares.
+         */
+        void insert_into_parent(node * left, K && separator, node * right, internal ** spares) noexcept
+        {
+            internal * v_parent = left->m_parent;
+            if (v_parent == nullptr)
+            {
+                internal * v_root = *spares;
+                ::new (static_cast<void*>(v_root->keys())) K(std::move(separator));
+                v_root->m_children[0] = left;
+                v_root->m_children[1] = right;
+                v_root->m_count = 1;
+                left->m_parent = v_root;
+                right->m_parent = v_root;
+                m_root = v_root;
+                return;
+            }
+
+            std::size_t v_position = v_parent->child_index(left);
+            move_keys(v_parent, v_position, v_parent, v_position + 1, v_parent->m_count - v_position);
+            move_children(v_parent, v_position + 1, v_parent, v_position + 2, v_parent->m_count - v_position);
+            ::new (static_cast<void*>(v_parent->keys() + v_position)) K(std::move(separator));
+            v_parent->m_children[v_position + 1] = right;
+            right->m_parent = v_parent;
+            v_parent->m_count++;
+
+            if (v_parent->m_count < Fanout)
+            {
+                return;
+            }
+
+            // Overflowed to Fanout keys and Fanout + 1 children: keep half, push the middle key up.
+            internal * v_sibling = *spares++;
+            std::size_t v_left_children = (Fanout + 1) / 2;
+            std::size_t v_right_keys = Fanout - v_left_children;
+            move_keys(v_parent, v_left_children, v_sibling, 0, v_right_keys);
+            move_children(v_parent, v_left_children, v_sibling, 0, v_right_keys + 1);
+            v_sibling->m_count = static_cast<std::uint16_t>(v_right_keys);
+
+            K * v_middle_ptr = v_parent->keys() + v_left_children - 1;
+            K v_middle(std::move(*v_middle_ptr));
+            v_middle_ptr->~K();
+            v_parent->m_count = static_cast<std::uint16_t>(v_left_children - 1);
+
+            insert_into_parent(v_parent, std::move(v_middle), v_sibling, spares);
+        }
+
+        iterator erase_at(leaf * l, std::size_t index)
+        {
+            // The separators borrowing could need are copied before anything changes, so that erase either
+            // succeeds or throws with the map unchanged.
+            internal * v_parent = l->m_parent;
+            std::size_t v_position = 0;
+            leaf * v_left = nullptr;
+            leaf * v_right = nullptr;
+            std::optional<K> v_separator;
+            bool v_underflow = v_parent != nullptr && l->m_count - 1u < min_fill;
+            if (v_underflow)
+            {
+                v_position = v_parent->child_index(l);
+                v_left = v_position > 0 ? static_cast<leaf *>(v_parent->m_children[v_position - 1]) : nullptr;
+                v_right = v_position < v_parent->m_count ? static_cast<leaf *>(v_parent->m_children[v_position + 1]) : nullptr;
+                if (v_left != nullptr && v_left->m_count > min_fill)
+                {
+                    v_separator.emplace(v_left->key(v_left->m_count - 1u));
+                }
+                else if (v_right != nullptr && v_right->m_count > min_fill)
+                {
+                    v_separator.emplace(v_right->key(1));
+                }
+            }
+
+            l->slot(index)->~slot_type();
+            move_slots(l, index + 1, l, index, l->m_count - index - 1u);
+            l->m_count--;
+            m_size--;
+
+            if (l->m_count == 0 && v_parent == nullptr)
+            {
+                delete_leaf(l);
+                m_root = m_first = m_last = nullptr;
+                return end();
+            }
+            if (!v_underflow)
+            {
+                return normalize(l, index);
+            }
+
+            if (v_left != nullptr && v_left->m_count > min_fill)
+            {
+                move_slots(l, 0, l, 1, l->m_count);
+                move_slots(v_left, v_left->m_count - 1u, l, 0, 1);
+                v_left->m_count--;
+                l->m_count++;
+                v_parent->keys()[v_position - 1] = std::move(*v_separator);
+                return normalize(l, index + 1);
+            }
+            if (v_right != nullptr && v_right->m_count > min_fill)
+            {
+                move_slots(v_right, 0, l, l->m_count, 1);
+                move_slots(v_right, 1, v_right, 0, v_right->m_count - 1u);
+                v_right->m_count--;
+                l->m_count++;
+                v_parent->keys()[v_position] = std::move(*v_separator);
+                return normalize(l, index);
+            }
+
+            if (v_left != nullptr)
+            {
+                std::size_t v_index = v_left->m_count + index;
+                merge_leaves(v_left, l, v_position - 1);
+                rebalance_internal(v_parent);
+                return normalize(v_left, v_index);
+            }
+            merge_leaves(l, v_right, v_position);
+            rebalance_internal(v_parent);
+            return normalize(l, index);
+        }
+
+        /** Moves every value of right into left, which precede it under parent key separator_index, and frees right.
+         */
+        void merge_leaves(leaf * left, leaf * right, std::size_t separator_index) noexcept
+        {
+            move_slots(right, 0, left, left->m_count, right->m_count);
+            left->m_count = static_cast<std::uint16_t>(left->m_count + right->m_count);
+            left->m_next = right->m_next;
+            if (right->m_next != nullptr)
+            {
+                right->m_next->m_prev = left;
+            }
+            else
+            {
+                m_last = left;
+            }
+            remove_from_parent(left->m_parent, separator_index);
+            delete_leaf(right);
+        }
+
+        /** Removes key i and child i + 1 of n.
+         */
+        static void remove_from_parent(internal * n, std::size_t i) noexcept
+        {
+            n->keys()[i].~K();
+            move_keys(n, i + 1, n, i, n->m_count - i - 1u);
+            move_children(n, i + 2, n, i + 1, n->m_count - i - 1u);
+            n->m_count--;
+        }
+
+        /** Restores the fill of n after it lost a child, walking up as merges propagate.
+         */
+        void rebalance_internal(internal * n) noexcept
+        {
+            while (true)
+            {
+                if (n == m_root)
+                {
+                    if (n->m_count == 0)
+                    {
+                        m_root = n->m_children[0];
+                        m_root->m_parent = nullptr;
+                        delete_internal(n);
+                    }
+                    return;
+                }
+                if (n->m_count + 1u >= min_fill)
+                {
+                    return;
+                }
+
+                internal * v_parent = n->m_parent;
+                std::size_t v_position = v_parent->child_index(n);
+                internal * v_left = v_position > 0 ? static_cast<internal *>(v_parent->m_children[v_position - 1]) : nullptr;
+                internal * v_right = v_position < v_parent->m_count ? static_cast<internal *>(v_parent->m_children[v_position + 1]) : nullptr;
+
+                if (v_left != nullptr && v_left->m_count + 1u > min_fill)
+                {
+                    // Rotate the left sibling's last child through the parent.
+                    move_keys(n, 0, n, 1, n->m_count);
+                    move_children(n, 0, n, 1, n->m_count + 1u);
+                    relocate(v_parent->keys() + v_position - 1, n->keys());
+                    relocate(v_left->keys() + v_left->m_count - 1, v_parent->keys() + v_position - 1);
+                    move_children(v_left, v_left->m_count, n, 0, 1);
+                    v_left->m_count--;
+                    n->m_count++;
+                    return;
+                }
+                if (v_right != nullptr && v_right->m_count + 1u > min_fill)
+                {
+                    relocate(v_parent->keys() + v_position, n->keys() + n->m_count);
+                    relocate(v_right->keys(), v_parent->keys() + v_position);
+                    move_children(v_right, 0, n, n->m_count + 1u, 1);
+                    move_keys(v_right, 1, v_right, 0, v_right->m_count - 1u);
+                    move_children(v_right, 1, v_right, 0, v_right->m_count);
+                    v_right->m_count--;
+                    n->m_count++;
+                    return;
+                }
+
+                if (v_left != nullptr)
+                {
+                    merge_internal(v_left, n, v_position - 1);
+                }
+                else
+                {
+                    merge_internal(n, v_right, v_position);
+                }
+                n = v_parent;
+            }
+        }
+
+        /** Moves the separator between left and right and all of right into left, and frees right.
+         */
+        void merge_internal(internal * left, internal * right, std::size_t separator_index) noexcept
+        {
+            internal * v_parent = left->m_parent;
+            relocate(v_parent->keys() + separator_index, left->keys() + left->m_count);
+            move_keys(right, 0, left, left->m_count + 1u, right->m_count);
+            move_children(right, 0, left, left->m_count + 1u, right->m_count + 1u);
+            left->m_count = static_cast<std::uint16_t>(left->m_count + 1u + right->m_count);
+            // The separator was relocated already, so shift over it rather than destroying it again.
+            move_keys(v_parent, separator_index + 1, v_parent, separator_index, v_parent->m_count - separator_index - 1u);
+            move_children(v_parent, separator_index + 2, v_parent, separator_index + 1, v_parent->m_count - separator_index - 1u);
+            v_parent->m_count--;
+            right->m_count = 0;
+            delete_internal(right);
+        }
+
+        /** Appends every value of other, which is sorted, filling each leaf.
+         */
+        void append_all(btree_map const & other)
+        {
+            for (auto const & x : other)
+            {
+                slot_type v_value(x);
+                insert_at(m_last, m_last != nullptr ? m_last->m_count : 0, v_value);
+            }
+        }
+
+        bool check_node(node const * n, K const * low, K const * high, std::size_t depth, std::size_t & leaf_depth, std::size_t & count, leaf const * & previous) const
+        {
+            if (n->m_count == 0)
+            {
+                return false;
+            }
+            if (n->m_leaf)
+            {
+                leaf const * l = static_cast<leaf const *>(n);
+                if (leaf_depth == 0)
+                {
+                    leaf_depth = depth;
+                    if (l != m_first)
+                    {
+                        return false;
+                    }
+                }
+                if (depth != leaf_depth || l->m_prev != previous || (previous != nullptr && previous->m_next != l))
+                {
+                    return false;
+                }
+                for (std::size_t i = 0; i < l->m_count; i++)
+                {
+                    if ((i > 0 && !less(l->key(i - 1), l->key(i))) || (low != nullptr && less(l->key(i), *low)) || (high != nullptr && !less(l->key(i), *high)))
+                    {
+                        return false;
+                    }
+                }
+                count += l->m_count;
+                previous = l;
+                return true;
+            }
+
+            internal const * v_internal = static_cast<internal const *>(n);
+            if (v_internal->m_count >= Fanout)
+            {
+                return false;
+            }
+            for (std::size_t i = 0; i <= v_internal->m_count; i++)
+            {
+                node const * v_child = v_internal->m_children[i];
+                K const * v_low = i > 0 ? v_internal->keys() + i - 1 : low;
+                K const * v_high = i < v_internal->m_count ? v_internal->keys() + i : high;
+                if (v_child->m_parent != v_internal || (v_low != nullptr && v_high != nullptr && !less(*v_low, *v_high)))
+                {
+                    return false;
+                }
+                if (!check_node(v_child, v_low, v_high, depth + 1, leaf_depth, count, previous))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        void steal(btree_map & other) noexcept
+        {
+            m_root = other.m_root;
+            m_first = other.m_first;
+            m_last = other.m_last;
+            m_size = other.m_size;
+            other.m_root = nullptr;
+            other.m_first = nullptr;
+            other.m_last = nullptr;
+            other.m_size = 0;
+        }
+
+        void destroy_subtree(node * n) noexcept
+        {
+            if (n->m_leaf)
+            {
+                leaf * l = static_cast<leaf *>(n);
+                for (std::size_t i = 0; i < l->m_count; i++)
+                {
+                    l->slot(i)->~slot_type();
+                }
+                delete_leaf(l);
+                return;
+            }
+            internal * v_internal = static_cast<internal *>(n);
+            for (std::size_t i = 0; i <= v_internal->m_count; i++)
+            {
+                destroy_subtree(v_internal->m_children[i]);
+            }
+            delete_internal(v_internal);
+        }
+
+        leaf_allocator get_leaf_allocator() const noexcept
+        {
+            return leaf_allocator(get_allocator());
+        }
+
+        leaf * create_leaf()
+        {
+            leaf_allocator v_alloc = get_leaf_allocator();
+            leaf * v_leaf = leaf_allocator_traits::allocate(v_alloc, 1);
+            return ::new (static_cast<void*>(v_leaf)) leaf();
+        }
+
+        void delete_leaf(leaf * l) noexcept
+        {
+            leaf_allocator v_alloc = get_leaf_allocator();
+            l->~leaf();
+            leaf_allocator_traits::deallocate(v_alloc, l, 1);
+        }
+
+        internal * create_internal()
+        {
+            internal_allocator v_alloc(get_allocator());
+            internal * v_internal = internal_allocator_traits::allocate(v_alloc, 1);
+            return ::new (static_cast<void*>(v_internal)) internal();
+        }
+
+        void delete_internal(internal * n) noexcept
+        {
+            for (std::size_t i = 0; i < n->m_count; i++)
+            {
+                n->keys()[i].~K();
+            }
+            internal_allocator v_alloc(get_allocator());
+            n->~internal();
+            internal_allocator_traits::deallocate(v_alloc, n, 1);
+        }
+
+      private:
+        node * m_root = nullptr;
+        leaf * m_first = nullptr;
+        leaf * m_last = nullptr;
+        size_type m_size = 0;
+    };
+
+    template <typename K, typename T, typename Compare, typename Allocator, std::size_t Fanout>
+    void swap(btree_map<K, T, Compare, Allocator, Fanout> & a, btree_map<K, T, Compare, Allocator, Fanout> & b) noexcept
+    {
+        a.swap(b);
+    }
+}
+
+namespace rpnx
+{
+    /*
+      btree_map serializes exactly like std::map: a uintany count followed by each key and value in order.
+      Deserializing appends the sorted input, so it takes O(n) rather than O(n log n).
+     */
+    template < typename K, typename T, typename C, typename A, std::size_t N >
+    struct serial_traits< experimental::btree_map< K, T, C, A, N > >
+    {
+        static inline constexpr bool has_fixed_serial_size()
+        {
+            return false;
+        }
+
+        static inline std::size_t serial_size(experimental::btree_map< K, T, C, A, N > const& value)
+        {
+            return map_serial_traits< K, T >::serial_size(value);
+        }
+    };
+
+    template < typename K, typename T, typename C, typename A, std::size_t N, typename Iterator >
+    struct synchronous_iterator_serial_traits< experimental::btree_map< K, T, C, A, N >, Iterator >
+    {
+        static inline auto serialize(experimental::btree_map< K, T, C, A, N > const& val, Iterator out) -> Iterator
+        {
+            out = synchronous_iterator_serial_traits< uintany, Iterator >::serialize(val.size(), out);
+            for (auto const& x : val)
+            {
+                out = synchronous_iterator_serial_traits< std::pair< K const, T >, Iterator >::serialize(x, out);
+            }
+            return out;
+        }
+
+        static inline auto deserialize(experimental::btree_map< K, T, C, A, N >& val, Iterator in) -> Iterator
+        {
+            val.clear();
+            std::size_t sz = 0;
+            in = synchronous_iterator_serial_traits< uintany, Iterator >::deserialize(sz, in);
+            for (std::size_t i = 0; i != sz; i++)
+            {
+                std::pair< K, T > t;
+                in = synchronous_iterator_serial_traits< std::pair< K, T >, Iterator >::deserialize(t, in);
+                val.emplace_hint(val.end(), std::move(t));
+            }
+            return in;
+        }
+    };
+
+    template < typename K, typename T, typename C, typename A, std::size_t N, typename Generator >
+    struct synchronous_generator_serial_traits< experimental::btree_map< K, T, C, A, N >, Generator >
+    {
+        using value_type = std::pair< K const, T >;
+
+        static inline void serialize(experimental::btree_map< K, T, C, A, N > const& val, Generator g)
+        {
+            if constexpr (serial_traits< value_type >::has_fixed_serial_size())
+            {
+                auto it = g(serial_traits< experimental::btree_map< K, T, C, A, N > >::serial_size(val));
+                it = synchronous_iterator_serial_traits< uintany, decltype(it) >::serialize(val.size(), it);
+                for (auto const& x : val)
+                {
+                    it = synchronous_iterator_serial_traits< value_type, decltype(it) >::serialize(x, it);
+                }
+            }
+            else
+            {
+                auto it = g(serial_traits< uintany >::serial_size(val.size()));
+                it = synchronous_iterator_serial_traits< uintany, decltype(it) >::serialize(val.size(), it);
+                for (auto const& x : val)
+                {
+                    synchronous_generator_serial_traits< value_type, Generator >::serialize(x, g);
+                }
+            }
+        }
+
+        static inline void deserialize(experimental::btree_map< K, T, C, A, N >& val, Generator g)
+        {
+            val.clear();
+            std::size_t sz = 0;
+            synchronous_generator_serial_traits< uintany, Generator >::deserialize(sz, g);
+            if constexpr (serial_traits< value_type >::has_fixed_serial_size())
+            {
+                auto it = g(sz * serial_traits< value_type >::fixed_serial_size());
+                for (std::size_t i = 0; i != sz; i++)
+                {
+                    std::pair< K, T > t;
+                    it = synchronous_iterator_serial_traits< std::pair< K, T >, decltype(it) >::deserialize(t, it);
+                    val.emplace_hint(val.end(), std::move(t));
+                }
+            }
+            else
+            {
+                for (std::size_t i = 0; i != sz; i++)
+                {
+                    std::pair< K, T > t;
+                    synchronous_generator_serial_traits< std::pair< K, T >, Generator >::deserialize(t, g);
+                    val.emplace_hint(val.end(), std::move(t));
+                }
+            }
+        }
+    };
+} // namespace rpnx
+
+#endif // RPNXCORE_BTREE_MAP_HPP
@@ -9,25 +9,71 @@
 #include <list>
 #include <deque>
 #include <condition_variable>
+#include <mutex>
 
 
 namespace rpnx::experimental
 {
-    template <typename T>
+    /** A blocking multi-producer multi-consumer queue.
+     * Values are copied into storage obtained from Allocator, which is used concurrently by
+     * submitting and receiving threads and therefore must be thread safe (std::allocator and
+     * rpnx::experimental::pool_allocator are).
+     */
+    template <typename T, typename Allocator = std::allocator<T>>
     class channel
+        : private Allocator
     {
+        using allocator_traits = std::allocator_traits<Allocator>;
+
         //std::array<std::atomic<T*>, 64> m_arry;
         std::mutex m_mtx;
         std::condition_variable m_cond;
         std::deque<T*> m_queue;
 
+        void delete_value(T* value) noexcept
+        {
+            allocator_traits::destroy(static_cast<Allocator&>(*this), value);
+            allocator_traits::deallocate(static_cast<Allocator&>(*this), value, 1);
+        }
+
       public:
+        using allocator_type = Allocator;
+
         channel()
         {}
 
+        explicit channel(Allocator const & alloc)
+        : Allocator(alloc)
+        {}
+
+        channel(channel<T, Allocator> const&) = delete;
+        channel<T, Allocator>& operator=(channel<T, Allocator> const&) = delete;
+
+        ~channel()
+        {
+            for (T* value : m_queue)
+            {
+                delete_value(value);
+            }
+        }
+
+        Allocator get_allocator() const
+        {
+            return static_cast<Allocator const&>(*this);
+        }
+
         void submit(T value)
         {
-            T* copy = new T(std::move(value));
+            T* copy = allocator_traits::allocate(static_cast<Allocator&>(*this), 1);
+            try
+            {
+                allocator_traits::construct(static_cast<Allocator&>(*this), copy, std::move(value));
+            }
+            catch (...)
+            {
+                allocator_traits::deallocate(static_cast<Allocator&>(*this), copy, 1);
+                throw;
+            }
             try
             {
                 std::unique_lock v_lock(m_mtx);
@@ -35,7 +81,7 @@ namespace rpnx::experimental
             }
             catch (...)
             {
-                delete copy;
+                delete_value(copy);
                 throw;
             }
             m_cond.notify_all();
@@ -43,10 +89,15 @@ namespace rpnx::experimental
 
         T receive()
         {
-            std::unique_lock v_lock(m_mtx);
-            m_cond.wait(v_lock, [&]{ return ! m_queue.empty(); });
-            T result(std::move(m_queue.front()));
-            m_queue.pop_front();
+            T* value;
+            {
+                std::unique_lock v_lock(m_mtx);
+                m_cond.wait(v_lock, [&]{ return ! m_queue.empty(); });
+                value = m_queue.front();
+                m_queue.pop_front();
+            }
+            T result(std::move(*value));
+            delete_value(value);
             return result;
 
         }
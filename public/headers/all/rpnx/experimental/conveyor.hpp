@@ -5,23 +5,107 @@
 #ifndef RPNXCORE_CONVEYOR_HPP
 #define RPNXCORE_CONVEYOR_HPP
 
-#include <list>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <new>
+#include <type_traits>
+
+#include "rpnx/assert.hpp"
 
 namespace rpnx
 {
     namespace experimental
     {
+        /*
+          A bump arena for objects of type T.
+
+          Objects are constructed one after another in fixed size blocks. Each block starts with an inline header, so
+          the arena keeps no per-block bookkeeping outside of the blocks themselves. reset() destroys every object and
+          keeps the blocks for reuse, which makes it O(1) when T is trivially destructible, and makes subsequent use of
+          the arena allocation free until it grows beyond its previous high water mark. clear() additionally returns
+          all blocks to the allocator.
+         */
         template < typename T, typename Alloc = std::allocator< T > >
         class conveyor : private Alloc
         {
           public:
-            conveyor(Alloc const& alloc = Alloc()) : Alloc(alloc), m_block_allocs(alloc)
+            using value_type = T;
+            using allocator_type = Alloc;
+
+            static constexpr std::size_t default_block_size = 64 * 1024;
+
+          private:
+            struct block_header
             {
+                block_header* m_next;
+                std::size_t m_units;
+                std::size_t m_capacity;
+                std::size_t m_used;
+            };
+
+            using unit = std::max_align_t;
+            using unit_allocator = typename std::allocator_traits< Alloc >::template rebind_alloc< unit >;
+            using unit_allocator_traits = std::allocator_traits< unit_allocator >;
+
+            static_assert(alignof(T) <= alignof(unit), "Over-aligned types are not supported by conveyor");
+
+            static constexpr std::size_t header_units = (sizeof(block_header) + sizeof(unit) - 1) / sizeof(unit);
+
+          public:
+            explicit conveyor(Alloc const& alloc = Alloc()) : conveyor(default_block_size, alloc)
+            {
+            }
+
+            /** Creates a conveyor whose blocks are block_size bytes, including the block header.
+             * Blocks always have room for at least one T.
+             */
+            explicit conveyor(std::size_t block_size, Alloc const& alloc = Alloc()) : Alloc(alloc)
+            {
+                std::size_t v_payload = block_size > header_units * sizeof(unit) ? block_size - header_units * sizeof(unit) : 0;
+                m_block_capacity = v_payload / sizeof(T);
+                if (m_block_capacity == 0)
+                {
+                    m_block_capacity = 1;
+                }
+                m_block_units = header_units + (m_block_capacity * sizeof(T) + sizeof(unit) - 1) / sizeof(unit);
             }
 
             conveyor(conveyor< T, Alloc > const&) = delete;
 
+            conveyor(conveyor< T, Alloc >&& other) noexcept
+                : Alloc(static_cast< Alloc const& >(other)), m_current(other.m_current), m_oldest(other.m_oldest), m_free(other.m_free),
+                  m_large(other.m_large), m_block_capacity(other.m_block_capacity), m_block_units(other.m_block_units)
+            {
+                other.m_current = nullptr;
+                other.m_oldest = nullptr;
+                other.m_free = nullptr;
+                other.m_large = nullptr;
+            }
+
+            conveyor< T, Alloc >& operator=(conveyor< T, Alloc > const&) = delete;
+
+            conveyor< T, Alloc >& operator=(conveyor< T, Alloc >&& other) noexcept
+            {
+                if (this != &other)
+                {
+                    clear();
+                    static_cast< Alloc& >(*this) = static_cast< Alloc const& >(other);
+                    std::swap(m_current, other.m_current);
+                    std::swap(m_oldest, other.m_oldest);
+                    std::swap(m_free, other.m_free);
+                    std::swap(m_large, other.m_large);
+                    m_block_capacity = other.m_block_capacity;
+                    m_block_units = other.m_block_units;
+                }
+                return *this;
+            }
+
+            ~conveyor()
+            {
+                clear();
+            }
+
             template < typename... Ts >
             T* emplace(Ts&&... ts)
             {
@@ -31,109 +115,205 @@ namespace rpnx
                 }
 
                 T* position = get_current_position();
-                std::allocator_traits< Alloc >::construct(get_allocator(), position, std::forward< Ts >(ts)...);
+                std::allocator_traits< Alloc >::construct(allocator_ref(), position, std::forward< Ts >(ts)...);
                 advance_current_position();
 
                 return std::launder(position);
             }
 
-            void clear()
+            /** Returns uninitialized storage for n contiguous objects, aligned to at least alignment bytes.
+             * The storage is reclaimed by reset() or clear(); no destructors are run for it, so this is only
+             * available when T is trivially destructible. Requests that do not fit in a block get a dedicated
+             * block which is returned to the allocator on the next reset().
+             */
+            T* allocate(std::size_t n, std::size_t alignment = alignof(T))
             {
-                delete_everything();
-            }
+                static_assert(std::is_trivially_destructible_v< T >, "conveyor::allocate requires a trivially destructible T");
+                RPNX_ASSERT(alignment != 0 && (alignment & (alignment - 1)) == 0);
 
-          private:
-            void delete_everything()
-            {
-                while (have_block_allocated())
+                if (m_current != nullptr)
                 {
-                    while (current_block_has_object())
+                    if (T* v_result = bump(m_current, n, alignment))
                     {
-                        destroy_most_recent_object();
+                        return v_result;
                     }
-                    deallocate_current_block();
+                }
 
-                    if (have_deallocation_block())
+                if (n > m_block_capacity || (m_block_capacity - n) * sizeof(T) < alignment)
+                {
+                    return allocate_large(n, alignment);
+                }
+
+                make_more_storage();
+                T* v_result = bump(m_current, n, alignment);
+                RPNX_ASSERT(v_result != nullptr);
+                return v_result;
+            }
+
+            /** Destroys all objects and keeps the blocks for reuse.
+             * This is O(1) when T is trivially destructible (not counting oversized allocate() blocks).
+             */
+            void reset() noexcept
+            {
+                if constexpr (!std::is_trivially_destructible_v< T >)
+                {
+                    for (block_header* b = m_current; b != nullptr; b = b->m_next)
                     {
-                        move_deallocation_block_to_current_block();
+                        while (b->m_used != 0)
+                        {
+                            b->m_used--;
+                            std::allocator_traits< Alloc >::destroy(allocator_ref(), std::launder(block_begin(b) + b->m_used));
+                        }
                     }
                 }
+
+                if (m_current != nullptr)
+                {
+                    m_oldest->m_next = m_free;
+                    m_free = m_current;
+                    m_current = nullptr;
+                    m_oldest = nullptr;
+                }
+
+                deallocate_chain(m_large);
+                m_large = nullptr;
             }
 
-            void deallocate_current_block()
+            /** Destroys all objects and returns all blocks to the allocator.
+             */
+            void clear() noexcept
             {
-                std::allocator_traits< Alloc >::deallocate(get_allocator(), m_current_block, 64);
-                m_current_block = nullptr;
+                reset();
+                deallocate_chain(m_free);
+                m_free = nullptr;
             }
 
-            bool current_block_has_object() const
+            /** Returns the number of objects each block can hold.
+             */
+            std::size_t block_capacity() const noexcept
             {
-                return m_current_allocs != 0;
+                return m_block_capacity;
             }
 
-            bool have_deallocation_block() const
+            Alloc get_allocator() const noexcept
             {
-                return !m_block_allocs.empty();
+                return static_cast< Alloc const& >(*this);
             }
 
-            void move_deallocation_block_to_current_block()
+          private:
+            Alloc& allocator_ref() noexcept
             {
-                m_current_block = m_block_allocs.back();
-                m_block_allocs.pop_back();
-                m_current_allocs = 64;
+                return static_cast< Alloc& >(*this);
             }
 
-            Alloc& get_allocator() noexcept
+            static T* block_begin(block_header* b) noexcept
             {
-                return (Alloc&)*this;
+                return reinterpret_cast< T* >(reinterpret_cast< unit* >(b) + header_units);
             }
 
-            bool have_storage() const
+            bool have_storage() const noexcept
             {
-                return m_current_allocs != 64 && m_current_block != nullptr;
+                return m_current != nullptr && m_current->m_used != m_current->m_capacity;
             }
 
-            void make_more_storage() const
+            T* get_current_position() const noexcept
             {
-                if (have_block_allocated())
-                {
-                    move_current_block_to_dealloc_list();
-                }
+                return block_begin(m_current) + m_current->m_used;
+            }
 
-                allocate_block();
+            void advance_current_position() noexcept
+            {
+                m_current->m_used++;
             }
 
-            void move_current_block_to_dealloc_list()
+            void make_more_storage()
             {
-                m_block_allocs.push_back(m_current_block);
-                m_current_block = nullptr;
+                block_header* v_block = m_free;
+                if (v_block != nullptr)
+                {
+                    m_free = v_block->m_next;
+                }
+                else
+                {
+                    v_block = allocate_block(m_block_units);
+                }
+
+                v_block->m_used = 0;
+                v_block->m_next = m_current;
+                m_current = v_block;
+                if (m_oldest == nullptr)
+                {
+                    m_oldest = v_block;
+                }
             }
 
-            bool have_block_allocated() const
+            block_header* allocate_block(std::size_t units)
             {
-                return m_current_block != nullptr;
+                unit_allocator v_alloc(allocator_ref());
+                unit* v_storage = unit_allocator_traits::allocate(v_alloc, units);
+                block_header* v_block = ::new (static_cast< void* >(v_storage)) block_header;
+                v_block->m_next = nullptr;
+                v_block->m_units = units;
+                v_block->m_capacity = (units - header_units) * sizeof(unit) / sizeof(T);
+                v_block->m_used = 0;
+                return v_block;
             }
 
-            T* get_current_position() const
+            void deallocate_chain(block_header* b) noexcept
             {
-                return m_current_block + m_current_allocs;
+                unit_allocator v_alloc(allocator_ref());
+                while (b != nullptr)
+                {
+                    block_header* v_next = b->m_next;
+                    unit_allocator_traits::deallocate(v_alloc, reinterpret_cast< unit* >(b), b->m_units);
+                    b = v_next;
+                }
             }
 
-            void advance_current_position()
+            static T* bump(block_header* b, std::size_t n, std::size_t alignment) noexcept
             {
-                m_current_allocs++;
+                T* v_base = block_begin(b);
+                std::size_t v_index = b->m_used;
+                std::size_t v_misalignment = reinterpret_cast< std::uintptr_t >(v_base + v_index) & (alignment - 1);
+                if (v_misalignment != 0)
+                {
+                    v_index += (alignment - v_misalignment + sizeof(T) - 1) / sizeof(T);
+                    while (v_index < b->m_capacity && (reinterpret_cast< std::uintptr_t >(v_base + v_index) & (alignment - 1)) != 0)
+                    {
+                        v_index++;
+                    }
+                }
+
+                if (v_index > b->m_capacity || b->m_capacity - v_index < n)
+                {
+                    return nullptr;
+                }
+
+                b->m_used = v_index + n;
+                return v_base + v_index;
             }
 
-            void allocate_block()
+            T* allocate_large(std::size_t n, std::size_t alignment)
             {
-                m_current_block = std::allocator_traits< Alloc >::allocate(get_allocator(), 64);
-                m_current_allocs = 0;
+                std::size_t v_units = header_units + (n * sizeof(T) + alignment + sizeof(unit) - 1) / sizeof(unit);
+                block_header* v_block = allocate_block(v_units);
+                v_block->m_next = m_large;
+                m_large = v_block;
+                T* v_result = bump(v_block, n, alignment);
+                RPNX_ASSERT(v_result != nullptr);
+                return v_result;
             }
 
           private:
-            T* m_current_block;
-            size_t m_current_allocs;
-            std::list< T*, Alloc > m_block_allocs;
+            // Blocks in use, newest first. m_oldest is the tail, so the chain can be moved to m_free in O(1).
+            block_header* m_current = nullptr;
+            block_header* m_oldest = nullptr;
+            // Blocks retained by reset() for reuse.
+            block_header* m_free = nullptr;
+            // Dedicated blocks for allocate() requests that don't fit in a regular block.
+            block_header* m_large = nullptr;
+            std::size_t m_block_capacity = 0;
+            std::size_t m_block_units = 0;
         };
     } // namespace experimental
 
@@ -0,0 +1,153 @@
+#ifndef RPNXCORE_CONVEYOR_RESOURCE_HPP
+#define RPNXCORE_CONVEYOR_RESOURCE_HPP
+
+#include <cstddef>
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+#include "rpnx/experimental/conveyor.hpp"
+
+namespace rpnx
+{
+    namespace experimental
+    {
+        /*
+          A std::pmr::memory_resource that carves allocations out of a conveyor arena.
+
+          Deallocation is a no-op; memory is reclaimed for every allocation at once by reset(), which keeps the
+          arena's blocks for the next request, or release(), which returns them to the upstream allocator.
+          Containers using this resource must be destroyed (or abandoned, for trivially destructible contents)
+          before reset() is called.
+         */
+        template < typename Alloc = std::allocator< std::byte > >
+        class basic_conveyor_resource : public std::pmr::memory_resource
+        {
+          public:
+            using arena_type = conveyor< std::byte, typename std::allocator_traits< Alloc >::template rebind_alloc< std::byte > >;
+
+          private:
+            arena_type m_arena;
+
+          public:
+            explicit basic_conveyor_resource(Alloc const& alloc = Alloc()) : m_arena(arena_type::default_block_size, alloc)
+            {
+            }
+
+            explicit basic_conveyor_resource(std::size_t block_size, Alloc const& alloc = Alloc()) : m_arena(block_size, alloc)
+            {
+            }
+
+            basic_conveyor_resource(basic_conveyor_resource< Alloc > const&) = delete;
+            basic_conveyor_resource< Alloc >& operator=(basic_conveyor_resource< Alloc > const&) = delete;
+
+            /** Allocates directly from the arena, without going through the virtual memory_resource interface.
+             */
+            void* allocate_bytes(std::size_t bytes, std::size_t alignment)
+            {
+                return m_arena.allocate(bytes, alignment);
+            }
+
+            /** Reclaims every allocation made from this resource and keeps the blocks for reuse.
+             */
+            void reset() noexcept
+            {
+                m_arena.reset();
+            }
+
+            /** Reclaims every allocation made from this resource and returns all blocks upstream.
+             */
+            void release() noexcept
+            {
+                m_arena.clear();
+            }
+
+            arena_type& arena() noexcept
+            {
+                return m_arena;
+            }
+
+          protected:
+            void* do_allocate(std::size_t bytes, std::size_t alignment) override
+            {
+                return m_arena.allocate(bytes, alignment);
+            }
+
+            void do_deallocate(void*, std::size_t, std::size_t) override
+            {
+            }
+
+            bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override
+            {
+                return this == &other;
+            }
+        };
+
+        using conveyor_resource = basic_conveyor_resource<>;
+
+        /*
+          A classic (non-polymorphic) Allocator that allocates from a basic_conveyor_resource.
+
+          Unlike std::pmr::polymorphic_allocator, allocation is not a virtual call, and the allocator can be used with
+          containers that do not understand memory resources, such as rpnx::experimental::monoque or avl_tree.
+          deallocate is a no-op, memory is reclaimed by the resource's reset() or release().
+         */
+        template < typename T, typename Alloc = std::allocator< std::byte > >
+        class conveyor_allocator
+        {
+            template < typename T2, typename Alloc2 >
+            friend class conveyor_allocator;
+
+            basic_conveyor_resource< Alloc >* m_resource;
+
+          public:
+            using value_type = T;
+            using propagate_on_container_copy_assignment = std::true_type;
+            using propagate_on_container_move_assignment = std::true_type;
+            using propagate_on_container_swap = std::true_type;
+            using is_always_equal = std::false_type;
+
+            explicit conveyor_allocator(basic_conveyor_resource< Alloc >& resource) noexcept : m_resource(&resource)
+            {
+            }
+
+            template < typename T2 >
+            conveyor_allocator(conveyor_allocator< T2, Alloc > const& other) noexcept : m_resource(other.m_resource)
+            {
+            }
+
+            T* allocate(std::size_t n)
+            {
+                if (n > std::numeric_limits< std::size_t >::max() / sizeof(T))
+                {
+                    throw std::bad_array_new_length();
+                }
+                return static_cast< T* >(m_resource->allocate_bytes(n * sizeof(T), alignof(T)));
+            }
+
+            void deallocate(T*, std::size_t) noexcept
+            {
+            }
+
+            basic_conveyor_resource< Alloc >* resource() const noexcept
+            {
+                return m_resource;
+            }
+
+            template < typename T2 >
+            bool operator==(conveyor_allocator< T2, Alloc > const& other) const noexcept
+            {
+                return m_resource == other.m_resource;
+            }
+
+            template < typename T2 >
+            bool operator!=(conveyor_allocator< T2, Alloc > const& other) const noexcept
+            {
+                return m_resource != other.m_resource;
+            }
+        };
+    } // namespace experimental
+} // namespace rpnx
+
+#endif // RPNXCORE_CONVEYOR_RESOURCE_HPP
@@ -18,15 +18,19 @@ See rpnx-core/LICENSE.txt
 #include <limits>
 #include <iterator>
 #include <climits>
+#include <array>
+#include <stdexcept>
+#include <type_traits>
 
 #include "rpnx/assert.hpp"
+#include "rpnx/experimental/bitwise.hpp"
 
 namespace rpnx
 {
     namespace experimental
     {
-        // Probably will reimplement this later more efficiently.
-        inline namespace monoque_abi_v1
+        // Superseded by monoque_abi_v2, kept so code that names the v1 ABI explicitly still builds.
+        namespace monoque_abi_v1
         {
             template <typename T, typename Alloc>
             class monoque_iterator;
@@ -363,11 +367,11 @@ namespace rpnx
 
                 void resize(std::size_t n)
                 {
-                    while (n < size())
+                    while (n > size())
                     {
                         emplace_back();
                     }
-                    while (n > size())
+                    while (n < size())
                     {
                         pop_back();
                     }
@@ -455,7 +459,7 @@ namespace rpnx
 
                 inline monoque_iterator<T, Alloc> & operator -=(difference_type n) noexcept
                 {
-                    m_index += n;
+                    m_index -= n;
                     return *this;
                 }
 
@@ -608,7 +612,7 @@ namespace rpnx
 
                 inline monoque_const_iterator<T, Alloc> & operator -=(difference_type n)
                 {
-                    m_index += n;
+                    m_index -= n;
                     return *this;
                 }
 
@@ -705,28 +709,638 @@ namespace rpnx
 
 
         }
+
+        /*
+          Like vector, but non-contiguous, with worst-case O(1) push_back, worst-case O(1) indexing and element
+          addresses that never change while the element is alive.
+
+          Blocks have sizes 2, 2, 4, 8, 16 ... and an element's block is found with a count leading zeros operation.
+          The block table is stored inline, so indexing never goes through a separately allocated block list, and
+          push_back and iteration keep a pointer into the current block so they only compute a block index when they
+          cross a block boundary.
+         */
+        inline namespace monoque_abi_v2
+        {
+            template < typename T, typename Alloc >
+            class monoque_iterator;
+
+            template < typename T, typename Alloc = std::allocator< T > >
+            class monoque : private Alloc
+            {
+                friend class monoque_iterator< T, Alloc >;
+                friend class monoque_iterator< T const, Alloc >;
+
+                static_assert(std::is_same_v< typename std::allocator_traits< Alloc >::pointer, T* >, "Not implemented");
+
+              public:
+                using value_type = T;
+                using allocator_type = Alloc;
+                using size_type = std::size_t;
+                using difference_type = std::ptrdiff_t;
+                using reference = T&;
+                using const_reference = T const&;
+                using pointer = T*;
+                using const_pointer = T const*;
+
+                using iterator = monoque_iterator< T, Alloc >;
+                using const_iterator = monoque_iterator< T const, Alloc >;
+                using reverse_iterator = std::reverse_iterator< iterator >;
+                using const_reverse_iterator = std::reverse_iterator< const_iterator >;
+
+              private:
+                static constexpr std::size_t block_count = sizeof(std::size_t) * CHAR_BIT;
+
+                using block_allocator = typename std::allocator_traits< Alloc >::template rebind_alloc< T >;
+                using block_allocator_traits = std::allocator_traits< block_allocator >;
+
+                std::size_t m_size = 0;
+                std::size_t m_allocated_blocks = 0;
+                // m_next and m_next_limit bound the free part of the block that will receive the next push_back,
+                // they are both null when size() == capacity().
+                T* m_next = nullptr;
+                T* m_next_limit = nullptr;
+                std::array< T*, block_count > m_blocks{};
+
+                static inline std::size_t block_index(std::size_t at) noexcept
+                {
+                    return block_count - 1 - countl_zero(at | 1);
+                }
+
+                static inline std::size_t block_first(std::size_t index) noexcept
+                {
+                    return (std::size_t(1) << index) & ~std::size_t(1);
+                }
+
+                static inline std::size_t size_of_block(std::size_t index) noexcept
+                {
+                    return index == 0 ? 2 : std::size_t(1) << index;
+                }
+
+                block_allocator get_block_allocator() const noexcept
+                {
+                    return block_allocator(get_allocator());
+                }
+
+                T* address_of(std::size_t at) const noexcept
+                {
+                    std::size_t v_index = block_index(at);
+                    RPNX_ASSERT(m_blocks[v_index] != nullptr);
+                    return m_blocks[v_index] + (at - block_first(v_index));
+                }
+
+                void update_next() noexcept
+                {
+                    if (m_size == capacity())
+                    {
+                        m_next = nullptr;
+                        m_next_limit = nullptr;
+                        return;
+                    }
+                    std::size_t v_index = block_index(m_size);
+                    m_next = m_blocks[v_index] + (m_size - block_first(v_index));
+                    m_next_limit = m_blocks[v_index] + size_of_block(v_index);
+                }
+
+                void add_block()
+                {
+                    RPNX_ASSERT(m_allocated_blocks < block_count);
+                    block_allocator v_alloc = get_block_allocator();
+                    m_blocks[m_allocated_blocks] = block_allocator_traits::allocate(v_alloc, size_of_block(m_allocated_blocks));
+                    m_allocated_blocks++;
+                    update_next();
+                }
+
+                void release_blocks_from(std::size_t first_block) noexcept
+                {
+                    block_allocator v_alloc = get_block_allocator();
+                    while (m_allocated_blocks > first_block)
+                    {
+                        m_allocated_blocks--;
+                        block_allocator_traits::deallocate(v_alloc, m_blocks[m_allocated_blocks], size_of_block(m_allocated_blocks));
+                        m_blocks[m_allocated_blocks] = nullptr;
+                    }
+                    update_next();
+                }
+
+                template < typename... Ts >
+                T& emplace_back_slow(Ts&&... ts)
+                {
+                    add_block();
+                    return emplace_back(std::forward< Ts >(ts)...);
+                }
+
+              public:
+                monoque() noexcept(noexcept(Alloc()))
+                {
+                }
+
+                explicit monoque(Alloc const& alloc) noexcept : Alloc(alloc)
+                {
+                }
+
+                explicit monoque(std::size_t count, Alloc const& alloc = Alloc()) : Alloc(alloc)
+                {
+                    resize(count);
+                }
+
+                monoque(std::size_t count, T const& value, Alloc const& alloc = Alloc()) : Alloc(alloc)
+                {
+                    assign(count, value);
+                }
+
+                template < typename It, typename = typename std::iterator_traits< It >::iterator_category >
+                monoque(It first, It last, Alloc const& alloc = Alloc()) : Alloc(alloc)
+                {
+                    assign(first, last);
+                }
+
+                monoque(std::initializer_list< T > ilist, Alloc const& alloc = Alloc()) : Alloc(alloc)
+                {
+                    assign(ilist.begin(), ilist.end());
+                }
+
+                monoque(monoque< T, Alloc > const& other)
+                    : Alloc(std::allocator_traits< Alloc >::select_on_container_copy_construction(other.get_allocator()))
+                {
+                    assign(other.begin(), other.end());
+                }
+
+                monoque(monoque< T, Alloc >&& other) noexcept : Alloc(other.get_allocator())
+                {
+                    swap(other);
+                }
+
+                ~monoque()
+                {
+                    clear();
+                    release_blocks_from(0);
+                }
+
+                monoque< T, Alloc >& operator=(monoque< T, Alloc > const& other)
+                {
+                    if (this != &other)
+                    {
+                        monoque< T, Alloc > v_copy(other);
+                        swap(v_copy);
+                    }
+                    return *this;
+                }
+
+                monoque< T, Alloc >& operator=(monoque< T, Alloc >&& other) noexcept
+                {
+                    swap(other);
+                    return *this;
+                }
+
+                monoque< T, Alloc >& operator=(std::initializer_list< T > ilist)
+                {
+                    assign(ilist.begin(), ilist.end());
+                    return *this;
+                }
+
+                template < typename It, typename = typename std::iterator_traits< It >::iterator_category >
+                void assign(It first, It last)
+                {
+                    clear();
+                    for (; first != last; ++first)
+                        emplace_back(*first);
+                }
+
+                void assign(std::size_t count, T const& value)
+                {
+                    clear();
+                    reserve(count);
+                    for (std::size_t i = 0; i < count; i++)
+                        emplace_back(value);
+                }
+
+                void assign(std::initializer_list< T > ilist)
+                {
+                    assign(ilist.begin(), ilist.end());
+                }
+
+                Alloc get_allocator() const noexcept
+                {
+                    return static_cast< Alloc const& >(*this);
+                }
+
+                template < typename... Ts >
+                T& emplace_back(Ts&&... ts)
+                {
+                    if (m_next == m_next_limit)
+                    {
+                        return emplace_back_slow(std::forward< Ts >(ts)...);
+                    }
+
+                    block_allocator v_alloc = get_block_allocator();
+                    block_allocator_traits::construct(v_alloc, m_next, std::forward< Ts >(ts)...);
+                    T* v_result = std::launder(m_next);
+                    m_size++;
+                    if (++m_next == m_next_limit)
+                    {
+                        update_next();
+                    }
+                    return *v_result;
+                }
+
+                void push_back(T const& value)
+                {
+                    emplace_back(value);
+                }
+
+                void push_back(T&& value)
+                {
+                    emplace_back(std::move(value));
+                }
+
+                void pop_back() noexcept
+                {
+                    RPNX_ASSERT(m_size != 0);
+                    m_size--;
+                    update_next();
+                    block_allocator v_alloc = get_block_allocator();
+                    block_allocator_traits::destroy(v_alloc, std::launder(m_next));
+                }
+
+                T& operator[](std::size_t n) noexcept
+                {
+                    RPNX_ASSERT(n < m_size);
+                    return *std::launder(address_of(n));
+                }
+
+                T const& operator[](std::size_t n) const noexcept
+                {
+                    RPNX_ASSERT(n < m_size);
+                    return *std::launder(address_of(n));
+                }
+
+                T& at(std::size_t n)
+                {
+                    if (n >= m_size)
+                        throw std::out_of_range("monoque::at");
+                    return (*this)[n];
+                }
+
+                T const& at(std::size_t n) const
+                {
+                    if (n >= m_size)
+                        throw std::out_of_range("monoque::at");
+                    return (*this)[n];
+                }
+
+                T& front() noexcept
+                {
+                    return (*this)[0];
+                }
+
+                T const& front() const noexcept
+                {
+                    return (*this)[0];
+                }
+
+                T& back() noexcept
+                {
+                    return (*this)[m_size - 1];
+                }
+
+                T const& back() const noexcept
+                {
+                    return (*this)[m_size - 1];
+                }
+
+                std::size_t size() const noexcept
+                {
+                    return m_size;
+                }
+
+                bool empty() const noexcept
+                {
+                    return m_size == 0;
+                }
+
+                std::size_t capacity() const noexcept
+                {
+                    // 0, [2, 4, 8, 16, 32, 64, 128, 256], 512, 1024 ...
+                    return m_allocated_blocks == 0 ? 0 : std::size_t(1) << m_allocated_blocks;
+                }
+
+                void reserve(std::size_t n)
+                {
+                    while (n > capacity())
+                    {
+                        add_block();
+                    }
+                }
+
+                void resize(std::size_t n)
+                {
+                    while (n < m_size)
+                        pop_back();
+                    reserve(n);
+                    while (n > m_size)
+                        emplace_back();
+                }
+
+                void resize(std::size_t n, T const& value)
+                {
+                    while (n < m_size)
+                        pop_back();
+                    reserve(n);
+                    while (n > m_size)
+                        emplace_back(value);
+                }
+
+                /** Destroys all elements but keeps the storage blocks. Use shrink_to_fit to release them.
+                 */
+                void clear() noexcept
+                {
+                    if constexpr (std::is_trivially_destructible_v< T >)
+                    {
+                        m_size = 0;
+                        update_next();
+                    }
+                    else
+                    {
+                        while (m_size != 0)
+                            pop_back();
+                    }
+                }
+
+                void shrink_to_fit() noexcept
+                {
+                    release_blocks_from(m_size == 0 ? 0 : block_index(m_size - 1) + 1);
+                }
+
+                void swap(monoque< T, Alloc >& other) noexcept
+                {
+                    if constexpr (std::allocator_traits< Alloc >::propagate_on_container_swap::value)
+                    {
+                        std::swap(static_cast< Alloc& >(*this), static_cast< Alloc& >(other));
+                    }
+                    std::swap(m_size, other.m_size);
+                    std::swap(m_allocated_blocks, other.m_allocated_blocks);
+                    std::swap(m_next, other.m_next);
+                    std::swap(m_next_limit, other.m_next_limit);
+                    std::swap(m_blocks, other.m_blocks);
+                }
+
+                friend void swap(monoque< T, Alloc >& a, monoque< T, Alloc >& b) noexcept
+                {
+                    a.swap(b);
+                }
+
+                iterator begin() noexcept
+                {
+                    return iterator(this, 0);
+                }
+
+                iterator end() noexcept
+                {
+                    return iterator(this, m_size);
+                }
+
+                const_iterator begin() const noexcept
+                {
+                    return cbegin();
+                }
+
+                const_iterator end() const noexcept
+                {
+                    return cend();
+                }
+
+                const_iterator cbegin() const noexcept
+                {
+                    return const_iterator(this, 0);
+                }
+
+                const_iterator cend() const noexcept
+                {
+                    return const_iterator(this, m_size);
+                }
+
+                reverse_iterator rbegin() noexcept
+                {
+                    return reverse_iterator(end());
+                }
+
+                reverse_iterator rend() noexcept
+                {
+                    return reverse_iterator(begin());
+                }
+
+                const_reverse_iterator rbegin() const noexcept
+                {
+                    return const_reverse_iterator(end());
+                }
+
+                const_reverse_iterator rend() const noexcept
+                {
+                    return const_reverse_iterator(begin());
+                }
+
+                bool operator==(monoque< T, Alloc > const& other) const
+                {
+                    return m_size == other.m_size && std::equal(begin(), end(), other.begin());
+                }
+
+                bool operator!=(monoque< T, Alloc > const& other) const
+                {
+                    return !(*this == other);
+                }
+            };
+
+            /* The iterator caches a pointer into the current block, so sequential iteration only
+             * recomputes the block index when it crosses into the next block. */
+            template < typename T, typename Alloc >
+            class monoque_iterator
+            {
+                friend class monoque< std::remove_const_t< T >, Alloc >;
+                friend class monoque_iterator< std::remove_const_t< T >, Alloc >;
+                friend class monoque_iterator< T const, Alloc >;
+
+                using container = std::conditional_t< std::is_const_v< T >, monoque< std::remove_const_t< T >, Alloc > const, monoque< T, Alloc > >;
+
+              public:
+                using value_type = std::remove_const_t< T >;
+                using difference_type = std::ptrdiff_t;
+                using pointer = T*;
+                using reference = T&;
+                using iterator_category = std::random_access_iterator_tag;
+
+              private:
+                container* m_which = nullptr;
+                std::size_t m_index = 0;
+                T* m_ptr = nullptr;
+                T* m_block_end = nullptr;
+
+                monoque_iterator(container* which, std::size_t index) noexcept : m_which(which), m_index(index)
+                {
+                    seek();
+                }
+
+                void seek() noexcept
+                {
+                    if (m_which != nullptr && m_index < m_which->capacity())
+                    {
+                        std::size_t v_block = container::block_index(m_index);
+                        T* v_begin = m_which->m_blocks[v_block];
+                        m_ptr = v_begin + (m_index - container::block_first(v_block));
+                        m_block_end = v_begin + container::size_of_block(v_block);
+                    }
+                    else
+                    {
+                        m_ptr = nullptr;
+                        m_block_end = nullptr;
+                    }
+                }
+
+              public:
+                monoque_iterator() noexcept = default;
+
+                template < typename T2, typename = std::enable_if_t< std::is_const_v< T > && std::is_same_v< T2, std::remove_const_t< T > > > >
+                monoque_iterator(monoque_iterator< T2, Alloc > const& other) noexcept
+                    : m_which(other.m_which), m_index(other.m_index), m_ptr(other.m_ptr), m_block_end(other.m_block_end)
+                {
+                }
+
+                reference operator*() const noexcept
+                {
+                    RPNX_ASSERT(m_ptr != nullptr);
+                    return *std::launder(m_ptr);
+                }
+
+                pointer operator->() const noexcept
+                {
+                    return std::launder(m_ptr);
+                }
+
+                reference operator[](difference_type n) const noexcept
+                {
+                    return *(*this + n);
+                }
+
+                monoque_iterator& operator++() noexcept
+                {
+                    m_index++;
+                    if (++m_ptr == m_block_end)
+                    {
+                        seek();
+                    }
+                    return *this;
+                }
+
+                monoque_iterator operator++(int) noexcept
+                {
+                    monoque_iterator v_copy = *this;
+                    ++*this;
+                    return v_copy;
+                }
+
+                monoque_iterator& operator--() noexcept
+                {
+                    m_index--;
+                    seek();
+                    return *this;
+                }
+
+                monoque_iterator operator--(int) noexcept
+                {
+                    monoque_iterator v_copy = *this;
+                    --*this;
+                    return v_copy;
+                }
+
+                monoque_iterator& operator+=(difference_type n) noexcept
+                {
+                    m_index += n;
+                    seek();
+                    return *this;
+                }
+
+                monoque_iterator& operator-=(difference_type n) noexcept
+                {
+                    m_index -= n;
+                    seek();
+                    return *this;
+                }
+
+                monoque_iterator operator+(difference_type n) const noexcept
+                {
+                    return monoque_iterator(m_which, m_index + n);
+                }
+
+                monoque_iterator operator-(difference_type n) const noexcept
+                {
+                    return monoque_iterator(m_which, m_index - n);
+                }
+
+                friend monoque_iterator operator+(difference_type n, monoque_iterator const& it) noexcept
+                {
+                    return it + n;
+                }
+
+                difference_type operator-(monoque_iterator const& other) const noexcept
+                {
+                    RPNX_ASSERT(m_which == other.m_which);
+                    return difference_type(m_index) - difference_type(other.m_index);
+                }
+
+                bool operator==(monoque_iterator const& other) const noexcept
+                {
+                    RPNX_ASSERT(m_which == other.m_which);
+                    return m_index == other.m_index;
+                }
+
+                bool operator!=(monoque_iterator const& other) const noexcept
+                {
+                    return !(*this == other);
+                }
+
+                bool operator<(monoque_iterator const& other) const noexcept
+                {
+                    RPNX_ASSERT(m_which == other.m_which);
+                    return m_index < other.m_index;
+                }
+
+                bool operator>(monoque_iterator const& other) const noexcept
+                {
+                    return other < *this;
+                }
+
+                bool operator<=(monoque_iterator const& other) const noexcept
+                {
+                    return !(other < *this);
+                }
+
+                bool operator>=(monoque_iterator const& other) const noexcept
+                {
+                    return !(*this < other);
+                }
+            };
+        } // namespace monoque_abi_v2
     }
 }
 template <typename T, typename Alloc>
-auto operator+(std::ptrdiff_t lhs, typename rpnx::experimental::monoque_iterator<T,Alloc> const & rhs)
+auto operator+(std::ptrdiff_t lhs, typename rpnx::experimental::monoque_abi_v1::monoque_iterator<T,Alloc> const & rhs)
 {
     return rhs+lhs;
 }
 
 template <typename T, typename Alloc>
-auto operator-(std::ptrdiff_t lhs, typename rpnx::experimental::monoque_iterator<T,Alloc> const & rhs)
+auto operator-(std::ptrdiff_t lhs, typename rpnx::experimental::monoque_abi_v1::monoque_iterator<T,Alloc> const & rhs)
 {
     return rhs-lhs;
 }
 
 template <typename T, typename Alloc>
-auto operator+(std::ptrdiff_t lhs, typename rpnx::experimental::monoque_const_iterator<T,Alloc> const & rhs)
+auto operator+(std::ptrdiff_t lhs, typename rpnx::experimental::monoque_abi_v1::monoque_const_iterator<T,Alloc> const & rhs)
 {
     return rhs+lhs;
 }
 
 template <typename T, typename Alloc>
-auto operator-(std::ptrdiff_t lhs, typename rpnx::experimental::monoque_const_iterator<T,Alloc> const & rhs)
+auto operator-(std::ptrdiff_t lhs, typename rpnx::experimental::monoque_abi_v1::monoque_const_iterator<T,Alloc> const & rhs)
 {
     return rhs-lhs;
 }
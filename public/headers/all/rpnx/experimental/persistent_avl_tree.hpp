@@ -0,0 +1,778 @@
+#ifndef RPNXCORE_PERSISTENT_AVL_TREE_HPP
+#define RPNXCORE_PERSISTENT_AVL_TREE_HPP
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+#include "rpnx/assert.hpp"
+
+namespace rpnx::experimental
+{
+    template <typename K, typename T, typename Compare = std::less<K>, typename Allocator = std::allocator< std::pair< K const, T > > >
+    class persistent_avl_tree;
+
+    template <typename K, typename T, typename Compare, typename Allocator>
+    class persistent_avl_tree_iterator;
+
+    /*
+      Nodes are immutable once they are reachable from more than one tree, and are shared between versions of a
+      tree through an intrusive reference count. Each child pointer owns one reference.
+     */
+    template <typename K, typename T, typename Compare, typename Allocator>
+    class persistent_avl_tree_node
+    {
+        friend class persistent_avl_tree<K, T, Compare, Allocator>;
+        friend class persistent_avl_tree_iterator<K, T, Compare, Allocator>;
+
+        using node = persistent_avl_tree_node<K, T, Compare, Allocator>;
+        using value_type = std::pair<K const, T>;
+
+        std::array<node*, 2> m_child {};
+        std::atomic<std::size_t> m_refs {1};
+        std::size_t m_size = 1;
+        std::int32_t m_height = 1;
+        value_type m_value;
+
+      public:
+        template <typename ... Ts>
+        explicit persistent_avl_tree_node(Ts && ... ts)
+        : m_value(std::forward<Ts>(ts)...)
+        {
+        }
+    };
+
+    /*
+      Iterators keep the ancestors still to be visited on an inline stack, since shared nodes can't have parent
+      links. The current element is on top. An AVL tree of height h has at least fib(h + 2) - 1 nodes, so no tree that fits in memory is taller than 92.
+     */
+    template <typename K, typename T, typename Compare, typename Allocator>
+    class persistent_avl_tree_iterator
+    {
+        friend class persistent_avl_tree<K, T, Compare, Allocator>;
+
+        using node = persistent_avl_tree_node<K, T, Compare, Allocator>;
+
+        static constexpr std::size_t max_height = 92;
+
+        std::array<node const *, max_height> m_path {};
+        std::size_t m_depth = 0;
+
+        void push_leftmost(node const * n) noexcept
+        {
+            while (n != nullptr)
+            {
+                RPNX_ASSERT(m_depth < max_height);
+                m_path[m_depth++] = n;
+                n = n->m_child[0];
+            }
+        }
+
+      public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::pair<K const, T>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = value_type const *;
+        using reference = value_type const &;
+
+        persistent_avl_tree_iterator() noexcept = default;
+
+        reference operator*() const noexcept
+        {
+            return m_path[m_depth - 1]->m_value;
+        }
+
+        pointer operator->() const noexcept
+        {
+            return std::addressof(m_path[m_depth - 1]->m_value);
+        }
+
+        /** Amortized O(1), O(log n) worst case.
+         */
+        persistent_avl_tree_iterator & operator++() noexcept
+        {
+            node const * n = m_path[--m_depth];
+            push_leftmost(n->m_child[1]);
+            return *this;
+        }
+
+        persistent_avl_tree_iterator operator++(int) noexcept
+        {
+            persistent_avl_tree_iterator v_copy = *this;
+            ++*this;
+            return v_copy;
+        }
+
+        bool operator==(persistent_avl_tree_iterator const & other) const noexcept
+        {
+            return m_depth == other.m_depth && (m_depth == 0 || m_path[m_depth - 1] == other.m_path[other.m_depth - 1]);
+        }
+
+        bool operator!=(persistent_avl_tree_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+    };
+
+    /*
+      A persistent ordered map. Copying a tree is O(1): the copy shares every node with the original, and
+      modifications copy only the O(log n) nodes on the path to the change (path copying), leaving every other
+      copy untouched. Nodes that are not shared with any other copy are modified in place, so a tree that is
+      never copied performs like an ordinary AVL tree.
+
+      Different copies may be read and modified by different threads concurrently without synchronization; a
+      single copy follows the usual rules (concurrent reads, exclusive writes). Use atomic_snapshot to publish new
+      versions of a tree from a writer to readers.
+     */
+    template <typename K, typename T, typename Compare, typename Allocator>
+    class persistent_avl_tree
+        :
+        private Compare,
+        private Allocator
+    {
+      public:
+        using key_type = K;
+        using mapped_type = T;
+        using value_type = std::pair<K const, T>;
+        using size_type = std::size_t;
+        using difference_type = std::ptrdiff_t;
+        using key_compare = Compare;
+        using allocator_type = Allocator;
+        using const_reference = value_type const &;
+        using const_iterator = persistent_avl_tree_iterator<K, T, Compare, Allocator>;
+        using iterator = const_iterator;
+
+      private:
+        using node = persistent_avl_tree_node<K, T, Compare, Allocator>;
+        using node_allocator = typename std::allocator_traits<Allocator>::template rebind_alloc<node>;
+        using node_allocator_traits = std::allocator_traits<node_allocator>;
+
+        static_assert(std::allocator_traits<Allocator>::is_always_equal::value, "Nodes are shared between trees, so the allocator must be stateless");
+
+      public:
+        persistent_avl_tree() noexcept(noexcept(Allocator()) && noexcept(Compare()))
+        {}
+
+        explicit persistent_avl_tree(Compare const & comp)
+        : Compare(comp)
+        {}
+
+        persistent_avl_tree(std::initializer_list<value_type> init, Compare const & comp = Compare())
+        : Compare(comp)
+        {
+            for (auto const & x : init)
+            {
+                insert(x);
+            }
+        }
+
+        /** O(1), the copy shares all nodes with other.
+         */
+        persistent_avl_tree(persistent_avl_tree const & other) noexcept
+        : Compare(other.key_comp()), Allocator(other.get_allocator()), m_root(retain(other.m_root))
+        {
+        }
+
+        persistent_avl_tree(persistent_avl_tree && other) noexcept
+        : Compare(other.key_comp()), Allocator(other.get_allocator()), m_root(other.m_root)
+        {
+            other.m_root = nullptr;
+        }
+
+        ~persistent_avl_tree()
+        {
+            release(m_root);
+        }
+
+        persistent_avl_tree & operator=(persistent_avl_tree const & other) noexcept
+        {
+            node * v_old = m_root;
+            m_root = retain(other.m_root);
+            static_cast<Compare&>(*this) = static_cast<Compare const&>(other);
+            release(v_old);
+            return *this;
+        }
+
+        persistent_avl_tree & operator=(persistent_avl_tree && other) noexcept
+        {
+            if (this != &other)
+            {
+                release(m_root);
+                m_root = other.m_root;
+                other.m_root = nullptr;
+                static_cast<Compare&>(*this) = static_cast<Compare const&>(other);
+            }
+            return *this;
+        }
+
+        Allocator get_allocator() const
+        {
+            return static_cast<Allocator const &>(*this);
+        }
+
+        Compare key_comp() const
+        {
+            return static_cast<Compare const &>(*this);
+        }
+
+        const_iterator begin() const noexcept
+        {
+            const_iterator v_result;
+            v_result.push_leftmost(m_root);
+            return v_result;
+        }
+
+        const_iterator end() const noexcept
+        {
+            return const_iterator();
+        }
+
+        const_iterator cbegin() const noexcept
+        {
+            return begin();
+        }
+
+        const_iterator cend() const noexcept
+        {
+            return end();
+        }
+
+        bool empty() const noexcept
+        {
+            return m_root == nullptr;
+        }
+
+        size_type size() const noexcept
+        {
+            return subtree_size(m_root);
+        }
+
+        void clear() noexcept
+        {
+            release(m_root);
+            m_root = nullptr;
+        }
+
+        void swap(persistent_avl_tree & other) noexcept
+        {
+            using std::swap;
+            swap(static_cast<Compare&>(*this), static_cast<Compare&>(other));
+            swap(m_root, other.m_root);
+        }
+
+        /** Returns a pointer to the value for key, or nullptr. The pointer is valid until this tree is next
+         * modified. After that it stays valid only while a copy or snapshot still shares the node.
+         */
+        value_type const * find(K const & key) const
+        {
+            node const * n = find_node(key);
+            return n != nullptr ? std::addressof(n->m_value) : nullptr;
+        }
+
+        bool contains(K const & key) const
+        {
+            return find_node(key) != nullptr;
+        }
+
+        T const & at(K const & key) const
+        {
+            node const * n = find_node(key);
+            if (n == nullptr)
+            {
+                throw std::out_of_range("persistent_avl_tree::at");
+            }
+            return n->m_value.second;
+        }
+
+        /** Returns an iterator to the first element whose key is not less than key.
+         */
+        const_iterator lower_bound(K const & key) const
+        {
+            const_iterator v_result;
+            node const * n = m_root;
+            while (n != nullptr)
+            {
+                if (less(n->m_value.first, key))
+                {
+                    n = n->m_child[1];
+                }
+                else
+                {
+                    v_result.m_path[v_result.m_depth++] = n;
+                    n = n->m_child[0];
+                }
+            }
+            return v_result;
+        }
+
+        /** Returns the element at in order position i. i must be less than size().
+         */
+        value_type const & nth(size_type i) const
+        {
+            RPNX_ASSERT(i < size());
+            node const * n = m_root;
+            while (true)
+            {
+                size_type v_left = subtree_size(n->m_child[0]);
+                if (i < v_left)
+                {
+                    n = n->m_child[0];
+                }
+                else if (i == v_left)
+                {
+                    return n->m_value;
+                }
+                else
+                {
+                    i -= v_left + 1;
+                    n = n->m_child[1];
+                }
+            }
+        }
+
+        /** Returns the number of elements with keys less than key.
+         */
+        size_type rank(K const & key) const
+        {
+            size_type v_rank = 0;
+            node const * n = m_root;
+            while (n != nullptr)
+            {
+                if (less(n->m_value.first, key))
+                {
+                    v_rank += subtree_size(n->m_child[0]) + 1;
+                    n = n->m_child[1];
+                }
+                else
+                {
+                    n = n->m_child[0];
+                }
+            }
+            return v_rank;
+        }
+
+        /** Inserts value if its key is not present. Returns true if it was inserted.
+         */
+        bool insert(value_type const & value)
+        {
+            if (contains(value.first))
+            {
+                return false;
+            }
+            insert_node(m_root, value.first, value);
+            return true;
+        }
+
+        template <typename ... Ts>
+        bool try_emplace(K const & key, Ts && ... ts)
+        {
+            if (contains(key))
+            {
+                return false;
+            }
+            insert_node(m_root, key, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Ts>(ts)...));
+            return true;
+        }
+
+        /** Inserts or replaces the value for key. Returns true if it was inserted.
+         */
+        template <typename M>
+        bool insert_or_assign(K const & key, M && value)
+        {
+            if (contains(key))
+            {
+                assign_node(m_root, key, std::forward<M>(value));
+                return false;
+            }
+            insert_node(m_root, key, key, std::forward<M>(value));
+            return true;
+        }
+
+        size_type erase(K const & key)
+        {
+            if (!contains(key))
+            {
+                return 0;
+            }
+            erase_node(m_root, key);
+            return 1;
+        }
+
+        /** Returns true if both trees are the same version, in O(1). Equal contents in different versions compare
+         * unequal here; use operator== to compare contents.
+         */
+        bool shares_root_with(persistent_avl_tree const & other) const noexcept
+        {
+            return m_root == other.m_root;
+        }
+
+        /** Checks ordering, heights, balance and subtree sizes. O(n), intended for tests.
+         */
+        bool is_valid() const
+        {
+            return check_subtree(m_root, nullptr, nullptr) >= 0;
+        }
+
+        friend bool operator==(persistent_avl_tree const & a, persistent_avl_tree const & b)
+        {
+            return a.m_root == b.m_root || (a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin()));
+        }
+
+        friend bool operator!=(persistent_avl_tree const & a, persistent_avl_tree const & b)
+        {
+            return !(a == b);
+        }
+
+      private:
+        bool less(K const & a, K const & b) const
+        {
+            return static_cast<Compare const&>(*this)(a, b);
+        }
+
+        static std::int32_t height(node const * n) noexcept
+        {
+            return n != nullptr ? n->m_height : 0;
+        }
+
+        static std::size_t subtree_size(node const * n) noexcept
+        {
+            return n != nullptr ? n->m_size : 0;
+        }
+
+        static void update(node * n) noexcept
+        {
+            n->m_height = 1 + std::max(height(n->m_child[0]), height(n->m_child[1]));
+            n->m_size = 1 + subtree_size(n->m_child[0]) + subtree_size(n->m_child[1]);
+        }
+
+        static node * retain(node * n) noexcept
+        {
+            if (n != nullptr)
+            {
+                n->m_refs.fetch_add(1, std::memory_order_relaxed);
+            }
+            return n;
+        }
+
+        void release(node * n) noexcept
+        {
+            if (n != nullptr && n->m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                release(n->m_child[0]);
+                release(n->m_child[1]);
+                delete_node(n);
+            }
+        }
+
+        /** Makes the node in slot safe for this tree to modify, copying it if any other tree shares it, and returns it.
+         * A reference count of one can't be raced: every other path to the node would hold a reference.
+         * slot is only overwritten once the copy exists, so if copying throws the tree is unchanged.
+         */
+        node * make_mutable(node * & slot)
+        {
+            node * n = slot;
+            if (n->m_refs.load(std::memory_order_acquire) == 1)
+            {
+                return n;
+            }
+            node * v_copy = create_node(n->m_value);
+            v_copy->m_child = {retain(n->m_child[0]), retain(n->m_child[1])};
+            v_copy->m_height = n->m_height;
+            v_copy->m_size = n->m_size;
+            // Still referenced by another tree, so this only decrements.
+            release(n);
+            slot = v_copy;
+            return v_copy;
+        }
+
+        /** Rotates n down in direction dir and returns the new subtree root. n and the child rotated up must
+         * already be mutable, so rotations never allocate.
+         */
+        static node * rotate(node * n, int dir) noexcept
+        {
+            node * v_child = n->m_child[!dir];
+            RPNX_ASSERT(v_child->m_refs.load(std::memory_order_relaxed) == 1);
+            n->m_child[!dir] = v_child->m_child[dir];
+            v_child->m_child[dir] = n;
+            update(n);
+            update(v_child);
+            return v_child;
+        }
+
+        static node * rebalance(node * n) noexcept
+        {
+            update(n);
+            std::int32_t v_balance = height(n->m_child[1]) - height(n->m_child[0]);
+            if (v_balance > 1 || v_balance < -1)
+            {
+                int v_heavy = v_balance > 1 ? 1 : 0;
+                node * v_child = n->m_child[v_heavy];
+                if (height(v_child->m_child[!v_heavy]) > height(v_child->m_child[v_heavy]))
+                {
+                    n->m_child[v_heavy] = rotate(v_child, v_heavy);
+                }
+                return rotate(n, !v_heavy);
+            }
+            return n;
+        }
+
+        /*
+          The recursive modifiers take a reference to the child pointer (or m_root) holding the subtree, and make
+          each node on the path mutable before changing it. Callers have already checked whether key is present.
+
+          Everything that can throw (copying shared nodes, constructing the new value) happens before the first
+          structural change, so a throwing modification leaves the tree's contents unchanged. After an insertion
+          the nodes that rotate up are always on the path, which is already mutable. After a removal they are on
+          the sibling side, so prepare_removal copies them on the way down when a rotation might need them.
+         */
+
+        template <typename ... Ts>
+        void insert_node(node * & slot, K const & key, Ts && ... ts)
+        {
+            if (slot == nullptr)
+            {
+                slot = create_node(std::forward<Ts>(ts)...);
+                return;
+            }
+            node * n = make_mutable(slot);
+            int v_dir = less(n->m_value.first, key) ? 1 : 0;
+            insert_node(n->m_child[v_dir], key, std::forward<Ts>(ts)...);
+            slot = rebalance(n);
+        }
+
+        template <typename M>
+        void assign_node(node * & slot, K const & key, M && value)
+        {
+            node * n = make_mutable(slot);
+            if (less(key, n->m_value.first))
+            {
+                assign_node(n->m_child[0], key, std::forward<M>(value));
+            }
+            else if (less(n->m_value.first, key))
+            {
+                assign_node(n->m_child[1], key, std::forward<M>(value));
+            }
+            else
+            {
+                n->m_value.second = std::forward<M>(value);
+            }
+        }
+
+        /** Copies the nodes a rebalance of n could rotate up if the subtree in direction dir shrinks.
+         */
+        void prepare_removal(node * n, int dir)
+        {
+            if (height(n->m_child[!dir]) > height(n->m_child[dir]))
+            {
+                node * v_sibling = make_mutable(n->m_child[!dir]);
+                if (height(v_sibling->m_child[dir]) > height(v_sibling->m_child[!dir]))
+                {
+                    make_mutable(v_sibling->m_child[dir]);
+                }
+            }
+        }
+
+        void erase_node(node * & slot, K const & key)
+        {
+            node * n = make_mutable(slot);
+            if (less(key, n->m_value.first) || less(n->m_value.first, key))
+            {
+                int v_dir = less(n->m_value.first, key) ? 1 : 0;
+                prepare_removal(n, v_dir);
+                erase_node(n->m_child[v_dir], key);
+                slot = rebalance(n);
+                return;
+            }
+
+            if (n->m_child[0] == nullptr || n->m_child[1] == nullptr)
+            {
+                slot = n->m_child[n->m_child[0] == nullptr];
+            }
+            else
+            {
+                // Replace n with its successor, unlinked from the right subtree.
+                prepare_removal(n, 1);
+                node * v_successor = remove_min(n->m_child[1]);
+                v_successor->m_child = {n->m_child[0], n->m_child[1]};
+                slot = rebalance(v_successor);
+            }
+            // n's child references have been handed over.
+            n->m_child = {};
+            release(n);
+        }
+
+        /** Unlinks the minimum of the subtree in slot and returns it, mutable and without children.
+         */
+        node * remove_min(node * & slot)
+        {
+            node * n = make_mutable(slot);
+            if (n->m_child[0] == nullptr)
+            {
+                slot = n->m_child[1];
+                n->m_child[1] = nullptr;
+                return n;
+            }
+            prepare_removal(n, 0);
+            node * v_min = remove_min(n->m_child[0]);
+            slot = rebalance(n);
+            return v_min;
+        }
+
+        node const * find_node(K const & key) const
+        {
+            node const * n = m_root;
+            while (n != nullptr)
+            {
+                if (less(key, n->m_value.first))
+                {
+                    n = n->m_child[0];
+                }
+                else if (less(n->m_value.first, key))
+                {
+                    n = n->m_child[1];
+                }
+                else
+                {
+                    return n;
+                }
+            }
+            return nullptr;
+        }
+
+        std::int32_t check_subtree(node const * n, K const * low, K const * high) const
+        {
+            if (n == nullptr)
+            {
+                return 0;
+            }
+            if ((low != nullptr && !less(*low, n->m_value.first)) || (high != nullptr && !less(n->m_value.first, *high)))
+            {
+                return -1;
+            }
+            std::int32_t v_left = check_subtree(n->m_child[0], low, &n->m_value.first);
+            std::int32_t v_right = check_subtree(n->m_child[1], &n->m_value.first, high);
+            if (v_left < 0 || v_right < 0 || v_left - v_right > 1 || v_right - v_left > 1)
+            {
+                return -1;
+            }
+            if (n->m_height != 1 + std::max(v_left, v_right) || n->m_size != 1 + subtree_size(n->m_child[0]) + subtree_size(n->m_child[1]))
+            {
+                return -1;
+            }
+            if (n->m_refs.load(std::memory_order_relaxed) == 0)
+            {
+                return -1;
+            }
+            return n->m_height;
+        }
+
+        template <typename ... Ts>
+        node * create_node(Ts && ... ts)
+        {
+            node_allocator node_alloc(get_allocator());
+            node * nptr = node_allocator_traits::allocate(node_alloc, 1);
+            try
+            {
+                node_allocator_traits::construct(node_alloc, nptr, std::forward<Ts>(ts)...);
+            }
+            catch (...)
+            {
+                node_allocator_traits::deallocate(node_alloc, nptr, 1);
+                throw;
+            }
+            return std::launder(nptr);
+        }
+
+        void delete_node(node * nptr) noexcept
+        {
+            node_allocator node_alloc(get_allocator());
+            node_allocator_traits::destroy(node_alloc, nptr);
+            node_allocator_traits::deallocate(node_alloc, nptr, 1);
+        }
+
+      private:
+        node * m_root = nullptr;
+    };
+
+    template <typename K, typename T, typename Compare, typename Allocator>
+    void swap(persistent_avl_tree<K, T, Compare, Allocator> & a, persistent_avl_tree<K, T, Compare, Allocator> & b) noexcept
+    {
+        a.swap(b);
+    }
+
+    /*
+      Publishes versions of a persistent container from writers to readers.
+
+      load() returns the current version in O(1) without copying any nodes, and never waits for a writer to finish
+      modifying its tree: writers build the next version privately and then swap it in with store() or update().
+      The exchange uses the standard atomic shared_ptr operations, which are lock-free where the platform provides
+      it, and otherwise hold an internal lock only for the pointer exchange itself.
+     */
+    template <typename Tree>
+    class atomic_snapshot
+    {
+        std::shared_ptr<Tree const> m_current;
+
+      public:
+        atomic_snapshot()
+        : m_current(std::make_shared<Tree const>())
+        {
+        }
+
+        explicit atomic_snapshot(Tree initial)
+        : m_current(std::make_shared<Tree const>(std::move(initial)))
+        {
+        }
+
+        atomic_snapshot(atomic_snapshot const &) = delete;
+        atomic_snapshot & operator=(atomic_snapshot const &) = delete;
+
+        /** Returns the current version. The result stays valid and unchanged however it is later updated.
+         */
+        std::shared_ptr<Tree const> load() const
+        {
+            return std::atomic_load_explicit(&m_current, std::memory_order_acquire);
+        }
+
+        /** Returns a copy of the current version, O(1) for persistent containers.
+         */
+        Tree snapshot() const
+        {
+            return *load();
+        }
+
+        void store(Tree next)
+        {
+            std::atomic_store_explicit(&m_current, std::make_shared<Tree const>(std::move(next)), std::memory_order_release);
+        }
+
+        /** Applies f to a copy of the current version and publishes the result. If another writer publishes first,
+         * f is applied again to the newer version, so f must be safe to retry.
+         */
+        template <typename F>
+        void update(F && f)
+        {
+            std::shared_ptr<Tree const> v_current = load();
+            while (true)
+            {
+                Tree v_next = *v_current;
+                f(v_next);
+                auto v_published = std::make_shared<Tree const>(std::move(v_next));
+                if (std::atomic_compare_exchange_weak_explicit(&m_current, &v_current, v_published, std::memory_order_acq_rel, std::memory_order_acquire))
+                {
+                    return;
+                }
+            }
+        }
+    };
+}
+
+#endif // RPNXCORE_PERSISTENT_AVL_TREE_HPP
@@ -0,0 +1,83 @@
+#ifndef RPNXCORE_POOL_ALLOCATOR_HPP
+#define RPNXCORE_POOL_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <type_traits>
+
+namespace rpnx
+{
+    namespace experimental
+    {
+        /** The largest allocation served from a size class; larger requests go directly to ::operator new.
+         */
+        inline constexpr std::size_t pool_max_class_size = 4096;
+
+        /** Allocates bytes from the process wide size-class pool.
+         * Each thread keeps a cache of free blocks per size class, so the common case takes no locks.
+         * Caches exchange blocks with a shared central list in batches when they run empty or grow too large,
+         * which is what makes it safe (and cheap) to free a block on a different thread than the one that
+         * allocated it. Memory held by the pool is reused but never returned to the operating system.
+         */
+        void* pool_allocate(std::size_t bytes, std::size_t alignment = alignof(std::max_align_t));
+
+        /** Returns memory obtained from pool_allocate. bytes and alignment must match the allocation.
+         */
+        void pool_deallocate(void* ptr, std::size_t bytes, std::size_t alignment = alignof(std::max_align_t)) noexcept;
+
+        /** Returns the calling thread's cached blocks to the central lists.
+         * This happens automatically when a thread exits.
+         */
+        void pool_flush_thread_cache() noexcept;
+
+        /*
+          A stateless Allocator backed by pool_allocate. All instances compare equal, so containers may move and swap
+          storage freely between instances and threads.
+          Usable as the Allocator of rpnx::derivator, avl_tree, channel, and the standard containers.
+         */
+        template < typename T >
+        class pool_allocator
+        {
+          public:
+            using value_type = T;
+            using propagate_on_container_move_assignment = std::true_type;
+            using is_always_equal = std::true_type;
+
+            pool_allocator() noexcept = default;
+
+            template < typename T2 >
+            pool_allocator(pool_allocator< T2 > const&) noexcept
+            {
+            }
+
+            T* allocate(std::size_t n)
+            {
+                if (n > std::numeric_limits< std::size_t >::max() / sizeof(T))
+                {
+                    throw std::bad_array_new_length();
+                }
+                return static_cast< T* >(pool_allocate(n * sizeof(T), alignof(T)));
+            }
+
+            void deallocate(T* ptr, std::size_t n) noexcept
+            {
+                pool_deallocate(ptr, n * sizeof(T), alignof(T));
+            }
+
+            template < typename T2 >
+            bool operator==(pool_allocator< T2 > const&) const noexcept
+            {
+                return true;
+            }
+
+            template < typename T2 >
+            bool operator!=(pool_allocator< T2 > const&) const noexcept
+            {
+                return false;
+            }
+        };
+    } // namespace experimental
+} // namespace rpnx
+
+#endif // RPNXCORE_POOL_ALLOCATOR_HPP
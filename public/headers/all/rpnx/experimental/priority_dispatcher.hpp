@@ -5,10 +5,26 @@
 #ifndef RPNXCORE_PRIORITY_DISPATCHER_HPP
 #define RPNXCORE_PRIORITY_DISPATCHER_HPP
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
 #include <mutex>
+#include <optional>
 #include <condition_variable>
 #include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "rpnx/experimental/pool_allocator.hpp"
+#include "rpnx/experimental/result.hpp"
 
 
 
@@ -16,10 +32,145 @@ namespace rpnx
 {
     namespace experimental
     {
+        class task_group;
+        class priority_dispatcher;
+
+        /** What a job_future shares with the job that completes it. It lives in one pooled block with the job's
+         * functor, and whichever of the two lets go last frees the block.
+         * Waiters sleep on a fixed table of mutexes and condition variables picked by the state's address, so a
+         * state holds neither.
+         */
+        class job_future_state
+        {
+          public:
+            explicit job_future_state(void (*destroy)(job_future_state*) noexcept) noexcept
+                : m_destroy(destroy)
+            {
+            }
+
+            bool ready() const noexcept
+            {
+                return (m_status.load(std::memory_order_acquire) & ready_bit) != 0;
+            }
+
+            /** Blocks until set_ready has been called. */
+            void wait();
+
+            /** Publishes the result to waiters. */
+            void set_ready() noexcept;
+
+            void release() noexcept
+            {
+                if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    m_destroy(this);
+                }
+            }
+
+          private:
+            static constexpr std::uint32_t ready_bit = 1;
+            static constexpr std::uint32_t waiting_bit = 2;
+
+            // The future and the job.
+            std::atomic<std::uint32_t> m_refs{2};
+            std::atomic<std::uint32_t> m_status{0};
+            void (*m_destroy)(job_future_state*) noexcept;
+        };
+
+        /** The eventual result of a job submitted with priority_dispatcher::submit_with_result. Move only, and
+         * get() may be called once. Dropping the future does not cancel the job.
+         */
+        template <typename T>
+        class job_future
+        {
+            friend class priority_dispatcher;
+
+          public:
+            struct state : job_future_state
+            {
+                using job_future_state::job_future_state;
+
+                std::optional<result<T>> m_result;
+            };
+
+            job_future() noexcept = default;
+
+            job_future(job_future&& other) noexcept
+                : m_state(std::exchange(other.m_state, nullptr))
+            {
+            }
 
+            job_future& operator=(job_future&& other) noexcept
+            {
+                if (this != &other)
+                {
+                    reset();
+                    m_state = std::exchange(other.m_state, nullptr);
+                }
+                return *this;
+            }
+
+            ~job_future()
+            {
+                reset();
+            }
+
+            /** False for a default constructed or moved from future, or after get(). */
+            bool valid() const noexcept
+            {
+                return m_state != nullptr;
+            }
+
+            /** True once the job has completed or been cancelled. */
+            bool ready() const noexcept
+            {
+                return m_state != nullptr && m_state->ready();
+            }
+
+            /** Blocks until the job has completed or been cancelled. Calling this from a job of the same dispatcher
+             * can deadlock.
+             */
+            void wait() const
+            {
+                if (m_state == nullptr)
+                {
+                    throw std::future_error(std::future_errc::no_state);
+                }
+                m_state->wait();
+            }
+
+            /** Waits for the job and takes its value or exception, leaving the future invalid. A cancelled job's
+             * result holds std::future_error with std::future_errc::broken_promise.
+             */
+            result<T> get()
+            {
+                wait();
+                result<T> r = std::move(*m_state->m_result);
+                reset();
+                return r;
+            }
+
+          private:
+            state* m_state = nullptr;
+
+            explicit job_future(state* s) noexcept
+                : m_state(s)
+            {
+            }
+
+            void reset() noexcept
+            {
+                if (m_state != nullptr)
+                {
+                    m_state->release();
+                    m_state = nullptr;
+                }
+            }
+        };
 
         class priority_dispatcher
         {
+            friend class task_group;
 
           public:
             enum class completion_state
@@ -28,14 +179,207 @@ namespace rpnx
                 completed_with_exception,
                 cancelled
             };
+
+            /** Functors passed to the templated submit that are trivially copyable and at most this large are
+             * stored in the job record itself instead of a pool_allocator block.
+             */
+            static constexpr std::size_t inline_functor_size = 48;
+
+            /** A locality hint that prefers no NUMA node, and what current_numa_node returns when the node is
+             * unknown.
+             */
+            static constexpr std::size_t any_node = std::numeric_limits<std::size_t>::max();
+
+            /** How submitted jobs are queued and handed to service threads. */
+            enum class scheduling_mode
+            {
+                /** One priority queue behind one mutex. Jobs start in strict priority order.
+                 */
+                shared_queue,
+
+                /** Each service thread has its own priority queue. Jobs submitted from a service thread go to that
+                 * thread's queue, and jobs submitted from other threads go to a lock-free injection list that idle
+                 * service threads drain into their own queues. A service thread with nothing to do steals from the
+                 * thread whose queue holds the highest priority job. Priority order is strict within each service
+                 * thread's queue but only approximate across threads, in exchange for submit and pickup never
+                 * contending on a shared lock.
+                 */
+                work_stealing,
+
+                /** Like shared_queue, but with options::m_band_count fixed priority levels instead of the full
+                 * int64 range, making submit and pickup O(1). Priority p goes to band clamp(p, 0, m_band_count - 1),
+                 * and jobs within a band start in submission order.
+                 */
+                banded
+            };
+
+            /** Which CPUs service threads may run on. Pinning is only done on Linux, and is best effort: a thread
+             * that cannot be pinned runs unpinned.
+             */
+            enum class affinity_policy
+            {
+                /** Service threads are not pinned, unless options::m_cpus is given, in which case each may run on
+                 * any of those CPUs.
+                 */
+                none,
+
+                /** Service thread i is pinned to the i-th usable CPU, counting node by node, so threads fill one
+                 * NUMA node before spilling into the next.
+                 */
+                per_core,
+
+                /** Service threads are dealt round robin to the NUMA nodes with usable CPUs, and each may run on
+                 * any usable CPU of its node.
+                 */
+                per_node
+            };
+
+            struct options
+            {
+                scheduling_mode m_mode = scheduling_mode::shared_queue;
+
+                /** The initial number of service threads, 0 for one per usable CPU. */
+                std::size_t m_thread_count = 0;
+
+                /** The number of priority levels for scheduling_mode::banded, from 1 to 64. */
+                std::size_t m_band_count = 64;
+
+                affinity_policy m_affinity = affinity_policy::none;
+
+                /** The CPUs service threads may use, by operating system number. Empty for every CPU the process
+                 * may run on.
+                 */
+                std::vector<std::size_t> m_cpus;
+
+                /** Whether service threads record the counters and histograms returned by stats(). */
+                bool m_collect_stats = false;
+
+                /** Called on the service thread with the exception of every job whose exec throws, before its
+                 * cleanup runs with completion_state::completed_with_exception. Exceptions it throws are
+                 * discarded. Jobs from submit_with_result deliver their exceptions to the future instead.
+                 */
+                std::function<void(std::exception_ptr)> m_exception_handler;
+            };
+
+            /** A log-linear histogram of durations: 16 equal buckets per power of two, so a duration is known to
+             * within about 6%. Bucket i covers [lower_bound(i), lower_bound(i + 1)), and the last bucket also
+             * holds everything longer.
+             */
+            struct latency_histogram
+            {
+                static constexpr std::size_t sub_bucket_bits = 4;
+                static constexpr std::size_t bucket_count = 720;
+
+                std::array<std::uint64_t, bucket_count> m_counts{};
+                // The sum of the samples, in the clock's ticks, and the length of a tick.
+                std::uint64_t m_total_ticks = 0;
+                double m_ns_per_tick = 1;
+
+                std::uint64_t count() const noexcept;
+                std::chrono::nanoseconds lower_bound(std::size_t bucket) const noexcept;
+                std::chrono::nanoseconds mean() const noexcept;
+
+                /** The upper bound of the bucket holding the sample at a_fraction of the way through, from 0 to 1.
+                 * 0 with no samples.
+                 */
+                std::chrono::nanoseconds percentile(double a_fraction) const noexcept;
+            };
+
+            /** What service threads have recorded since the dispatcher was created, with options::m_collect_stats.
+             * The counts only grow, so an interval is the difference of two snapshots.
+             */
+            struct statistics
+            {
+                /** From submit until the job starts, or for submit_at and task_group jobs, from when the job was
+                 * queued after its timer fired or its predecessors finished.
+                 */
+                latency_histogram m_wait;
+
+                /** How long exec and cleanup took. */
+                latency_histogram m_run;
+
+                std::uint64_t m_exceptions = 0;
+
+                /** Jobs taken from another service thread's queue, in scheduling_mode::work_stealing. */
+                std::uint64_t m_steals = 0;
+
+                /** How often a service thread went to sleep for want of work. */
+                std::uint64_t m_parks = 0;
+
+                /** Time spent running jobs, and time service threads existed, summed over service threads. */
+                std::chrono::nanoseconds m_busy{0};
+                std::chrono::nanoseconds m_alive{0};
+
+                /** Queued jobs by priority, highest priority first, with priorities clamped to their band in
+                 * scheduling_mode::banded. Jobs waiting for their deadline or for task_group predecessors are not
+                 * queued yet, and in scheduling_mode::work_stealing neither are jobs submitted from outside the
+                 * dispatcher that no service thread has picked up. Filled in whether or not stats are collected.
+                 */
+                std::vector<std::pair<std::int64_t, std::size_t>> m_queue_depth;
+
+                double utilization() const noexcept
+                {
+                    return m_alive.count() == 0 ? 0.0 : double(m_busy.count()) / double(m_alive.count());
+                }
+            };
+
           private:
             void * m_implementation;
 
+            void submit_inline(void(*exec)(void*), void const* functor, std::size_t size, std::int64_t priority, std::chrono::steady_clock::time_point const* when,
+                               std::size_t node);
+
+            /** Copies f into the job record or a pool_allocator block and submits it, at *when if when is not null,
+             * or else near node.
+             */
+            template <typename F>
+            void submit_functor(F f, std::int64_t priority, std::chrono::steady_clock::time_point const* when, std::size_t node = any_node)
+            {
+                if constexpr (std::is_trivially_copyable_v<F> && sizeof(F) <= inline_functor_size && alignof(F) <= alignof(void*))
+                {
+                    submit_inline(&exec_functor<F>, &f, sizeof(F), priority, when, node);
+                    return;
+                }
+
+                pool_allocator<F> alloc;
+                F * f_copy = alloc.allocate(1);
+                try
+                {
+                    f_copy = new (f_copy) F(std::move(f));
+                }
+                catch (...)
+                {
+                    alloc.deallocate(f_copy, 1);
+                    throw;
+                }
+
+                void (*ef)(void*);
+                ef = &exec_functor<F>;
+                try
+                {
+                    if (when != nullptr)
+                    {
+                        submit_at(ef, &delete_functor<F>, reinterpret_cast<void*>(f_copy), priority, *when);
+                    }
+                    else
+                    {
+                        submit_near(ef, &delete_functor<F>, reinterpret_cast<void*>(f_copy), priority, node);
+                    }
+                }
+                catch (...)
+                {
+                    delete_functor<F>(f_copy, completion_state::cancelled);
+                    throw;
+                }
+            }
+
           private:
             template <typename T>
             static void delete_functor(void * t, completion_state) noexcept
             {
-                delete reinterpret_cast<T*>(t);
+                T * f = reinterpret_cast<T*>(t);
+                f->~T();
+                pool_allocator<T>().deallocate(f, 1);
             }
 
             template <typename T>
@@ -44,11 +388,179 @@ namespace rpnx
                 (*reinterpret_cast<T*>(t))();
             }
 
+            /** The pooled block behind submit_with_result: the future's state followed by the functor, which is
+             * destroyed as soon as the job completes or is cancelled.
+             */
+            template <typename F, typename T>
+            struct result_job final : job_future<T>::state
+            {
+                std::optional<F> m_functor;
+
+                explicit result_job(F&& f)
+                    : job_future<T>::state(&destroy), m_functor(std::move(f))
+                {
+                }
+
+                static void destroy(job_future_state* s) noexcept
+                {
+                    result_job* j = static_cast<result_job*>(s);
+                    j->~result_job();
+                    pool_allocator<result_job>().deallocate(j, 1);
+                }
+
+                static void exec(void* t)
+                {
+                    result_job* j = reinterpret_cast<result_job*>(t);
+                    try
+                    {
+                        if constexpr (std::is_void_v<T>)
+                        {
+                            (*j->m_functor)();
+                            j->m_result.emplace();
+                        }
+                        else
+                        {
+                            j->m_result.emplace((*j->m_functor)());
+                        }
+                    }
+                    catch (...)
+                    {
+                        j->m_result.emplace(std::current_exception());
+                    }
+                }
+
+                static void cleanup(void* t, completion_state) noexcept
+                {
+                    result_job* j = reinterpret_cast<result_job*>(t);
+                    if (!j->m_result)
+                    {
+                        j->m_result.emplace(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+                    }
+                    j->m_functor.reset();
+                    j->set_ready();
+                    j->release();
+                }
+            };
+
+            /** The single pooled allocation behind a templated submit_bulk call: a Header followed by one Record per
+             * job. Header starts with the count of jobs that have not finished or been cancelled yet, and the last
+             * one destroys the header and frees the block.
+             */
+            template <typename Header, typename Record>
+            struct bulk_layout
+            {
+                static constexpr std::size_t alignment = alignof(Header) > alignof(Record) ? alignof(Header) : alignof(Record);
+                static constexpr std::size_t records_offset = (sizeof(Header) + alignof(Record) - 1) / alignof(Record) * alignof(Record);
+
+                static std::size_t bytes(std::size_t count)
+                {
+                    if (count > (std::numeric_limits<std::size_t>::max() - records_offset) / sizeof(Record))
+                    {
+                        throw std::bad_array_new_length();
+                    }
+                    return records_offset + count * sizeof(Record);
+                }
+
+                static Header* allocate(std::size_t count)
+                {
+                    return static_cast<Header*>(pool_allocate(bytes(count), alignment));
+                }
+
+                static Record* records(Header* header) noexcept
+                {
+                    return reinterpret_cast<Record*>(reinterpret_cast<unsigned char*>(header) + records_offset);
+                }
+
+                static void release(Header* header) noexcept
+                {
+                    if (header->m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                    {
+                        std::size_t count = header->m_count;
+                        header->~Header();
+                        pool_deallocate(header, bytes(count), alignment);
+                    }
+                }
+            };
+
+            template <typename F>
+            struct indexed_bulk
+            {
+                struct record
+                {
+                    indexed_bulk* m_bulk;
+                    std::size_t m_index;
+                };
+                using layout = bulk_layout<indexed_bulk, record>;
+
+                std::atomic<std::size_t> m_remaining;
+                std::size_t m_count;
+                F m_functor;
+
+                template <typename F2>
+                indexed_bulk(std::size_t count, F2&& f)
+                    : m_remaining(count), m_count(count), m_functor(std::forward<F2>(f))
+                {
+                }
+
+                static void exec(void* t)
+                {
+                    record* r = reinterpret_cast<record*>(t);
+                    static_cast<F const&>(r->m_bulk->m_functor)(r->m_index);
+                }
+
+                static void cleanup(void* t, completion_state) noexcept
+                {
+                    layout::release(reinterpret_cast<record*>(t)->m_bulk);
+                }
+            };
+
+            template <typename F>
+            struct functor_bulk
+            {
+                struct record
+                {
+                    functor_bulk* m_bulk;
+                    F m_functor;
+                };
+                using layout = bulk_layout<functor_bulk, record>;
+
+                std::atomic<std::size_t> m_remaining;
+                std::size_t m_count;
+
+                explicit functor_bulk(std::size_t count)
+                    : m_remaining(count), m_count(count)
+                {
+                }
+
+                static void exec(void* t)
+                {
+                    reinterpret_cast<record*>(t)->m_functor();
+                }
+
+                static void cleanup(void* t, completion_state) noexcept
+                {
+                    record* r = reinterpret_cast<record*>(t);
+                    functor_bulk* bulk = r->m_bulk;
+                    r->~record();
+                    layout::release(bulk);
+                }
+            };
+
 
           public:
             priority_dispatcher();
+            /** Throws std::invalid_argument if a_options.m_band_count is out of range in scheduling_mode::banded,
+             * or if a_options.m_cpus names a CPU the process may not run on.
+             */
+            explicit priority_dispatcher(options const& a_options);
             ~priority_dispatcher();
 
+            /** The number of NUMA nodes, at least 1. Nodes are numbered as by the operating system, from 0. */
+            static std::size_t numa_node_count() noexcept;
+
+            /** The NUMA node of the CPU the calling thread is running on, or any_node if it is unknown. */
+            static std::size_t current_numa_node() noexcept;
+
             /** Cancels all running operations. After this function completes, there are no pending actions.
              * Note: A job could still complete normally instead of being cancelled.
              * Note: This call will not terminate until all running executions have completed. If a running job exists, this call will block until it completes.
@@ -74,6 +586,11 @@ namespace rpnx
 
             void set_service_thread_count(std::size_t n);
 
+            /** Aggregates the service threads' counters. Service threads write their own counters without
+             * synchronizing, so a snapshot taken while jobs run may be off by the jobs in flight.
+             */
+            statistics stats() const;
+
 
 
 
@@ -88,8 +605,34 @@ namespace rpnx
              */
             void submit(void(*exec)(void*), void(*cleanup) (void*, completion_state) noexcept, void* caller_data, std::int64_t priority);
 
+            /**
+             * Like submit, but prefers running the job on a service thread on NUMA node node, or on any service
+             * thread if node is any_node.
+             * In scheduling_mode::work_stealing the job is queued to a service thread of that node, and only
+             * taken by another node's thread if that one is idle with nothing left to steal closer to home. The
+             * other modes share one queue, so the hint only picks which idle service thread is woken.
+             * Service threads only have a node under affinity_policy::per_core and affinity_policy::per_node.
+             */
+            void submit_near(void(*exec)(void*), void(*cleanup) (void*, completion_state) noexcept, void* caller_data, std::int64_t priority, std::size_t node);
+
+            template <typename F>
+            void submit_near(F f, std::int64_t priority, std::size_t node)
+            {
+                submit_functor(std::move(f), priority, nullptr, node);
+            }
+
+            /**
+             * Submits count jobs sharing exec, cleanup and priority, whose caller data are first_data,
+             * first_data + data_stride, ... in bytes. The jobs are queued under one lock and with one wake-up sequence.
+             * Either every job is submitted or an exception is thrown and none are.
+             */
+            void submit_bulk(void(*exec)(void*), void(*cleanup) (void*, completion_state) noexcept, void* first_data, std::size_t data_stride, std::size_t count,
+                             std::int64_t priority);
+
             /**
              * RAII style wrapper around the C style submit call
+             * Small trivially copyable functors, such as lambdas capturing only references and scalars, are copied
+             * into the job record. Others are copied into storage from the thread caching pool_allocator.
              * @tparam F
              * @param f
              * @param priority
@@ -97,11 +640,274 @@ namespace rpnx
             template <typename F>
             void submit(F f, std::int64_t priority)
             {
-                F * f_copy = new F(std::move(f));
+                submit_functor(std::move(f), priority, nullptr);
+            }
 
-                void (*ef)(void*);
-                ef = &exec_functor<F>;
-                submit(ef, &delete_functor<F>, reinterpret_cast<void*>(f_copy), priority);
+            /**
+             * Like submit, but returns a job_future for the value f returns, by value, or the exception it
+             * throws. The functor and the future's state share one pool_allocator block, where std::promise would
+             * allocate its shared state from the heap.
+             */
+            template <typename F>
+            job_future<std::decay_t<std::invoke_result_t<F&>>> submit_with_result(F f, std::int64_t priority)
+            {
+                using T = std::decay_t<std::invoke_result_t<F&>>;
+                using job = result_job<F, T>;
+                pool_allocator<job> alloc;
+                job* j = alloc.allocate(1);
+                try
+                {
+                    j = new (j) job(std::move(f));
+                }
+                catch (...)
+                {
+                    alloc.deallocate(j, 1);
+                    throw;
+                }
+
+                try
+                {
+                    submit(&job::exec, &job::cleanup, j, priority);
+                }
+                catch (...)
+                {
+                    job::destroy(j);
+                    throw;
+                }
+                return job_future<T>(j);
+            }
+
+            /**
+             * Like submit, but the job is only queued once when has passed, rounded up to the next millisecond.
+             * It then competes by priority with the other queued jobs.
+             * Delayed jobs wait in a timing wheel, taking constant memory each, without a thread per timer: one idle
+             * service thread sleeps until the earliest deadline while the others check between jobs. They are
+             * cancelled through the cleanup routine by cancel_all, cancel_all_quick and the destructor, but
+             * finish_all only waits for jobs that are already due.
+             */
+            void submit_at(void(*exec)(void*), void(*cleanup) (void*, completion_state) noexcept, void* caller_data, std::int64_t priority,
+                           std::chrono::steady_clock::time_point when);
+
+            template <typename F>
+            void submit_at(F f, std::chrono::steady_clock::time_point when, std::int64_t priority)
+            {
+                submit_functor(std::move(f), priority, &when);
+            }
+
+            template <typename F, typename Rep, typename Period>
+            void submit_after(F f, std::chrono::duration<Rep, Period> delay, std::int64_t priority)
+            {
+                std::chrono::steady_clock::time_point when = std::chrono::steady_clock::now() + std::chrono::ceil<std::chrono::steady_clock::duration>(delay);
+                submit_functor(std::move(f), priority, &when);
+            }
+
+            /**
+             * Submits a copy of every functor in [first, last) at the same priority, as with submit_bulk.
+             * The copies and the job records are kept in one pooled block, freed when the last job completes.
+             * The range is walked twice, once to size the block, so it must be a forward range.
+             */
+            template <typename ForwardIt>
+            void submit_bulk(ForwardIt first, ForwardIt last, std::int64_t priority)
+            {
+                static_assert(std::is_base_of_v<std::forward_iterator_tag, typename std::iterator_traits<ForwardIt>::iterator_category>,
+                              "submit_bulk needs forward iterators; copy single pass input into a container first");
+                using F = typename std::iterator_traits<ForwardIt>::value_type;
+                using bulk = functor_bulk<F>;
+                std::size_t count = std::size_t(std::distance(first, last));
+                if (count == 0)
+                {
+                    return;
+                }
+
+                bulk* b = bulk::layout::allocate(count);
+                new (b) bulk(count);
+                typename bulk::record* records = bulk::layout::records(b);
+                std::size_t constructed = 0;
+                try
+                {
+                    for (; constructed < count; ++constructed, ++first)
+                    {
+                        new (records + constructed) typename bulk::record{b, *first};
+                    }
+                    submit_bulk(&bulk::exec, &bulk::cleanup, records, sizeof(typename bulk::record), count, priority);
+                }
+                catch (...)
+                {
+                    while (constructed != 0)
+                    {
+                        records[--constructed].~record();
+                    }
+                    b->~bulk();
+                    pool_deallocate(b, bulk::layout::bytes(count), bulk::layout::alignment);
+                    throw;
+                }
+            }
+
+            /**
+             * Submits count jobs calling f(i) for each i in [0, count) at the same priority, as with submit_bulk.
+             * f is copied once into a pooled block that also holds every job record, and is destroyed when the last
+             * job completes. The jobs share the copy and may run concurrently, so it is invoked as const.
+             */
+            template <typename F>
+            void submit_bulk_n(F f, std::size_t count, std::int64_t priority)
+            {
+                using bulk = indexed_bulk<F>;
+                if (count == 0)
+                {
+                    return;
+                }
+
+                bulk* b = bulk::layout::allocate(count);
+                try
+                {
+                    new (b) bulk(count, std::move(f));
+                }
+                catch (...)
+                {
+                    pool_deallocate(b, bulk::layout::bytes(count), bulk::layout::alignment);
+                    throw;
+                }
+
+                typename bulk::record* records = bulk::layout::records(b);
+                for (std::size_t i = 0; i < count; i++)
+                {
+                    new (records + i) typename bulk::record{b, i};
+                }
+                try
+                {
+                    submit_bulk(&bulk::exec, &bulk::cleanup, records, sizeof(typename bulk::record), count, priority);
+                }
+                catch (...)
+                {
+                    b->~bulk();
+                    pool_deallocate(b, bulk::layout::bytes(count), bulk::layout::alignment);
+                    throw;
+                }
+            }
+        };
+
+        /** A set of jobs on a priority_dispatcher that can be waited for apart from the dispatcher's other work,
+         * where a job may name jobs of this or any other group that must finish before it starts. This runs a
+         * pipeline as a graph of jobs instead of phases separated by finish_all.
+         * A job is queued, by priority like any other, once its last predecessor completes, normally or with an
+         * exception. A job with a cancelled predecessor is cancelled without running, and so are its successors.
+         * Predecessors exist before the jobs that name them, so the graph can have no cycles.
+         * Jobs waiting for predecessors are queued before the job that releases them finishes, so finish_all and
+         * cancel_all cover them as well.
+         * The dispatcher must outlive the group, and the destructor waits for every job in the group.
+         */
+        class task_group
+        {
+          public:
+            using completion_state = priority_dispatcher::completion_state;
+
+            /** Names a job added to a task_group, to make it a predecessor of later jobs. Handles keep only the
+             * job's bookkeeping alive, and may outlive both the job and the group.
+             */
+            class task
+            {
+                friend class task_group;
+                void* m_node = nullptr;
+
+                explicit task(void* node) noexcept
+                    : m_node(node)
+                {
+                }
+
+              public:
+                task() noexcept = default;
+                task(task const& other) noexcept;
+                task(task&& other) noexcept;
+                task& operator=(task other) noexcept;
+                ~task();
+
+                /** True once the job has completed or been cancelled. */
+                bool done() const noexcept;
+
+                explicit operator bool() const noexcept
+                {
+                    return m_node != nullptr;
+                }
+            };
+
+            explicit task_group(priority_dispatcher& dispatcher);
+            task_group(task_group const&) = delete;
+            task_group& operator=(task_group const&) = delete;
+            ~task_group();
+
+            /**
+             * Adds a job, as with priority_dispatcher::submit, that starts once every job in
+             * [after, after + after_count) has finished. Empty handles are ignored.
+             * Unlike submit, this may be called at any time, including from jobs of the dispatcher. A job added
+             * from outside the dispatcher while finish_all is pending may or may not be waited for.
+             * If this throws, the job was not added and cleanup is not called.
+             */
+            task add(void(*exec)(void*), void(*cleanup) (void*, completion_state) noexcept, void* caller_data, std::int64_t priority, task const* after = nullptr,
+                     std::size_t after_count = 0);
+
+            template <typename F>
+            task add(F f, std::int64_t priority, std::initializer_list<task> after = {})
+            {
+                return add_functor(std::move(f), priority, after.begin(), after.size());
+            }
+
+            template <typename F>
+            task add(F f, std::int64_t priority, task const* after, std::size_t after_count)
+            {
+                return add_functor(std::move(f), priority, after, after_count);
+            }
+
+            /** Blocks until every job added to the group has completed or been cancelled, including jobs added
+             * while waiting. Calling this from a job of the same dispatcher can deadlock.
+             */
+            void wait();
+
+            /** True if no job in the group is waiting, queued or running. */
+            bool done() const noexcept;
+
+          private:
+            struct node;
+
+            void* m_dispatcher;
+            // Jobs added and not yet finished or cancelled. Only drops to zero under m_mtx, so a waiter that sees
+            // zero knows the last job no longer touches the group.
+            std::atomic<std::size_t> m_outstanding{0};
+            std::mutex m_mtx;
+            std::condition_variable m_cond;
+
+            task add_inline(void(*exec)(void*), void const* functor, std::size_t size, std::int64_t priority, task const* after, std::size_t after_count);
+
+            template <typename F>
+            task add_functor(F f, std::int64_t priority, task const* after, std::size_t after_count)
+            {
+                if constexpr (std::is_trivially_copyable_v<F> && sizeof(F) <= priority_dispatcher::inline_functor_size && alignof(F) <= alignof(void*))
+                {
+                    return add_inline(&priority_dispatcher::exec_functor<F>, &f, sizeof(F), priority, after, after_count);
+                }
+                else
+                {
+                    pool_allocator<F> alloc;
+                    F * f_copy = alloc.allocate(1);
+                    try
+                    {
+                        f_copy = new (f_copy) F(std::move(f));
+                    }
+                    catch (...)
+                    {
+                        alloc.deallocate(f_copy, 1);
+                        throw;
+                    }
+
+                    try
+                    {
+                        return add(&priority_dispatcher::exec_functor<F>, &priority_dispatcher::delete_functor<F>, f_copy, priority, after, after_count);
+                    }
+                    catch (...)
+                    {
+                        priority_dispatcher::delete_functor<F>(f_copy, completion_state::cancelled);
+                        throw;
+                    }
+                }
             }
         };
 
@@ -5,6 +5,7 @@
 #ifndef RPNXCORE_RESULT_HPP
 #define RPNXCORE_RESULT_HPP
 
+#include <exception>
 #include <variant>
 
 namespace rpnx::experimental
@@ -48,6 +49,27 @@ namespace rpnx::experimental
         }
     };
 
+    /** The outcome of an operation with no value: success, or an exception that get() rethrows. */
+    template <>
+    class result<void>
+    {
+        std::exception_ptr m_exception;
+      public:
+        result() noexcept = default;
+
+        result(std::exception_ptr ptr) noexcept
+        : m_exception(ptr)
+        {}
+
+        void get() const
+        {
+            if (m_exception)
+            {
+                std::rethrow_exception(m_exception);
+            }
+        }
+    };
+
 }
 
 #endif // RPNXCORE_RESULT_HPP
@@ -2017,7 +2017,7 @@ namespace rpnx
         {
             value.clear();
             std::size_t size = 0;
-            it = synchronous_iterator_serial_traits< uintany, decltype(it) >::serialize(size, it);
+            it = synchronous_iterator_serial_traits< uintany, decltype(it) >::deserialize(size, it);
             value.reserve(size);
             //auto outit = std::back_inserter(value);
             for (int i = 0; i < size; i++)